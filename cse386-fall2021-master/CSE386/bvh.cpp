@@ -0,0 +1,218 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "bvh.h"
+
+const uint32_t MAX_LEAF_ITEMS = 4;		//!< Leaves hold at most this many objects.
+
+/**
+ * @fn	SceneBVH::SceneBVH()
+ * @brief	Constructs an empty hierarchy.
+ */
+
+SceneBVH::SceneBVH()
+	: nodes(nullptr), numNodes(0), items(nullptr), numItems(0),
+	unbounded(nullptr), numUnbounded(0) {
+}
+
+/**
+ * @fn	void SceneBVH::clear()
+ * @brief	Empties the hierarchy.
+ */
+
+void SceneBVH::clear() {
+	nodeStorage.clear();
+	itemStorage.clear();
+	unboundedStorage.clear();
+	view(nullptr, 0, nullptr, 0, nullptr, 0);
+}
+
+/**
+ * @fn	void SceneBVH::view(const BVHNode *theNodes, size_t nNodes, const uint32_t *theItems, size_t nItems, const uint32_t *theUnbounded, size_t nUnbounded)
+ * @brief	Uses arrays owned elsewhere (e.g., a mapped file) as the hierarchy.
+ * 			They must outlive this object.
+ * @param	theNodes		The nodes, root first.
+ * @param	nNodes			Number of nodes.
+ * @param	theItems		Object indices referenced by the leaves.
+ * @param	nItems			Number of items.
+ * @param	theUnbounded	Objects that are always tested.
+ * @param	nUnbounded		Number of unbounded objects.
+ */
+
+void SceneBVH::view(const BVHNode *theNodes, size_t nNodes, const uint32_t *theItems, size_t nItems,
+					const uint32_t *theUnbounded, size_t nUnbounded) {
+	nodes = theNodes;
+	numNodes = nNodes;
+	items = theItems;
+	numItems = nItems;
+	unbounded = theUnbounded;
+	numUnbounded = nUnbounded;
+}
+
+/**
+ * @fn	void SceneBVH::build(const vector<BoundingBox> &bounds, const vector<bool> &isBounded)
+ * @brief	Builds the hierarchy, splitting each node at the median object
+ * 			along its widest axis. Nodes at level MAX_BVH_DEPTH are leaves
+ * 			however many objects they hold.
+ * @param	bounds   	Bounds of each object.
+ * @param	isBounded	False for objects with infinite extent.
+ */
+
+void SceneBVH::build(const vector<BoundingBox> &bounds, const vector<bool> &isBounded) {
+	nodeStorage.clear();
+	itemStorage.clear();
+	unboundedStorage.clear();
+
+	vector<dvec3> centers(bounds.size());
+	for (uint32_t i = 0; i < bounds.size(); i++) {
+		if (isBounded[i]) {
+			itemStorage.push_back(i);
+			centers[i] = bounds[i].center();
+		} else {
+			unboundedStorage.push_back(i);
+		}
+	}
+	if (!itemStorage.empty()) {
+		nodeStorage.reserve(2 * (itemStorage.size() / MAX_LEAF_ITEMS + 1));
+		buildNode(bounds, centers, 0, (uint32_t)itemStorage.size(), 1);
+	}
+	view(nodeStorage.data(), nodeStorage.size(), itemStorage.data(), itemStorage.size(),
+			unboundedStorage.data(), unboundedStorage.size());
+}
+
+/**
+ * @fn	void SceneBVH::buildNode(const vector<BoundingBox> &bounds, vector<dvec3> &centers, uint32_t first, uint32_t count, int level)
+ * @brief	Appends the node for items [first, first + count), then its subtrees.
+ * @param	bounds 	Bounds of each object.
+ * @param	centers	Center of each object's bounds.
+ * @param	first  	First item.
+ * @param	count  	Number of items.
+ * @param	level  	Level of the node; the root is level 1.
+ */
+
+void SceneBVH::buildNode(const vector<BoundingBox> &bounds, vector<dvec3> &centers,
+							uint32_t first, uint32_t count, int level) {
+	uint32_t index = (uint32_t)nodeStorage.size();
+	nodeStorage.push_back(BVHNode());
+
+	BoundingBox box, centerBox;
+	for (uint32_t i = first; i < first + count; i++) {
+		box.grow(bounds[itemStorage[i]]);
+		centerBox.grow(BoundingBox(centers[itemStorage[i]], centers[itemStorage[i]]));
+	}
+	BVHNode &node = nodeStorage[index];
+	for (int a = 0; a < 3; a++) {
+		node.lo[a] = roundDown<RayReal>(box.lo[a]);
+		node.hi[a] = roundUp<RayReal>(box.hi[a]);
+	}
+	node.first = first;
+	node.count = count;
+	node.right = 0;
+	node.axis = 0;
+
+	dvec3 extent = centerBox.hi - centerBox.lo;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	if (count <= MAX_LEAF_ITEMS || extent[axis] <= 0.0 || level >= MAX_BVH_DEPTH) {
+		return;
+	}
+
+	uint32_t mid = first + count / 2;
+	std::nth_element(itemStorage.begin() + first, itemStorage.begin() + mid,
+						itemStorage.begin() + first + count,
+						[&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+	nodeStorage[index].count = 0;
+	nodeStorage[index].axis = axis;
+	buildNode(bounds, centers, first, mid - first, level + 1);
+	nodeStorage[index].right = (uint32_t)nodeStorage.size();
+	buildNode(bounds, centers, mid, first + count - mid, level + 1);
+}
+
+/**
+ * @fn	int SceneBVH::depth() const
+ * @brief	Number of levels in the deepest branch; 0 if there are no nodes.
+ * 			Children must come after their parents, as they do in build.
+ * @return	The depth.
+ */
+
+int SceneBVH::depth() const {
+	vector<int> levels(numNodes, 1);
+	int deepest = numNodes > 0 ? 1 : 0;
+	for (size_t i = 0; i < numNodes; i++) {
+		if (nodes[i].count == 0) {
+			int childLevel = levels[i] + 1;
+			levels[i + 1] = std::max(levels[i + 1], childLevel);
+			levels[nodes[i].right] = std::max(levels[nodes[i].right], childLevel);
+			deepest = std::max(deepest, childLevel);
+		}
+	}
+	return deepest;
+}
+
+/**
+ * @fn	void SceneBVH::findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &objs, HitRecord &theHit) const
+ * @brief	Same result as VisibleIShape::findIntersection over objs, but only
+ * 			visits objects whose bounds the ray passes through.
+ * @param	ray			The ray.
+ * @param	objs		The objects the hierarchy was built over.
+ * @param	theHit  	The closest intersection.
+ */
+
+void SceneBVH::findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &objs,
+								HitRecord &theHit) const {
+	theHit.t = FLT_MAX;
+	const VisibleIShape *closest = nullptr;
+	for (size_t i = 0; i < numUnbounded; i++) {
+		HitRecord thisHit;
+		objs[unbounded[i]]->intersect(ray, thisHit);
+		if (thisHit.t < theHit.t) {
+			theHit = thisHit;
+			closest = objs[unbounded[i]];
+		}
+	}
+	RayReal tMax = roundUp<RayReal>(theHit.t);
+	traverse(RayT<RayReal>(ray), tMax, [&](uint32_t item) {
+		HitRecord thisHit;
+		objs[item]->intersect(ray, thisHit);
+		if (thisHit.t < theHit.t) {
+			theHit = thisHit;
+			closest = objs[item];
+			tMax = roundUp<RayReal>(theHit.t);
+		}
+	});
+	if (closest != nullptr) {
+		closest->finishHit(theHit);
+	}
+}
+
+/**
+ * @fn	bool SceneBVH::anyIntersection(const Ray &ray, const vector<VisibleIShapePtr> &objs, double tMax) const
+ * @brief	Determines if any of objs is hit nearer than tMax, stopping at the
+ * 			first hit found. Cheaper than findIntersection, e.g., for shadows.
+ * @param	ray 	The ray.
+ * @param	objs	The objects the hierarchy was built over.
+ * @param	tMax	Hits at or beyond this distance do not count.
+ * @return	True if there is such a hit.
+ */
+
+bool SceneBVH::anyIntersection(const Ray &ray, const vector<VisibleIShapePtr> &objs, double tMax) const {
+	for (size_t i = 0; i < numUnbounded; i++) {
+		HitRecord thisHit;
+		objs[unbounded[i]]->intersect(ray, thisHit);
+		if (thisHit.t < tMax) {
+			return true;
+		}
+	}
+	const RayReal boxMax = roundUp<RayReal>(tMax);
+	return traverseUntil(RayT<RayReal>(ray), boxMax, [&](uint32_t item) {
+		HitRecord thisHit;
+		objs[item]->intersect(ray, thisHit);
+		return thisHit.t < tMax;
+	});
+}
@@ -0,0 +1,160 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include "defs.h"
+#include "hitrecord.h"
+#include "ishape.h"
+
+/**
+ * @struct	BVHNodeT
+ * @brief	One node of a flattened BVH, with bounds of type T. Plain data with
+ * 			no pointers, so an array of them can be written to disk and mapped
+ * 			back in as is. Interior nodes have count == 0; their left child
+ * 			immediately follows them and right is the index of the right child.
+ */
+
+template <class T>
+struct BVHNodeT {
+	T lo[3], hi[3];			//!< Bounds of everything below this node.
+	uint32_t first;			//!< Leaf: first entry in the item list.
+	uint32_t count;			//!< Leaf: number of items. 0 for interior nodes.
+	uint32_t right;			//!< Interior: index of the right child.
+	uint32_t axis;			//!< Interior: axis the children were split along.
+};
+
+typedef BVHNodeT<RayReal> BVHNode;		//!< Nodes in the kernels' precision.
+
+const int MAX_BVH_DEPTH = 64;			//!< Most levels a tree may have; sizes the traversal stack.
+
+/**
+ * @fn	template <class T> inline bool rayHitsBox(const BVHNodeT<T> &node, const typename Vec3Of<T>::type &origin, const typename Vec3Of<T>::type &invDir, T tMax)
+ * @brief	Slab test.
+ * @param	node  	The node.
+ * @param	origin	Ray origin.
+ * @param	invDir	1 / ray direction, per component.
+ * @param	tMax  	Ignore boxes beyond this distance.
+ * @return	True if the ray enters the box before tMax.
+ */
+
+template <class T>
+inline bool rayHitsBox(const BVHNodeT<T> &node, const typename Vec3Of<T>::type &origin,
+						const typename Vec3Of<T>::type &invDir, T tMax) {
+	T t0 = 0, t1 = tMax;
+	for (int a = 0; a < 3; a++) {
+		T tNear = (node.lo[a] - origin[a]) * invDir[a];
+		T tFar = (node.hi[a] - origin[a]) * invDir[a];
+		if (tNear > tFar) std::swap(tNear, tFar);
+		t0 = tNear > t0 ? tNear : t0;
+		t1 = tFar < t1 ? tFar : t1;
+		if (t0 > t1) return false;
+	}
+	return true;
+}
+
+/**
+ * @struct	SceneBVH
+ * @brief	Bounding volume hierarchy over a list of visible objects (or any
+ * 			other items with bounds, such as the triangles of a mesh). Items
+ * 			without finite bounds (e.g., planes) are kept in a separate list and
+ * 			always tested. The arrays are either owned (after build) or point
+ * 			into memory owned by someone else (after view), such as a mapped
+ * 			scene cache.
+ */
+
+struct SceneBVH {
+	const BVHNode *nodes;			//!< The nodes, root first.
+	size_t numNodes;				//!< Number of nodes.
+	const uint32_t *items;			//!< Object indices referenced by the leaves.
+	size_t numItems;				//!< Number of bounded objects.
+	const uint32_t *unbounded;		//!< Objects that are always tested.
+	size_t numUnbounded;			//!< Number of unbounded objects.
+
+	SceneBVH();
+	void build(const vector<BoundingBox> &bounds, const vector<bool> &isBounded);
+	void view(const BVHNode *theNodes, size_t nNodes, const uint32_t *theItems, size_t nItems,
+				const uint32_t *theUnbounded, size_t nUnbounded);
+	void clear();
+	void findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &objs, HitRecord &theHit) const;
+	bool anyIntersection(const Ray &ray, const vector<VisibleIShapePtr> &objs, double tMax) const;
+	int depth() const;
+
+	/**
+	 * @fn	template <class ItemTest> bool traverseUntil(const RayT<RayReal> &ray, const RayReal &tMax, ItemTest test) const
+	 * @brief	Calls test(item) for every bounded item in a leaf the ray reaches
+	 * 			before tMax, nearer subtrees first, until a test returns true.
+	 * 			The test may lower tMax (usually by finding a closer hit), which
+	 * 			prunes what is left. The tree must be at most MAX_BVH_DEPTH
+	 * 			levels deep, which build and the scene cache make sure of.
+	 * @param	ray 	The ray.
+	 * @param	tMax	Current closest hit; read again before each node.
+	 * @param	test	Called with the index of each candidate item.
+	 * @return	True if a test returned true.
+	 */
+
+	template <class ItemTest>
+	bool traverseUntil(const RayT<RayReal> &ray, const RayReal &tMax, ItemTest test) const {
+		if (numNodes == 0) {
+			return false;
+		}
+		const Vec3Of<RayReal>::type invDir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+		// A node n levels down waits with at most one sibling per level above it.
+		uint32_t stack[MAX_BVH_DEPTH];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			uint32_t index = stack[--top];
+			const BVHNode &node = nodes[index];
+			if (!rayHitsBox(node, ray.origin, invDir, tMax)) {
+				continue;
+			}
+			if (node.count > 0) {
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					if (test(items[i])) {
+						return true;
+					}
+				}
+			} else {
+				assert(top + 2 <= MAX_BVH_DEPTH);
+				// Visit the nearer child first so the farther one is more likely to be culled.
+				if (ray.dir[node.axis] < 0) {
+					stack[top++] = index + 1;
+					stack[top++] = node.right;
+				} else {
+					stack[top++] = node.right;
+					stack[top++] = index + 1;
+				}
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * @fn	template <class ItemTest> void traverse(const RayT<RayReal> &ray, const RayReal &tMax, ItemTest test) const
+	 * @brief	Same as traverseUntil, visiting every candidate item.
+	 * @param	ray 	The ray.
+	 * @param	tMax	Current closest hit; read again before each node.
+	 * @param	test	Called with the index of each candidate item.
+	 */
+
+	template <class ItemTest>
+	void traverse(const RayT<RayReal> &ray, const RayReal &tMax, ItemTest test) const {
+		traverseUntil(ray, tMax, [&](uint32_t item) { test(item); return false; });
+	}
+protected:
+	vector<BVHNode> nodeStorage;		//!< Nodes, when built here.
+	vector<uint32_t> itemStorage;		//!< Items, when built here.
+	vector<uint32_t> unboundedStorage;	//!< Unbounded items, when built here.
+	void buildNode(const vector<BoundingBox> &bounds, vector<dvec3> &centers,
+					uint32_t first, uint32_t count, int level);
+};
@@ -8,6 +8,60 @@
  ****************************************************/
 
 #include "camera.h"
+#include "vertexstream.h"
+
+/**
+ * @fn	void RayBatch::resize(size_t n)
+ * @brief	Makes room for n rays.
+ * @param	n	Number of rays.
+ */
+
+void RayBatch::resize(size_t n) {
+	count = n;
+	vector<double> *arrays[] = { &ox, &oy, &oz, &dx, &dy, &dz };
+	for (vector<double> *a : arrays) {
+		a->resize(n);
+	}
+}
+
+/**
+ * @fn	Ray RayBatch::rayWithDifferentials(size_t i, const RayBatch &nextRow, RayDifferential &differential) const
+ * @brief	Ray i, with the next ray in this batch and ray i of the next row
+ * 			as its differentials -- the same as getRayWithDifferentials gives,
+ * 			if the batches are made one pixel apart.
+ * @param 		  	i				Which ray. The batch must have ray i + 1.
+ * @param 		  	nextRow			The rays one pixel up.
+ * @param [in,out]	differential	The differentials.
+ * @return	Ray i.
+ */
+
+Ray RayBatch::rayWithDifferentials(size_t i, const RayBatch &nextRow, RayDifferential &differential) const {
+	differential.hasDifferentials = true;
+	differential.rxOrigin = dvec3(ox[i + 1], oy[i + 1], oz[i + 1]);
+	differential.rxDirection = dvec3(dx[i + 1], dy[i + 1], dz[i + 1]);
+	differential.ryOrigin = dvec3(nextRow.ox[i], nextRow.oy[i], nextRow.oz[i]);
+	differential.ryDirection = dvec3(nextRow.dx[i], nextRow.dy[i], nextRow.dz[i]);
+	return ray(i);
+}
+
+/**
+ * @fn	Ray RayBatch::rayWithDifferentials(size_t i, size_t xi, size_t yi, RayDifferential &differential) const
+ * @brief	Ray i, with rays xi and yi of this batch as its differentials.
+ * @param 		  	i				Which ray.
+ * @param 		  	xi				The ray one pixel to the right of it.
+ * @param 		  	yi				The ray one pixel up from it.
+ * @param [in,out]	differential	The differentials.
+ * @return	Ray i.
+ */
+
+Ray RayBatch::rayWithDifferentials(size_t i, size_t xi, size_t yi, RayDifferential &differential) const {
+	differential.hasDifferentials = true;
+	differential.rxOrigin = dvec3(ox[xi], oy[xi], oz[xi]);
+	differential.rxDirection = dvec3(dx[xi], dy[xi], dz[xi]);
+	differential.ryOrigin = dvec3(ox[yi], oy[yi], oz[yi]);
+	differential.ryDirection = dvec3(dx[yi], dy[yi], dz[yi]);
+	return ray(i);
+}
 
 /**
  * @fn	RaytracingCamera::RaytracingCamera(const dvec3 &viewingPos, 
@@ -157,6 +211,176 @@ Ray OrthographicCamera::getRay(double x, double y) const {
 	return Ray(cameraFrame.origin + uv.x * cameraFrame.u + uv.y * cameraFrame.v, -cameraFrame.w);
 }
 
+/**
+ * @fn	void OrthographicCamera::getRays(double x, double y, int n, RayBatch &rays) const
+ * @brief	Makes the n rays through (x, y), (x + 1, y), ..., (x + n - 1, y).
+ * 			They share a direction; each origin is the first plus a multiple of
+ * 			one pixel's step.
+ * @param 		  	x   	The x coordinate of the first ray.
+ * @param 		  	y   	The y coordinate.
+ * @param 		  	n   	Number of rays.
+ * @param [in,out]	rays	The rays.
+ */
+
+void OrthographicCamera::getRays(double x, double y, int n, RayBatch &rays) const {
+	rays.resize(n);
+	dvec2 uv = getProjectionPlaneCoordinates(x, y);
+	const dvec3 first = cameraFrame.origin + uv.x * cameraFrame.u + uv.y * cameraFrame.v;
+	const dvec3 step = ((right - left) / nx) * cameraFrame.u;
+	for (int i = 0; i < n; i++) {
+		rays.ox[i] = first.x + i * step.x;
+		rays.oy[i] = first.y + i * step.y;
+		rays.oz[i] = first.z + i * step.z;
+		rays.dx[i] = -cameraFrame.w.x;
+		rays.dy[i] = -cameraFrame.w.y;
+		rays.dz[i] = -cameraFrame.w.z;
+	}
+}
+
+/**
+ * @fn	void OrthographicCamera::getRays(const dvec2 *points, int n, RayBatch &rays) const
+ * @brief	Makes the rays through n points. They share a direction; the origin
+ * 			for (x, y) is that for (0, 0) plus x and y times one pixel's steps.
+ * @param 		  	points	The (x, y) of each ray.
+ * @param 		  	n	  	Number of rays.
+ * @param [in,out]	rays  	The rays.
+ */
+
+void OrthographicCamera::getRays(const dvec2 *points, int n, RayBatch &rays) const {
+	rays.resize(n);
+	dvec2 uv = getProjectionPlaneCoordinates(0, 0);
+	const dvec3 first = cameraFrame.origin + uv.x * cameraFrame.u + uv.y * cameraFrame.v;
+	const dvec3 stepX = ((right - left) / nx) * cameraFrame.u;
+	const dvec3 stepY = ((top - bottom) / ny) * cameraFrame.v;
+	for (int i = 0; i < n; i++) {
+		rays.ox[i] = first.x + points[i].x * stepX.x + points[i].y * stepY.x;
+		rays.oy[i] = first.y + points[i].x * stepX.y + points[i].y * stepY.y;
+		rays.oz[i] = first.z + points[i].x * stepX.z + points[i].y * stepY.z;
+		rays.dx[i] = -cameraFrame.w.x;
+		rays.dy[i] = -cameraFrame.w.y;
+		rays.dz[i] = -cameraFrame.w.z;
+	}
+}
+
+/**
+ * @fn	Ray RaytracingCamera::getRayWithDifferentials(double x, double y, RayDifferential &differential) const
+ * @brief	Same ray as getRay(x, y), along with the rays through (x + 1, y)
+ * 			and (x, y + 1) as its differentials.
+ * @param 		  	x				The x coordinate.
+ * @param 		  	y				The y coordinate.
+ * @param [in,out]	differential	The differentials.
+ * @return	The ray through the projection plane at (x, y).
+ */
+
+Ray RaytracingCamera::getRayWithDifferentials(double x, double y, RayDifferential &differential) const {
+	Ray rx = getRay(x + 1, y);
+	Ray ry = getRay(x, y + 1);
+	differential.hasDifferentials = true;
+	differential.rxOrigin = rx.origin;
+	differential.ryOrigin = ry.origin;
+	differential.rxDirection = rx.dir;
+	differential.ryDirection = ry.dir;
+	return getRay(x, y);
+}
+
+/**
+ * @fn	void RaytracingCamera::getRays(double x, double y, int n, RayBatch &rays) const
+ * @brief	Makes the n rays through (x, y), (x + 1, y), ..., (x + n - 1, y),
+ * 			the same as calling getRay for each.
+ * @param 		  	x   	The x coordinate of the first ray.
+ * @param 		  	y   	The y coordinate.
+ * @param 		  	n   	Number of rays.
+ * @param [in,out]	rays	The rays.
+ */
+
+void RaytracingCamera::getRays(double x, double y, int n, RayBatch &rays) const {
+	rays.resize(n);
+	for (int i = 0; i < n; i++) {
+		Ray ray = getRay(x + i, y);
+		rays.ox[i] = ray.origin.x;
+		rays.oy[i] = ray.origin.y;
+		rays.oz[i] = ray.origin.z;
+		rays.dx[i] = ray.dir.x;
+		rays.dy[i] = ray.dir.y;
+		rays.dz[i] = ray.dir.z;
+	}
+}
+
+/**
+ * @fn	void RaytracingCamera::getRays(const dvec2 *points, int n, RayBatch &rays) const
+ * @brief	Makes the rays through n points, the same as calling getRay for each.
+ * @param 		  	points	The (x, y) of each ray.
+ * @param 		  	n	  	Number of rays.
+ * @param [in,out]	rays  	The rays.
+ */
+
+void RaytracingCamera::getRays(const dvec2 *points, int n, RayBatch &rays) const {
+	rays.resize(n);
+	for (int i = 0; i < n; i++) {
+		Ray ray = getRay(points[i].x, points[i].y);
+		rays.ox[i] = ray.origin.x;
+		rays.oy[i] = ray.origin.y;
+		rays.oz[i] = ray.origin.z;
+		rays.dx[i] = ray.dir.x;
+		rays.dy[i] = ray.dir.y;
+		rays.dz[i] = ray.dir.z;
+	}
+}
+
+/**
+ * @fn	void PerspectiveCamera::getRays(double x, double y, int n, RayBatch &rays) const
+ * @brief	Makes the n rays through (x, y), (x + 1, y), ..., (x + n - 1, y).
+ * 			The projection plane is mapped once for the row; each direction
+ * 			is then the first one plus a multiple of one pixel's step, and
+ * 			they are all normalized together.
+ * @param 		  	x   	The x coordinate of the first ray.
+ * @param 		  	y   	The y coordinate.
+ * @param 		  	n   	Number of rays.
+ * @param [in,out]	rays	The rays.
+ */
+
+void PerspectiveCamera::getRays(double x, double y, int n, RayBatch &rays) const {
+	rays.resize(n);
+	dvec2 uv = getProjectionPlaneCoordinates(x, y);
+	const dvec3 first = -distToPlane * cameraFrame.w + uv.x * cameraFrame.u + uv.y * cameraFrame.v;
+	const dvec3 step = ((right - left) / nx) * cameraFrame.u;
+	for (int i = 0; i < n; i++) {
+		rays.ox[i] = cameraFrame.origin.x;
+		rays.oy[i] = cameraFrame.origin.y;
+		rays.oz[i] = cameraFrame.origin.z;
+		rays.dx[i] = first.x + i * step.x;
+		rays.dy[i] = first.y + i * step.y;
+		rays.dz[i] = first.z + i * step.z;
+	}
+	normalizeVectors(rays.count, rays.dx.data(), rays.dy.data(), rays.dz.data());
+}
+
+/**
+ * @fn	void PerspectiveCamera::getRays(const dvec2 *points, int n, RayBatch &rays) const
+ * @brief	Makes the rays through n points. The direction through (x, y) is
+ * 			that through (0, 0) plus x and y times one pixel's steps.
+ * @param 		  	points	The (x, y) of each ray.
+ * @param 		  	n	  	Number of rays.
+ * @param [in,out]	rays  	The rays.
+ */
+
+void PerspectiveCamera::getRays(const dvec2 *points, int n, RayBatch &rays) const {
+	rays.resize(n);
+	dvec2 uv = getProjectionPlaneCoordinates(0, 0);
+	const dvec3 first = -distToPlane * cameraFrame.w + uv.x * cameraFrame.u + uv.y * cameraFrame.v;
+	const dvec3 stepX = ((right - left) / nx) * cameraFrame.u;
+	const dvec3 stepY = ((top - bottom) / ny) * cameraFrame.v;
+	for (int i = 0; i < n; i++) {
+		rays.ox[i] = cameraFrame.origin.x;
+		rays.oy[i] = cameraFrame.origin.y;
+		rays.oz[i] = cameraFrame.origin.z;
+		rays.dx[i] = first.x + points[i].x * stepX.x + points[i].y * stepY.x;
+		rays.dy[i] = first.y + points[i].x * stepX.y + points[i].y * stepY.y;
+		rays.dz[i] = first.z + points[i].x * stepX.z + points[i].y * stepY.z;
+	}
+	normalizeVectors(rays.count, rays.dx.data(), rays.dy.data(), rays.dz.data());
+}
+
 /**
  * @fn	Ray PerspectiveCamera::getRay(double x, double y) const
  * @brief	Determines ray eminating from camera through the projection plane at (x, y).
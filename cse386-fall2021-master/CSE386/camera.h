@@ -9,8 +9,31 @@
 
 #pragma once
 #include <iostream>
+#include <vector>
 #include "ishape.h"
 
+/**
+ * @struct	RayBatch
+ * @brief	A row, or any set, of camera rays in structure of arrays layout,
+ * 			one array per component, as made by RaytracingCamera::getRays. The directions
+ * 			are unit length. A packet of rays can be read straight from the
+ * 			arrays; ray() makes one Ray for the scalar tracer.
+ *
+ * 			The arrays keep their capacity from one row to the next.
+ */
+
+struct RayBatch {
+	size_t count;					//!< Number of rays.
+	vector<double> ox, oy, oz;		//!< Origins.
+	vector<double> dx, dy, dz;		//!< Directions.
+
+	RayBatch() : count(0) {}
+	void resize(size_t n);
+	Ray ray(size_t i) const { return Ray(dvec3(ox[i], oy[i], oz[i]), dvec3(dx[i], dy[i], dz[i])); }
+	Ray rayWithDifferentials(size_t i, const RayBatch &nextRow, RayDifferential &differential) const;
+	Ray rayWithDifferentials(size_t i, size_t xi, size_t yi, RayDifferential &differential) const;
+};
+
 /**
  * @struct	RaytracingCamera
  * @brief	Base class for cameras in raytracing applications.
@@ -19,7 +42,11 @@
 struct RaytracingCamera {
 	RaytracingCamera(const dvec3 &pos, const dvec3 &lookAtPt, const dvec3 &up,
 						int width, int height);
+	virtual ~RaytracingCamera() {}
 	virtual Ray getRay(double x, double y) const = 0;
+	Ray getRayWithDifferentials(double x, double y, RayDifferential &differential) const;
+	virtual void getRays(double x, double y, int n, RayBatch &rays) const;
+	virtual void getRays(const dvec2 *points, int n, RayBatch &rays) const;
 	Frame getFrame() const { return cameraFrame;  }
 	int getNX() const { return nx; }
 	int getNY() const { return ny; }
@@ -49,6 +76,8 @@ struct PerspectiveCamera : public RaytracingCamera {
 	PerspectiveCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up, double FOVRads,
 							int width, int height);
 	virtual Ray getRay(double x, double y) const;
+	virtual void getRays(double x, double y, int n, RayBatch &rays) const;
+	virtual void getRays(const dvec2 *points, int n, RayBatch &rays) const;
 	double getDistToPlane() const { return distToPlane; }
 private:
 	double fov;						//!< The camera's field of view
@@ -65,6 +94,8 @@ struct OrthographicCamera : public RaytracingCamera {
 	OrthographicCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up,
 								int width, int height, double scaleFactor);
 	virtual Ray getRay(double x, double y) const;
+	virtual void getRays(double x, double y, int n, RayBatch &rays) const;
+	virtual void getRays(const dvec2 *points, int n, RayBatch &rays) const;
 private:
 	double scale;		//!< Controls the size of the image plane.
 	virtual void setupViewingParameters(int width, int height);
@@ -105,6 +105,18 @@ Material Material::operator +(const Material &mat) const {
 	return result;
 }
 
+/**
+ * @fn	bool Material::operator==(const Material &mat) const
+ * @brief	Determines if two Materials are identical.
+ * @param	mat	The second Material.
+ * @return	True if every property is the same.
+ */
+
+bool Material::operator ==(const Material &mat) const {
+	return ambient == mat.ambient && diffuse == mat.diffuse && specular == mat.specular &&
+			shininess == mat.shininess && alpha == mat.alpha;
+}
+
 /**
  * @fn	Material operator*(double w, const Material &mat)
  * @brief	Multiply a Material and a scalar.
@@ -10,6 +10,7 @@
 #pragma once
 #pragma warning( disable : 26451 )
 
+#include <cfloat>
 #include <iostream>
 #include <istream>
 #include <vector>
@@ -68,6 +69,57 @@ const dvec3 X_AXIS(1.0, 0.0, 0.0);			//!< <1, 0, 0>
 const dvec3 Y_AXIS(0.0, 1.0, 0.0);			//!< <0, 1, 0>
 const dvec3 Z_AXIS(0.0, 0.0, 1.0);			//!< <0, 0, 1>
 
+// Define RAYTRACE_FLOAT to run the ray tracer's intersection kernels -- BVH
+// traversal and the triangle test -- in single precision, with the BVH stored
+// in single precision too. Hits are handed back in double precision either way.
+#ifdef RAYTRACE_FLOAT
+typedef float RayReal;				//!< Precision of the intersection kernels.
+#else
+typedef double RayReal;				//!< Precision of the intersection kernels.
+#endif
+
+/**
+ * @struct	Vec3Of
+ * @brief	The glm 3D vector with components of type T.
+ */
+
+template <class T> struct Vec3Of;
+template <> struct Vec3Of<float> { typedef glm::vec3 type; };
+template <> struct Vec3Of<double> { typedef dvec3 type; };
+
+/**
+ * @fn	template <class T> T roundDown(double x)
+ * @brief	Converts x to T, rounding toward -infinity, so that a lower bound
+ * 			stays one.
+ */
+
+template <class T> inline T roundDown(double x) {
+	T r = (T)x;
+	return r > x ? std::nextafter(r, -std::numeric_limits<T>::max()) : r;
+}
+
+/**
+ * @fn	template <class T> T roundUp(double x)
+ * @brief	Converts x to T, rounding toward +infinity, so that an upper bound
+ * 			stays one.
+ */
+
+template <class T> inline T roundUp(double x) {
+	T r = (T)x;
+	return r < x ? std::nextafter(r, std::numeric_limits<T>::max()) : r;
+}
+
+/**
+ * @fn	template <class T> double roundingGamma(int n)
+ * @brief	Bound on the relative error of n operations in T, each rounded
+ * 			to nearest: n u / (1 - n u), where u is half of T's epsilon.
+ */
+
+template <class T> inline double roundingGamma(int n) {
+	const double u = std::numeric_limits<T>::epsilon() * 0.5;
+	return n * u / (1 - n * u);
+}
+
 /**
  * @class	BoundingBoxi
  * @brief	A bounding box in 2D, with integer positions and widths.
@@ -89,6 +141,27 @@ struct BoundingBoxi {
 	}
 };
 
+/**
+ * @struct	BoundingBox
+ * @brief	An axis aligned bounding box.
+ */
+
+struct BoundingBox {
+	dvec3 lo, hi;		//!< Minimum and maximum corners.
+	BoundingBox() : lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+	BoundingBox(const dvec3 &lo, const dvec3 &hi) : lo(lo), hi(hi) {}
+	void grow(const BoundingBox &b) {
+		lo = glm::min(lo, b.lo);
+		hi = glm::max(hi, b.hi);
+	}
+	void grow(const dvec3 &pt) {
+		lo = glm::min(lo, pt);
+		hi = glm::max(hi, pt);
+	}
+	dvec3 center() const { return (lo + hi) / 2.0; }
+	bool isEmpty() const { return lo.x > hi.x; }
+};
+
 /**
  * @struct	Frame
  * @brief	Represents a coordinate frame
@@ -81,7 +81,7 @@ color FragmentOps::applyBlending(double alpha, const color &srcColor, const colo
 /**
  * @fn	void FragmentOps::processFragment(FrameBuffer &frameBuffer, 
  *											const dvec3 &eyePositionInWorldCoords,
- *											const vector<LightSourcePtr> lights, 
+ *											const vector<LightSourcePtr> &lights, 
  *											const Fragment &fragment,
  *											const dmat4 &viewingMatrix)
  * @brief	Process the fragment, leaving the results in the framebuffer.
@@ -93,7 +93,7 @@ color FragmentOps::applyBlending(double alpha, const color &srcColor, const colo
  */
 
 void FragmentOps::processFragment(FrameBuffer& frameBuffer, const dvec3& eyePositionInWorldCoords,
-	const vector<LightSourcePtr> lights,
+	const vector<LightSourcePtr> &lights,
 	const Fragment& fragment,
 	const Frame& eyeFrame) {
 	const dvec3& eyePos = eyePositionInWorldCoords;
@@ -7,10 +7,21 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
+#include <cstring>
 #include "defs.h"
 #include "utilities.h"
 #include "framebuffer.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRAMEBUFFER_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#define FRAMEBUFFER_SSSE3
+#include <tmmintrin.h>
+#endif
+
 /**
  * @fn	FrameBuffer::FrameBuffer(const int width, const int height)
  * @brief	Constructor
@@ -18,7 +29,8 @@
  * @param	height	The height.
  */
 
-FrameBuffer::FrameBuffer(const int width, const int height) {
+FrameBuffer::FrameBuffer(const int width, const int height)
+	: colorBuffer(nullptr), depthBuffer(nullptr), reversedZ(false), gammaTableValue(0.0) {
 	setFrameBufferSize(width, height);
 }
 
@@ -48,7 +60,7 @@ void FrameBuffer::setFrameBufferSize(int width, int height) {
 	delete [] colorBuffer;
 	delete [] depthBuffer;
 	colorBuffer = new GLubyte[area * BYTES_PER_PIXEL];
-	depthBuffer = new double[area];
+	depthBuffer = new DepthValue[area];
 }
 
 /**
@@ -70,15 +82,205 @@ void FrameBuffer::setClearColor(const color &clear) {
  */
 
 void FrameBuffer::clearColorAndDepthBuffers() {
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width),
-				clearColorUB, BYTES_PER_PIXEL);
+	clearColorBuffer();
+	clearDepthBuffer();
+}
+
+/**
+ * @fn	void FrameBuffer::clearColorBuffer()
+ * @brief	Fills the color buffer with the clear color. Sixteen pixels make up
+ * 			exactly three 16-byte blocks, so the clear color is expanded once
+ * 			into a 48-byte pattern that is then stored in bulk.
+ */
+
+void FrameBuffer::clearColorBuffer() {
+	const int PATTERN_PIXELS = 16;
+	const int PATTERN_BYTES = PATTERN_PIXELS * BYTES_PER_PIXEL;
+	GLubyte pattern[PATTERN_BYTES];
+	for (int i = 0; i < PATTERN_PIXELS; i++) {
+		std::memcpy(pattern + i * BYTES_PER_PIXEL, clearColorUB, BYTES_PER_PIXEL);
+	}
+
+	const size_t N = (size_t)width * height * BYTES_PER_PIXEL;
+	size_t i = 0;
+#ifdef FRAMEBUFFER_SSE2
+	const __m128i P0 = _mm_loadu_si128((const __m128i *)(pattern));
+	const __m128i P1 = _mm_loadu_si128((const __m128i *)(pattern + 16));
+	const __m128i P2 = _mm_loadu_si128((const __m128i *)(pattern + 32));
+	for (; i + PATTERN_BYTES <= N; i += PATTERN_BYTES) {
+		_mm_storeu_si128((__m128i *)(colorBuffer + i), P0);
+		_mm_storeu_si128((__m128i *)(colorBuffer + i + 16), P1);
+		_mm_storeu_si128((__m128i *)(colorBuffer + i + 32), P2);
+	}
+#else
+	for (; i + PATTERN_BYTES <= N; i += PATTERN_BYTES) {
+		std::memcpy(colorBuffer + i, pattern, PATTERN_BYTES);
+	}
+#endif
+	std::memcpy(colorBuffer + i, pattern, N - i);
+}
+
+/**
+ * @fn	void FrameBuffer::clearDepthBuffer()
+ * @brief	Sets every entry in the depth buffer to the far value (1.0, or 0.0
+ * 			with reversed Z).
+ */
+
+void FrameBuffer::clearDepthBuffer() {
+	const int SZ = width * height;
+	std::fill(depthBuffer, depthBuffer + SZ, toDepthValue(getClearDepth()));
+}
+
+/**
+ * @fn	double FrameBuffer::ndcToDepth(double ndcZ) const
+ * @brief	Maps a normalized device z, -1 at the near plane and 1 at the far,
+ * 			to window depth.
+ * @param	ndcZ	Normalized device z.
+ * @return	The depth, in [0, 1].
+ */
+
+double FrameBuffer::ndcToDepth(double ndcZ) const {
+	return reversedZ ? 0.5 - 0.5 * ndcZ : 0.5 + 0.5 * ndcZ;
+}
+
+/**
+ * @fn	void FrameBuffer::buildGammaTable(double gamma)
+ * @brief	Builds the table mapping linear intensities in [0,1] to gamma encoded
+ * 			bytes. The table is only rebuilt when gamma changes.
+ * @param	gamma	The display gamma (e.g., 2.2).
+ */
+
+void FrameBuffer::buildGammaTable(double gamma) {
+	if (gamma == gammaTableValue) {
+		return;
+	}
+	const double invGamma = 1.0 / gamma;
+	for (int i = 0; i < GAMMA_LUT_SIZE; i++) {
+		double linear = (double)i / (GAMMA_LUT_SIZE - 1);
+		gammaTable[i] = (GLubyte)(std::pow(linear, invGamma) * 255.0);
+	}
+	gammaTableValue = gamma;
+}
+
+/**
+ * @fn	void FrameBuffer::resolveColorBuffer(const float *rgb, double gamma)
+ * @brief	Converts a floating point RGB image (e.g., an accumulation buffer) into
+ * 			the 8-bit color buffer. Values are clamped to [0,1]. When gamma is not 1,
+ * 			the values are gamma encoded through a lookup table.
+ * @param	rgb  	width*height RGB triples, in the same row order as the color buffer.
+ * @param	gamma	The display gamma. 1.0 ==> no gamma encoding.
+ */
+
+void FrameBuffer::resolveColorBuffer(const float *rgb, double gamma) {
+	const size_t N = (size_t)width * height * BYTES_PER_PIXEL;
+	size_t i = 0;
+
+	if (gamma == 1.0) {
+#ifdef FRAMEBUFFER_SSE2
+		const __m128 ZERO = _mm_setzero_ps();
+		const __m128 ONE = _mm_set1_ps(1.0f);
+		const __m128 SCALE = _mm_set1_ps(255.0f);
+		for (; i + 16 <= N; i += 16) {
+			__m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(rgb + i), ZERO), ONE);
+			__m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(rgb + i + 4), ZERO), ONE);
+			__m128 c = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(rgb + i + 8), ZERO), ONE);
+			__m128 d = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(rgb + i + 12), ZERO), ONE);
+			__m128i ia = _mm_cvttps_epi32(_mm_mul_ps(a, SCALE));
+			__m128i ib = _mm_cvttps_epi32(_mm_mul_ps(b, SCALE));
+			__m128i ic = _mm_cvttps_epi32(_mm_mul_ps(c, SCALE));
+			__m128i id = _mm_cvttps_epi32(_mm_mul_ps(d, SCALE));
+			__m128i packed = _mm_packus_epi16(_mm_packs_epi32(ia, ib), _mm_packs_epi32(ic, id));
+			_mm_storeu_si128((__m128i *)(colorBuffer + i), packed);
+		}
+#endif
+		for (; i < N; i++) {
+			float c = !(rgb[i] > 0.0f) ? 0.0f : std::min(rgb[i], 1.0f);	// NaN to 0, as in the SIMD path
+			colorBuffer[i] = (GLubyte)(c * 255.0f);
+		}
+	} else {
+		buildGammaTable(gamma);
+		const float LAST = (float)(GAMMA_LUT_SIZE - 1);
+#ifdef FRAMEBUFFER_SSE2
+		const __m128 ZERO = _mm_setzero_ps();
+		const __m128 ONE = _mm_set1_ps(1.0f);
+		const __m128 SCALE = _mm_set1_ps(LAST);
+		alignas(16) int idx[4];
+		for (; i + 4 <= N; i += 4) {
+			__m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(rgb + i), ZERO), ONE);
+			_mm_store_si128((__m128i *)idx, _mm_cvttps_epi32(_mm_mul_ps(v, SCALE)));
+			colorBuffer[i] = gammaTable[idx[0]];
+			colorBuffer[i + 1] = gammaTable[idx[1]];
+			colorBuffer[i + 2] = gammaTable[idx[2]];
+			colorBuffer[i + 3] = gammaTable[idx[3]];
+		}
+#endif
+		for (; i < N; i++) {
+			float c = !(rgb[i] > 0.0f) ? 0.0f : std::min(rgb[i], 1.0f);	// NaN to 0, as in the SIMD path
+			colorBuffer[i] = gammaTable[(int)(c * LAST)];
 		}
 	}
-	int area = width * height;
-	const int SZ = area;
-	std::fill(depthBuffer, depthBuffer + SZ, 1.0);
+}
+
+/**
+ * @fn	void FrameBuffer::convertColorBuffer(GLubyte *dest, PixelFormat format) const
+ * @brief	Copies the color buffer into dest, reordering (and optionally padding)
+ * 			the channels. RGBA and BGRA outputs have an alpha of 255.
+ * @param [out]	dest  	Receives width*height pixels. Must hold 3 or 4 bytes per pixel,
+ * 						depending on format.
+ * @param		format	The desired channel layout.
+ */
+
+void FrameBuffer::convertColorBuffer(GLubyte *dest, PixelFormat format) const {
+	const size_t NPIXELS = (size_t)width * height;
+	const GLubyte *src = colorBuffer;
+	size_t p = 0;
+
+	switch (format) {
+	case PixelFormat::RGB:
+		std::memcpy(dest, src, NPIXELS * BYTES_PER_PIXEL);
+		break;
+	case PixelFormat::BGR:
+#ifdef FRAMEBUFFER_SSSE3
+		{
+			// 5 pixels (15 bytes) per step; the 16th byte is rewritten by the next step.
+			const __m128i SHUF = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+			for (; p + 6 <= NPIXELS; p += 5) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(src + p * 3));
+				_mm_storeu_si128((__m128i *)(dest + p * 3), _mm_shuffle_epi8(v, SHUF));
+			}
+		}
+#endif
+		for (; p < NPIXELS; p++) {
+			dest[p * 3] = src[p * 3 + 2];
+			dest[p * 3 + 1] = src[p * 3 + 1];
+			dest[p * 3 + 2] = src[p * 3];
+		}
+		break;
+	case PixelFormat::RGBA:
+	case PixelFormat::BGRA:
+		{
+			const bool swapRB = format == PixelFormat::BGRA;
+#ifdef FRAMEBUFFER_SSSE3
+			// 4 pixels (12 bytes) in, 16 bytes out. Alpha lanes are zeroed and then set.
+			const __m128i SHUF = swapRB ?
+				_mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+				_mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const __m128i ALPHA = _mm_set1_epi32((int)0xFF000000);
+			for (; p + 6 <= NPIXELS; p += 4) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(src + p * 3));
+				__m128i out = _mm_or_si128(_mm_shuffle_epi8(v, SHUF), ALPHA);
+				_mm_storeu_si128((__m128i *)(dest + p * 4), out);
+			}
+#endif
+			for (; p < NPIXELS; p++) {
+				dest[p * 4] = src[p * 3 + (swapRB ? 2 : 0)];
+				dest[p * 4 + 1] = src[p * 3 + 1];
+				dest[p * 4 + 2] = src[p * 3 + (swapRB ? 0 : 2)];
+				dest[p * 4 + 3] = 255;
+			}
+		}
+		break;
+	}
 }
 
 /**
@@ -165,7 +367,7 @@ void FrameBuffer::setDepth(double x, double y, double depth) {
 
 void FrameBuffer::setDepth(int x, int y, double depth) {
 	if (checkInWindow(x, y)) {
-		depthBuffer[y * width + x] = depth;
+		depthBuffer[y * width + x] = toDepthValue(depth);
 	}
 }
 
@@ -179,7 +381,7 @@ void FrameBuffer::setDepth(int x, int y, double depth) {
 
 double FrameBuffer::getDepth(int x, int y) const {
 	if (checkInWindow(x, y)) {
-		return depthBuffer[y * width + x];
+		return fromDepthValue(depthBuffer[y * width + x]);
 	} else {
 		return 0.0;
 	}
@@ -365,6 +567,7 @@ void FrameBuffer::showAxes(const dmat4 &VM, const dmat4 &PM, const dmat4 &VPM,
 			const int W = 1;
 			if (std::abs(clip.x) <= 1.0 && std::abs(clip.y) <= 1.0 && std::abs(clip.z) <= 1.0) {
 				dvec4 window = VPM * clip;
+				window.z = ndcToDepth(clip.z);
 				int rx = viewport.lx + viewport.width - 1;
 				int ry = viewport.ly + viewport.height- 1;
 
@@ -372,10 +575,57 @@ void FrameBuffer::showAxes(const dmat4 &VM, const dmat4 &PM, const dmat4 &VPM,
 				int y = (int)glm::clamp(window.y, (double)viewport.ly, (double)ry);
 				double currZ = getDepth(x, y);
 				//if (std::abs(window.z - currZ) < 0.01) {
-				if (std::abs(window.z - currZ) < 0.01 || window.z < currZ) {
+				bool inFront = reversedZ ? window.z > currZ : window.z < currZ;
+				if (std::abs(window.z - currZ) < 0.01 || inFront) {
 					dot(*this, x, y, 1, C[j], window.z);
 				}
 			}
 		}
 	}
 }
+
+/**
+ * @fn	ImageDiff compareColorBuffers(const FrameBuffer &a, const FrameBuffer &b, int tolerance)
+ * @brief	Compares the color buffers of two framebuffers of the same size, such
+ * 			as the same scene rendered by two builds.
+ * @param	a		  	The first framebuffer.
+ * @param	b		  	The second framebuffer.
+ * @param	tolerance 	Channel differences up to this much do not count a pixel
+ * 						as differing.
+ * @return	The differences. If the sizes differ, every pixel differs.
+ */
+
+ImageDiff compareColorBuffers(const FrameBuffer &a, const FrameBuffer &b, int tolerance) {
+	ImageDiff diff = { 0, 0.0, std::numeric_limits<double>::infinity(), 0 };
+	const int W = a.getWindowWidth(), H = a.getWindowHeight();
+	if (W != b.getWindowWidth() || H != b.getWindowHeight()) {
+		diff.maxError = 255;
+		diff.meanError = 255.0;
+		diff.psnr = 0.0;
+		diff.pixelsDiffering = (size_t)std::max(W * H, b.getWindowWidth() * b.getWindowHeight());
+		return diff;
+	}
+	const GLubyte *pa = a.getColorBuffer(), *pb = b.getColorBuffer();
+	const size_t n = (size_t)W * H;
+	double sumError = 0.0, sumSquared = 0.0;
+	for (size_t i = 0; i < n; i++) {
+		int pixelMax = 0;
+		for (int c = 0; c < BYTES_PER_PIXEL; c++) {
+			int e = std::abs((int)pa[BYTES_PER_PIXEL * i + c] - (int)pb[BYTES_PER_PIXEL * i + c]);
+			pixelMax = std::max(pixelMax, e);
+			sumError += e;
+			sumSquared += (double)e * e;
+		}
+		diff.maxError = std::max(diff.maxError, pixelMax);
+		if (pixelMax > tolerance) {
+			diff.pixelsDiffering++;
+		}
+	}
+	if (n > 0) {
+		diff.meanError = sumError / (n * BYTES_PER_PIXEL);
+		if (sumSquared > 0.0) {
+			diff.psnr = 10.0 * std::log10(255.0 * 255.0 / (sumSquared / (n * BYTES_PER_PIXEL)));
+		}
+	}
+	return diff;
+}
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include "defs.h"
 #include "ishape.h"
 #include "colorandmaterials.h"
@@ -18,12 +19,41 @@
 #endif
 
 const int BYTES_PER_PIXEL = 3;			//!< RGB requires 3 bytes.
+const int GAMMA_LUT_SIZE = 4096;		//!< Entries in the linear-to-gamma lookup table.
+
+// Window depth runs from 0 to 1. The depth buffer stores it as 32 bit floats,
+// or, if DEPTH_BUFFER_24 is defined, as 24 bit fixed point in the low bits of
+// a 32 bit word.
+#ifdef DEPTH_BUFFER_24
+typedef uint32_t DepthValue;			//!< One entry of the depth buffer.
+const double DEPTH_24_SCALE = 16777215.0;
+inline DepthValue toDepthValue(double z) { return (DepthValue)(glm::clamp(z, 0.0, 1.0) * DEPTH_24_SCALE + 0.5); }
+inline double fromDepthValue(DepthValue d) { return d / DEPTH_24_SCALE; }
+#else
+typedef float DepthValue;				//!< One entry of the depth buffer.
+inline DepthValue toDepthValue(double z) { return (float)z; }
+inline double fromDepthValue(DepthValue d) { return d; }
+#endif
+
+/**
+ * @enum	PixelFormat
+ * @brief	Byte layouts the color buffer can be converted into.
+ */
+
+enum class PixelFormat { RGB, BGR, RGBA, BGRA };
 
 /**
  * @struct	FrameBuffer
  * @brief	Represents a framebuffer. Two identically sized 2D arrays. The color
  * 			buffer stores the colors and the depth buffer stores the corresponding
  * 			depth at each pixel.
+ *
+ * 			Depth is 0 at the near plane and 1 at the far plane, unless the
+ * 			framebuffer is set to reversed Z, in which case it is the other way
+ * 			round: the depth test keeps the larger value and the buffer clears
+ * 			to 0. With a float buffer, reversed Z puts the dense floats near 0
+ * 			where perspective crowds the distant depths, so precision is nearly
+ * 			even over the view volume.
  */
 
 struct FrameBuffer {
@@ -36,6 +66,11 @@ struct FrameBuffer {
 	color getColor(int x, int y) const;
 
 	void clearColorAndDepthBuffers();
+	void clearColorBuffer();
+	void clearDepthBuffer();
+	void resolveColorBuffer(const float *rgb, double gamma = 1.0);
+	void convertColorBuffer(GLubyte *dest, PixelFormat format) const;
+	const GLubyte *getColorBuffer() const { return colorBuffer; }
 	void showColorBuffer() const;
 	int getWindowWidth() const { return width; }
 	int getWindowHeight() const { return height; }
@@ -44,6 +79,12 @@ struct FrameBuffer {
 	void setDepth(int x, int y, double depth);
 	double getDepth(int x, int y) const;
 	double getDepth(double x, double y) const;
+	DepthValue *getDepthBuffer() { return depthBuffer; }
+	const DepthValue *getDepthBuffer() const { return depthBuffer; }
+	void setReversedZ(bool reversed) { reversedZ = reversed; }
+	bool isReversedZ() const { return reversedZ; }
+	double getClearDepth() const { return reversedZ ? 0.0 : 1.0; }
+	double ndcToDepth(double ndcZ) const;
 
 	void showAxes(int x, int y, const Ray &ray, double thickness);
 	void showAxes(const dmat4 &VM, const dmat4 &PM, const dmat4 &VPM,
@@ -51,10 +92,28 @@ struct FrameBuffer {
 	void setPixel(int x, int y, const color &C, double depth);
 protected:
 	bool checkInWindow(int x, int y) const;
+	void buildGammaTable(double gamma);
 	int width;								//!< width of framebuffer
 	int height;								//!< height of framebuffer
 	GLubyte clearColorUB[BYTES_PER_PIXEL];	//!< Clear color, as unsigned bytes
 	color clearColor;						//!< Clear color
 	GLubyte *colorBuffer;					//!< 2D array for holding colors
-	double *depthBuffer;					//!< 2D array for holding depths
-};
\ No newline at end of file
+	DepthValue *depthBuffer;				//!< 2D array for holding depths
+	bool reversedZ;							//!< True ==> 1 is near and 0 is far
+	double gammaTableValue;					//!< Gamma the lookup table was built for
+	GLubyte gammaTable[GAMMA_LUT_SIZE];		//!< Linear [0,1] to gamma encoded byte
+};
+
+/**
+ * @struct	ImageDiff
+ * @brief	How far apart two color buffers are, in 8 bit channel steps.
+ */
+
+struct ImageDiff {
+	int maxError;				//!< Largest difference in any channel.
+	double meanError;			//!< Mean difference over all channels.
+	double psnr;				//!< Peak signal to noise ratio in dB; infinite if identical.
+	size_t pixelsDiffering;		//!< Pixels with some channel more than the tolerance apart.
+};
+
+ImageDiff compareColorBuffers(const FrameBuffer &a, const FrameBuffer &b, int tolerance = 0);
\ No newline at end of file
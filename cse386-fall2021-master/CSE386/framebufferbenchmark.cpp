@@ -0,0 +1,70 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "defs.h"
+#include "framebuffer.h"
+
+const int W = 3840;		// 4K UHD
+const int H = 2160;
+const int REPS = 20;
+
+/**
+ * @fn	template <class F> double timeIt(F f)
+ * @brief	Runs f REPS times.
+ * @return	Average milliseconds per call.
+ */
+
+template <class F>
+double timeIt(F f) {
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < REPS; i++) {
+		f();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / REPS;
+}
+
+int main() {
+	FrameBuffer fb(W, H);
+	fb.setClearColor(lightGray);
+
+	vector<float> accum((size_t)W * H * BYTES_PER_PIXEL);
+	for (size_t i = 0; i < accum.size(); i++) {
+		accum[i] = (float)(i % 1000) / 900.0f;		// includes some values > 1
+	}
+	vector<GLubyte> converted((size_t)W * H * 4);
+
+	// The original clear: one 3-byte memcpy per pixel.
+	GLubyte *reference = new GLubyte[(size_t)W * H * BYTES_PER_PIXEL];
+	GLubyte clearUB[BYTES_PER_PIXEL] = { 204, 204, 204 };
+	double perPixel = timeIt([&]() {
+		for (int y = 0; y < H; ++y) {
+			for (int x = 0; x < W; ++x) {
+				std::memcpy(reference + BYTES_PER_PIXEL * (x + y * W), clearUB, BYTES_PER_PIXEL);
+			}
+		}
+	});
+
+	cout << "FrameBuffer " << W << "x" << H << ", average of " << REPS << " runs (ms)" << endl;
+	cout << "clear (per pixel memcpy): " << perPixel << endl;
+	cout << "clearColorBuffer:         " << timeIt([&]() { fb.clearColorBuffer(); }) << endl;
+	cout << "clearDepthBuffer:         " << timeIt([&]() { fb.clearDepthBuffer(); }) << endl;
+	cout << "resolve (linear):         " << timeIt([&]() { fb.resolveColorBuffer(accum.data()); }) << endl;
+	cout << "resolve (gamma 2.2):      " << timeIt([&]() { fb.resolveColorBuffer(accum.data(), 2.2); }) << endl;
+	cout << "convert to BGR:           " << timeIt([&]() { fb.convertColorBuffer(converted.data(), PixelFormat::BGR); }) << endl;
+	cout << "convert to RGBA:          " << timeIt([&]() { fb.convertColorBuffer(converted.data(), PixelFormat::RGBA); }) << endl;
+	cout << "convert to BGRA:          " << timeIt([&]() { fb.convertColorBuffer(converted.data(), PixelFormat::BGRA); }) << endl;
+
+	delete[] reference;
+	return 0;
+}
@@ -18,6 +18,8 @@
 #include "image.h"
 #include "camera.h"
 #include "rasterization.h"
+#include "scenearena.h"
+#include "scenefile.h"
 
 
 Image im1("usflag.ppm");
@@ -30,6 +32,7 @@ double inc = 0.5;
 bool isAnimated = false;
 int numReflections = 0;
 int antiAliasing = 1;
+SamplerType samplerType = SOBOL_SAMPLER;
 bool multiViewOn = false;
 double spotDirX = 0;
 double spotDirY = -1;
@@ -41,9 +44,11 @@ dvec3 cameraUp1 = Y_AXIS;
 
 double cameraFOV = glm::radians(120.0);
 
+SceneArena arena;
+
 vector<PositionalLightPtr> lights = {
-						new PositionalLight(dvec3(10, 10, 10), pureWhiteLight),
-						new SpotLight(dvec3(3, 5, 3), 
+						arena.create<PositionalLight>(dvec3(10, 10, 10), pureWhiteLight),
+						arena.create<SpotLight>(dvec3(3, 5, 3), 
 										dvec3(spotDirX,spotDirY,spotDirZ), 
 										glm::radians(45.0), 
 										pureWhiteLight)
@@ -57,6 +62,8 @@ RayTracer rayTrace(lightGray);
 PerspectiveCamera pCamera(cameraPos1, cameraFocus1, cameraUp1, cameraFOV, 
 							WINDOW_WIDTH, WINDOW_HEIGHT);
 IScene scene(&pCamera);
+SceneFile sceneFile;
+bool useSceneFile = false;
 
 void render() {
 	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
@@ -70,8 +77,13 @@ void render() {
 	// not change the view 
 	dvec3 v1(4, 4, 4);
 	dvec3 v2(4, 4, 0);
-	pCamera = PerspectiveCamera(cameraPos1, cameraFocus1, cameraUp1, cameraFOV, width, height);
-	rayTrace.raytraceScene(frameBuffer, numReflections, scene, antiAliasing);
+	if (useSceneFile) {
+		sceneFile.resizeCamera(width, height);
+		rayTrace.raytraceScene(frameBuffer, numReflections, sceneFile.scene, antiAliasing);
+	} else {
+		pCamera = PerspectiveCamera(cameraPos1, cameraFocus1, cameraUp1, cameraFOV, width, height);
+		rayTrace.raytraceScene(frameBuffer, numReflections, scene, antiAliasing);
+	}
 
 	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
@@ -83,26 +95,26 @@ void resize(int width, int height) {
 	glutPostRedisplay();
 } 
 
-IPlane *plane = new IPlane(dvec3(0.0, -2.0, 0.0), dvec3(0.0, 1.0, 0.0));
-IPlane *clearPlane = new IPlane(dvec3(0.0, 0.0, 0.0), dvec3(0.0, 0.0, -1.0));
-ISphere *sphere1 = new ISphere(dvec3(0.0, 4.0, 0.0), 2.0);
-ISphere *sphere2 = new ISphere(dvec3(6.0, 4.0, 0.0), 2.0);
-ISphere *sphere3 = new ISphere(dvec3(0.0, 4.0, 6.0), 2.0);
-ICylinderY* cylinderY = new ICylinderY(dvec3(-20.0, -2.0, 10.0), 4.0, 10.0);
-IClosedCylinderY* closedY = new IClosedCylinderY(dvec3(-5.0, 0.0, 7.0), 2.0, 4.0);
-ICylinderZ* cylinderZ = new ICylinderZ(dvec3(5.0, 3.0, -3.0), 2.0, 3.0);
-IConeY* coneY = new IConeY(dvec3(6.0, 0.0, 0.0), 2.0, 2.0);
-IDisk* backFaceDisk = new IDisk(dvec3(4.0, 4.0, 4.0), dvec3(0.0, -1.0, 0.0), 2.0);
+IPlane *plane = arena.create<IPlane>(dvec3(0.0, -2.0, 0.0), dvec3(0.0, 1.0, 0.0));
+IPlane *clearPlane = arena.create<IPlane>(dvec3(0.0, 0.0, 0.0), dvec3(0.0, 0.0, -1.0));
+ISphere *sphere1 = arena.create<ISphere>(dvec3(0.0, 4.0, 0.0), 2.0);
+ISphere *sphere2 = arena.create<ISphere>(dvec3(6.0, 4.0, 0.0), 2.0);
+ISphere *sphere3 = arena.create<ISphere>(dvec3(0.0, 4.0, 6.0), 2.0);
+ICylinderY* cylinderY = arena.create<ICylinderY>(dvec3(-20.0, -2.0, 10.0), 4.0, 10.0);
+IClosedCylinderY* closedY = arena.create<IClosedCylinderY>(dvec3(-5.0, 0.0, 7.0), 2.0, 4.0);
+ICylinderZ* cylinderZ = arena.create<ICylinderZ>(dvec3(5.0, 3.0, -3.0), 2.0, 3.0);
+IConeY* coneY = arena.create<IConeY>(dvec3(6.0, 0.0, 0.0), 2.0, 2.0);
+IDisk* backFaceDisk = arena.create<IDisk>(dvec3(4.0, 4.0, 4.0), dvec3(0.0, -1.0, 0.0), 2.0);
 void buildScene() {
-	scene.addOpaqueObject(new VisibleIShape(plane, tin));
-	scene.addTransparentObject(new VisibleIShape(clearPlane, Material(red, red, red, 0.0)), 0.25);
-	scene.addOpaqueObject(new VisibleIShape(backFaceDisk, gold));
-	scene.addOpaqueObject(new VisibleIShape(sphere1, gold));
-	//scene.addOpaqueObject(new VisibleIShape(sphere2, redPlastic));
-	scene.addOpaqueObject(new VisibleIShape(cylinderY, tin, &im1));
-	scene.addOpaqueObject(new VisibleIShape(closedY, cyanPlastic));
-	scene.addOpaqueObject(new VisibleIShape(coneY, greenPlastic));
-	scene.addOpaqueObject(new VisibleIShape(cylinderZ, redPlastic));
+	scene.addOpaqueObject(arena.create<VisibleIShape>(plane, tin));
+	scene.addTransparentObject(arena.create<VisibleIShape>(clearPlane, Material(red, red, red, 0.0)), 0.25);
+	scene.addOpaqueObject(arena.create<VisibleIShape>(backFaceDisk, gold));
+	scene.addOpaqueObject(arena.create<VisibleIShape>(sphere1, gold));
+	//scene.addOpaqueObject(arena.create<VisibleIShape>(sphere2, redPlastic));
+	scene.addOpaqueObject(arena.create<VisibleIShape>(cylinderY, tin, &im1));
+	scene.addOpaqueObject(arena.create<VisibleIShape>(closedY, cyanPlastic));
+	scene.addOpaqueObject(arena.create<VisibleIShape>(coneY, greenPlastic));
+	scene.addOpaqueObject(arena.create<VisibleIShape>(cylinderZ, redPlastic));
 	scene.addLight(lights[0]);
 	scene.addLight(lights[1]);
 }
@@ -218,6 +230,11 @@ void keyboard(unsigned char key, int x, int y) {
 				cout << "Anti aliasing: " << antiAliasing << endl;
 				break;
 
+	case 'S':
+	case 's':	samplerType = (SamplerType)((samplerType + 1) % NUM_SAMPLER_TYPES);
+				rayTrace.setSampler(samplerType);
+				cout << "Sampler: " << rayTrace.getSampler().name() << endl;
+				break;
 	case '?':	multiViewOn = !multiViewOn;
 				break;
 	case '0':	
@@ -245,7 +262,16 @@ int main(int argc, char *argv[]) {
 	glutKeyboardFunc(keyboard);
 	glutMouseFunc(mouseUtility);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
-	buildScene();
+	if (argc > 1 && sceneFile.load(argv[1])) {
+		useSceneFile = true;
+		rayTrace.defaultColor = sceneFile.background;
+		sceneFile.arena.report(cout);
+		if (argc > 2) {
+			sceneFile.saveCache(argv[2]);		// fullraytrace in.scene out.cache
+		}
+	} else {
+		buildScene();
+	}
 
 	glutMainLoop();
 
@@ -0,0 +1,167 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "gbuffer.h"
+
+/**
+ * @fn	static double signNotZero(double x)
+ * @brief	Sign of x, taking 0 as positive.
+ */
+
+static double signNotZero(double x) {
+	return x >= 0.0 ? 1.0 : -1.0;
+}
+
+/**
+ * @fn	uint32_t encodeOctahedral(const dvec3 &n)
+ * @brief	Packs a direction into 32 bits. The direction is projected onto the
+ * 			octahedron |x| + |y| + |z| = 1, whose lower half is folded over the
+ * 			upper, and the resulting (x, y) in [-1, 1] stored as 16 bit signed
+ * 			fixed point. The error is under 1/10000 of a radian in every direction.
+ * @param	n	The direction. Need not be unit length.
+ * @return	The packed direction. A zero vector is packed as +z.
+ */
+
+uint32_t encodeOctahedral(const dvec3 &n) {
+	double L1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (L1 == 0.0) {
+		return encodeOctahedral(dvec3(0.0, 0.0, 1.0));
+	}
+	double x = n.x / L1;
+	double y = n.y / L1;
+	if (n.z < 0.0) {
+		double fx = (1.0 - std::abs(y)) * signNotZero(x);
+		double fy = (1.0 - std::abs(x)) * signNotZero(y);
+		x = fx;
+		y = fy;
+	}
+	uint16_t u = (uint16_t)(int16_t)std::lround(glm::clamp(x, -1.0, 1.0) * 32767.0);
+	uint16_t v = (uint16_t)(int16_t)std::lround(glm::clamp(y, -1.0, 1.0) * 32767.0);
+	return (uint32_t)u | ((uint32_t)v << 16);
+}
+
+/**
+ * @fn	dvec3 decodeOctahedral(uint32_t code)
+ * @brief	Unpacks a direction packed by encodeOctahedral.
+ * @param	code	The packed direction.
+ * @return	The unit length direction.
+ */
+
+dvec3 decodeOctahedral(uint32_t code) {
+	double x = (int16_t)(code & 0xFFFF) / 32767.0;
+	double y = (int16_t)(code >> 16) / 32767.0;
+	double z = 1.0 - std::abs(x) - std::abs(y);
+	if (z < 0.0) {
+		double fx = (1.0 - std::abs(y)) * signNotZero(x);
+		double fy = (1.0 - std::abs(x)) * signNotZero(y);
+		x = fx;
+		y = fy;
+	}
+	return glm::normalize(dvec3(x, y, z));
+}
+
+/**
+ * @fn	static size_t hashMaterial(const Material &mat)
+ * @brief	Hashes the bits of a material's properties.
+ */
+
+static size_t hashMaterial(const Material &mat) {
+	const double values[] = { mat.ambient.r, mat.ambient.g, mat.ambient.b,
+								mat.diffuse.r, mat.diffuse.g, mat.diffuse.b,
+								mat.specular.r, mat.specular.g, mat.specular.b,
+								mat.shininess, mat.alpha };
+	uint64_t h = 14695981039346656037ull;
+	for (double v : values) {
+		uint64_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		h = (h ^ bits) * 1099511628211ull;
+	}
+	return (size_t)(h ^ (h >> 32));
+}
+
+/**
+ * @fn	void GBuffer::setSize(int width, int height)
+ * @brief	Resizes the buffer. Its contents are undefined until clear is called.
+ * @param	width 	Width, in pixels.
+ * @param	height	Height, in pixels.
+ */
+
+void GBuffer::setSize(int width, int height) {
+	this->width = width;
+	this->height = height;
+	normals.resize(width * height);
+	materialIds.resize(width * height);
+}
+
+/**
+ * @fn	void GBuffer::clear()
+ * @brief	Marks every pixel empty and empties the material table. The table's
+ * 			storage is kept for the next frame.
+ */
+
+void GBuffer::clear() {
+	std::fill(materialIds.begin(), materialIds.end(), GBUFFER_EMPTY);
+	std::fill(slots.begin(), slots.end(), 0);
+	materials.clear();
+	lastMaterial = 0;
+}
+
+/**
+ * @fn	void GBuffer::rehash(size_t numSlots)
+ * @brief	Rebuilds the material hash with more slots.
+ * @param	numSlots	New number of slots, a power of 2.
+ */
+
+void GBuffer::rehash(size_t numSlots) {
+	slots.assign(numSlots, 0);
+	for (uint32_t i = 0; i < materials.size(); i++) {
+		size_t s = hashMaterial(materials[i]) & (numSlots - 1);
+		while (slots[s] != 0) {
+			s = (s + 1) & (numSlots - 1);
+		}
+		slots[s] = i + 1;
+	}
+}
+
+/**
+ * @fn	uint32_t GBuffer::addMaterial(const Material &mat)
+ * @brief	Finds a material in the table, adding it if it is not there yet.
+ * 			Consecutive triangles usually share a material, so the last one
+ * 			found is checked first. Clipping blends the materials of the
+ * 			vertices it interpolates between, so even a one material scene
+ * 			can have many that differ in the last bits; they are looked up
+ * 			by hash.
+ * @param	mat	The material.
+ * @return	Its index in the table.
+ */
+
+uint32_t GBuffer::addMaterial(const Material &mat) {
+	if (lastMaterial < materials.size() && materials[lastMaterial] == mat) {
+		return lastMaterial;
+	}
+	if (slots.size() < 2 * (materials.size() + 1)) {
+		rehash(std::max<size_t>(64, 2 * slots.size()));
+	}
+	const size_t mask = slots.size() - 1;
+	size_t s = hashMaterial(mat) & mask;
+	while (slots[s] != 0) {
+		if (materials[slots[s] - 1] == mat) {
+			lastMaterial = slots[s] - 1;
+			return lastMaterial;
+		}
+		s = (s + 1) & mask;
+	}
+	materials.push_back(mat);
+	lastMaterial = (uint32_t)materials.size() - 1;
+	slots[s] = lastMaterial + 1;
+	return lastMaterial;
+}
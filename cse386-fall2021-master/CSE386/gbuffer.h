@@ -0,0 +1,50 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "defs.h"
+#include "colorandmaterials.h"
+
+const uint32_t GBUFFER_EMPTY = 0xFFFFFFFF;	//!< Material id of a pixel nothing was drawn to.
+
+uint32_t encodeOctahedral(const dvec3 &n);
+dvec3 decodeOctahedral(uint32_t code);
+
+/**
+ * @struct	GBuffer
+ * @brief	What the lighting pass of deferred shading needs to know about each
+ * 			pixel, apart from its depth: the surface normal, folded onto an
+ * 			octahedron and stored as two 16 bit values, and an index into a table
+ * 			of the frame's materials. Eight bytes per pixel.
+ *
+ * 			Depth is kept in the framebuffer's depth buffer, and world position
+ * 			is recovered from it and the pixel's window coordinates.
+ */
+
+struct GBuffer {
+	int width, height;				//!< Size, in pixels.
+	vector<uint32_t> normals;		//!< Octahedral normal of pixel (x, y) at y * width + x.
+	vector<uint32_t> materialIds;	//!< Index into materials, or GBUFFER_EMPTY.
+	vector<Material> materials;		//!< The distinct materials drawn this frame.
+
+	GBuffer() : width(0), height(0), lastMaterial(0) {}
+	void setSize(int width, int height);
+	void clear();
+	uint32_t addMaterial(const Material &mat);
+	void set(int x, int y, uint32_t normal, uint32_t materialId) {
+		normals[y * width + x] = normal;
+		materialIds[y * width + x] = materialId;
+	}
+protected:
+	void rehash(size_t numSlots);
+	vector<uint32_t> slots;			//!< Open addressed hash of materials: index + 1, or 0 if free.
+	uint32_t lastMaterial;			//!< Index returned by the last addMaterial.
+};
@@ -15,6 +15,8 @@
 #include "image.h"
 #include "utilities.h"
 
+struct IShape;
+
 /**
  * @struct	HitRecord
  * @brief	Stores information regarding a ray-object intersection. Used in raytracing.
@@ -27,6 +29,8 @@ struct HitRecord {
 	Material material;		//!< the Material value of the object.
 	Image *texture;			//!< the texture associated with this object, if any.
 	double u, v;			//!< (u,v) correpsonding to intersection point.
+	dvec3 pError;			//!< Bound on the rounding error in each coordinate of interceptPt.
+	const IShape *shape;	//!< the shape hit, set along with the material.
 
 	/**
 	 * @fn	HitRecord()
@@ -37,6 +41,8 @@ struct HitRecord {
 		t = FLT_MAX;
 		u = v = 0;
 		texture = nullptr; 
+		pError = dvec3(0.0, 0.0, 0.0);
+		shape = nullptr;
 	}
 
 	/**
@@ -7,6 +7,8 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <utility>
@@ -100,6 +102,65 @@ Image::Image(std::string ppmFileName) : W(0), H(0) {
 	}
 
 	input.close();
+	buildMipLevels();
+}
+
+/**
+ * @fn	void Image::buildMipLevels()
+ * @brief	Builds the mip pyramid by averaging 2x2 blocks of texels, down to a
+ * 			single texel. An odd last row or column of a level is dropped.
+ */
+
+void Image::buildMipLevels() {
+	mipLevels.clear();
+	if (pixels == nullptr) {
+		return;
+	}
+	int srcW = W, srcH = H;
+	const color *src = pixels;
+	while (srcW > 1 || srcH > 1) {
+		MipLevel level;
+		level.W = std::max(1, srcW / 2);
+		level.H = std::max(1, srcH / 2);
+		level.texels.resize((size_t)level.W * level.H);
+		for (int y = 0; y < level.H; y++) {
+			int y0 = std::min(2 * y, srcH - 1), y1 = std::min(2 * y + 1, srcH - 1);
+			for (int x = 0; x < level.W; x++) {
+				int x0 = std::min(2 * x, srcW - 1), x1 = std::min(2 * x + 1, srcW - 1);
+				level.texels[(size_t)y * level.W + x] =
+					(src[y0 * srcW + x0] + src[y0 * srcW + x1] +
+					 src[y1 * srcW + x0] + src[y1 * srcW + x1]) / 4.0;
+			}
+		}
+		mipLevels.push_back(std::move(level));
+		srcW = mipLevels.back().W;
+		srcH = mipLevels.back().H;
+		src = mipLevels.back().texels.data();
+	}
+}
+
+/**
+ * @fn	color Image::bilinear(int level, double u, double v) const
+ * @brief	Interpolates between the four texels of a mip level whose centers
+ * 			surround (u, v), clamping at the edges.
+ * @param	level	The mip level; 0 is the full image.
+ * @param	u	 	The u in (u, v).
+ * @param	v	 	The v in (u, v).
+ * @return	The interpolated color.
+ */
+
+color Image::bilinear(int level, double u, double v) const {
+	int w = level == 0 ? W : mipLevels[level - 1].W;
+	int h = level == 0 ? H : mipLevels[level - 1].H;
+	const color *texels = level == 0 ? pixels : mipLevels[level - 1].texels.data();
+	double x = u * w - 0.5, y = v * h - 0.5;
+	double fx = std::floor(x), fy = std::floor(y);
+	double ax = x - fx, ay = y - fy;
+	int x0 = glm::clamp((int)fx, 0, w - 1), x1 = glm::clamp((int)fx + 1, 0, w - 1);
+	int y0 = glm::clamp((int)fy, 0, h - 1), y1 = glm::clamp((int)fy + 1, 0, h - 1);
+	color bottom = (1 - ax) * texels[y0 * w + x0] + ax * texels[y0 * w + x1];
+	color top = (1 - ax) * texels[y1 * w + x0] + ax * texels[y1 * w + x1];
+	return (1 - ay) * bottom + ay * top;
 }
 
 /**
@@ -117,3 +178,36 @@ color Image::getPixelUV(double u, double v) const {
 	int y = glm::clamp((int)(H * v), 0, H-1);
 	return pixels[y * W + x];
 }
+
+/**
+ * @fn	color Image::getPixelUV(double u, double v, double dudx, double dvdx, double dudy, double dvdy) const
+ * @brief	Gets the color for a footprint around (u, v), given how u and v
+ * 			change over one pixel in x and in y. The mip level is picked so
+ * 			that its texels are about as wide as the footprint, and the two
+ * 			nearest levels are blended (trilinear filtering). A footprint
+ * 			smaller than a texel is point sampled, as by getPixelUV(u, v).
+ * @param	u   	The u in (u, v).
+ * @param	v   	The v in (u, v).
+ * @param	dudx	Change in u over one pixel in x.
+ * @param	dvdx	Change in v over one pixel in x.
+ * @param	dudy	Change in u over one pixel in y.
+ * @param	dvdy	Change in v over one pixel in y.
+ * @return	The filtered color.
+ */
+
+color Image::getPixelUV(double u, double v, double dudx, double dvdx, double dudy, double dvdy) const {
+	double width = std::max(std::sqrt(dudx * W * dudx * W + dvdx * H * dvdx * H),
+							std::sqrt(dudy * W * dudy * W + dvdy * H * dvdy * H));
+	if (!(width > 1.0)) {
+		return getPixelUV(u, v);
+	}
+	int lastLevel = numMipLevels() - 1;
+	double lod = std::min(std::log2(width), (double)lastLevel);
+	int level = (int)lod;
+	double blend = lod - level;
+	color result = bilinear(level, u, v);
+	if (blend > 0 && level < lastLevel) {
+		result = (1 - blend) * result + blend * bilinear(level + 1, u, v);
+	}
+	return result;
+}
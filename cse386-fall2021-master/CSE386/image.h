@@ -9,12 +9,15 @@
 
 #pragma once
 #include <memory>
+#include <vector>
 #include "defs.h"
 #include "colorandmaterials.h"
 
 /**
  * @struct	Image
- * @brief	Represents a rectangular RGB image.
+ * @brief	Represents a rectangular RGB image. A mip pyramid is built when
+ * 			the image is loaded, so texture lookups with a footprint can be
+ * 			filtered.
  */
 
 struct Image {
@@ -23,4 +26,18 @@ struct Image {
 	Image(std::string ppmFileName);
 	~Image() { delete[] pixels; }
 	color getPixelUV(double u, double v) const;
+	color getPixelUV(double u, double v, double dudx, double dvdx, double dudy, double dvdy) const;
+	int numMipLevels() const { return pixels != nullptr ? 1 + (int)mipLevels.size() : 0; }
+protected:
+	/**
+	 * @struct	MipLevel
+	 * @brief	One level of the pyramid, half the size of the one before.
+	 */
+	struct MipLevel {
+		int W, H;
+		vector<color> texels;
+	};
+	vector<MipLevel> mipLevels;		//!< Levels 1 and up; level 0 is pixels.
+	void buildMipLevels();
+	color bilinear(int level, double u, double v) const;
 };
@@ -0,0 +1,669 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include "imagewriter.h"
+
+#ifndef WINDOWS
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(IOV_MAX)
+const int MAX_SLICES_PER_CALL = IOV_MAX;
+#else
+const int MAX_SLICES_PER_CALL = 1024;
+#endif
+
+const size_t MAX_STORED_BLOCK = 65535;		//!< Largest deflate "stored" block.
+const int MIN_MATCH = 3;					//!< Shortest deflate match.
+const int MAX_MATCH = 258;					//!< Longest deflate match.
+const int MAX_DISTANCE = 32768;				//!< Deflate window size.
+const int END_OF_BLOCK = 256;				//!< Deflate end-of-block symbol.
+
+static const int lengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+									35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const int lengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+									3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const int distanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+									257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+									8193, 12289, 16385, 24577 };
+static const int distanceExtra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+									7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+/**
+ * @fn	static uint32_t updateCRC(uint32_t crc, const void *data, size_t len)
+ * @brief	Continues a PNG (IEEE 802.3) CRC-32. Start with 0xFFFFFFFF and
+ * 			complement the final value.
+ * @param	crc 	Running CRC.
+ * @param	data	Bytes to add.
+ * @param	len 	Number of bytes.
+ * @return	The updated CRC.
+ */
+
+static uint32_t updateCRC(uint32_t crc, const void *data, size_t len) {
+	// Built on first use; initialization of a local static is thread safe.
+	static const struct CRCTable {
+		uint32_t entries[256];
+		CRCTable() {
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++) {
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				}
+				entries[n] = c;
+			}
+		}
+	} table;
+	const unsigned char *p = (const unsigned char *)data;
+	for (size_t i = 0; i < len; i++) {
+		crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+/**
+ * @fn	static uint32_t updateAdler(uint32_t adler, const void *data, size_t len)
+ * @brief	Continues a zlib Adler-32 checksum. Start with 1.
+ * @param	adler	Running checksum.
+ * @param	data 	Bytes to add.
+ * @param	len  	Number of bytes.
+ * @return	The updated checksum.
+ */
+
+static uint32_t updateAdler(uint32_t adler, const void *data, size_t len) {
+	const uint32_t BASE = 65521;
+	const size_t NMAX = 5552;		// largest run before the sums can overflow
+	const unsigned char *p = (const unsigned char *)data;
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	while (len > 0) {
+		size_t n = std::min(len, NMAX);
+		len -= n;
+		while (n-- > 0) {
+			a += *p++;
+			b += a;
+		}
+		a %= BASE;
+		b %= BASE;
+	}
+	return (b << 16) | a;
+}
+
+/**
+ * @fn	static void putBigEndian(unsigned char *dest, uint32_t value)
+ * @brief	Stores a 32-bit value most significant byte first.
+ * @param [in,out]	dest 	Where to put the four bytes.
+ * @param 		  	value	The value.
+ */
+
+static void putBigEndian(unsigned char *dest, uint32_t value) {
+	dest[0] = (unsigned char)(value >> 24);
+	dest[1] = (unsigned char)(value >> 16);
+	dest[2] = (unsigned char)(value >> 8);
+	dest[3] = (unsigned char)value;
+}
+
+/**
+ * @fn	ImageWriter::ImageWriter(const string &fileName, ImageFileType type, int width, int height)
+ * @brief	Creates the file and writes the format header. Check good() afterwards.
+ * @param	fileName	Name of the file.
+ * @param	type		File format.
+ * @param	width   	Image width, in pixels.
+ * @param	height  	Image height, in pixels.
+ */
+
+ImageWriter::ImageWriter(const string &fileName, ImageFileType type, int width, int height)
+	: type(type), width(width), height(height), rowsWritten(0), ok(true), name(fileName),
+	stripY(0), stripH(0), stripPixels(0), adler(1), bitBuffer(0), bitCount(0) {
+#ifdef WINDOWS
+	file = fopen(fileName.c_str(), "wb");
+	if (file == nullptr) {
+#else
+	file = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file < 0) {
+#endif
+		std::cerr << "Unable to create image file: " << fileName << endl;
+		ok = false;
+		return;
+	}
+	if (width <= 0 || height <= 0) {
+		std::cerr << "Bad image size for " << fileName << ": " << width << "x" << height << endl;
+		ok = false;
+		return;
+	}
+	writeHeader();
+}
+
+/**
+ * @fn	ImageWriter::~ImageWriter()
+ * @brief	Destructor. Closes the file if close() has not been called.
+ */
+
+ImageWriter::~ImageWriter() {
+	close();
+}
+
+/**
+ * @fn	size_t ImageWriter::pixelBytes() const
+ * @brief	Size of one pixel as supplied to writeRows.
+ * @return	12 for PFM (three floats), 3 otherwise.
+ */
+
+size_t ImageWriter::pixelBytes() const {
+	return type == ImageFileType::PFM ? 3 * sizeof(float) : BYTES_PER_PIXEL;
+}
+
+/**
+ * @fn	void ImageWriter::writeSlices(const vector<IoSlice> &slices)
+ * @brief	Writes the slices back to back. On POSIX systems this is a gather
+ * 			write, so nothing is copied into a staging buffer.
+ * @param	slices	The memory to write, in order.
+ */
+
+void ImageWriter::writeSlices(const vector<IoSlice> &slices) {
+	if (!ok) return;
+#ifdef WINDOWS
+	for (const IoSlice &s : slices) {
+		if (fwrite(s.base, 1, s.len, file) != s.len) {
+			std::cerr << "Error writing image file: " << name << endl;
+			ok = false;
+			return;
+		}
+	}
+#else
+	vector<iovec> iov(slices.size());
+	for (size_t i = 0; i < slices.size(); i++) {
+		iov[i].iov_base = const_cast<void *>(slices[i].base);
+		iov[i].iov_len = slices[i].len;
+	}
+	size_t first = 0;
+	while (first < iov.size()) {
+		int count = (int)std::min(iov.size() - first, (size_t)MAX_SLICES_PER_CALL);
+		ssize_t written = writev(file, &iov[first], count);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			std::cerr << "Error writing image file: " << name << endl;
+			ok = false;
+			return;
+		}
+		// Skip whatever was written; a short write leaves us part way into a slice.
+		while (first < iov.size() && (size_t)written >= iov[first].iov_len) {
+			written -= iov[first].iov_len;
+			first++;
+		}
+		if (written > 0) {
+			iov[first].iov_base = (char *)iov[first].iov_base + written;
+			iov[first].iov_len -= written;
+		}
+	}
+#endif
+}
+
+/**
+ * @fn	void ImageWriter::writeHeader()
+ * @brief	Writes everything that precedes the first row of pixels.
+ */
+
+void ImageWriter::writeHeader() {
+	if (type == ImageFileType::PPM || type == ImageFileType::PFM) {
+		string header;
+		if (type == ImageFileType::PPM) {
+			header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+		} else {
+			// A negative scale means the floats are little-endian.
+			const uint16_t probe = 1;
+			bool littleEndian = *(const unsigned char *)&probe == 1;
+			header = "PF\n" + std::to_string(width) + " " + std::to_string(height) +
+						(littleEndian ? "\n-1.0\n" : "\n1.0\n");
+		}
+		writeSlices({ { header.data(), header.size() } });
+		return;
+	}
+
+	static const unsigned char signature[] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+	writeSlices({ { signature, sizeof(signature) } });
+
+	unsigned char ihdr[13];
+	putBigEndian(ihdr, width);
+	putBigEndian(ihdr + 4, height);
+	ihdr[8] = 8;		// bits per channel
+	ihdr[9] = 2;		// truecolor RGB
+	ihdr[10] = 0;		// deflate
+	ihdr[11] = 0;		// adaptive filtering (we always use filter type 0)
+	ihdr[12] = 0;		// not interlaced
+	writePNGChunk("IHDR", ihdr, sizeof(ihdr));
+
+	if (type == ImageFileType::PNG_STORE) {
+		static const unsigned char zlibHeader[] = { 0x78, 0x01 };
+		writePNGChunk("IDAT", zlibHeader, sizeof(zlibHeader));
+	} else {
+		packed.push_back(0x78);
+		packed.push_back(0x01);
+		putBits(2, 3);			// not final, fixed Huffman codes
+	}
+}
+
+/**
+ * @fn	void ImageWriter::writeTrailer()
+ * @brief	Finishes the file once all rows are out.
+ */
+
+void ImageWriter::writeTrailer() {
+	if (type == ImageFileType::PPM || type == ImageFileType::PFM) {
+		return;
+	}
+	unsigned char adlerBytes[4];
+	putBigEndian(adlerBytes, adler);
+	if (type == ImageFileType::PNG_STORE) {
+		// An empty final stored block, then the zlib checksum.
+		unsigned char tail[9] = { 1, 0, 0, 0xFF, 0xFF };
+		memcpy(tail + 5, adlerBytes, 4);
+		writePNGChunk("IDAT", tail, sizeof(tail));
+	} else {
+		putLiteral(END_OF_BLOCK);		// closes the open block
+		putBits(3, 3);			// final, fixed Huffman codes
+		putLiteral(END_OF_BLOCK);		// ...and empty
+		if (bitCount > 0) {
+			putBits(0, 8 - bitCount);
+		}
+		packed.insert(packed.end(), adlerBytes, adlerBytes + 4);
+		writePNGChunk("IDAT", packed.data(), packed.size());
+		packed.clear();
+	}
+	writePNGChunk("IEND", nullptr, 0);
+}
+
+/**
+ * @fn	void ImageWriter::writePNGChunk(const char *chunkType, const unsigned char *data, size_t len)
+ * @brief	Writes a complete PNG chunk.
+ * @param	chunkType	Four character chunk type.
+ * @param	data	 	The chunk data.
+ * @param	len		 	Length of the data.
+ */
+
+void ImageWriter::writePNGChunk(const char *chunkType, const unsigned char *data, size_t len) {
+	unsigned char head[8], tail[4];
+	putBigEndian(head, (uint32_t)len);
+	memcpy(head + 4, chunkType, 4);
+	uint32_t crc = updateCRC(0xFFFFFFFFu, head + 4, 4);
+	crc = updateCRC(crc, data, len);
+	putBigEndian(tail, ~crc);
+	writeSlices({ { head, 8 }, { data, len }, { tail, 4 } });
+}
+
+/**
+ * @fn	void ImageWriter::writePNGRowsStored(const unsigned char *pixels, int numRows, ptrdiff_t rowStride)
+ * @brief	Writes rows as uncompressed deflate blocks, one IDAT chunk per row.
+ * 			Only the small chunk and block headers are built here; the pixel
+ * 			bytes go to the file straight from the caller's buffer.
+ * @param	pixels   	First row.
+ * @param	numRows  	Number of rows.
+ * @param	rowStride	Bytes from one row to the next.
+ */
+
+void ImageWriter::writePNGRowsStored(const unsigned char *pixels, int numRows, ptrdiff_t rowStride) {
+	const size_t rowBytes = (size_t)width * BYTES_PER_PIXEL;
+	const size_t streamBytes = rowBytes + 1;		// filter byte + pixels
+	const size_t blocksPerRow = (streamBytes + MAX_STORED_BLOCK - 1) / MAX_STORED_BLOCK;
+	const size_t headBytes = 8 + 5 * blocksPerRow + 1;
+	const size_t scratchPerRow = headBytes + 4;
+
+	vector<unsigned char> scratch(scratchPerRow * numRows);
+	vector<IoSlice> slices;
+	slices.reserve(numRows * (2 * blocksPerRow + 1));
+
+	for (int r = 0; r < numRows; r++) {
+		const unsigned char *row = pixels + r * rowStride;
+		unsigned char *head = scratch.data() + r * scratchPerRow;
+		unsigned char *tail = head + headBytes;
+		unsigned char *out = head + 8;
+		uint32_t crc;
+
+		putBigEndian(head, (uint32_t)(5 * blocksPerRow + streamBytes));
+		memcpy(head + 4, "IDAT", 4);
+		crc = updateCRC(0xFFFFFFFFu, head + 4, 4);
+
+		size_t done = 0;		// row bytes emitted so far
+		for (size_t b = 0; b < blocksPerRow; b++) {
+			// The first block also carries the filter byte.
+			size_t blockLen = std::min(streamBytes - (done + (b == 0 ? 0 : 1)), MAX_STORED_BLOCK);
+			size_t dataLen = b == 0 ? blockLen - 1 : blockLen;
+			unsigned char *blockHead = out;
+			*out++ = 0;		// not final, stored
+			*out++ = (unsigned char)(blockLen & 0xFF);
+			*out++ = (unsigned char)(blockLen >> 8);
+			*out++ = (unsigned char)(~blockLen & 0xFF);
+			*out++ = (unsigned char)((~blockLen >> 8) & 0xFF);
+			if (b == 0) {
+				*out++ = 0;		// filter type None
+				adler = updateAdler(adler, out - 1, 1);
+			}
+			if (b == 0) {
+				slices.push_back({ head, (size_t)(out - head) });
+				crc = updateCRC(crc, head + 8, out - (head + 8));
+			} else {
+				slices.push_back({ blockHead, (size_t)(out - blockHead) });
+				crc = updateCRC(crc, blockHead, out - blockHead);
+			}
+			slices.push_back({ row + done, dataLen });
+			crc = updateCRC(crc, row + done, dataLen);
+			adler = updateAdler(adler, row + done, dataLen);
+			done += dataLen;
+		}
+		putBigEndian(tail, ~crc);
+		slices.push_back({ tail, 4 });
+	}
+	writeSlices(slices);
+}
+
+/**
+ * @fn	void ImageWriter::putBits(uint32_t bits, int count)
+ * @brief	Appends count bits to the deflate stream, least significant first.
+ * @param	bits 	The bits.
+ * @param	count	How many (at most 16).
+ */
+
+void ImageWriter::putBits(uint32_t bits, int count) {
+	bitBuffer |= bits << bitCount;
+	bitCount += count;
+	while (bitCount >= 8) {
+		packed.push_back((unsigned char)bitBuffer);
+		bitBuffer >>= 8;
+		bitCount -= 8;
+	}
+}
+
+/**
+ * @fn	void ImageWriter::putHuffman(uint32_t code, int length)
+ * @brief	Appends a Huffman code. These are defined most significant bit first.
+ * @param	code  	The code.
+ * @param	length	Its length in bits.
+ */
+
+void ImageWriter::putHuffman(uint32_t code, int length) {
+	uint32_t reversed = 0;
+	for (int i = 0; i < length; i++) {
+		reversed = (reversed << 1) | ((code >> i) & 1);
+	}
+	putBits(reversed, length);
+}
+
+/**
+ * @fn	void ImageWriter::putLiteral(int literal)
+ * @brief	Appends a literal/length symbol using the fixed Huffman code.
+ * @param	literal	Symbol, 0 to 287.
+ */
+
+void ImageWriter::putLiteral(int literal) {
+	if (literal < 144) {
+		putHuffman(0x30 + literal, 8);
+	} else if (literal < 256) {
+		putHuffman(0x190 + literal - 144, 9);
+	} else if (literal < 280) {
+		putHuffman(literal - 256, 7);
+	} else {
+		putHuffman(0xC0 + literal - 280, 8);
+	}
+}
+
+/**
+ * @fn	void ImageWriter::putMatch(int length, int distance)
+ * @brief	Appends a back reference using the fixed Huffman codes.
+ * @param	length  	Match length, MIN_MATCH to MAX_MATCH.
+ * @param	distance	Distance back, 1 to MAX_DISTANCE.
+ */
+
+void ImageWriter::putMatch(int length, int distance) {
+	int lc = 28;
+	while (lengthBase[lc] > length) lc--;
+	putLiteral(257 + lc);
+	putBits(length - lengthBase[lc], lengthExtra[lc]);
+
+	int dc = 29;
+	while (distanceBase[dc] > distance) dc--;
+	putHuffman(dc, 5);
+	putBits(distance - distanceBase[dc], distanceExtra[dc]);
+}
+
+/**
+ * @fn	void ImageWriter::writePNGRowsFast(const unsigned char *pixels, int numRows, ptrdiff_t rowStride)
+ * @brief	Compresses rows with fixed-Huffman deflate. Rendered images are
+ * 			mostly runs of the same color, so the only matches tried are
+ * 			against the previous pixel and the pixel above, which is cheap
+ * 			and catches most of the redundancy.
+ * @param	pixels   	First row.
+ * @param	numRows  	Number of rows.
+ * @param	rowStride	Bytes from one row to the next.
+ */
+
+void ImageWriter::writePNGRowsFast(const unsigned char *pixels, int numRows, ptrdiff_t rowStride) {
+	const size_t rowBytes = (size_t)width * BYTES_PER_PIXEL;
+	const int up = (int)rowBytes + 1;
+	const bool tryUp = up <= MAX_DISTANCE;
+
+	for (int r = 0; r < numRows; r++) {
+		const unsigned char *row = pixels + r * rowStride;
+		size_t start = history.size();
+		history.push_back(0);		// filter type None
+		history.insert(history.end(), row, row + rowBytes);
+		adler = updateAdler(adler, history.data() + start, rowBytes + 1);
+
+		const unsigned char *h = history.data();
+		const int end = (int)history.size();
+		int pos = (int)start;
+		while (pos < end) {
+			int limit = std::min(MAX_MATCH, end - pos);
+			int bestLength = 0, bestDistance = 0;
+			const int candidates[] = { BYTES_PER_PIXEL, tryUp ? up : 0 };
+			for (int distance : candidates) {
+				if (distance == 0 || distance > pos) continue;
+				int length = 0;
+				while (length < limit && h[pos + length] == h[pos + length - distance]) {
+					length++;
+				}
+				if (length > bestLength) {
+					bestLength = length;
+					bestDistance = distance;
+				}
+			}
+			if (bestLength >= MIN_MATCH) {
+				putMatch(bestLength, bestDistance);
+				pos += bestLength;
+			} else {
+				putLiteral(h[pos]);
+				pos++;
+			}
+		}
+
+		// Only the previous row is ever referenced.
+		if (history.size() > 4 * (size_t)up) {
+			history.erase(history.begin(), history.end() - up);
+		}
+	}
+	writePNGChunk("IDAT", packed.data(), packed.size());
+	packed.clear();
+}
+
+/**
+ * @fn	void ImageWriter::writeRows(const void *pixels, int numRows, ptrdiff_t rowStride)
+ * @brief	Writes the next numRows rows of the image, in file order.
+ * @param	pixels   	The first row to write.
+ * @param	numRows  	Number of rows.
+ * @param	rowStride	Bytes from the start of one row to the next. 0 means tightly
+ * 						packed. May be negative, e.g. to write a bottom-up buffer
+ * 						top-down.
+ */
+
+void ImageWriter::writeRows(const void *pixels, int numRows, ptrdiff_t rowStride) {
+	if (!ok || numRows <= 0) return;
+	if (rowsWritten + numRows > height) {
+		std::cerr << "Too many rows written to " << name << endl;
+		ok = false;
+		return;
+	}
+	const size_t rowBytes = width * pixelBytes();
+	if (rowStride == 0) {
+		rowStride = (ptrdiff_t)rowBytes;
+	}
+	const unsigned char *first = (const unsigned char *)pixels;
+
+	switch (type) {
+	case ImageFileType::PPM:
+	case ImageFileType::PFM:
+		if (rowStride == (ptrdiff_t)rowBytes) {
+			writeSlices({ { first, rowBytes * numRows } });
+		} else {
+			vector<IoSlice> slices(numRows);
+			for (int r = 0; r < numRows; r++) {
+				slices[r] = { first + r * rowStride, rowBytes };
+			}
+			writeSlices(slices);
+		}
+		break;
+	case ImageFileType::PNG_STORE:
+		writePNGRowsStored(first, numRows, rowStride);
+		break;
+	case ImageFileType::PNG_FAST:
+		writePNGRowsFast(first, numRows, rowStride);
+		break;
+	}
+	rowsWritten += numRows;
+}
+
+/**
+ * @fn	void ImageWriter::writeTile(int x, int y, int w, int h, const void *pixels)
+ * @brief	Writes one tile. Tiles are gathered into a strip of rows, which is
+ * 			written as soon as it is complete, so only one strip is ever held.
+ * 			All tiles of a strip must share y and h, and strips must arrive in
+ * 			file order. Within a strip tiles may come in any order.
+ * @param	x	  	Left column of the tile.
+ * @param	y	  	First row of the tile, counted in file order.
+ * @param	w	  	Tile width.
+ * @param	h	  	Tile height.
+ * @param	pixels	Tile pixels, tightly packed, in file order.
+ */
+
+void ImageWriter::writeTile(int x, int y, int w, int h, const void *pixels) {
+	if (!ok) return;
+	if (h <= 0 || y < 0 || y + h > height) {
+		std::cerr << "Tile rows " << y << " to " << y + h << " out of range in " << name << endl;
+		ok = false;
+		return;
+	}
+	if (stripPixels == 0) {
+		stripY = y;
+		stripH = h;
+		strip.resize(width * pixelBytes() * h);
+	}
+	if (y != stripY || h != stripH || y != rowsWritten || x < 0 || w <= 0 || x + w > width) {
+		std::cerr << "Out of order tile (" << x << "," << y << "," << w << "," << h
+					<< ") written to " << name << endl;
+		ok = false;
+		return;
+	}
+	const size_t tileRowBytes = w * pixelBytes();
+	const size_t stripRowBytes = width * pixelBytes();
+	const unsigned char *src = (const unsigned char *)pixels;
+	for (int r = 0; r < h; r++) {
+		memcpy(strip.data() + r * stripRowBytes + x * pixelBytes(), src + r * tileRowBytes, tileRowBytes);
+	}
+	stripPixels += (size_t)w * h;
+	if (stripPixels >= (size_t)width * h) {
+		writeRows(strip.data(), h);
+		stripPixels = 0;
+	}
+}
+
+/**
+ * @fn	bool ImageWriter::close()
+ * @brief	Finishes and closes the file. Safe to call more than once.
+ * @return	True if the whole image was written without error.
+ */
+
+bool ImageWriter::close() {
+#ifdef WINDOWS
+	if (file == nullptr) return ok;
+#else
+	if (file < 0) return ok;
+#endif
+	if (ok && rowsWritten != height) {
+		std::cerr << "Only " << rowsWritten << " of " << height << " rows written to " << name << endl;
+		ok = false;
+	}
+	if (ok) {
+		writeTrailer();
+	}
+#ifdef WINDOWS
+	ok = fclose(file) == 0 && ok;
+	file = nullptr;
+#else
+	ok = ::close(file) == 0 && ok;
+	file = -1;
+#endif
+	return ok;
+}
+
+/**
+ * @fn	bool ImageWriter::writeFrameBuffer(const FrameBuffer &frameBuffer, const string &fileName, ImageFileType type)
+ * @brief	Saves the color buffer. For PPM and PNG_STORE the pixels are written
+ * 			straight out of the frame buffer without being copied.
+ * @param	frameBuffer	The frame buffer.
+ * @param	fileName   	Name of the file.
+ * @param	type	   	File format.
+ * @return	True if successful.
+ */
+
+bool ImageWriter::writeFrameBuffer(const FrameBuffer &frameBuffer, const string &fileName,
+									ImageFileType type) {
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const GLubyte *color = frameBuffer.getColorBuffer();
+	const ptrdiff_t rowBytes = (ptrdiff_t)W * BYTES_PER_PIXEL;
+	ImageWriter writer(fileName, type, W, H);
+
+	if (type == ImageFileType::PFM) {
+		// PFM is bottom-up like the frame buffer, but needs floats.
+		const int ROWS_PER_BATCH = 64;
+		vector<float> rows((size_t)rowBytes * ROWS_PER_BATCH);
+		for (int y = 0; y < H; y += ROWS_PER_BATCH) {
+			int n = std::min(ROWS_PER_BATCH, H - y);
+			const GLubyte *src = color + y * rowBytes;
+			for (size_t i = 0; i < (size_t)rowBytes * n; i++) {
+				rows[i] = src[i] / 255.0f;
+			}
+			writer.writeRows(rows.data(), n);
+		}
+	} else {
+		// The frame buffer's origin is the bottom left; these formats start at the top.
+		writer.writeRows(color + (H - 1) * rowBytes, H, -rowBytes);
+	}
+	return writer.close();
+}
+
+/**
+ * @fn	bool ImageWriter::writePFM(const float *rgb, int width, int height, const string &fileName)
+ * @brief	Saves a float RGB buffer (e.g. a ray tracer accumulation buffer laid
+ * 			out like FrameBuffer, origin at the bottom left) as a PFM file.
+ * @param	rgb			The pixels.
+ * @param	width   	Width, in pixels.
+ * @param	height  	Height, in pixels.
+ * @param	fileName	Name of the file.
+ * @return	True if successful.
+ */
+
+bool ImageWriter::writePFM(const float *rgb, int width, int height, const string &fileName) {
+	ImageWriter writer(fileName, ImageFileType::PFM, width, height);
+	writer.writeRows(rgb, height);
+	return writer.close();
+}
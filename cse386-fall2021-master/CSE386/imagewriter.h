@@ -0,0 +1,100 @@
+/****************************************************
+ * 2016-2020 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted..
+ ****************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "defs.h"
+#include "framebuffer.h"
+
+/**
+ * @enum	ImageFileType
+ * @brief	The file formats ImageWriter can produce.
+ */
+
+enum class ImageFileType {
+	PPM,		//!< Binary (P6) 8-bit RGB.
+	PFM,		//!< Portable float map, 32-bit float RGB.
+	PNG_STORE,	//!< 8-bit RGB PNG, deflate "stored" (uncompressed) blocks.
+	PNG_FAST	//!< 8-bit RGB PNG, fixed-Huffman deflate with run matches.
+};
+
+/**
+ * @struct	IoSlice
+ * @brief	A piece of memory to be written, without being copied first.
+ */
+
+struct IoSlice {
+	const void *base;	//!< Start of the bytes.
+	size_t len;			//!< Number of bytes.
+};
+
+/**
+ * @class	ImageWriter
+ * @brief	Streams an image to disk one group of rows (or tiles) at a time, so
+ * 			the whole image never has to be resident in memory. Rows are supplied
+ * 			in file order: top-to-bottom for PPM and PNG, bottom-to-top for PFM
+ * 			(see rowsAreBottomUp()). Pixel rows are GLubyte RGB for PPM/PNG and
+ * 			float RGB for PFM. Where the format allows, rows are handed to the
+ * 			OS with writev() straight from the caller's memory.
+ */
+
+class ImageWriter {
+public:
+	ImageWriter(const string &fileName, ImageFileType type, int width, int height);
+	ImageWriter(const ImageWriter &) = delete;
+	ImageWriter &operator = (const ImageWriter &) = delete;
+	~ImageWriter();
+	bool good() const { return ok; }
+	bool rowsAreBottomUp() const { return type == ImageFileType::PFM; }
+	int getRowsWritten() const { return rowsWritten; }
+	void writeRows(const void *pixels, int numRows, ptrdiff_t rowStride = 0);
+	void writeTile(int x, int y, int w, int h, const void *pixels);
+	bool close();
+
+	static bool writeFrameBuffer(const FrameBuffer &frameBuffer, const string &fileName,
+									ImageFileType type = ImageFileType::PPM);
+	static bool writePFM(const float *rgb, int width, int height, const string &fileName);
+protected:
+	ImageFileType type;				//!< Format being written.
+	int width, height;				//!< Image size, in pixels.
+	int rowsWritten;				//!< Rows emitted so far.
+	bool ok;						//!< False once any error has occurred.
+#ifdef WINDOWS
+	FILE *file;						//!< Output file.
+#else
+	int file;						//!< Output file descriptor.
+#endif
+	string name;				//!< File name, for error messages.
+
+	vector<unsigned char> strip;	//!< Tile assembly buffer - one strip of rows.
+	int stripY, stripH;				//!< Rows covered by the current strip.
+	size_t stripPixels;				//!< Pixels received for the current strip.
+
+	uint32_t adler;					//!< Running Adler-32 of the uncompressed PNG stream.
+	vector<unsigned char> history;	//!< PNG_FAST: trailing bytes of the uncompressed stream.
+	vector<unsigned char> packed;	//!< PNG_FAST: compressed bytes awaiting an IDAT chunk.
+	uint32_t bitBuffer;				//!< PNG_FAST: pending output bits.
+	int bitCount;					//!< PNG_FAST: number of pending bits.
+
+	size_t pixelBytes() const;
+	void writeSlices(const vector<IoSlice> &slices);
+	void writeHeader();
+	void writeTrailer();
+	void writePNGChunk(const char *chunkType, const unsigned char *data, size_t len);
+	void writePNGRowsStored(const unsigned char *pixels, int numRows, ptrdiff_t rowStride);
+	void writePNGRowsFast(const unsigned char *pixels, int numRows, ptrdiff_t rowStride);
+	void putBits(uint32_t bits, int count);
+	void putHuffman(uint32_t code, int length);
+	void putLiteral(int literal);
+	void putMatch(int length, int distance);
+};
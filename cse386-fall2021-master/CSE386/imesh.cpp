@@ -0,0 +1,591 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include "imesh.h"
+
+/**
+ * @struct	WatertightRay
+ * @brief	Per ray setup for the watertight ray/triangle test of Woop, Benthin
+ * 			and Wald (JCGT 2013). The ray is turned into the +z axis by a
+ * 			permutation and a shear, after which the test is 2D and adjacent
+ * 			triangles compute bit-identical edge values, so rays cannot slip
+ * 			through shared edges or vertices. That holds in either precision.
+ */
+
+template <class T>
+struct WatertightRay {
+	typedef typename Vec3Of<T>::type Vec;
+	Vec origin;			//!< Ray origin.
+	int kx, ky, kz;		//!< Axis permutation; kz is the dominant direction.
+	T sx, sy, sz;		//!< Shear constants.
+
+	WatertightRay(const RayT<T> &ray) : origin(ray.origin) {
+		Vec d = glm::abs(ray.dir);
+		kz = d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		if (ray.dir[kz] < 0) {
+			std::swap(kx, ky);		// keep the winding
+		}
+		sx = ray.dir[kx] / ray.dir[kz];
+		sy = ray.dir[ky] / ray.dir[kz];
+		sz = 1 / ray.dir[kz];
+	}
+
+	/**
+	 * @brief	Intersects one triangle.
+	 * @param	v0, v1, v2	The corners.
+	 * @param	tMin, tMax	Only hits between these count.
+	 * @param	t			Distance to the hit.
+	 * @param	b			Barycentric weights of v0, v1 and v2.
+	 * @return	True if the ray hits the triangle in (tMin, tMax).
+	 */
+	bool intersect(const Vec &v0, const Vec &v1, const Vec &v2, T tMin, T tMax, T &t, Vec &b) const {
+		const T Az = v0[kz] - origin[kz], Bz = v1[kz] - origin[kz], Cz = v2[kz] - origin[kz];
+		const T ax = (v0[kx] - origin[kx]) - sx * Az, ay = (v0[ky] - origin[ky]) - sy * Az;
+		const T bx = (v1[kx] - origin[kx]) - sx * Bz, by = (v1[ky] - origin[ky]) - sy * Bz;
+		const T cx = (v2[kx] - origin[kx]) - sx * Cz, cy = (v2[ky] - origin[ky]) - sy * Cz;
+
+		T U = cx * by - cy * bx;
+		T V = ax * cy - ay * cx;
+		T W = bx * ay - by * ax;
+		if (sizeof(T) < sizeof(double) && (U == 0 || V == 0 || W == 0)) {
+			// A float 0 may be rounding hiding the sign. Products of floats are
+			// exact in double, so only the difference rounds there.
+			U = (T)((double)cx * by - (double)cy * bx);
+			V = (T)((double)ax * cy - (double)ay * cx);
+			W = (T)((double)bx * ay - (double)by * ax);
+		}
+		if ((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0)) {
+			return false;
+		}
+		const T det = U + V + W;
+		if (det == 0) {
+			return false;
+		}
+		const T dist = U * sz * Az + V * sz * Bz + W * sz * Cz;
+		if (det > 0 ? (dist <= tMin * det || dist >= tMax * det) : (dist >= tMin * det || dist <= tMax * det)) {
+			return false;
+		}
+		t = dist / det;
+		b = Vec(U, V, W) / det;
+		return true;
+	}
+};
+
+/**
+ * @fn	static dvec3 barycentricPoint(const dvec3 &b, const dvec3 &v0, const dvec3 &v1, const dvec3 &v2, dvec3 &pError)
+ * @brief	Rebuilds the hit point from its barycentric weights, which keeps it
+ * 			on the triangle's plane to within the bound returned in pError
+ * 			(the weights come from RayReal arithmetic).
+ */
+
+static dvec3 barycentricPoint(const dvec3 &b, const dvec3 &v0, const dvec3 &v1, const dvec3 &v2,
+								dvec3 &pError) {
+	dvec3 p0 = b.x * v0, p1 = b.y * v1, p2 = b.z * v2;
+	pError = roundingGamma<RayReal>(7) * (glm::abs(p0) + glm::abs(p1) + glm::abs(p2));
+	return p0 + p1 + p2;
+}
+
+/**
+ * @fn	static void padTriangleBounds(BoundingBox &box)
+ * @brief	A flat, axis aligned triangle has a box with no thickness. Pads it
+ * 			so rounding in the slab test cannot cull a hit on it.
+ */
+
+static void padTriangleBounds(BoundingBox &box) {
+	dvec3 pad = (glm::abs(box.lo) + glm::abs(box.hi) + 1.0) * 1e-9;
+	box.lo -= pad;
+	box.hi += pad;
+}
+
+/**
+ * @fn	ITriangleMesh::ITriangleMesh()
+ * @brief	Constructs an empty mesh.
+ */
+
+ITriangleMesh::ITriangleMesh() : IShape() {
+	kind = IShapeKind::TRIANGLE_MESH;
+}
+
+/**
+ * @fn	BoundingBox ITriangleMesh::getBounds() const
+ * @brief	Gets the bounds of the mesh, as of the last buildIndex().
+ * @return	The bounds.
+ */
+
+BoundingBox ITriangleMesh::getBounds() const {
+	return bounds;
+}
+
+/**
+ * @fn	void ITriangleMesh::buildIndex()
+ * @brief	Builds the BVH over the triangles. Must be called after the
+ * 			buffers are filled or changed.
+ */
+
+void ITriangleMesh::buildIndex() {
+	size_t n = numTriangles();
+	vector<BoundingBox> triBounds(n);
+	vector<bool> isBounded(n, true);
+	bounds = BoundingBox();
+	for (size_t i = 0; i < n; i++) {
+		for (int k = 0; k < 3; k++) {
+			dvec3 v(vertices[indices[3 * i + k]]);
+			triBounds[i].grow(BoundingBox(v, v));
+		}
+		padTriangleBounds(triBounds[i]);
+		bounds.grow(triBounds[i]);
+	}
+	bvh.build(triBounds, isBounded);
+}
+
+/**
+ * @fn	void ITriangleMesh::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds the closest triangle hit by the ray.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit. The normal is interpolated from the vertex
+ * 						normals if there are any. u and v are set here too,
+ * 						from the vertex texture coordinates if there are any,
+ * 						or else the barycentric coordinates.
+ */
+
+void ITriangleMesh::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	typedef Vec3Of<RayReal>::type RayVec;
+	const RayT<RayReal> kernelRay(ray);
+	const WatertightRay<RayReal> wray(kernelRay);
+	RayReal tBest = FLT_MAX;
+	uint32_t bestTri = 0;
+	RayVec bestB;
+	bvh.traverse(kernelRay, tBest, [&](uint32_t tri) {
+		const uint32_t *idx = &indices[3 * tri];
+		RayReal t;
+		RayVec b;
+		if (wray.intersect(RayVec(vertices[idx[0]]), RayVec(vertices[idx[1]]), RayVec(vertices[idx[2]]),
+							kernelRay.tMin, tBest, t, b)) {
+			tBest = t;
+			bestTri = tri;
+			bestB = b;
+		}
+	});
+
+	hit.t = FLT_MAX;
+	if (tBest == (RayReal)FLT_MAX) {
+		return;
+	}
+	const uint32_t *idx = &indices[3 * bestTri];
+	const dvec3 bary(bestB);
+	dvec3 v0(vertices[idx[0]]), v1(vertices[idx[1]]), v2(vertices[idx[2]]);
+	hit.t = tBest;
+	hit.interceptPt = barycentricPoint(bary, v0, v1, v2, hit.pError);
+
+	dvec3 faceN = glm::cross(v1 - v0, v2 - v0);
+	hit.normal = glm::normalize(faceN);
+	if (!normals.empty()) {
+		dvec3 n = bary.x * dvec3(normals[idx[0]]) + bary.y * dvec3(normals[idx[1]]) +
+					bary.z * dvec3(normals[idx[2]]);
+		if (glm::dot(n, n) > 0.0) {
+			hit.normal = glm::normalize(n);
+		}
+	}
+	if (!texCoords.empty()) {
+		dvec2 uv = bary.x * dvec2(texCoords[idx[0]]) + bary.y * dvec2(texCoords[idx[1]]) +
+					bary.z * dvec2(texCoords[idx[2]]);
+		hit.u = uv.x;
+		hit.v = uv.y;
+	} else {
+		hit.u = bary.y;
+		hit.v = bary.z;
+	}
+}
+
+/**
+ * @fn	void ITriangleMesh::getTexCoords(const dvec3 &pt, double &u, double &v) const
+ * @brief	Leaves u and v alone: findClosestIntersection has already set them
+ * 			from the triangle that was hit, which the point alone cannot
+ * 			identify.
+ */
+
+void ITriangleMesh::getTexCoords(const dvec3 &/*pt*/, double &/*u*/, double &/*v*/) const {
+}
+
+/**
+ * @fn	IEShape::IEShape(const EShapeData &triangles, const dmat4 &modelingMatrix)
+ * @brief	Wraps the triangles and builds their index.
+ * @param	triangles	  	The triangles. Not copied.
+ * @param	modelingMatrix	Object to world transformation.
+ */
+
+IEShape::IEShape(const EShapeData &triangles, const dmat4 &modelingMatrix)
+	: IShape(), data(&triangles) {
+	kind = IShapeKind::EMESH;
+	setModelingMatrix(modelingMatrix);
+	buildIndex();
+}
+
+/**
+ * @fn	void IEShape::setModelingMatrix(const dmat4 &modelingMatrix)
+ * @brief	Moves the shape. The index is in object coordinates, so it does not
+ * 			need to be rebuilt.
+ * @param	modelingMatrix	Object to world transformation.
+ */
+
+void IEShape::setModelingMatrix(const dmat4 &modelingMatrix) {
+	modelMatrix = modelingMatrix;
+	inverseModelMatrix = glm::inverse(modelingMatrix);
+	normalMatrix = glm::transpose(glm::inverse(dmat3(modelingMatrix)));
+}
+
+/**
+ * @fn	void IEShape::buildIndex()
+ * @brief	Builds the BVH over the triangles.
+ */
+
+void IEShape::buildIndex() {
+	size_t n = numTriangles();
+	vector<BoundingBox> triBounds(n);
+	vector<bool> isBounded(n, true);
+	objectBounds = BoundingBox();
+	for (size_t i = 0; i < n; i++) {
+		for (int k = 0; k < 3; k++) {
+			dvec3 v((*data)[3 * i + k].pos);
+			triBounds[i].grow(BoundingBox(v, v));
+		}
+		padTriangleBounds(triBounds[i]);
+		objectBounds.grow(triBounds[i]);
+	}
+	bvh.build(triBounds, isBounded);
+}
+
+/**
+ * @fn	BoundingBox IEShape::getBounds() const
+ * @brief	Gets the bounds of the shape in world coordinates.
+ * @return	The bounds.
+ */
+
+BoundingBox IEShape::getBounds() const {
+	BoundingBox box;
+	if (numTriangles() == 0) {
+		return box;
+	}
+	for (int corner = 0; corner < 8; corner++) {
+		dvec4 p((corner & 1) ? objectBounds.hi.x : objectBounds.lo.x,
+				(corner & 2) ? objectBounds.hi.y : objectBounds.lo.y,
+				(corner & 4) ? objectBounds.hi.z : objectBounds.lo.z, 1.0);
+		dvec3 w(modelMatrix * p);
+		box.grow(BoundingBox(w, w));
+	}
+	return box;
+}
+
+/**
+ * @fn	bool IEShape::hasOwnMaterials() const
+ * @brief	Triangles carry their own materials.
+ * @return	True.
+ */
+
+bool IEShape::hasOwnMaterials() const {
+	return true;
+}
+
+/**
+ * @fn	void IEShape::findClosestIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds the closest triangle hit by the ray.
+ * @param 		  	ray	The ray, in world coordinates.
+ * @param [in,out]	hit	The hit, in world coordinates. The normal is
+ * 						interpolated from the vertex normals, and the
+ * 						material is the triangle's.
+ */
+
+void IEShape::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
+	hit.t = FLT_MAX;
+	if (numTriangles() == 0) {
+		return;
+	}
+	dvec3 objOrigin(inverseModelMatrix * dvec4(ray.origin, 1.0));
+	dvec3 objDir(inverseModelMatrix * dvec4(ray.dir, 0.0));
+	const Ray objRay(objOrigin, objDir, ray.tMin * glm::length(objDir));	// objRay.dir is normalized
+
+	typedef Vec3Of<RayReal>::type RayVec;
+	const RayT<RayReal> kernelRay(objRay);
+	const WatertightRay<RayReal> wray(kernelRay);
+	RayReal tBest = FLT_MAX;
+	uint32_t bestTri = 0;
+	RayVec bestB;
+	bvh.traverse(kernelRay, tBest, [&](uint32_t tri) {
+		const VertexData *v = &(*data)[3 * tri];
+		RayReal t;
+		RayVec b;
+		if (wray.intersect(RayVec(v[0].pos), RayVec(v[1].pos), RayVec(v[2].pos), kernelRay.tMin, tBest, t, b)) {
+			tBest = t;
+			bestTri = tri;
+			bestB = b;
+		}
+	});
+	if (tBest == (RayReal)FLT_MAX) {
+		return;
+	}
+
+	const VertexData *v = &(*data)[3 * bestTri];
+	const dvec3 bary(bestB);
+	dvec3 objError;
+	dvec3 objPt = barycentricPoint(bary, dvec3(v[0].pos), dvec3(v[1].pos), dvec3(v[2].pos), objError);
+	hit.interceptPt = dvec3(modelMatrix * dvec4(objPt, 1.0));
+	hit.t = glm::dot(hit.interceptPt - ray.origin, ray.dir);
+	// The object space error, carried through the matrix, plus the matrix's own rounding.
+	hit.pError = dvec3(0.0, 0.0, 0.0);
+	for (int r = 0; r < 3; r++) {
+		double absSum = std::abs(modelMatrix[3][r]);
+		for (int c = 0; c < 3; c++) {
+			hit.pError[r] += std::abs(modelMatrix[c][r]) * objError[c];
+			absSum += std::abs(modelMatrix[c][r] * objPt[c]);
+		}
+		hit.pError[r] += roundingGamma<double>(3) * absSum;
+	}
+	dvec3 n = bary.x * v[0].normal + bary.y * v[1].normal + bary.z * v[2].normal;
+	if (glm::dot(n, n) == 0.0) {
+		n = glm::cross(dvec3(v[1].pos) - dvec3(v[0].pos), dvec3(v[2].pos) - dvec3(v[0].pos));
+	}
+	hit.normal = glm::normalize(normalMatrix * n);
+	hit.material = v[0].material;
+	hit.u = bary.y;
+	hit.v = bary.z;
+}
+
+/**
+ * @struct	OBJCorner
+ * @brief	One corner of an OBJ face: position, texture and normal indices,
+ * 			zero based, -1 if absent.
+ */
+
+struct OBJCorner {
+	int64_t v, vt, vn;
+	bool operator == (const OBJCorner &other) const {
+		return v == other.v && vt == other.vt && vn == other.vn;
+	}
+};
+
+/**
+ * @struct	OBJCornerHash
+ * @brief	Hash for OBJCorner.
+ */
+
+struct OBJCornerHash {
+	size_t operator () (const OBJCorner &c) const {
+		uint64_t h = (uint64_t)c.v * 0x9E3779B97F4A7C15ULL;
+		h ^= (uint64_t)c.vt * 0xC2B2AE3D27D4EB4FULL + (h << 6) + (h >> 2);
+		h ^= (uint64_t)c.vn * 0x165667B19E3779F9ULL + (h << 6) + (h >> 2);
+		return (size_t)h;
+	}
+};
+
+/**
+ * @struct	OBJReader
+ * @brief	Turns OBJ lines into mesh buffers. OBJ indexes positions, texture
+ * 			coordinates and normals separately; each distinct combination
+ * 			becomes one mesh vertex. Faces with more than three corners are
+ * 			split into a fan.
+ */
+
+struct OBJReader {
+	ITriangleMesh &mesh;						//!< The mesh being filled.
+	const string &source;						//!< Name used in error messages.
+	size_t line;								//!< Current line number.
+	vector<glm::vec3> positions;				//!< "v" lines.
+	vector<glm::vec3> objNormals;				//!< "vn" lines.
+	vector<glm::vec2> objTexCoords;				//!< "vt" lines.
+	vector<uint32_t> positionOnly;				//!< Mesh vertex for a bare position index.
+	std::unordered_map<OBJCorner, uint32_t, OBJCornerHash> corners;	//!< Mesh vertex for other corners.
+	bool anyNormals, anyTexCoords;				//!< Whether any corner used them.
+	vector<uint32_t> face;						//!< Corners of the current face.
+
+	OBJReader(ITriangleMesh &theMesh, const string &sourceName)
+		: mesh(theMesh), source(sourceName), line(0), anyNormals(false), anyTexCoords(false) {}
+
+	bool error(const string &message) {
+		std::cerr << source << ":" << line << ": " << message << endl;
+		return false;
+	}
+
+	static void skipSpace(char *&p) {
+		while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+	}
+
+	bool numbers(char *p, float *values, int count, int required) {
+		for (int i = 0; i < count; i++) {
+			char *stop;
+			double d = strtod(p, &stop);
+			if (stop == p) {
+				if (i >= required) {
+					values[i] = 0.0f;
+					continue;
+				}
+				return error("bad number");
+			}
+			values[i] = (float)d;
+			p = stop;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief	Reads one index of a corner, making it zero based.
+	 * @return	False if it is missing or out of range.
+	 */
+	bool index(char *&p, size_t count, int64_t &result) {
+		char *stop;
+		long long i = strtoll(p, &stop, 10);
+		if (stop == p) return false;
+		p = stop;
+		result = i > 0 ? i - 1 : (int64_t)count + i;		// negative indices are relative
+		return i != 0 && result >= 0 && (size_t)result < count;
+	}
+
+	bool corner(char *&p, uint32_t &vertex) {
+		OBJCorner c = { -1, -1, -1 };
+		if (!index(p, positions.size(), c.v)) return error("bad vertex index");
+		if (*p == '/') {
+			p++;
+			if (*p != '/' && !index(p, objTexCoords.size(), c.vt)) return error("bad texture index");
+			if (*p == '/') {
+				p++;
+				if (!index(p, objNormals.size(), c.vn)) return error("bad normal index");
+			}
+		}
+		if (c.vt < 0 && c.vn < 0) {
+			if (positionOnly.size() < positions.size()) {
+				positionOnly.resize(positions.size(), UINT32_MAX);
+			}
+			uint32_t &slot = positionOnly[c.v];
+			if (slot == UINT32_MAX) {
+				slot = addVertex(c);
+			}
+			vertex = slot;
+		} else {
+			auto found = corners.find(c);
+			if (found == corners.end()) {
+				found = corners.insert(std::make_pair(c, addVertex(c))).first;
+			}
+			vertex = found->second;
+		}
+		return true;
+	}
+
+	uint32_t addVertex(const OBJCorner &c) {
+		mesh.vertices.push_back(positions[c.v]);
+		mesh.normals.push_back(c.vn >= 0 ? objNormals[c.vn] : glm::vec3(0.0f, 0.0f, 0.0f));
+		mesh.texCoords.push_back(c.vt >= 0 ? objTexCoords[c.vt] : glm::vec2(0.0f, 0.0f));
+		anyNormals = anyNormals || c.vn >= 0;
+		anyTexCoords = anyTexCoords || c.vt >= 0;
+		return (uint32_t)(mesh.vertices.size() - 1);
+	}
+
+	/**
+	 * @brief	Handles one line. The line is NUL terminated and may be changed.
+	 * @return	False on error.
+	 */
+	bool parseLine(char *p) {
+		line++;
+		skipSpace(p);
+		if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+			float xyz[3];
+			if (!numbers(p + 2, xyz, 3, 3)) return false;
+			positions.push_back(glm::vec3(xyz[0], xyz[1], xyz[2]));
+		} else if (p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+			float xyz[3];
+			if (!numbers(p + 3, xyz, 3, 3)) return false;
+			objNormals.push_back(glm::vec3(xyz[0], xyz[1], xyz[2]));
+		} else if (p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) {
+			float uv[2];
+			if (!numbers(p + 3, uv, 2, 1)) return false;
+			objTexCoords.push_back(glm::vec2(uv[0], uv[1]));
+		} else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			p++;
+			face.clear();
+			for (skipSpace(p); *p != '\0'; skipSpace(p)) {
+				uint32_t vertex;
+				if (!corner(p, vertex)) return false;
+				face.push_back(vertex);
+			}
+			if (face.size() < 3) return error("face with fewer than 3 corners");
+			for (size_t i = 1; i + 1 < face.size(); i++) {
+				mesh.indices.push_back(face[0]);
+				mesh.indices.push_back(face[i]);
+				mesh.indices.push_back(face[i + 1]);
+			}
+		}
+		// Everything else (comments, groups, materials, smoothing) is ignored.
+		return true;
+	}
+};
+
+/**
+ * @fn	bool ITriangleMesh::loadOBJ(const string &fileName)
+ * @brief	Replaces the mesh with the triangles of a Wavefront OBJ file and
+ * 			builds the index. The file is read in large chunks and parsed as it
+ * 			arrives, so only the mesh itself has to fit in memory.
+ * @param	fileName	Name of the file.
+ * @return	True if successful. Errors are reported on cerr.
+ */
+
+bool ITriangleMesh::loadOBJ(const string &fileName) {
+	vertices.clear();
+	normals.clear();
+	texCoords.clear();
+	indices.clear();
+
+	FILE *fp = fopen(fileName.c_str(), "rb");
+	if (fp == nullptr) {
+		std::cerr << "Unable to open mesh: " << fileName << endl;
+		return false;
+	}
+
+	OBJReader reader(*this, fileName);
+	vector<char> buffer(1 << 20);
+	size_t have = 0;
+	bool ok = true, atEnd = false;
+	while (ok && !atEnd) {
+		if (have == buffer.size() - 1) {
+			buffer.resize(buffer.size() * 2);		// a line longer than the buffer
+		}
+		size_t got = fread(buffer.data() + have, 1, buffer.size() - 1 - have, fp);
+		atEnd = got == 0;
+		have += got;
+		char *start = buffer.data();
+		char *end = start + have;
+		while (ok) {
+			char *nl = (char *)memchr(start, '\n', end - start);
+			if (nl == nullptr) {
+				if (atEnd && start < end) {
+					*end = '\0';
+					ok = reader.parseLine(start);
+					start = end;
+				}
+				break;
+			}
+			*nl = '\0';
+			ok = reader.parseLine(start);
+			start = nl + 1;
+		}
+		have = end - start;
+		memmove(buffer.data(), start, have);
+	}
+	fclose(fp);
+
+	if (!reader.anyNormals) normals.clear();
+	if (!reader.anyTexCoords) texCoords.clear();
+	if (ok) {
+		buildIndex();
+	}
+	return ok;
+}
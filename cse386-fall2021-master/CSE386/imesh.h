@@ -0,0 +1,76 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "defs.h"
+#include "bvh.h"
+#include "eshape.h"
+#include "ishape.h"
+
+/**
+ * @struct	ITriangleMesh
+ * @brief	An indexed triangle mesh. Vertex attributes are stored in single
+ * 			precision to keep large meshes compact; intersections are computed
+ * 			in RayReal precision. The triangles are indexed by a BVH of their
+ * 			own, so one mesh is one object to the scene.
+ *
+ * 			After filling the buffers directly, call buildIndex() before
+ * 			tracing. loadOBJ() does both.
+ */
+
+struct ITriangleMesh final : public IShape {
+	vector<glm::vec3> vertices;		//!< Vertex positions.
+	vector<glm::vec3> normals;		//!< Per vertex normals, or empty for flat shading.
+	vector<glm::vec2> texCoords;	//!< Per vertex (u, v), or empty.
+	vector<uint32_t> indices;		//!< Three vertex indices per triangle, counter-clockwise.
+
+	ITriangleMesh();
+	bool loadOBJ(const string &fileName);
+	void buildIndex();
+	size_t numTriangles() const { return indices.size() / 3; }
+	BoundingBox getBounds() const;
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual void getTexCoords(const dvec3 &pt, double &u, double &v) const;
+protected:
+	SceneBVH bvh;					//!< Index over the triangles.
+	BoundingBox bounds;				//!< Bounds of all the vertices.
+};
+
+/**
+ * @struct	IEShape
+ * @brief	Lets the ray tracer use the triangles of an EShapeData -- the same
+ * 			vertices the rasterizer draws -- without copying them. The only
+ * 			thing built is a BVH over the triangles, once; the vertex data is
+ * 			read in place, so it must outlive this object and buildIndex()
+ * 			must be called again if it changes.
+ *
+ * 			The modeling matrix plays the same role as the one passed to
+ * 			VertexOps::render: rays are taken into object coordinates rather
+ * 			than the vertices into world coordinates. Each triangle's material
+ * 			is that of its first vertex.
+ */
+
+struct IEShape final : public IShape {
+	IEShape(const EShapeData &triangles, const dmat4 &modelingMatrix = dmat4(1.0));
+	void setModelingMatrix(const dmat4 &modelingMatrix);
+	void buildIndex();
+	size_t numTriangles() const { return data->size() / 3; }
+	BoundingBox getBounds() const;
+	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	virtual bool hasOwnMaterials() const;
+protected:
+	const EShapeData *data;			//!< The triangles, three vertices each.
+	dmat4 modelMatrix;				//!< Object to world.
+	dmat4 inverseModelMatrix;		//!< World to object.
+	dmat3 normalMatrix;				//!< Object to world, for normals.
+	SceneBVH bvh;					//!< Index over the triangles, in object coordinates.
+	BoundingBox objectBounds;		//!< Bounds in object coordinates.
+};
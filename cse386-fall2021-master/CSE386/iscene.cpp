@@ -17,6 +17,7 @@
 
 IScene::IScene(RaytracingCamera *theCamera) {
 	camera = theCamera;
+	opaqueIndex = nullptr;
 }
 
 /**
@@ -27,6 +28,7 @@ IScene::IScene(RaytracingCamera *theCamera) {
 
 void IScene::addOpaqueObject(const VisibleIShapePtr obj) {
 	opaqueObjs.push_back(obj);
+	opaqueGroups.add(*obj);
 }
 
 /**
@@ -39,6 +41,7 @@ void IScene::addOpaqueObject(const VisibleIShapePtr obj) {
 void IScene::addTransparentObject(const VisibleIShapePtr obj, double alpha) {
 	obj->material.alpha = alpha;
 	transparentObjs.push_back(obj);
+	transparentGroups.add(*obj);
 }
 
 /**
@@ -50,3 +53,57 @@ void IScene::addTransparentObject(const VisibleIShapePtr obj, double alpha) {
 void IScene::addLight(const PositionalLightPtr light) {
 	lights.push_back(light);
 }
+
+/**
+ * @fn	void IScene::findOpaqueIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds the closest opaque object along a ray, using the index if there is one.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The closest hit.
+ */
+
+void IScene::findOpaqueIntersection(const Ray &ray, HitRecord &hit) const {
+	if (opaqueIndex != nullptr) {
+		opaqueIndex->findIntersection(ray, opaqueObjs, hit);
+	} else {
+		opaqueGroups.findIntersection(ray, opaqueObjs, hit);
+	}
+}
+
+/**
+ * @fn	void IScene::findTransparentIntersection(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds the closest transparent object along a ray.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The closest hit.
+ */
+
+void IScene::findTransparentIntersection(const Ray &ray, HitRecord &hit) const {
+	transparentGroups.findIntersection(ray, transparentObjs, hit);
+}
+
+/**
+ * @fn	bool IScene::anyOpaqueIntersection(const Ray &ray, double tMax) const
+ * @brief	Determines if an opaque object is hit nearer than tMax, using the
+ * 			index if there is one.
+ * @param	ray 	The ray.
+ * @param	tMax	Hits at or beyond this distance do not count.
+ * @return	True if there is such a hit.
+ */
+
+bool IScene::anyOpaqueIntersection(const Ray &ray, double tMax) const {
+	if (opaqueIndex != nullptr) {
+		return opaqueIndex->anyIntersection(ray, opaqueObjs, tMax);
+	}
+	return opaqueGroups.anyIntersection(ray, opaqueObjs, tMax);
+}
+
+/**
+ * @fn	bool IScene::anyTransparentIntersection(const Ray &ray, double tMax) const
+ * @brief	Determines if a transparent object is hit nearer than tMax.
+ * @param	ray 	The ray.
+ * @param	tMax	Hits at or beyond this distance do not count.
+ * @return	True if there is such a hit.
+ */
+
+bool IScene::anyTransparentIntersection(const Ray &ray, double tMax) const {
+	return transparentGroups.anyIntersection(ray, transparentObjs, tMax);
+}
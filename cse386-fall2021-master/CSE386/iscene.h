@@ -16,6 +16,7 @@
 #include "light.h"
 #include "eshape.h"
 #include "ishape.h"
+#include "bvh.h"
 
 /**
  * @struct	IScene
@@ -27,8 +28,15 @@ struct IScene {
 	vector<VisibleIShapePtr> opaqueObjs;			//!< All the visible objects in the scene
 	vector<VisibleIShapePtr> transparentObjs;		//!< All the transparent objects in the scene
 	RaytracingCamera *camera;						//!< The one camera in the scene
+	const SceneBVH *opaqueIndex;					//!< Optional index over opaqueObjs. Must be rebuilt if they change.
+	ShapeGroups opaqueGroups;						//!< opaqueObjs grouped by kind of shape.
+	ShapeGroups transparentGroups;					//!< transparentObjs grouped by kind of shape.
 	IScene(RaytracingCamera *theCamera);
 	void addOpaqueObject(const VisibleIShapePtr obj);
 	void addTransparentObject(const VisibleIShapePtr obj, double alpha);
 	void addLight(const PositionalLightPtr light);
+	void findOpaqueIntersection(const Ray &ray, HitRecord &hit) const;
+	void findTransparentIntersection(const Ray &ray, HitRecord &hit) const;
+	bool anyOpaqueIntersection(const Ray &ray, double tMax) const;
+	bool anyTransparentIntersection(const Ray &ray, double tMax) const;
 };
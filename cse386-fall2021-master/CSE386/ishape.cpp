@@ -7,16 +7,42 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
 #include <vector>
 #include "ishape.h"
+#include "imesh.h"
 #include "io.h"
 
+/**
+ * @fn	template <class Visitor> static void visitShape(const IShape &shape, Visitor visit)
+ * @brief	Calls visit with the shape as its own final class, so that calls
+ * 			made on it are direct and can be inlined. Shapes of unknown kind
+ * 			are passed as IShape.
+ */
+
+template <class Visitor>
+static void visitShape(const IShape &shape, Visitor visit) {
+	switch (shape.kind) {
+	case IShapeKind::PLANE:				visit(static_cast<const IPlane &>(shape)); break;
+	case IShapeKind::DISK:				visit(static_cast<const IDisk &>(shape)); break;
+	case IShapeKind::SPHERE:			visit(static_cast<const ISphere &>(shape)); break;
+	case IShapeKind::ELLIPSOID:			visit(static_cast<const IEllipsoid &>(shape)); break;
+	case IShapeKind::CYLINDER_Y:		visit(static_cast<const ICylinderY &>(shape)); break;
+	case IShapeKind::CLOSED_CYLINDER_Y:	visit(static_cast<const IClosedCylinderY &>(shape)); break;
+	case IShapeKind::CYLINDER_Z:		visit(static_cast<const ICylinderZ &>(shape)); break;
+	case IShapeKind::CONE_Y:			visit(static_cast<const IConeY &>(shape)); break;
+	case IShapeKind::TRIANGLE_MESH:		visit(static_cast<const ITriangleMesh &>(shape)); break;
+	case IShapeKind::EMESH:				visit(static_cast<const IEShape &>(shape)); break;
+	default:							visit(shape); break;
+	}
+}
+
 /**
  * @fn	IShape::IShape()
  * @brief	Constructs a default IShape, centered at the origin.
  */
 
-IShape::IShape() {
+IShape::IShape() : kind(IShapeKind::OTHER) {
 }
 
 /**
@@ -33,16 +59,114 @@ void IShape::getTexCoords(const dvec3 &pt, double &u, double &v) const {
 }
 
 /**
- * @fn	dvec3 IShape::movePointOffSurface(const dvec3 &pt, const dvec3 &n)
- * @brief	Compute point that is slightly off surface.
- * @param	pt	Intersection point.
- * @param	n 	Normal vector at pt.
- * @return	The point that is approximately EPSILON off the surface.
+ * @fn	bool IShape::hasOwnMaterials() const
+ * @brief	Whether the shape sets hit.material itself (e.g., a mesh with a
+ * 			material per triangle). Otherwise the VisibleIShape's material is used.
+ * @return	False by default.
  */
 
-dvec3 IShape::movePointOffSurface(const dvec3 &pt, const dvec3 &n) {
-	/* CSE 386 - todo  */
-	return pt + n * EPSILON;
+bool IShape::hasOwnMaterials() const {
+	return false;
+}
+
+/**
+ * @fn	dvec3 IShape::movePointOffSurface(const HitRecord &hit, const dvec3 &dir)
+ * @brief	Computes the origin of a ray leaving a surface (a shadow feeler or
+ * 			reflected ray), such that the ray cannot hit the surface it leaves.
+ * 			The intercept is moved along the normal, to the side dir points
+ * 			to, just far enough to clear the box of points hit.pError says it
+ * 			might really be, and then rounded away from the surface. This
+ * 			scales with the scene, unlike a fixed offset.
+ * @param	hit	The hit the ray leaves from.
+ * @param	dir	Direction of the new ray.
+ * @return	The point the new ray should start at.
+ */
+
+dvec3 IShape::movePointOffSurface(const HitRecord &hit, const dvec3 &dir) {
+	double d = glm::dot(glm::abs(hit.normal), hit.pError);
+	dvec3 offset = d * hit.normal;
+	if (glm::dot(dir, hit.normal) < 0) {
+		offset = -offset;
+	}
+	dvec3 pt = hit.interceptPt + offset;
+	for (int i = 0; i < 3; i++) {
+		if (offset[i] > 0) {
+			pt[i] = std::nextafter(pt[i], DBL_MAX);
+		} else if (offset[i] < 0) {
+			pt[i] = std::nextafter(pt[i], -DBL_MAX);
+		}
+	}
+	return pt;
+}
+
+/**
+ * @fn	void RayDifferential::scaleDifferentials(const Ray &ray, double s)
+ * @brief	Moves the offset rays toward the main ray, so they describe a
+ * 			footprint s times as wide; used when a pixel takes several samples.
+ * @param	ray	The main ray.
+ * @param	s  	The scale.
+ */
+
+void RayDifferential::scaleDifferentials(const Ray &ray, double s) {
+	rxOrigin = ray.origin + (rxOrigin - ray.origin) * s;
+	ryOrigin = ray.origin + (ryOrigin - ray.origin) * s;
+	rxDirection = ray.dir + (rxDirection - ray.dir) * s;
+	ryDirection = ray.dir + (ryDirection - ray.dir) * s;
+}
+
+/**
+ * @fn	bool RayDifferential::footprint(const HitRecord &hit, dvec3 &dpdx, dvec3 &dpdy) const
+ * @brief	Finds where the offset rays meet the plane tangent to the hit, as
+ * 			offsets from the intercept.
+ * @param 		  	hit 	The main ray's hit.
+ * @param [in,out]	dpdx	Change in the point for a step of one pixel right.
+ * @param [in,out]	dpdy	Change in the point for a step of one pixel up.
+ * @return	False if there are no differentials or an offset ray runs
+ * 			parallel to the plane.
+ */
+
+bool RayDifferential::footprint(const HitRecord &hit, dvec3 &dpdx, dvec3 &dpdy) const {
+	if (!hasDifferentials) {
+		return false;
+	}
+	const dvec3 &n = hit.normal;
+	double d = glm::dot(n, hit.interceptPt);
+	double nx = glm::dot(n, rxDirection);
+	double ny = glm::dot(n, ryDirection);
+	if (nx == 0 || ny == 0) {
+		return false;
+	}
+	double tx = (d - glm::dot(n, rxOrigin)) / nx;
+	double ty = (d - glm::dot(n, ryOrigin)) / ny;
+	dpdx = rxOrigin + tx * rxDirection - hit.interceptPt;
+	dpdy = ryOrigin + ty * ryDirection - hit.interceptPt;
+	return true;
+}
+
+/**
+ * @fn	RayDifferential RayDifferential::reflected(const HitRecord &hit, const dvec3 &origin) const
+ * @brief	The differentials of the ray reflected at hit. The offset rays
+ * 			start where they met the tangent plane and are mirrored about the
+ * 			same normal. The surface is treated as flat across the footprint,
+ * 			since the shapes do not supply normal derivatives.
+ * @param	hit   	The hit being reflected from.
+ * @param	origin	Origin of the reflected main ray.
+ * @return	The reflected differentials, or none if the footprint is unknown.
+ */
+
+RayDifferential RayDifferential::reflected(const HitRecord &hit, const dvec3 &origin) const {
+	RayDifferential result;
+	dvec3 dpdx, dpdy;
+	if (!footprint(hit, dpdx, dpdy)) {
+		return result;
+	}
+	const dvec3 &n = hit.normal;
+	result.hasDifferentials = true;
+	result.rxOrigin = origin + dpdx;
+	result.ryOrigin = origin + dpdy;
+	result.rxDirection = rxDirection - 2 * glm::dot(rxDirection, n) * n;
+	result.ryDirection = ryDirection - 2 * glm::dot(ryDirection, n) * n;
+	return result;
 }
 
 /**
@@ -69,13 +193,41 @@ void VisibleIShape::findClosestIntersection(const Ray &ray, HitRecord &hit) cons
 	if (DEBUG_PIXEL) {
 		cout << "";
 	}
-	shape->findClosestIntersection(ray, hit);
+	intersect(ray, hit);
 	if (hit.t != FLT_MAX) {
-		hit.material = material;
+		finishHit(hit);
+	}
+}
+
+/**
+ * @fn	void VisibleIShape::intersect(const Ray &ray, HitRecord &hit) const
+ * @brief	Finds where the ray first hits the shape, without the surface
+ * 			details: those only matter for the closest of several hits, so
+ * 			callers searching many shapes call finishHit on that one.
+ * @param 		  	ray	The ray.
+ * @param [in,out]	hit	The hit.
+ */
+
+void VisibleIShape::intersect(const Ray &ray, HitRecord &hit) const {
+	visitShape(*shape, [&](const auto &s) { s.findClosestIntersection(ray, hit); });
+}
+
+/**
+ * @fn	void VisibleIShape::finishHit(HitRecord &hit) const
+ * @brief	Fills in this shape's material, texture and texture coordinates.
+ * @param [in,out]	hit	A hit on this shape, from intersect.
+ */
+
+void VisibleIShape::finishHit(HitRecord &hit) const {
+	visitShape(*shape, [&](const auto &s) {
+		if (!s.hasOwnMaterials()) {
+			hit.material = material;
+		}
 		hit.texture = texture;
+		hit.shape = &s;
 		if (hit.texture != nullptr)
-			shape->getTexCoords(hit.interceptPt, hit.u, hit.v);
-	}
+			s.getTexCoords(hit.interceptPt, hit.u, hit.v);
+	});
 }
 
 /**
@@ -90,15 +242,233 @@ void VisibleIShape::findIntersection(const Ray &ray, const vector<VisibleIShapeP
 											HitRecord &theHit) {
 	
 	theHit.t = FLT_MAX;
+	const VisibleIShape *closest = nullptr;
 
 	for (unsigned int i = 0; i < surfaces.size(); i++) {
 		HitRecord thisHit;
 		VisibleIShape& thisShape = *surfaces[i];
-		thisShape.findClosestIntersection(ray, thisHit);
+		thisShape.intersect(ray, thisHit);
 		if (thisHit.t < theHit.t) {
 			theHit = thisHit;
+			closest = &thisShape;
 		}
 	}
+	if (closest != nullptr) {
+		closest->finishHit(theHit);
+	}
+}
+
+/**
+ * @fn	bool VisibleIShape::anyIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, double tMax)
+ * @brief	Determines if any of the surfaces is hit nearer than tMax, stopping
+ * 			at the first hit found.
+ * @param	ray			The ray.
+ * @param	surfaces	The surfaces in the scene.
+ * @param	tMax		Hits at or beyond this distance do not count.
+ * @return	True if there is such a hit.
+ */
+
+bool VisibleIShape::anyIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, double tMax) {
+	for (unsigned int i = 0; i < surfaces.size(); i++) {
+		HitRecord thisHit;
+		surfaces[i]->intersect(ray, thisHit);
+		if (thisHit.t < tMax) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	void ShapeGroups::clear()
+ * @brief	Empties the groups.
+ */
+
+void ShapeGroups::clear() {
+	for (int k = 0; k < NUM_ISHAPE_KINDS; k++) {
+		members[k].clear();
+	}
+	size = 0;
+}
+
+/**
+ * @fn	void ShapeGroups::add(const VisibleIShape &obj)
+ * @brief	Adds the next shape of the list.
+ * @param	obj	The shape, which is at index size in the list.
+ */
+
+void ShapeGroups::add(const VisibleIShape &obj) {
+	members[(int)obj.shape->kind].push_back((uint32_t)size);
+	size++;
+}
+
+/**
+ * @fn	template <class S> static void intersectGroup(const vector<uint32_t> &group, const vector<VisibleIShapePtr> &surfaces, const Ray &ray, HitRecord &theHit, uint32_t &closest)
+ * @brief	Intersects the ray with shapes that are all of class S, keeping the
+ * 			closest hit. Equally close hits go to the shape earliest in the
+ * 			list, as they do when the list is searched in order.
+ */
+
+template <class S>
+static void intersectGroup(const vector<uint32_t> &group, const vector<VisibleIShapePtr> &surfaces,
+							const Ray &ray, HitRecord &theHit, uint32_t &closest) {
+	for (uint32_t i : group) {
+		HitRecord thisHit;
+		static_cast<const S *>(surfaces[i]->shape)->findClosestIntersection(ray, thisHit);
+		if (thisHit.t < theHit.t || (thisHit.t == theHit.t && thisHit.t != FLT_MAX && i < closest)) {
+			theHit = thisHit;
+			closest = i;
+		}
+	}
+}
+
+/**
+ * @fn	template <class S> static void intersectQuadricGroup(const vector<uint32_t> &group, const vector<VisibleIShapePtr> &surfaces, const Ray &ray, HitRecord &theHit, uint32_t &closest)
+ * @brief	Same as intersectGroup, for quadrics that use
+ * 			IQuadricSurface::findClosestIntersection as is. The coefficients
+ * 			of a block of shapes are computed first and their quadratics
+ * 			solved together; the point and normal are only computed for the
+ * 			closest.
+ */
+
+template <class S>
+static void intersectQuadricGroup(const vector<uint32_t> &group, const vector<VisibleIShapePtr> &surfaces,
+									const Ray &ray, HitRecord &theHit, uint32_t &closest) {
+	const size_t BLOCK = 64;
+	double Aq[BLOCK], Bq[BLOCK], Cq[BLOCK], lo[BLOCK], hi[BLOCK];
+	double bestT = FLT_MAX;
+	uint32_t best = UINT32_MAX;
+	for (size_t first = 0; first < group.size(); first += BLOCK) {
+		size_t n = std::min(BLOCK, group.size() - first);
+		for (size_t j = 0; j < n; j++) {
+			const S *shape = static_cast<const S *>(surfaces[group[first + j]]->shape);
+			shape->computeAqBqCq(ray, Aq[j], Bq[j], Cq[j]);
+		}
+		quadratic(n, Aq, Bq, Cq, lo, hi);
+		for (size_t j = 0; j < n; j++) {
+			double t = lo[j] > ray.tMin ? lo[j] : hi[j];
+			if (t > ray.tMin && t < bestT) {
+				bestT = t;
+				best = group[first + j];
+			}
+		}
+	}
+	if (best != UINT32_MAX &&
+		(bestT < theHit.t || (bestT == theHit.t && best < closest))) {
+		const S *shape = static_cast<const S *>(surfaces[best]->shape);
+		theHit = HitRecord();
+		shape->setHit(ray, bestT, theHit);
+		closest = best;
+	}
+}
+
+/**
+ * @fn	void ShapeGroups::findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, HitRecord &theHit) const
+ * @brief	Same result as VisibleIShape::findIntersection over the list the
+ * 			groups were built from, which it falls back to if the list has
+ * 			changed size since.
+ * @param	ray			The ray.
+ * @param	surfaces	The list.
+ * @param	theHit  	The closest intersection.
+ */
+
+void ShapeGroups::findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces,
+									HitRecord &theHit) const {
+	if (size != surfaces.size()) {
+		VisibleIShape::findIntersection(ray, surfaces, theHit);
+		return;
+	}
+	theHit.t = FLT_MAX;
+	uint32_t closest = UINT32_MAX;
+	intersectGroup<IPlane>(members[(int)IShapeKind::PLANE], surfaces, ray, theHit, closest);
+	intersectGroup<IDisk>(members[(int)IShapeKind::DISK], surfaces, ray, theHit, closest);
+	intersectQuadricGroup<ISphere>(members[(int)IShapeKind::SPHERE], surfaces, ray, theHit, closest);
+	intersectQuadricGroup<IEllipsoid>(members[(int)IShapeKind::ELLIPSOID], surfaces, ray, theHit, closest);
+	intersectGroup<ICylinderY>(members[(int)IShapeKind::CYLINDER_Y], surfaces, ray, theHit, closest);
+	intersectGroup<IClosedCylinderY>(members[(int)IShapeKind::CLOSED_CYLINDER_Y], surfaces, ray, theHit, closest);
+	intersectGroup<ICylinderZ>(members[(int)IShapeKind::CYLINDER_Z], surfaces, ray, theHit, closest);
+	intersectGroup<IConeY>(members[(int)IShapeKind::CONE_Y], surfaces, ray, theHit, closest);
+	intersectGroup<ITriangleMesh>(members[(int)IShapeKind::TRIANGLE_MESH], surfaces, ray, theHit, closest);
+	intersectGroup<IEShape>(members[(int)IShapeKind::EMESH], surfaces, ray, theHit, closest);
+	intersectGroup<IShape>(members[(int)IShapeKind::OTHER], surfaces, ray, theHit, closest);
+	if (closest != UINT32_MAX) {
+		surfaces[closest]->finishHit(theHit);
+	}
+}
+
+/**
+ * @fn	template <class S> static bool anyInGroup(const vector<uint32_t> &group, const vector<VisibleIShapePtr> &surfaces, const Ray &ray, double tMax)
+ * @brief	Determines if any of the shapes, which are all of class S, is hit
+ * 			nearer than tMax.
+ */
+
+template <class S>
+static bool anyInGroup(const vector<uint32_t> &group, const vector<VisibleIShapePtr> &surfaces,
+						const Ray &ray, double tMax) {
+	for (uint32_t i : group) {
+		HitRecord thisHit;
+		static_cast<const S *>(surfaces[i]->shape)->findClosestIntersection(ray, thisHit);
+		if (thisHit.t < tMax) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	template <class S> static bool anyInQuadricGroup(const vector<uint32_t> &group, const vector<VisibleIShapePtr> &surfaces, const Ray &ray, double tMax)
+ * @brief	Same as anyInGroup, for the quadrics intersectQuadricGroup handles.
+ * 			Solves a block of them at a time and never computes a hit point.
+ */
+
+template <class S>
+static bool anyInQuadricGroup(const vector<uint32_t> &group, const vector<VisibleIShapePtr> &surfaces,
+								const Ray &ray, double tMax) {
+	const size_t BLOCK = 64;
+	double Aq[BLOCK], Bq[BLOCK], Cq[BLOCK], lo[BLOCK], hi[BLOCK];
+	for (size_t first = 0; first < group.size(); first += BLOCK) {
+		size_t n = std::min(BLOCK, group.size() - first);
+		for (size_t j = 0; j < n; j++) {
+			const S *shape = static_cast<const S *>(surfaces[group[first + j]]->shape);
+			shape->computeAqBqCq(ray, Aq[j], Bq[j], Cq[j]);
+		}
+		quadratic(n, Aq, Bq, Cq, lo, hi);
+		for (size_t j = 0; j < n; j++) {
+			double t = lo[j] > ray.tMin ? lo[j] : hi[j];
+			if (t > ray.tMin && t < tMax) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * @fn	bool ShapeGroups::anyIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, double tMax) const
+ * @brief	Same result as VisibleIShape::anyIntersection over the list the
+ * 			groups were built from, which it falls back to if the list has
+ * 			changed size since.
+ * @param	ray			The ray.
+ * @param	surfaces	The list.
+ * @param	tMax		Hits at or beyond this distance do not count.
+ * @return	True if there is such a hit.
+ */
+
+bool ShapeGroups::anyIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, double tMax) const {
+	if (size != surfaces.size()) {
+		return VisibleIShape::anyIntersection(ray, surfaces, tMax);
+	}
+	return anyInGroup<IPlane>(members[(int)IShapeKind::PLANE], surfaces, ray, tMax) ||
+		anyInGroup<IDisk>(members[(int)IShapeKind::DISK], surfaces, ray, tMax) ||
+		anyInQuadricGroup<ISphere>(members[(int)IShapeKind::SPHERE], surfaces, ray, tMax) ||
+		anyInQuadricGroup<IEllipsoid>(members[(int)IShapeKind::ELLIPSOID], surfaces, ray, tMax) ||
+		anyInGroup<ICylinderY>(members[(int)IShapeKind::CYLINDER_Y], surfaces, ray, tMax) ||
+		anyInGroup<IClosedCylinderY>(members[(int)IShapeKind::CLOSED_CYLINDER_Y], surfaces, ray, tMax) ||
+		anyInGroup<ICylinderZ>(members[(int)IShapeKind::CYLINDER_Z], surfaces, ray, tMax) ||
+		anyInGroup<IConeY>(members[(int)IShapeKind::CONE_Y], surfaces, ray, tMax) ||
+		anyInGroup<ITriangleMesh>(members[(int)IShapeKind::TRIANGLE_MESH], surfaces, ray, tMax) ||
+		anyInGroup<IEShape>(members[(int)IShapeKind::EMESH], surfaces, ray, tMax) ||
+		anyInGroup<IShape>(members[(int)IShapeKind::OTHER], surfaces, ray, tMax);
 }
 
 /**
@@ -109,6 +479,7 @@ void VisibleIShape::findIntersection(const Ray &ray, const vector<VisibleIShapeP
 
 IDisk::IDisk()
 	: IShape(), center(ORIGIN3D), n(Y_AXIS), radius(1.0) {
+	kind = IShapeKind::DISK;
 }
 
 /**
@@ -121,6 +492,7 @@ IDisk::IDisk()
 
 IDisk::IDisk(const dvec3 &pos, const dvec3 &normal, double rad)
 	: IShape(), center(pos), n(normal), radius(rad) {
+	kind = IShapeKind::DISK;
 }
 
 /**
@@ -165,6 +537,7 @@ void IDisk::getTexCoords(const dvec3& pt, double& u, double& v) const {
 
 ISphere::ISphere(const dvec3 &position, double radius)
 	: IQuadricSurface(QuadricParameters::sphereQParams(radius), position) {
+	kind = IShapeKind::SPHERE;
 }
 
 /**
@@ -185,30 +558,31 @@ void ISphere::getTexCoords(const dvec3 &pt, double &u, double &v) const {
 }
 
 /**
- * @fn	QuadricParameters::QuadricParameters()
+ * @fn	QuadricParametersT<T>::QuadricParametersT()
  * @brief	Default constructor
  */
 
-QuadricParameters::QuadricParameters()
-	: QuadricParameters(vector<double> {1, 1, 1, 0, 0, 0, 0, 0, 0, -1}) {
+template <class T>
+QuadricParametersT<T>::QuadricParametersT()
+	: QuadricParametersT(vector<double> {1, 1, 1, 0, 0, 0, 0, 0, 0, -1}) {
 }
 
 /**
- * @fn	QuadricParameters::QuadricParameters(const vector<double> &items)
+ * @fn	QuadricParametersT<T>::QuadricParametersT(const vector<double> &items)
  * @brief	Constructor using 10 values.
  * @param	items	The items.
  */
 
-QuadricParameters::QuadricParameters(const vector<double> &items)
-			: A(items[0]), B(items[1]), C(items[2]), D(items[3]),
-				E(items[4]), F(items[5]), G(items[6]), H(items[7]),
-				I(items[8]), J(items[9]) {
+template <class T>
+QuadricParametersT<T>::QuadricParametersT(const vector<double> &items)
+			: A((T)items[0]), B((T)items[1]), C((T)items[2]), D((T)items[3]),
+				E((T)items[4]), F((T)items[5]), G((T)items[6]), H((T)items[7]),
+				I((T)items[8]), J((T)items[9]) {
 }
 
 /**
- * @fn	QuadricParameters::QuadricParameters(double a, double b, double c, double d, 
- *											double e, double , double g, double h, double i, 
- *											double j)
+ * @fn	QuadricParametersT<T>::QuadricParametersT(T a, T b, T c, T d, T e, T f,
+ *											T g, T h, T i, T j)
  * @brief	Constructor
  * @param	a	Quadric parameter A.
  * @param	b	Quadric parameter B.
@@ -222,84 +596,93 @@ QuadricParameters::QuadricParameters(const vector<double> &items)
  * @param	j	Quadric parameter J.
  */
 
-QuadricParameters::QuadricParameters(double a, double b, double c, double d, double e, double f,
-									double g, double h, double i, double j)
-				: QuadricParameters(vector<double> {a, b, c, d, e, f, g, h, i, j}) {
+template <class T>
+QuadricParametersT<T>::QuadricParametersT(T a, T b, T c, T d, T e, T f, T g, T h, T i, T j)
+				: A(a), B(b), C(c), D(d), E(e), F(f), G(g), H(h), I(i), J(j) {
 }
 
 /**
- * @fn	QuadricParameters QuadricParameters::cylinderXQParams(double R)
+ * @fn	QuadricParametersT<T> QuadricParametersT<T>::cylinderXQParams(double R)
  * @brief	Constructs the parameters for a cylinder oriented along the x axis.
  * @param	R	Radius of cylinder.
  * @return	The QuadricParameters.
  */
 
-QuadricParameters QuadricParameters::cylinderXQParams(double R) {
+template <class T>
+QuadricParametersT<T> QuadricParametersT<T>::cylinderXQParams(double R) {
 	double R2 = R * R;
-	return QuadricParameters(0.0, 1.0 / R2, 1.0 / R2, 0, 0, 0, 0, 0, 0, -1);
+	return QuadricParametersT(vector<double> {0.0, 1.0 / R2, 1.0 / R2, 0, 0, 0, 0, 0, 0, -1});
 }
 
 /**
- * @fn	QuadricParameters QuadricParameters::cylinderYQParams(double R)
+ * @fn	QuadricParametersT<T> QuadricParametersT<T>::cylinderYQParams(double R)
  * @brief	Constructs the parameters for a cylinder oriented along the y axis.
  * @param	R	Radius of cylinder.
  * @return	The QuadricParameters.
  */
 
-QuadricParameters QuadricParameters::cylinderYQParams(double R) {
+template <class T>
+QuadricParametersT<T> QuadricParametersT<T>::cylinderYQParams(double R) {
 	double R2 = R * R;
-	return QuadricParameters(1.0 / R2, 0, 1.0 / R2, 0, 0, 0, 0, 0, 0, -1);
+	return QuadricParametersT(vector<double> {1.0 / R2, 0, 1.0 / R2, 0, 0, 0, 0, 0, 0, -1});
 }
 
 /**
- * @fn	QuadricParameters QuadricParameters::cylinderZQParams(double R)
+ * @fn	QuadricParametersT<T> QuadricParametersT<T>::cylinderZQParams(double R)
  * @brief	Constructs the parameters for a cylinder oriented along the z axis.
  * @param	R	Radius of cylinder.
  * @return	The QuadricParameters.
  */
 
-QuadricParameters QuadricParameters::cylinderZQParams(double R) {
+template <class T>
+QuadricParametersT<T> QuadricParametersT<T>::cylinderZQParams(double R) {
 	double R2 = R * R;
-	return QuadricParameters(1.0 / R2, 1.0 / R2, 0, 0, 0, 0, 0, 0, 0, -1);
+	return QuadricParametersT(vector<double> {1.0 / R2, 1.0 / R2, 0, 0, 0, 0, 0, 0, 0, -1});
 }
 
 /**
- * @fn	QuadricParameters QuadricParameters::sphereQParams(double R)
+ * @fn	QuadricParametersT<T> QuadricParametersT<T>::sphereQParams(double R)
  * @brief	Constructs the parameters for a sphere centered on the origin.
  * @param	R	Radius of cylinder.
  * @return	The QuadricParameters.
  */
 
-QuadricParameters QuadricParameters::sphereQParams(double R) {
+template <class T>
+QuadricParametersT<T> QuadricParametersT<T>::sphereQParams(double R) {
 	double R2 = R * R;
-	return QuadricParameters(1, 1, 1, 0, 0, 0, 0, 0, 0, -R2);
+	return QuadricParametersT(vector<double> {1, 1, 1, 0, 0, 0, 0, 0, 0, -R2});
 }
 
 /**
- * @fn	QuadricParameters QuadricParameters::ellipsoidQParams(dvec3 sz)
+ * @fn	QuadricParametersT<T> QuadricParametersT<T>::ellipsoidQParams(dvec3 sz)
  * @brief	Ellipoid parameters
  * @param	sz	Size of ellipsoid.
  * @return	The QuadricParameters.
  */
 
-QuadricParameters QuadricParameters::ellipsoidQParams(const dvec3 &sz) {
+template <class T>
+QuadricParametersT<T> QuadricParametersT<T>::ellipsoidQParams(const dvec3 &sz) {
 	dvec3 size = sz * sz;
-	return QuadricParameters(1.0 / size.x, 1.0 / size.y, 1.0 / size.z,
-							0, 0, 0, 0, 0, 0, -1);
+	return QuadricParametersT(vector<double> {1.0 / size.x, 1.0 / size.y, 1.0 / size.z,
+									0, 0, 0, 0, 0, 0, -1});
 }
 
 /**
- * @fn	QuadricParameters QuadricParameters::cylinderXQParams(double R)
+ * @fn	QuadricParametersT<T> QuadricParametersT<T>::cylinderXQParams(double R)
  * @brief	Constructs the parameters for a cylinder oriented along the x axis.
  * @param	R	Radius of cylinder.
  * @return	The QuadricParameters.
  */
 
-QuadricParameters QuadricParameters::coneYQParams(double R, double H) {
+template <class T>
+QuadricParametersT<T> QuadricParametersT<T>::coneYQParams(double R, double H) {
 	double R2 = R * R / H / H;
-	return QuadricParameters(1.0 / R2, -1.0, 1.0 / R2, 0, 0, 0, 0, 0, 0, 0);
+	return QuadricParametersT(vector<double> {1.0 / R2, -1.0, 1.0 / R2, 0, 0, 0, 0, 0, 0, 0});
 }
 
+template struct QuadricParametersT<float>;
+template struct QuadricParametersT<double>;
+
 /**
  * @fn	IPlane::IPlane(const dvec3 &point, const dvec3 &normal)
  * @brief	Constructor
@@ -309,6 +692,7 @@ QuadricParameters QuadricParameters::coneYQParams(double R, double H) {
 
 IPlane::IPlane(const dvec3 &point, const dvec3 &normal)
 	: IShape(), a(point), n(normalize(normal)) {
+	kind = IShapeKind::PLANE;
 }
 
 /**
@@ -319,6 +703,7 @@ IPlane::IPlane(const dvec3 &point, const dvec3 &normal)
 
 IPlane::IPlane(const vector<dvec3> &vertices)
 				: IShape() {
+	kind = IShapeKind::PLANE;
 	a = vertices[0];
 	n = glm::normalize(glm::cross(vertices[2] - vertices[1], vertices[0] - vertices[1]));
 }
@@ -331,6 +716,7 @@ IPlane::IPlane(const vector<dvec3> &vertices)
 
 IPlane::IPlane()
 	: IShape(), a(ORIGIN3D), n(Z_AXIS) {
+	kind = IShapeKind::PLANE;
 }
 
 /**
@@ -343,6 +729,7 @@ IPlane::IPlane()
 
 IPlane::IPlane(const dvec3 &p0, const dvec3 &p1, const dvec3 &p2)
 				: IShape(), a(p1), n(glm::normalize(glm::cross(p2 - p1, p0 - p1))) {
+	kind = IShapeKind::PLANE;
 }
 
 
@@ -379,12 +766,16 @@ void IPlane::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
 		double num = glm::dot(a - ray.origin, n);
 		double t = num / denom;
 		
-		if (t < 0) {
+		if (t <= ray.tMin) {
 			hit.t = FLT_MAX;
 		} else {
 			hit.t = t;
 			hit.interceptPt = ray.getPoint(t);
 			hit.normal = n;
+			// The rounding in num (gamma(3)), in the division and in getPoint
+			// moves the point by up to gamma(5) (|a| + |origin| + |t dir|).
+			hit.pError = roundingGamma<double>(5) *
+							(glm::abs(a) + glm::abs(ray.origin) + glm::abs(t * ray.dir));
 		}
 	}
 }
@@ -477,7 +868,7 @@ bool equalPlanes(const IPlane& p1, const IPlane& p2) {
  */
 
 IQuadricSurface::IQuadricSurface(const QuadricParameters &params, const dvec3 &position)
-								: IShape(), qParams(params), center(position) {
+								: IShape(), qParams(params), form(params.form()), center(position) {
 	twoA = 2.0 * qParams.A;
 	twoB = 2.0 * qParams.B;
 	twoC = 2.0 * qParams.C;
@@ -515,42 +906,29 @@ IQuadricSurface::IQuadricSurface(const dvec3 &position)
  */
 
 void IQuadricSurface::computeAqBqCq(const Ray &ray, double &Aq, double &Bq, double &Cq) const {
-	dvec3 Ro = ray.origin - center;
-	const dvec3 &Rd = ray.dir;
-	const double &A = qParams.A;
-	const double &B = qParams.B;
-	const double &C = qParams.C;
-	const double &D = qParams.D;
-	const double &E = qParams.E;
-	const double &F = qParams.F;
-	const double &G = qParams.G;
-	const double &H = qParams.H;
-	const double &I = qParams.I;
-	const double &J = qParams.J;
-	Aq = A * (Rd.x*Rd.x) +
-		B * (Rd.y*Rd.y) +
-		C * (Rd.z*Rd.z) +
-		D * (Rd.x * Rd.y) +
-		E * (Rd.x * Rd.z) +
-		F * (Rd.y * Rd.z);
-
-	Bq = twoA * Ro.x*Rd.x +
-		twoB * Ro.y*Rd.y +
-		twoC * Ro.z*Rd.z +
-		D * (Ro.x * Rd.y + Ro.y * Rd.x) +
-		E * (Ro.x * Rd.z + Ro.z * Rd.x) +
-		F * (Ro.y * Rd.z + Ro.z * Rd.y) +
-		G * Rd.x + H * Rd.y + I * Rd.z;
-
-	Cq = A * (Ro.x * Ro.x) +
-		B * (Ro.y * Ro.y) +
-		C * (Ro.z * Ro.z) +
-		D * (Ro.x * Ro.y) +
-		E * (Ro.x * Ro.z) +
-		F * (Ro.y * Ro.z) +
-		G * Ro.x +
-		H * Ro.y +
-		I * Ro.z + J;
+	// Always in double precision: in float, Cq = |Ro|^2 - R^2 for a small,
+	// distant sphere loses most of its digits to cancellation.
+	const dvec3 Ro = ray.origin - center;
+	switch (form) {
+	case QuadricForm::SPHERE:
+		QuadricKernel<QuadricForm::SPHERE, double>::rayCoefficients(qParams, Ro, ray.dir, Aq, Bq, Cq);
+		break;
+	case QuadricForm::CYLINDER_X:
+		QuadricKernel<QuadricForm::CYLINDER_X, double>::rayCoefficients(qParams, Ro, ray.dir, Aq, Bq, Cq);
+		break;
+	case QuadricForm::CYLINDER_Y:
+		QuadricKernel<QuadricForm::CYLINDER_Y, double>::rayCoefficients(qParams, Ro, ray.dir, Aq, Bq, Cq);
+		break;
+	case QuadricForm::CYLINDER_Z:
+		QuadricKernel<QuadricForm::CYLINDER_Z, double>::rayCoefficients(qParams, Ro, ray.dir, Aq, Bq, Cq);
+		break;
+	case QuadricForm::AXIS_ALIGNED:
+		QuadricKernel<QuadricForm::AXIS_ALIGNED, double>::rayCoefficients(qParams, Ro, ray.dir, Aq, Bq, Cq);
+		break;
+	default:
+		qParams.rayCoefficients(Ro, ray.dir, Aq, Bq, Cq);
+		break;
+	}
 }
 
 /**
@@ -571,12 +949,8 @@ int IQuadricSurface::findIntersections(const Ray &ray, HitRecord hits[2]) const
 	int numIntersections = 0;
 
 	for (int i = 0; i < numRoots; i++) {
-		if (roots[i] > 0) {
-			const double &t = roots[i];
-			hits[numIntersections].t = t;
-			hits[numIntersections].interceptPt = ray.origin + t * ray.dir;
-			const dvec3 &intercept = hits[numIntersections].interceptPt;
-			hits[numIntersections].normal = normal(intercept);
+		if (roots[i] > ray.tMin) {
+			setHit(ray, roots[i], hits[numIntersections]);
 			numIntersections++;
 		}
 	}
@@ -584,6 +958,51 @@ int IQuadricSurface::findIntersections(const Ray &ray, HitRecord hits[2]) const
 	return numIntersections;
 }
 
+/**
+ * @fn	void IQuadricSurface::setHit(const Ray &ray, double t, HitRecord &hit) const
+ * @brief	Fills in the hit at t along the ray. The point is moved onto the
+ * 			surface by a Newton step along the gradient, because o + t d is
+ * 			only as accurate as t. For a ray from far away that error grows
+ * 			with the square of the distance. After the step, what is left is
+ * 			rounding in evaluating the quadric near the point. That bound goes
+ * 			in hit.pError.
+ * @param 		  	ray	The ray.
+ * @param 		  	t  	Where the ray meets the surface.
+ * @param [in,out]	hit	The hit.
+ */
+
+void IQuadricSurface::setHit(const Ray &ray, double t, HitRecord &hit) const {
+	const QuadricParameters &q = qParams;
+	dvec3 p = ray.origin + t * ray.dir - center;
+	double f = q.A * p.x * p.x + q.B * p.y * p.y + q.C * p.z * p.z +
+				q.D * p.x * p.y + q.E * p.x * p.z + q.F * p.y * p.z +
+				q.G * p.x + q.H * p.y + q.I * p.z + q.J;
+	double fAbs = std::abs(q.A * p.x * p.x) + std::abs(q.B * p.y * p.y) + std::abs(q.C * p.z * p.z) +
+				std::abs(q.D * p.x * p.y) + std::abs(q.E * p.x * p.z) + std::abs(q.F * p.y * p.z) +
+				std::abs(q.G * p.x) + std::abs(q.H * p.y) + std::abs(q.I * p.z) + std::abs(q.J);
+	dvec3 grad(twoA * p.x + q.D * p.y + q.E * p.z + q.G,
+				twoB * p.y + q.D * p.x + q.F * p.z + q.H,
+				twoC * p.z + q.E * p.x + q.F * p.y + q.I);
+	double grad2 = glm::dot(grad, grad);
+	dvec3 step(0.0, 0.0, 0.0);
+	double distError = 0.0;
+	if (grad2 > 0) {
+		double gradLen = std::sqrt(grad2);
+		step = (f / grad2) * grad;
+		// Rounding in f, and the curvature the step ignores.
+		double curvature = std::abs(twoA) + std::abs(twoB) + std::abs(twoC) +
+							std::abs(q.D) + std::abs(q.E) + std::abs(q.F);
+		distError = (roundingGamma<double>(12) * fAbs + glm::dot(step, step) * curvature) / gradLen;
+	}
+	p -= step;
+	hit.t = t;
+	hit.interceptPt = p + center;
+	hit.pError = roundingGamma<double>(8) * (glm::abs(p) + glm::abs(step)) +
+					roundingGamma<double>(1) * glm::abs(hit.interceptPt) +
+					dvec3(distError, distError, distError);
+	hit.normal = normal(hit.interceptPt);
+}
+
 /**
  * @fn	void IQuadricSurface::findClosestIntersection(const Ray &ray, HitRecord &hit) const
  * @brief	Searches for the nearest intersection
@@ -596,20 +1015,11 @@ void IQuadricSurface::findClosestIntersection(const Ray &ray, HitRecord &hit) co
 	hit.t = FLT_MAX;
 
 	int numIntercepts = findIntersections(ray, hits);
-	if (numIntercepts == 1 && hits[0].t > 0) {
+	if (numIntercepts > 0) {
 		hit.t = hits[0].t;
 		hit.interceptPt = hits[0].interceptPt;
-		hit.normal = normal(hit.interceptPt);
-	} else if (numIntercepts == 2) {
-		if (hits[0].t > 0) {
-			hit.t = hits[0].t;
-			hit.interceptPt = hits[0].interceptPt;
-			hit.normal = normal(hit.interceptPt);
-		} else if (hits[1].t > 0) {
-			hit.t = hits[1].t;
-			hit.interceptPt = hits[1].interceptPt;
-			hit.normal = normal(hit.interceptPt);
-		}
+		hit.normal = hits[0].normal;
+		hit.pError = hits[0].pError;
 	}
 }
 
@@ -678,6 +1088,7 @@ ICone::ICone(const dvec3& pos, double R, double H, const QuadricParameters& qPar
 
 IConeY::IConeY(const dvec3& pos, double rad, double H)
 	: ICone(pos + dvec3(0.0, H, 0.0), rad, H, QuadricParameters::coneYQParams(rad, H)) {
+	kind = IShapeKind::CONE_Y;
 }
 
 /**
@@ -712,6 +1123,7 @@ void IConeY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 
 ICylinderY::ICylinderY(const dvec3 &pos, double rad, double len)
 	: ICylinder(pos, rad, len, QuadricParameters::cylinderYQParams(rad)) {
+	kind = IShapeKind::CYLINDER_Y;
 }
 
 /**
@@ -742,6 +1154,7 @@ void ICylinderY::findClosestIntersection(const Ray &ray, HitRecord &hit) const {
 
 IClosedCylinderY::IClosedCylinderY(const dvec3& position, double rad, double len)
 	: ICylinder(position, rad, len, QuadricParameters::cylinderYQParams(rad)) {
+	kind = IShapeKind::CLOSED_CYLINDER_Y;
 }
 void IClosedCylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) const {
 	if (DEBUG_PIXEL) {
@@ -751,12 +1164,12 @@ void IClosedCylinderY::findClosestIntersection(const Ray& ray, HitRecord& hit) c
 	//HitRecord bottomHit;
 	dvec3 upperN = dvec3(0.0, 1.0, 0.0);
 	//dvec3 bottomN = dvec3(0.0, -1.0, 0.0);
-	IDisk* upper = new IDisk(dvec3(center.x, center.y + length / 2, center.z), 
+	IDisk upper(dvec3(center.x, center.y + length / 2, center.z), 
 		upperN, radius);
 	//IDisk* bottom = new IDisk(dvec3(center.x, center.y - length, center.z),
 	//	bottomN, radius);
 
-	upper->findClosestIntersection(ray, upperHit);
+	upper.findClosestIntersection(ray, upperHit);
 	//bottom->findClosestIntersection(ray, bottomHit);
 	if (upperHit.t != FLT_MAX) {
 		hit = upperHit;
@@ -806,6 +1219,7 @@ void ICylinderY::getTexCoords(const dvec3& pt, double& u, double& v) const {
 
 ICylinderZ::ICylinderZ(const dvec3 &pos, double rad, double len)
 	: ICylinder(pos, rad, len, QuadricParameters::cylinderZQParams(rad)) {
+	kind = IShapeKind::CYLINDER_Z;
 }
 
 /**
@@ -843,4 +1257,5 @@ void ICylinderZ::findClosestIntersection(const Ray &ray,
 
 IEllipsoid::IEllipsoid(const dvec3 &position, const dvec3 &sz)
 	: IQuadricSurface(QuadricParameters::ellipsoidQParams(sz), position) {
+	kind = IShapeKind::ELLIPSOID;
 }
@@ -8,6 +8,7 @@
  ****************************************************/
 
 #pragma once
+#include <cstdint>
 #include <vector>
 #include "hitrecord.h"
 
@@ -17,31 +18,76 @@ struct VisibleIShape;
 typedef VisibleIShape *VisibleIShapePtr;
 
 /**
- * @struct	Ray
- * @brief	Represents a ray.
+ * @struct	RayT
+ * @brief	Represents a ray, with components of type T. The ray tracer works
+ * 			with Ray (double); the intersection kernels convert it to
+ * 			RayT<RayReal>. Only hits with t > tMin count.
  */
 
-struct Ray {
-	dvec3 origin;		//!< starting point for this ray
-	dvec3 dir;			//!< direction for this ray, given it's origin
-	Ray(const dvec3 &rayOrigin, const dvec3 &rayDirection) :
-		origin(rayOrigin), dir(glm::normalize(rayDirection)) {
+template <class T>
+struct RayT {
+	typedef typename Vec3Of<T>::type Vec;
+	Vec origin;			//!< starting point for this ray
+	Vec dir;			//!< direction for this ray, given it's origin
+	T tMin;				//!< hits at or before this distance are ignored
+	RayT(const Vec &rayOrigin, const Vec &rayDirection, T rayTMin = 0) :
+		origin(rayOrigin), dir(glm::normalize(rayDirection)), tMin(rayTMin) {
 	}
-	dvec3 getPoint(double t) const {
+	template <class U>
+	explicit RayT(const RayT<U> &ray) : origin(ray.origin), dir(ray.dir), tMin((T)ray.tMin) {
+	}
+	Vec getPoint(T t) const {
 		return origin + t * dir;
 	}
 };
 
+typedef RayT<double> Ray;
+
+/**
+ * @struct	RayDifferential
+ * @brief	Two rays offset from a main ray by one pixel, one to the right and
+ * 			one up. The three rays together describe the footprint of the
+ * 			pixel on whatever they hit. The rays are kept beside the Ray
+ * 			rather than in it, so the intersection code does not pay for
+ * 			them. The method is Igehy's, "Tracing Ray Differentials", 1999.
+ */
+
+struct RayDifferential {
+	bool hasDifferentials;			//!< False if there is no footprint information.
+	dvec3 rxOrigin, ryOrigin;		//!< Origins of the offset rays.
+	dvec3 rxDirection, ryDirection;	//!< Directions of the offset rays.
+	RayDifferential() : hasDifferentials(false) {}
+	void scaleDifferentials(const Ray &ray, double s);
+	bool footprint(const HitRecord &hit, dvec3 &dpdx, dvec3 &dpdy) const;
+	RayDifferential reflected(const HitRecord &hit, const dvec3 &origin) const;
+};
+
+/**
+ * @enum	IShapeKind
+ * @brief	The shapes the ray tracer calls directly rather than through
+ * 			IShape's virtual functions. Each is a final class that sets its
+ * 			kind when constructed. Any other shape is OTHER.
+ */
+
+enum class IShapeKind {
+	OTHER, PLANE, DISK, SPHERE, ELLIPSOID, CYLINDER_Y, CLOSED_CYLINDER_Y, CYLINDER_Z, CONE_Y,
+	TRIANGLE_MESH, EMESH
+};
+
+const int NUM_ISHAPE_KINDS = (int)IShapeKind::EMESH + 1;	//!< Number of IShapeKind values.
+
 /**
  * @struct	IShape
  * @brief	Base class for all implicit shapes.
  */
 
 struct IShape {
+	IShapeKind kind;	//!< What the shape is, for dispatch without virtual calls.
 	IShape();
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const = 0;
 	virtual void getTexCoords(const dvec3 &pt, double &u, double &v) const;
-	static dvec3 movePointOffSurface(const dvec3 &pt, const dvec3 &n);
+	virtual bool hasOwnMaterials() const;
+	static dvec3 movePointOffSurface(const HitRecord &hit, const dvec3 &dir);
 };
 
 /**
@@ -55,8 +101,30 @@ struct VisibleIShape {
 	Image *texture;		//!< Texture associated with this shape, if any.
 	VisibleIShape(IShapePtr shapePtr, const Material &mat, Image *image = nullptr);
 	void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
+	void intersect(const Ray &ray, HitRecord &hit) const;
+	void finishHit(HitRecord &hit) const;
 	static void findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces,
 								HitRecord &theHit);
+	static bool anyIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, double tMax);
+};
+
+/**
+ * @struct	ShapeGroups
+ * @brief	A list of visible shapes split up by kind, so that finding the
+ * 			closest hit runs one tight loop per kind, each calling its shape's
+ * 			intersection code directly. Holds indices into the list, which
+ * 			must be added in order.
+ */
+
+struct ShapeGroups {
+	vector<uint32_t> members[NUM_ISHAPE_KINDS];	//!< Per kind, indices into the list.
+	size_t size;								//!< Number of shapes added.
+	ShapeGroups() : size(0) {}
+	void clear();
+	void add(const VisibleIShape &obj);
+	void findIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces,
+							HitRecord &theHit) const;
+	bool anyIntersection(const Ray &ray, const vector<VisibleIShapePtr> &surfaces, double tMax) const;
 };
 
 /**
@@ -64,7 +132,7 @@ struct VisibleIShape {
  * @brief	An implicit representation of a plane.
  */
 
-struct IPlane : public IShape {
+struct IPlane final : public IShape {
 	dvec3 a;	//!< point on the plane
 	dvec3 n;	//!< plane's normal vector
 	IPlane();
@@ -86,7 +154,7 @@ dvec3 normalFrom3Points(const vector<dvec3>& pts);
  * 			center and normal vector.
  */
 
-struct IDisk : public IShape {
+struct IDisk final : public IShape {
 	IDisk();
 	IDisk(const dvec3 &position, const dvec3 &n, double rad);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
@@ -97,24 +165,164 @@ struct IDisk : public IShape {
 };
 
 /**
- * @struct	QuadricParameters
- * @brief	Represents the 9 parameters that describe a quadric.
+ * @enum	QuadricForm
+ * @brief	Quadrics with enough zero terms to get an intersection kernel of
+ * 			their own. See QuadricParametersT::form().
+ */
+
+enum class QuadricForm {
+	GENERAL,		//!< Any quadric.
+	AXIS_ALIGNED,	//!< D to I are 0: ellipsoids, cones and cylinders along an axis.
+	SPHERE,			//!< Axis aligned, with A == B == C.
+	CYLINDER_X,		//!< Axis aligned, with A == 0 and B == C.
+	CYLINDER_Y,		//!< Axis aligned, with B == 0 and A == C.
+	CYLINDER_Z		//!< Axis aligned, with C == 0 and A == B.
+};
+
+/**
+ * @struct	QuadricParametersT
+ * @brief	Represents the 9 parameters that describe a quadric, as values of
+ * 			type T. Instantiated for float and double.
+ */
+
+template <class T>
+struct QuadricParametersT {
+	typedef typename Vec3Of<T>::type Vec;
+	T A, B, C, D, E, F, G, H, I, J;
+	QuadricParametersT();
+	QuadricParametersT(const vector<double> &items);
+	QuadricParametersT(T a, T b, T c, T d, T e, T f, T g, T h, T i, T j);
+	template <class U>
+	explicit QuadricParametersT(const QuadricParametersT<U> &p)
+		: A((T)p.A), B((T)p.B), C((T)p.C), D((T)p.D), E((T)p.E),
+		F((T)p.F), G((T)p.G), H((T)p.H), I((T)p.I), J((T)p.J) {
+	}
+	static QuadricParametersT cylinderXQParams(double R);
+	static QuadricParametersT cylinderYQParams(double R);
+	static QuadricParametersT cylinderZQParams(double R);
+	static QuadricParametersT coneYQParams(double R, double H);
+	static QuadricParametersT sphereQParams(double R);
+	static QuadricParametersT ellipsoidQParams(const dvec3 &sz);
+
+	/**
+	 * @brief	Identifies the most specialized form these parameters fit.
+	 */
+	QuadricForm form() const {
+		if (D != 0 || E != 0 || F != 0 || G != 0 || H != 0 || I != 0) {
+			return QuadricForm::GENERAL;
+		}
+		if (A == B && B == C) return QuadricForm::SPHERE;
+		if (A == 0 && B == C) return QuadricForm::CYLINDER_X;
+		if (B == 0 && A == C) return QuadricForm::CYLINDER_Y;
+		if (C == 0 && A == B) return QuadricForm::CYLINDER_Z;
+		return QuadricForm::AXIS_ALIGNED;
+	}
+
+	/**
+	 * @brief	Coefficients of Aq*t^2 + Bq*t + Cq = 0, whose roots are where
+	 * 			the ray Ro + t*Rd meets the quadric.
+	 * @param	Ro	Ray origin, relative to the quadric's center.
+	 * @param	Rd	Ray direction.
+	 */
+	void rayCoefficients(const Vec &Ro, const Vec &Rd, T &Aq, T &Bq, T &Cq) const {
+		const T twoA = 2 * A, twoB = 2 * B, twoC = 2 * C;
+		Aq = A * (Rd.x*Rd.x) +
+			B * (Rd.y*Rd.y) +
+			C * (Rd.z*Rd.z) +
+			D * (Rd.x * Rd.y) +
+			E * (Rd.x * Rd.z) +
+			F * (Rd.y * Rd.z);
+
+		Bq = twoA * Ro.x*Rd.x +
+			twoB * Ro.y*Rd.y +
+			twoC * Ro.z*Rd.z +
+			D * (Ro.x * Rd.y + Ro.y * Rd.x) +
+			E * (Ro.x * Rd.z + Ro.z * Rd.x) +
+			F * (Ro.y * Rd.z + Ro.z * Rd.y) +
+			G * Rd.x + H * Rd.y + I * Rd.z;
+
+		Cq = A * (Ro.x * Ro.x) +
+			B * (Ro.y * Ro.y) +
+			C * (Ro.z * Ro.z) +
+			D * (Ro.x * Ro.y) +
+			E * (Ro.x * Ro.z) +
+			F * (Ro.y * Ro.z) +
+			G * Ro.x +
+			H * Ro.y +
+			I * Ro.z + J;
+	}
+};
+
+typedef QuadricParametersT<double> QuadricParameters;
+
+/**
+ * @struct	QuadricKernel
+ * @brief	QuadricParametersT::rayCoefficients for parameters of form F. The
+ * 			specializations leave out the terms that are 0 for their form, so
+ * 			they give the same coefficients as the general one, to within
+ * 			rounding (exactly, for the spheres and cylinders this file
+ * 			creates), for a fraction of the work.
  */
 
-struct QuadricParameters {
-	double A, B, C, D, E, F, G, H, I, J;
-	QuadricParameters();
-	QuadricParameters(const vector<double> &items);
-	QuadricParameters(double a, double b, double c, double d, double e, double f,
-						double g, double h, double i, double j);
-	static QuadricParameters cylinderXQParams(double R);
-	static QuadricParameters cylinderYQParams(double R);
-	static QuadricParameters cylinderZQParams(double R);
-	static QuadricParameters coneYQParams(double R, double H);
-	static QuadricParameters sphereQParams(double R);
-	static QuadricParameters ellipsoidQParams(const dvec3 &sz);
+template <QuadricForm F, class T>
+struct QuadricKernel {
+	typedef typename Vec3Of<T>::type Vec;
+	static void rayCoefficients(const QuadricParametersT<T> &q, const Vec &Ro, const Vec &Rd,
+								T &Aq, T &Bq, T &Cq) {
+		q.rayCoefficients(Ro, Rd, Aq, Bq, Cq);
+	}
 };
 
+template <class T>
+struct QuadricKernel<QuadricForm::AXIS_ALIGNED, T> {
+	typedef typename Vec3Of<T>::type Vec;
+	static void rayCoefficients(const QuadricParametersT<T> &q, const Vec &Ro, const Vec &Rd,
+								T &Aq, T &Bq, T &Cq) {
+		const T twoA = 2 * q.A, twoB = 2 * q.B, twoC = 2 * q.C;
+		Aq = q.A * (Rd.x*Rd.x) + q.B * (Rd.y*Rd.y) + q.C * (Rd.z*Rd.z);
+		Bq = twoA * Ro.x*Rd.x + twoB * Ro.y*Rd.y + twoC * Ro.z*Rd.z;
+		Cq = q.A * (Ro.x * Ro.x) + q.B * (Ro.y * Ro.y) + q.C * (Ro.z * Ro.z) + q.J;
+	}
+};
+
+template <class T>
+struct QuadricKernel<QuadricForm::SPHERE, T> {
+	typedef typename Vec3Of<T>::type Vec;
+	static void rayCoefficients(const QuadricParametersT<T> &q, const Vec &Ro, const Vec &Rd,
+								T &Aq, T &Bq, T &Cq) {
+		Aq = q.A * (Rd.x*Rd.x + Rd.y*Rd.y + Rd.z*Rd.z);
+		Bq = 2 * q.A * (Ro.x*Rd.x + Ro.y*Rd.y + Ro.z*Rd.z);
+		Cq = q.A * (Ro.x*Ro.x + Ro.y*Ro.y + Ro.z*Ro.z) + q.J;
+	}
+};
+
+/**
+ * @struct	CylinderKernel
+ * @brief	Coefficients for a cylinder along the given axis: the quadric only
+ * 			depends on the other two coordinates, U and V.
+ */
+
+template <class T, int AXIS>
+struct CylinderKernel {
+	typedef typename Vec3Of<T>::type Vec;
+	static void rayCoefficients(const QuadricParametersT<T> &q, const Vec &Ro, const Vec &Rd,
+								T &Aq, T &Bq, T &Cq) {
+		const int U = AXIS == 0 ? 1 : 0, V = AXIS == 2 ? 1 : 2;
+		const T a = U == 0 ? q.A : q.B;
+		const T c = V == 2 ? q.C : q.B;
+		Aq = a * (Rd[U]*Rd[U]) + c * (Rd[V]*Rd[V]);
+		Bq = 2 * a * Ro[U]*Rd[U] + 2 * c * Ro[V]*Rd[V];
+		Cq = a * (Ro[U] * Ro[U]) + c * (Ro[V] * Ro[V]) + q.J;
+	}
+};
+
+template <class T>
+struct QuadricKernel<QuadricForm::CYLINDER_X, T> : CylinderKernel<T, 0> {};
+template <class T>
+struct QuadricKernel<QuadricForm::CYLINDER_Y, T> : CylinderKernel<T, 1> {};
+template <class T>
+struct QuadricKernel<QuadricForm::CYLINDER_Z, T> : CylinderKernel<T, 2> {};
+
 /**
  * @struct	IQuadricSurface
  * @brief	Implicit representation of quadric surface. These shapes can be
@@ -130,10 +338,12 @@ struct IQuadricSurface : public IShape {
 	IQuadricSurface(const dvec3 & position);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
 	int findIntersections(const Ray &ray, HitRecord hits[2]) const;
+	void setHit(const Ray &ray, double t, HitRecord &hit) const;
 	dvec3 normal(const dvec3 &pt) const;
-	virtual void computeAqBqCq(const Ray &ray, double &Aq, double &Bq, double &Cq) const;
+	void computeAqBqCq(const Ray &ray, double &Aq, double &Bq, double &Cq) const;
 protected:
 	QuadricParameters qParams;		//!< The parameters that make up the quadric
+	QuadricForm form;				//!< Selects the kernel for qParams
 	double twoA;					//!< 2*A
 	double twoB;					//!< 2*B
 	double twoC;					//!< 2*C
@@ -144,7 +354,7 @@ protected:
  * @brief	Implicit representation of sphere.
  */
 
-struct ISphere : IQuadricSurface {
+struct ISphere final : IQuadricSurface {
 	ISphere(const dvec3 &position, double radius);
 	virtual void getTexCoords(const dvec3 &pt, double &u, double &v) const;
 };
@@ -175,7 +385,7 @@ struct ICone : public IQuadricSurface {
  * @brief	Base class for implicit representation of a cone.
  */
 
-struct IConeY : public ICone {
+struct IConeY final : public ICone {
 	IConeY(const dvec3& position, double R, double H);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
 };
@@ -185,13 +395,13 @@ struct IConeY : public ICone {
  * @brief	Implicit representation of open cylinder oriented along y-axis coordinate.
  */
 
-struct ICylinderY : public ICylinder {
+struct ICylinderY final : public ICylinder {
 	ICylinderY(const dvec3 &position, double R, double len);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
 	void getTexCoords(const dvec3 &pt, double &u, double &v) const;
 };
 
-struct IClosedCylinderY : public ICylinder {
+struct IClosedCylinderY final : public ICylinder {
 	IClosedCylinderY(const dvec3& position, double R, double len);
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const;
 };
@@ -201,7 +411,7 @@ struct IClosedCylinderY : public ICylinder {
  * @brief	Implicit representation of open cylinder oriented along y-axis coordinate.
  */
 
-struct ICylinderZ : public ICylinder {
+struct ICylinderZ final : public ICylinder {
 	ICylinderZ(const dvec3 &position, double R, double len);
 	virtual void findClosestIntersection(const Ray &ray, HitRecord &hit) const;
 };
@@ -211,6 +421,6 @@ struct ICylinderZ : public ICylinder {
  * @brief	Implicit representation of an ellipsoid.
  */
 
-struct IEllipsoid : public IQuadricSurface {
+struct IEllipsoid final : public IQuadricSurface {
 	IEllipsoid(const dvec3& position, const dvec3& sz);
 };
\ No newline at end of file
@@ -8,6 +8,7 @@
  ****************************************************/
 
 #include "light.h"
+#include "iscene.h"
 #include "io.h"
 
 /**
@@ -219,31 +220,20 @@ bool inCone(const dvec3& spotPos, const dvec3& spotDir, double spotFOV, const dv
 }
 
 /**
-* @fn	bool inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const vector<VisibleIShapePtr> objects)
+* @fn	bool inShadow(const dvec3& lightPos, const HitRecord& hit, const IScene& scene, bool byTransparent)
 * @brief	Determines if an intercept point falls in a shadow.
 * @param	lightPos		where the spotlight is positioned
-* @param	intercept	the position of the intercept.
-* @param	normal		the normal vector at the intercept point
-* @param	objects		the collection of opaque objects in the scene
+* @param	hit				the intercept, with its normal and error bound
+* @param	scene			the scene
+* @param	byTransparent	true for shadows cast by the transparent objects
+* 							rather than the opaque ones
 */
 
-bool inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const vector<VisibleIShapePtr>& objects) {
+bool inShadow(const dvec3& lightPos, const HitRecord& hit, const IScene& scene, bool byTransparent) {
 	/* CSE 386 - todo  */
-	HitRecord hits;
-	double lightDistance = glm::distance(lightPos, intercept);
-	dvec3 lightV = glm::normalize(lightPos - intercept);
-	Ray ray = Ray(intercept, lightV);
-	
-	for (int i = 0; i < objects.size(); i++) {
-		Ray shadowFeeler = Ray(intercept + EPSILON * normal, lightV);
-		objects[i]->findClosestIntersection(shadowFeeler, hits);
-
-		if (hits.t != FLT_MAX && glm::distance(hits.interceptPt, intercept) < lightDistance) {
-			return true;
-		}
-		else {
-	//		return false;
-		}
-	}
-	return false;
+	dvec3 lightV = glm::normalize(lightPos - hit.interceptPt);
+	Ray shadowFeeler = Ray(IShape::movePointOffSurface(hit, lightV), lightV);
+	double lightDistance = glm::distance(lightPos, shadowFeeler.origin);
+	return byTransparent ? scene.anyTransparentIntersection(shadowFeeler, lightDistance)
+						 : scene.anyOpaqueIntersection(shadowFeeler, lightDistance);
 }
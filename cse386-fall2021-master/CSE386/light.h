@@ -14,6 +14,8 @@
 #include "hitrecord.h"
 #include "ishape.h"
 
+struct IScene;
+
  /**
   * @struct	LightATParams
   * @brief	A light attenuation parameters.
@@ -61,6 +63,7 @@ struct LightSource {
 	LightSource() {
 		isOn = true;
 	}
+	virtual ~LightSource() {}
 	virtual color illuminate(const dvec3& interceptWorldCoords,
 		const dvec3& normal,
 		const Material& material,
@@ -132,7 +135,7 @@ color totalColor(const Material& mat, const LightColor& lightColor,
 	bool attenuationOn,
 	const LightATParams& ATparams);
 bool inCone(const dvec3& spotPos, const dvec3& spotDir, double spotFOV, const dvec3& intercept);
-bool inShadow(const dvec3& lightPos, const dvec3& intercept, const dvec3& normal, const vector<VisibleIShapePtr>& objects);
+bool inShadow(const dvec3& lightPos, const HitRecord& hit, const IScene& scene, bool byTransparent = false);
 
 typedef LightSource* LightSourcePtr;
 typedef PositionalLight* PositionalLightPtr;
@@ -0,0 +1,121 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+// Checks that the ray tracer gives the same images with RAYTRACE_FLOAT as
+// without it. One build has one RayReal, so build this twice:
+//
+//	without RAYTRACE_FLOAT:	precisiontests [scene ...]	writes scene.double.ppm for each scene
+//	with RAYTRACE_FLOAT:	precisiontests [scene ...]	compares each scene to scene.double.ppm
+//
+// The scenes default to the sample scene, fullraytrace.scene.
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "defs.h"
+#include "framebuffer.h"
+#include "imagewriter.h"
+#include "raytracer.h"
+#include "scenefile.h"
+
+const int W = 400;
+const int H = 300;
+const int NUM_REFLECTIONS = 1;
+const int ANTI_ALIASING = 1;
+
+// A pixel on an edge may go the other way, but the images must otherwise agree.
+const int TOLERANCE = 2;					// Channel steps that do not count as a difference.
+const double MIN_PSNR = 40.0;				// dB.
+const double MAX_FRACTION_DIFFERING = 0.001;
+
+/**
+ * @fn	bool render(const string &sceneFileName, FrameBuffer &frameBuffer)
+ * @brief	Ray traces a scene file into frameBuffer.
+ * @return	True if the scene loaded.
+ */
+
+bool render(const string &sceneFileName, FrameBuffer &frameBuffer) {
+	SceneFile sceneFile;
+	if (!sceneFile.load(sceneFileName)) {
+		return false;
+	}
+	sceneFile.resizeCamera(frameBuffer.getWindowWidth(), frameBuffer.getWindowHeight());
+	RayTracer rayTracer(sceneFile.background);
+	rayTracer.raytraceScene(frameBuffer, NUM_REFLECTIONS, sceneFile.scene, ANTI_ALIASING);
+	return true;
+}
+
+/**
+ * @fn	bool readPPM(const string &fileName, FrameBuffer &frameBuffer)
+ * @brief	Reads a binary PPM written by ImageWriter::writeFrameBuffer back
+ * 			into a framebuffer of the same size.
+ * @return	True if successful.
+ */
+
+bool readPPM(const string &fileName, FrameBuffer &frameBuffer) {
+	std::ifstream input(fileName.c_str(), std::ios::binary);
+	string magic;
+	int width, height, maxValue;
+	input >> magic >> width >> height >> maxValue;
+	input.get();
+	if (!input || magic != "P6" || maxValue != 255 ||
+		width != frameBuffer.getWindowWidth() || height != frameBuffer.getWindowHeight()) {
+		return false;
+	}
+	vector<unsigned char> row((size_t)width * BYTES_PER_PIXEL);
+	for (int y = height - 1; y >= 0; y--) {
+		if (!input.read((char *)row.data(), row.size())) {
+			return false;
+		}
+		for (int x = 0; x < width; x++) {
+			// Halfway between steps, so setColor's truncation gives back the byte.
+			const unsigned char *p = &row[BYTES_PER_PIXEL * x];
+			frameBuffer.setColor(x, y, color(p[0] + 0.5, p[1] + 0.5, p[2] + 0.5) / 255.0);
+		}
+	}
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	vector<string> scenes(argv + 1, argv + argc);
+	if (scenes.empty()) {
+		scenes.push_back("fullraytrace.scene");
+	}
+	int failures = 0;
+	for (const string &scene : scenes) {
+		const string referenceFileName = scene + ".double.ppm";
+		FrameBuffer frameBuffer(W, H);
+		if (!render(scene, frameBuffer)) {
+			failures++;
+			continue;
+		}
+#ifndef RAYTRACE_FLOAT
+		if (ImageWriter::writeFrameBuffer(frameBuffer, referenceFileName)) {
+			cout << scene << ": wrote " << referenceFileName << endl;
+		} else {
+			failures++;
+		}
+#else
+		FrameBuffer reference(W, H);
+		if (!readPPM(referenceFileName, reference)) {
+			cout << "FAIL " << scene << ": no reference " << referenceFileName
+				<< " from a build without RAYTRACE_FLOAT" << endl;
+			failures++;
+			continue;
+		}
+		ImageDiff diff = compareColorBuffers(reference, frameBuffer, TOLERANCE);
+		bool ok = diff.psnr >= MIN_PSNR && diff.pixelsDiffering <= MAX_FRACTION_DIFFERING * W * H;
+		cout << (ok ? "ok   " : "FAIL ") << scene << ": max error " << diff.maxError
+			<< ", mean error " << diff.meanError << ", PSNR " << diff.psnr << " dB, "
+			<< diff.pixelsDiffering << " of " << W * H << " pixels differ by more than " << TOLERANCE << endl;
+		failures += !ok;
+#endif
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "defs.h"
+#include "utilities.h"
+
+const double TOLERANCE = 1e-14;		// Largest relative error accepted in a root.
+const int N = 1 << 16;				// Equations per timing run.
+const int REPS = 50;
+
+/**
+ * @struct	QuadraticCase
+ * @brief	An equation and what it is meant to test.
+ */
+
+struct QuadraticCase {
+	const char *name;
+	double A, B, C;
+};
+
+const QuadraticCase CASES[] = {
+	{ "two roots",				1, 4, 3 },
+	{ "A == 0",					0, 2, -4 },
+	{ "A == 0, B == 0",			0, 0, 1 },
+	{ "zero discriminant",		1, 2, 1 },
+	{ "zero discriminant",		4, -4, 1 },
+	{ "B^2 >> 4AC",				1, 1e8, 1 },
+	{ "B^2 >> 4AC",				1, -1e8, 1 },
+	{ "B^2 >> 4AC",				1e-3, 1e5, 1e-3 },
+	{ "no real roots",			-4, -2, -1 },
+	{ "no real roots",			1, 0, 1 },
+};
+const int NUM_CASES = sizeof(CASES) / sizeof(CASES[0]);
+
+/**
+ * @fn	int referenceRoots(double A, double B, double C, long double roots[2])
+ * @brief	Solves the equation in long double, for comparison.
+ * @return	The number of real roots, in ascending order in roots.
+ */
+
+int referenceRoots(double A, double B, double C, long double roots[2]) {
+	long double a = A, b = B, c = C;
+	if (a == 0) {
+		if (b == 0) {
+			return 0;
+		}
+		roots[0] = -c / b;
+		return 1;
+	}
+	long double discrim = b * b - 4 * a * c;
+	if (discrim == 0) {
+		roots[0] = -b / (2 * a);
+		return 1;
+	} else if (discrim < 0) {
+		return 0;
+	}
+	long double q = -0.5L * (b + (b < 0 ? -std::sqrt(discrim) : std::sqrt(discrim)));
+	roots[0] = std::min(q / a, c / q);
+	roots[1] = std::max(q / a, c / q);
+	return 2;
+}
+
+/**
+ * @fn	bool closeTo(double x, long double reference)
+ * @brief	Determines if x is within TOLERANCE of reference, relatively.
+ */
+
+bool closeTo(double x, long double reference) {
+	long double error = reference == 0 ? std::abs((long double)x) : std::abs((x - reference) / reference);
+	return error <= TOLERANCE;
+}
+
+/**
+ * @fn	bool check(const char *overload, const QuadraticCase &test, int numRoots, const double roots[2])
+ * @brief	Compares roots found by one overload to the reference, reporting
+ * 			any difference.
+ * @return	True if they agree.
+ */
+
+bool check(const char *overload, const QuadraticCase &test, int numRoots, const double roots[2]) {
+	long double expected[2];
+	int expectedRoots = referenceRoots(test.A, test.B, test.C, expected);
+	bool ok = numRoots == expectedRoots;
+	for (int i = 0; ok && i < numRoots; i++) {
+		ok = closeTo(roots[i], expected[i]);
+	}
+	if (!ok) {
+		cout << "FAIL " << overload << " " << test.name << " (" << test.A << ", " << test.B << ", "
+			<< test.C << "): " << numRoots << " roots";
+		for (int i = 0; i < numRoots; i++) {
+			cout << " " << roots[i];
+		}
+		cout << ", expected " << expectedRoots;
+		for (int i = 0; i < expectedRoots; i++) {
+			cout << " " << (double)expected[i];
+		}
+		cout << endl;
+	}
+	return ok;
+}
+
+/**
+ * @fn	template <class F> double nsPerEquation(F f)
+ * @brief	Runs f, which solves N equations, REPS times.
+ * @return	Average nanoseconds per equation.
+ */
+
+template <class F>
+double nsPerEquation(F f) {
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < REPS; i++) {
+		f();
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / REPS / N;
+}
+
+int main() {
+	int failures = 0;
+
+	// The batch version solves four at a time when it can, so put every case
+	// through it at once, several times over.
+	const int BATCH = 4 * NUM_CASES;
+	double A[BATCH], B[BATCH], C[BATCH], lo[BATCH], hi[BATCH];
+	for (int i = 0; i < BATCH; i++) {
+		A[i] = CASES[i % NUM_CASES].A;
+		B[i] = CASES[i % NUM_CASES].B;
+		C[i] = CASES[i % NUM_CASES].C;
+	}
+	quadratic(BATCH, A, B, C, lo, hi);
+
+	for (int i = 0; i < BATCH; i++) {
+		const QuadraticCase &test = CASES[i % NUM_CASES];
+		if (i < NUM_CASES) {
+			double roots[2];
+			int numRoots = quadratic(test.A, test.B, test.C, roots);
+			failures += !check("scalar", test, numRoots, roots);
+
+			vector<double> rootList = quadratic(test.A, test.B, test.C);
+			failures += !check("vector", test, (int)rootList.size(), rootList.data());
+		}
+		// No roots is NaN twice, one root is the same root twice.
+		double roots[2] = { lo[i], hi[i] };
+		int numRoots = std::isnan(lo[i]) ? 0 : lo[i] == hi[i] ? 1 : 2;
+		if (std::isnan(lo[i]) != std::isnan(hi[i])) {
+			numRoots = -1;
+		}
+		failures += !check("batch", test, numRoots, roots);
+	}
+	cout << "quadratic: " << failures << " failures" << endl;
+
+	// Well conditioned equations, most with two real roots.
+	std::mt19937_64 generator(386);
+	std::uniform_real_distribution<double> coefficient(-1.0, 1.0);
+	vector<double> As(N), Bs(N), Cs(N), los(N), his(N);
+	for (int i = 0; i < N; i++) {
+		As[i] = 1 + 0.1 * coefficient(generator);
+		Bs[i] = 4 * coefficient(generator);
+		Cs[i] = 2 * coefficient(generator);
+	}
+	double sum = 0;		// Keeps the optimizer from dropping the work.
+	double scalarNs = nsPerEquation([&]() {
+		for (int i = 0; i < N; i++) {
+			double roots[2];
+			if (quadratic(As[i], Bs[i], Cs[i], roots) > 0) {
+				sum += roots[0];
+			}
+		}
+	});
+	double vectorNs = nsPerEquation([&]() {
+		for (int i = 0; i < N; i++) {
+			vector<double> roots = quadratic(As[i], Bs[i], Cs[i]);
+			if (!roots.empty()) {
+				sum += roots[0];
+			}
+		}
+	});
+	double batchNs = nsPerEquation([&]() {
+		quadratic(N, As.data(), Bs.data(), Cs.data(), los.data(), his.data());
+		sum += los[0];
+	});
+
+	cout << "quadratic, " << N << " equations, average of " << REPS << " runs (ns per equation)" << endl;
+	cout << "scalar:  " << scalarNs << endl;
+	cout << "vector:  " << vectorNs << endl;
+	cout << "batch:   " << batchNs << endl;
+	cout << "(" << sum << ")" << endl;
+	return failures == 0 ? 0 : 1;
+}
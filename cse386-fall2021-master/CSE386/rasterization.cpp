@@ -7,7 +7,9 @@
  * permission is granted.
  ****************************************************/
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include "rasterization.h"
 
 /**
@@ -563,69 +565,336 @@ void drawManyWireFrameTriangles(FrameBuffer &frameBuffer,
 }
 
 /**
- * @fn	static inline double f01(const VertexData &v0, const VertexData &v1, const VertexData &v2, double x, double y)
- * @brief	Computes f01. Implicit equation for the line between v0 and v1.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f01.
+ * @fn	static void packAttributes(const VertexData &v, double attr[NUM_ATTRIBUTES])
+ * @brief	Copies the attributes interpolated across a triangle into an array.
+ * @param 		  	v   	The vertex.
+ * @param [out]	  	attr	The attributes.
  */
 
-static inline double f01(const VertexData &v0, const VertexData &v1, const VertexData &v2, 
-							double x, double y) {
-	return (v0.pos.y - v1.pos.y) * x + (v1.pos.x - v0.pos.x) * y +
-		(v0.pos.x * v1.pos.y) - (v1.pos.x * v0.pos.y);
+static void packAttributes(const VertexData &v, double attr[NUM_ATTRIBUTES]) {
+	const Material &M = v.material;
+	const double values[NUM_ATTRIBUTES] = { v.pos.z,
+											v.normal.x, v.normal.y, v.normal.z,
+											v.worldPos.x, v.worldPos.y, v.worldPos.z,
+											M.ambient.r, M.ambient.g, M.ambient.b,
+											M.diffuse.r, M.diffuse.g, M.diffuse.b,
+											M.specular.r, M.specular.g, M.specular.b,
+											M.shininess, M.alpha };
+	for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+		attr[i] = values[i];
+	}
+}
+
+/**
+ * @fn	static bool setupEdges(const dvec4 *P[3], int width, int height, EdgeSetup &setup)
+ * @brief	Snaps the vertices to fixed point and computes the edge functions and
+ * 			bounds. The vertices must be counterclockwise.
+ * @param 		  	P	  	Window coordinates of the vertices.
+ * @param 		  	width 	Window width.
+ * @param 		  	height	Window height.
+ * @param [out]	  	setup 	The edge functions.
+ * @return	False if the triangle covers no pixels.
+ */
 
+static bool setupEdges(const dvec4 *P[3], int width, int height, EdgeSetup &setup) {
+	int64_t X[3], Y[3];
+	for (int i = 0; i < 3; i++) {
+		X[i] = (int64_t)std::llround(P[i]->x * SUBPIXEL_ONE);
+		Y[i] = (int64_t)std::llround(P[i]->y * SUBPIXEL_ONE);
+	}
+	int64_t area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+	if (area <= 0) {
+		return false;
+	}
+	for (int i = 0; i < 3; i++) {
+		int a = (i + 1) % 3;
+		int b = (i + 2) % 3;
+		int64_t dx = X[b] - X[a];
+		int64_t dy = Y[b] - Y[a];
+		// Window y points up, so for a counterclockwise triangle a top edge runs
+		// toward -x and a left edge runs down.
+		bool topLeft = (dy == 0 && dx < 0) || dy < 0;
+		setup.stepX[i] = -dy * SUBPIXEL_ONE;
+		setup.stepY[i] = dx * SUBPIXEL_ONE;
+		setup.offset[i] = dy * X[a] - dx * Y[a] - (topLeft ? 0 : 1);
+	}
+	setup.invArea = 1.0 / (double)area;
+
+	int64_t minX = std::min(X[0], std::min(X[1], X[2]));
+	int64_t maxX = std::max(X[0], std::max(X[1], X[2]));
+	int64_t minY = std::min(Y[0], std::min(Y[1], Y[2]));
+	int64_t maxY = std::max(Y[0], std::max(Y[1], Y[2]));
+	setup.xMin = (int)std::max<int64_t>(0, (minX + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+	setup.xMax = (int)std::min<int64_t>(width - 1, maxX >> SUBPIXEL_BITS);
+	setup.yMin = (int)std::max<int64_t>(0, (minY + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+	setup.yMax = (int)std::min<int64_t>(height - 1, maxY >> SUBPIXEL_BITS);
+	return setup.xMin <= setup.xMax && setup.yMin <= setup.yMax;
 }
 
 /**
- * @fn	static inline double f12(const VertexData &v0, const VertexData &v1, const VertexData &v2, 
- *									double x, double y)
- * @brief	Computes f12. Implicit equation for the line between v1 and v2.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f12.
+ * @fn	int EdgeSetup::classifyRect(int x0, int y0, int x1, int y1) const
+ * @brief	Classifies the pixels of a rectangle against the triangle. The edge
+ * 			functions are linear, so their extremes over the rectangle are at
+ * 			its corners.
+ * @param	x0	Left.
+ * @param	y0	Bottom.
+ * @param	x1	Right.
+ * @param	y1	Top.
+ * @return	RECT_OUTSIDE if no pixel is in the triangle, RECT_INSIDE if every
+ * 			pixel is, or RECT_PARTIAL.
  */
 
-static inline double f12(const VertexData &v0, const VertexData &v1, const VertexData &v2, 
-							double x, double y) {
-	return (v1.pos.y - v2.pos.y) * x + (v2.pos.x - v1.pos.x) * y +
-		(v1.pos.x * v2.pos.y) - (v2.pos.x * v1.pos.y);
+int EdgeSetup::classifyRect(int x0, int y0, int x1, int y1) const {
+	int result = RECT_INSIDE;
+	for (int i = 0; i < 3; i++) {
+		int64_t c00 = edge(i, x0, y0);
+		int64_t c10 = edge(i, x1, y0);
+		int64_t c01 = edge(i, x0, y1);
+		int64_t c11 = edge(i, x1, y1);
+		if (c00 < 0 && c10 < 0 && c01 < 0 && c11 < 0) {
+			return RECT_OUTSIDE;
+		} else if (c00 < 0 || c10 < 0 || c01 < 0 || c11 < 0) {
+			result = RECT_PARTIAL;
+		}
+	}
+	return result;
+}
+
+/**
+ * @fn	bool setupTriangle(const VertexData &v0, const VertexData &v1, const VertexData &v2,
+ *							int width, int height, TriangleSetup &setup,
+ *							GBuffer *gbuffer)
+ * @brief	Does the per triangle work of the rasterizer, so that the triangle can
+ * 			then be drawn piecewise by rasterizeTriangle. The vertices may be in
+ * 			either order.
+ * @param 		  	v0	  	v0, in window coordinates.
+ * @param 		  	v1	  	v1.
+ * @param 		  	v2	  	v2.
+ * @param 		  	width 	Window width.
+ * @param 		  	height	Window height.
+ * @param [out]	  	setup 	The triangle, ready to draw.
+ * @param [in,out]	gbuffer	If not null, the G-buffer the triangle will be drawn
+ * 							into. The vertices' materials are added to its table.
+ * @return	False if the triangle covers no pixels.
+ */
+
+bool setupTriangle(const VertexData &v0, const VertexData &v1, const VertexData &v2,
+					int width, int height, TriangleSetup &setup,
+					GBuffer *gbuffer) {
+	const VertexData *V[3] = { &v0, &v1, &v2 };
+	double cross = (v1.pos.x - v0.pos.x) * (v2.pos.y - v0.pos.y) -
+					(v1.pos.y - v0.pos.y) * (v2.pos.x - v0.pos.x);
+	if (cross < 0) {					// Make it counterclockwise
+		std::swap(V[1], V[2]);
+	}
+	const dvec4 *P[3] = { &V[0]->pos, &V[1]->pos, &V[2]->pos };
+	if (!setupEdges(P, width, height, setup.edges)) {
+		return false;
+	}
+
+	// Attribute = base + w1 * d1 + w2 * d2, where w1 and w2 are the weights of V[1] and V[2].
+	packAttributes(*V[0], setup.base);
+	packAttributes(*V[1], setup.d1);
+	packAttributes(*V[2], setup.d2);
+	for (int k = 0; k < NUM_ATTRIBUTES; k++) {
+		setup.d1[k] -= setup.base[k];
+		setup.d2[k] -= setup.base[k];
+	}
+	bool oneMaterial = V[0]->material == V[1]->material && V[0]->material == V[2]->material;
+	setup.numAttributes = oneMaterial ? NUM_GEOMETRY_ATTRIBUTES : NUM_ATTRIBUTES;
+	setup.material = V[0]->material;
+	if (gbuffer != nullptr) {
+		setup.materialIds[0] = gbuffer->addMaterial(V[0]->material);
+		for (int i = 1; i < 3; i++) {
+			setup.materialIds[i] = oneMaterial ? setup.materialIds[0] : gbuffer->addMaterial(V[i]->material);
+		}
+	}
+	setup.zMin = std::min(v0.pos.z, std::min(v1.pos.z, v2.pos.z));
+	setup.zMax = std::max(v0.pos.z, std::max(v1.pos.z, v2.pos.z));
+	return true;
+}
+
+/**
+ * @fn	DepthValue farthestDepth(const RasterTile &tile, int bx, int by)
+ * @brief	Finds the farthest depth in one block of a tile.
+ * @param	tile	The tile.
+ * @param	bx  	Left of the block.
+ * @param	by  	Bottom of the block.
+ * @return	The largest depth, or the smallest with reversed Z.
+ */
 
+DepthValue farthestDepth(const RasterTile &tile, int bx, int by) {
+	const int x1 = std::min(bx + RASTER_BLOCK_SIZE - 1, tile.x1);
+	const int y1 = std::min(by + RASTER_BLOCK_SIZE - 1, tile.y1);
+	DepthValue result = tile.depth[(by - tile.y0) * tile.stride + bx - tile.x0];
+	for (int y = by; y <= y1; y++) {
+		const DepthValue *row = tile.depth + (y - tile.y0) * tile.stride - tile.x0;
+		if (tile.reversedZ) {
+			for (int x = bx; x <= x1; x++) {
+				result = std::min(result, row[x]);
+			}
+		} else {
+			for (int x = bx; x <= x1; x++) {
+				result = std::max(result, row[x]);
+			}
+		}
+	}
+	return result;
 }
 
 /**
- * @fn	static inline double f20(const VertexData &v0, const VertexData &v1, const VertexData &v2, 
- *									double x, double y)
- * @brief	Computes f20. Implicit equation for the line between v2 and v0.
- * @see		*** page in textbook.
- * @param	v0	v0.
- * @param	v1	v1.
- * @param	v2	v2.
- * @param	x 	x coordinate.
- * @param	y 	y coordinate.
- * @return	f02.
+ * @fn	bool rasterizeTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *							const vector<LightSourcePtr> &lights,
+ *							const TriangleSetup &setup, const RasterTile &tile,
+ *							const Frame &eyeFrame)
+ * @brief	Draws the part of a triangle that falls in a tile. Pixel (x, y) is drawn
+ * 			if the point (x, y) is inside the triangle, using the top-left rule for
+ * 			points on an edge, and if it passes the depth test against the tile's
+ * 			depth buffer. Depth is rounded to the buffer's precision before it is
+ * 			tested, so a surface drawn twice passes the second time too.
+ * 			
+ * 			The tile is walked in 8x8 blocks; a block entirely outside an edge is
+ * 			skipped and a block entirely inside all three is filled without testing
+ * 			each pixel. If the tile has hierarchical Z, a block that the triangle
+ * 			is entirely behind is skipped too. Inside a block the edge values are
+ * 			stepped with one add per pixel, and depth is interpolated and tested
+ * 			before any other attribute.
+ *
+ * 			When drawing into a G-buffer, only the normal is interpolated. The
+ * 			G-buffer holds one material per pixel, so where the vertices' materials
+ * 			differ each pixel takes that of the vertex it is closest to.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	eyePos	   	Eye position.
+ * @param 		  	lights	   	Vector of lights in scene.
+ * @param 		  	setup	   	The triangle.
+ * @param 		  	tile	   	The pixels that may be drawn, and their depths.
+ * @param 		  	eyeFrame   	The camera's frame.
+ * @return	True if any depth was written.
  */
 
-static inline double f20(const VertexData &v0, const VertexData &v1, const VertexData &v2, 
-							double x, double y) {
-	return (v2.pos.y - v0.pos.y) * x + (v0.pos.x - v2.pos.x) * y +
-		(v2.pos.x * v0.pos.y) - (v0.pos.x * v2.pos.y);
+bool rasterizeTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+						const vector<LightSourcePtr> &lights,
+						const TriangleSetup &setup, const RasterTile &tile,
+						const Frame &eyeFrame) {
+	const EdgeSetup &edges = setup.edges;
+	const int xMin = std::max(edges.xMin, tile.x0);
+	const int xMax = std::min(edges.xMax, tile.x1);
+	const int yMin = std::max(edges.yMin, tile.y0);
+	const int yMax = std::min(edges.yMax, tile.y1);
+	const bool depthTest = FragmentOps::performDepthTest;
+	const bool depthWrite = !FragmentOps::readonlyDepthBuffer;
+	const bool useHiZ = depthTest && tile.blockFarZ != nullptr;
+	const bool reversed = tile.reversedZ;
+	bool wroteTile = false;
+	const int numAttributes = setup.numAttributes;
+	const double *base = setup.base;
+	const double *d1 = setup.d1;
+	const double *d2 = setup.d2;
+	GBuffer *gbuffer = tile.gbuffer;
+
+	Fragment fragment;
+	fragment.material = setup.material;
+	double attr[NUM_ATTRIBUTES];
+
+	const int B = RASTER_BLOCK_SIZE;
+	for (int by = yMin - yMin % B; by <= yMax; by += B) {
+		int y0 = std::max(by, yMin);
+		int y1 = std::min(by + B - 1, yMax);
+		for (int bx = xMin - xMin % B; bx <= xMax; bx += B) {
+			int x0 = std::max(bx, xMin);
+			int x1 = std::min(bx + B - 1, xMax);
+
+			int coverage = edges.classifyRect(x0, y0, x1, y1);
+			if (coverage == RECT_OUTSIDE) {
+				continue;
+			}
+			bool accept = coverage == RECT_INSIDE;
+
+			DepthValue *blockFarZ = nullptr;
+			if (useHiZ) {
+				blockFarZ = tile.blockFarZ + ((by - tile.y0) / B) * tile.blockStride + (bx - tile.x0) / B;
+				// Depth is linear, so over the block it is no nearer than its nearest
+				// corner value, nor than the nearest vertex.
+				double c00 = setup.depthAt(x0, y0);
+				double c10 = setup.depthAt(x1, y0);
+				double c01 = setup.depthAt(x0, y1);
+				double c11 = setup.depthAt(x1, y1);
+				double zNear = reversed ?
+								std::min(std::max(std::max(c00, c10), std::max(c01, c11)), setup.zMax) :
+								std::max(std::min(std::min(c00, c10), std::min(c01, c11)), setup.zMin);
+				if (depthBehind(toDepthValue(zNear), *blockFarZ, reversed)) {
+					continue;
+				}
+			}
+
+			bool wroteBlock = false;
+			for (int y = y0; y <= y1; y++) {
+				int64_t e0 = edges.edge(0, x0, y);
+				int64_t e1 = edges.edge(1, x0, y);
+				int64_t e2 = edges.edge(2, x0, y);
+				DepthValue *depthRow = tile.depth + (y - tile.y0) * tile.stride - tile.x0;
+				for (int x = x0; x <= x1; x++, e0 += edges.stepX[0], e1 += edges.stepX[1], e2 += edges.stepX[2]) {
+					if (!accept && (e0 | e1 | e2) < 0) {
+						continue;
+					}
+					double w1 = e1 * edges.invArea;
+					double w2 = e2 * edges.invArea;
+					double z = base[ATTR_Z] + w1 * d1[ATTR_Z] + w2 * d2[ATTR_Z];
+					DepthValue zd = toDepthValue(z);
+					if (depthTest && depthBehind(zd, depthRow[x], reversed)) {
+						continue;
+					}
+					if (depthWrite) {
+						depthRow[x] = zd;
+						wroteBlock = true;
+					}
+					if (gbuffer != nullptr) {
+						double w0 = 1.0 - w1 - w2;
+						int nearest = w0 >= w1 ? (w0 >= w2 ? 0 : 2) : (w1 >= w2 ? 1 : 2);
+						dvec3 n(base[ATTR_NORMAL] + w1 * d1[ATTR_NORMAL] + w2 * d2[ATTR_NORMAL],
+								base[ATTR_NORMAL + 1] + w1 * d1[ATTR_NORMAL + 1] + w2 * d2[ATTR_NORMAL + 1],
+								base[ATTR_NORMAL + 2] + w1 * d1[ATTR_NORMAL + 2] + w2 * d2[ATTR_NORMAL + 2]);
+						gbuffer->set(x, y, encodeOctahedral(n), setup.materialIds[nearest]);
+						continue;
+					}
+					for (int k = ATTR_NORMAL; k < numAttributes; k++) {
+						attr[k] = base[k] + w1 * d1[k] + w2 * d2[k];
+					}
+					fragment.windowPos = dvec3(x, y, z);
+					fragment.worldNormal = dvec3(attr[ATTR_NORMAL], attr[ATTR_NORMAL + 1], attr[ATTR_NORMAL + 2]);
+					fragment.worldPos = dvec3(attr[ATTR_WORLD_POS], attr[ATTR_WORLD_POS + 1], attr[ATTR_WORLD_POS + 2]);
+					if (numAttributes > ATTR_MATERIAL) {
+						const double *m = attr + ATTR_MATERIAL;
+						fragment.material.ambient = color(m[0], m[1], m[2]);
+						fragment.material.diffuse = color(m[3], m[4], m[5]);
+						fragment.material.specular = color(m[6], m[7], m[8]);
+						fragment.material.shininess = m[9];
+						fragment.material.alpha = m[10];
+					}
+					FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
+				}
+			}
+
+			if (wroteBlock) {
+				wroteTile = true;
+				if (blockFarZ != nullptr) {
+					*blockFarZ = farthestDepth(tile, bx, by);
+				}
+			}
+		}
+	}
+	return wroteTile;
 }
 
 /**
  * @fn	void drawFilledTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos, 
  *								const vector<LightSourcePtr> &lights, 
  *								const VertexData &v0, const VertexData &v1, const VertexData &v2, 
- *								const dmat4 &viewingMatrix)
- * @brief	Draw filled triangle.
+ *								const Frame &eyeFrame)
+ * @brief	Draw filled triangle, with the fixed point edge function rasterizer.
+ * 			The vertices are snapped to 1/256 pixel, so the inside test is exact
+ * 			and shared edges are drawn once. Attributes are interpolated as a flat
+ * 			array, and the material only when the vertices' materials differ.
  * @param [in,out]	frameBuffer  	Framebuffer.
  * @param 		  	eyePos		 	Eye position.
  * @param 		  	lights		 	Vector of lights in scene.
@@ -639,45 +908,13 @@ void drawFilledTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos,
 						const vector<LightSourcePtr> &lights,
 						const VertexData &v0, const VertexData &v1, const VertexData &v2,
 						const Frame &eyeFrame) {
-	// Find minimimum and maximum x and y limits for the triangle
-	double xMin = glm::floor(min(v0.pos.x, v1.pos.x, v2.pos.x));
-	double xMax = glm::ceil(max(v0.pos.x, v1.pos.x, v2.pos.x));
-	double yMin = glm::floor(min(v0.pos.y, v1.pos.y, v2.pos.y));
-	double yMax = glm::ceil(max(v0.pos.y, v1.pos.y, v2.pos.y));
-
-	double fAlpha = f12(v0, v1, v2, v0.pos.x, v0.pos.y);
-	double fBeta = f20(v0, v1, v2, v1.pos.x, v1.pos.y);
-	double fGamma = f01(v0, v1, v2, v2.pos.x, v2.pos.y);
-
-	for (double y = yMin; y <= yMax; y++) {
-		for (double x = xMin; x <= xMax; x++) {	
-			// Calculate the weights for inperpolation
-			// If any weight is negative, the fragment is not in the triangle
-			double alpha = f12(v0, v1, v2, x, y) / fAlpha;
-			double beta = f20(v0, v1, v2, x, y) / fBeta;
-			double gamma = f01(v0, v1, v2, x, y) / fGamma;
-
-			// Determine if the pixel position is inside the triangle
-			if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-				if ((alpha > 0 || fAlpha * f12(v0, v1, v2, -1, -1) > 0) &&
-					(beta > 0 || fBeta * f20(v0, v1, v2, -1, -1) > 0) &&
-					(gamma > 0 || fGamma * f01(v0, v1, v2, -1, -1) > 0)) {
-						Fragment fragment;
-
-						// Interpolate vertex attributes using alpha, beta, and gamma weights
-						fragment.material = barycentricWeighting(alpha, beta, gamma,
-																v0.material, v1.material, v2.material);
-						fragment.worldNormal = barycentricWeighting(alpha, beta, gamma,
-																	v0.normal, v1.normal, v2.normal);
-						fragment.worldPos = barycentricWeighting(alpha, beta, gamma,
-																	v0.worldPos, v1.worldPos, v2.worldPos);
-						double z = barycentricWeighting(alpha, beta, gamma,
-														v0.pos.z, v1.pos.z, v2.pos.z);
-						fragment.windowPos = dvec3(x, y, z);
-						FragmentOps::processFragment(frameBuffer, eyePos, lights, fragment, eyeFrame);
-				}
-			}
-		}
+	TriangleSetup setup;
+	int width = frameBuffer.getWindowWidth();
+	int height = frameBuffer.getWindowHeight();
+	if (setupTriangle(v0, v1, v2, width, height, setup)) {
+		RasterTile tile = { 0, 0, width - 1, height - 1, frameBuffer.getDepthBuffer(), width,
+								frameBuffer.isReversedZ(), nullptr, 0, nullptr };
+		rasterizeTriangle(frameBuffer, eyePos, lights, setup, tile, eyeFrame);
 	}
 }
 
@@ -9,10 +9,117 @@
 
 #pragma once
 
+#include <cstdint>
 #include "defs.h"
 #include "fragmentops.h"
+#include "gbuffer.h"
 #include "vertexdata.h"
 
+const int SUBPIXEL_BITS = 8;						//!< Window coordinates are snapped to 1/256 pixel.
+const int64_t SUBPIXEL_ONE = (int64_t)1 << SUBPIXEL_BITS;
+const int RASTER_BLOCK_SIZE = 8;					//!< Blocks are accepted or rejected as a whole when possible.
+const double RASTER_GUARD_BAND = 1048576.0;		//!< Vertices up to this many pixels from the origin are
+													//!< drawn without clipping; the edge functions stay
+													//!< well inside 64 bits.
+
+// Layout of the attributes interpolated across a triangle. Material comes last
+// so it can be left out when all three vertices share one.
+const int ATTR_Z = 0;
+const int ATTR_NORMAL = 1;
+const int ATTR_WORLD_POS = 4;
+const int ATTR_MATERIAL = 7;
+const int NUM_GEOMETRY_ATTRIBUTES = 7;
+const int NUM_ATTRIBUTES = 18;
+
+// Results of EdgeSetup::classifyRect.
+const int RECT_OUTSIDE = 0;
+const int RECT_PARTIAL = 1;
+const int RECT_INSIDE = 2;
+
+/**
+ * @fn	template <class T> inline bool depthBehind(T a, T b, bool reversedZ)
+ * @brief	True if depth a is farther away than depth b.
+ */
+
+template <class T>
+inline bool depthBehind(T a, T b, bool reversedZ) {
+	return reversedZ ? a < b : a > b;
+}
+
+/**
+ * @struct	EdgeSetup
+ * @brief	The edge functions of a triangle. Edge i is the edge opposite vertex
+ * 			i; its value at pixel (x, y) is stepX[i] * x + stepY[i] * y + offset[i],
+ * 			computed exactly in fixed point. It is non-negative inside the
+ * 			triangle, and the top-left rule is folded into offset so that pixels
+ * 			exactly on an edge shared by two triangles are drawn once.
+ */
+
+struct EdgeSetup {
+	int64_t stepX[3];		//!< Change in each edge function per pixel in x.
+	int64_t stepY[3];		//!< Change in each edge function per pixel in y.
+	int64_t offset[3];		//!< Each edge function at pixel (0, 0).
+	double invArea;			//!< 1 / twice the triangle's area, in fixed point units.
+	int xMin, xMax;			//!< Pixel bounds, clipped to the window.
+	int yMin, yMax;
+
+	int64_t edge(int i, int x, int y) const {
+		return stepX[i] * x + stepY[i] * y + offset[i];
+	}
+	int classifyRect(int x0, int y0, int x1, int y1) const;
+};
+
+/**
+ * @struct	TriangleSetup
+ * @brief	A triangle ready to rasterize: its edge functions and its attributes,
+ * 			stored as base + w1 * d1 + w2 * d2 so they interpolate with two
+ * 			multiply-adds each.
+ */
+
+struct TriangleSetup {
+	EdgeSetup edges;				//!< Coverage.
+	double base[NUM_ATTRIBUTES];	//!< Attributes of the first vertex.
+	double d1[NUM_ATTRIBUTES];		//!< Second vertex minus the first.
+	double d2[NUM_ATTRIBUTES];		//!< Third vertex minus the first.
+	int numAttributes;				//!< NUM_GEOMETRY_ATTRIBUTES if the material is constant.
+	Material material;				//!< The material, if constant.
+	uint32_t materialIds[3];		//!< G-buffer material of each vertex, when drawing into one.
+	double zMin, zMax;				//!< Smallest and largest depth of the three vertices.
+
+	double depthAt(int x, int y) const {
+		return base[ATTR_Z] + edges.edge(1, x, y) * edges.invArea * d1[ATTR_Z]
+							+ edges.edge(2, x, y) * edges.invArea * d2[ATTR_Z];
+	}
+	double nearestZ(bool reversedZ) const { return reversedZ ? zMax : zMin; }
+};
+
+/**
+ * @struct	RasterTile
+ * @brief	A rectangle of the window that a triangle is drawn into, and the depth
+ * 			buffer it is tested against. The rectangle's origin must be a multiple
+ * 			of RASTER_BLOCK_SIZE.
+ * 			
+ * 			blockFarZ, if not null, is a coarse level of hierarchical Z: the
+ * 			farthest depth in each RASTER_BLOCK_SIZE square block of the tile.
+ * 			Blocks the triangle is entirely behind are skipped without looking at
+ * 			their pixels, and the entries are kept up to date as depths are written.
+ *
+ * 			If gbuffer is not null the triangle is drawn for deferred shading: each
+ * 			pixel that passes the depth test gets a normal and a material id in the
+ * 			G-buffer instead of being shaded.
+ */
+
+struct RasterTile {
+	int x0, y0;			//!< Lower left pixel.
+	int x1, y1;			//!< Upper right pixel, inclusive.
+	DepthValue *depth;	//!< Depth of pixel (x, y) is depth[(y - y0) * stride + x - x0].
+	int stride;			//!< Row length of depth.
+	bool reversedZ;		//!< True if larger depths are nearer.
+	DepthValue *blockFarZ;	//!< Farthest depth in each block, row by row, or null.
+	int blockStride;	//!< Row length of blockFarZ.
+	GBuffer *gbuffer;	//!< Where deferred pixels go, or null to shade them now.
+};
+
 void drawAxisOnWindow(FrameBuffer &frameBuffer);
 void drawWirePolygon(FrameBuffer &frameBuffer, const vector<dvec3> &pts, const color &rgb);
 void drawLine(FrameBuffer &frameBuffer, int x1, int y1, int x2, int y2, const color &C);
@@ -29,9 +136,17 @@ void drawWireFrameTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos,
 							const VertexData &v0, const VertexData &v1, const VertexData &v2,
 							const Frame& eyeFrame);
 void drawFilledTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos, 
-						vector<LightSourcePtr> &lights, const VertexData &v0,
+						const vector<LightSourcePtr> &lights, const VertexData &v0,
 						const VertexData &v1, const VertexData &v2,
 						const Frame& eyeFrame);
+DepthValue farthestDepth(const RasterTile &tile, int bx, int by);
+bool setupTriangle(const VertexData &v0, const VertexData &v1, const VertexData &v2,
+					int width, int height, TriangleSetup &setup,
+					GBuffer *gbuffer = nullptr);
+bool rasterizeTriangle(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+						const vector<LightSourcePtr> &lights,
+						const TriangleSetup &setup, const RasterTile &tile,
+						const Frame &eyeFrame);
 void drawManyWireFrameTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos, 
 								const vector<LightSourcePtr> &lights, 
 								const vector<VertexData> &vertices,
@@ -6,6 +6,9 @@
  * of this material is prohibited unless prior written
  * permission is granted.
  ****************************************************/
+#include <cmath>
+#include <cstdint>
+#include <utility>
 #include "raytracer.h"
 #include "ishape.h"
 #include "io.h"
@@ -17,119 +20,268 @@
  */
 
 RayTracer::RayTracer(const color &defa)
-	: defaultColor(defa) {
+	: defaultColor(defa), adaptiveSampling(true), sampler(new SobolSampler) {
+}
+
+/**
+ * @fn	RayTracer::~RayTracer()
+ * @brief	Destroys the ray tracer and its sampler.
+ */
+
+RayTracer::~RayTracer() {
+	delete sampler;
+}
+
+/**
+ * @fn	void RayTracer::setSampler(SamplerType type, uint32_t seed)
+ * @brief	Changes how the supersamples are placed within a pixel.
+ * @param	type	The kind of sampler.
+ * @param	seed	Varies the samples, but the same seed always gives the same image.
+ */
+
+void RayTracer::setSampler(SamplerType type, uint32_t seed) {
+	Sampler *newSampler = Sampler::create(type, seed);
+	if (newSampler != nullptr) {
+		delete sampler;
+		sampler = newSampler;
+	}
 }
 
 /**
  * @fn	void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth, const IScene &theScene) const
- * @brief	Raytrace scene
+ * @brief	Raytrace scene. Each pixel gets N x N samples, placed by the
+ * 			sampler. With adaptiveSampling, each pixel first gets one sample,
+ * 			and the rays of its differential are checked for whether they hit
+ * 			the same objects. Only pixels where they do not get the full
+ * 			N x N samples. The camera makes the rays a batch at a time
+ * 			(RaytracingCamera::getRays).
  * @param [in,out]	frameBuffer	Framebuffer.
  * @param 		  	depth	   	The current depth of recursion.
  * @param 		  	theScene   	The scene.
+ * @param 		  	N		   	Samples per pixel along each axis.
  */
 
 void RayTracer::raytraceScene(FrameBuffer &frameBuffer, int depth,
 								const IScene &theScene, int N) const {
 	const RaytracingCamera &camera = *theScene.camera;
-	const vector<VisibleIShapePtr> &objs = theScene.opaqueObjs;
-	const vector<VisibleIShapePtr>& transObjs = theScene.transparentObjs;
-	const vector<PositionalLightPtr> &lights = theScene.lights;
-
-	for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
-		for (int x = 0; x < frameBuffer.getWindowWidth(); ++x) {
-			DEBUG_PIXEL = (x == xDebug && y == yDebug);
-			/* CSE 386 - todo  */
-		
-			HitRecord hit; 
-			HitRecord transHit; // trans hit
-			color sum = black; // anti-ailising
-			color clr;
-
-			for (int i = 0; i < N; i++) {
-				for (int j = 0; j < N; j++) {
-					// off set antiaisling
-					Ray ray = camera.getRay(x + (1.0 / (2.0 * N)) + (j * ( 1.0 / N )), y + (1.0 / (2.0 * N)) + (i * ( 1.0 / N))); 
-					VisibleIShape::findIntersection(ray, objs, hit); // opaque hit
-					VisibleIShape::findIntersection(ray, transObjs, transHit);
-					
-					// backfaces
-					dvec3 d = ray.origin - hit.interceptPt;
-					if (glm::dot(hit.normal, -d) > 0) {
-						hit.normal = -hit.normal;
-					}
-
-					if (hit.t != FLT_MAX && transHit.t == FLT_MAX) { // opaque hit no trans hit
-						if (hit.texture != nullptr) {
-							color texel = hit.texture->getPixelUV(hit.u, hit.v);
-							clr = traceIndividualRay(ray, theScene, depth); 
-							color mixture = texel / 2.0 + clr / 2.0;
-							sum += mixture;
-						}
-						else {
-							clr = traceIndividualRay(ray, theScene, depth);
-							sum += clr;
-						}
-					}
-					else if (hit.t != FLT_MAX && transHit.t != FLT_MAX) { // opaque hit and trans hit true
-						if (hit.t < transHit.t) {
-							if (DEBUG_PIXEL) {
-								cout << "";
-							}
-							clr = calTotalColor(theScene, hit, objs);
-							sum += clr;
-
-							if (hit.texture != nullptr) {
-								color texel = hit.texture->getPixelUV(hit.u, hit.v);
-								clr = 0.5 * clr + 0.5 * texel;
-								sum += clr;
-							}
-						}
-						else {
-							color source = transHit.material.ambient;
-							color des;
-							des = calTotalColor(theScene, hit, objs);
-							clr = (1 - transHit.material.alpha) * des + transHit.material.alpha * source;
-							if (hit.texture != nullptr) {
-								color texel = hit.texture->getPixelUV(hit.u, hit.v);
-								clr = 0.5 * clr + 0.5 * texel;
-							}
-							sum += clr;
-						}
-
-					}
-					else if (transHit.t != FLT_MAX && hit.t == FLT_MAX) { // only trans hit 
-						color backG = defaultColor;
-						color blend = calTotalColor(theScene, transHit, transObjs) + backG;
-						sum += blend;
-					}
-					else { // no hit 
-						color c = defaultColor;
-						sum += c;
-					}
-				}
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const bool adaptive = adaptiveSampling && N > 1;
+	const uint8_t EDGE_X = 1, EDGE_Y = 2;
+	vector<color> firstSamples;
+	vector<uint8_t> edges;
+	// The camera's rays come a row at a time. A row has one extra ray on the
+	// right, and together with the row one pixel up it gives each ray its
+	// differentials.
+	RayBatch row, nextRow, axisRays;
+	const int samplesPerPixel = N * N;
+
+	if (adaptive) {
+		firstSamples.resize((size_t)W * H);
+		edges.resize((size_t)W * H);
+		camera.getRays(0.5, 0.5, W + 1, nextRow);
+		for (int y = 0; y < H; ++y) {
+			// This row was the previous row's next one.
+			std::swap(row, nextRow);
+			camera.getRays(0.5, y + 1.5, W + 1, nextRow);
+			for (int x = 0; x < W; ++x) {
+				DEBUG_PIXEL = (x == xDebug && y == yDebug);
+				size_t pixel = (size_t)y * W + x;
+				RayDifferential differential;
+				Ray ray = row.rayWithDifferentials(x, nextRow, differential);
+				const IShape *shapes[2], *xShapes[2], *yShapes[2];
+				firstSamples[pixel] = traceSample(ray, differential, theScene, depth, shapes);
+				findHitShapes(row.ray(x + 1), theScene, xShapes);
+				findHitShapes(nextRow.ray(x), theScene, yShapes);
+				edges[pixel] = (xShapes[0] != shapes[0] || xShapes[1] != shapes[1] ? EDGE_X : 0) |
+							(yShapes[0] != shapes[0] || yShapes[1] != shapes[1] ? EDGE_Y : 0);
 			}
-			sum /=  N * N;
-			frameBuffer.setColor(x, y, sum);
-			
-			frameBuffer.showAxes(x, y, camera.getRay(x,y), 0.25);			// Displays R/x, G/y, B/z axes
+		}
+	}
+
+	vector<color> sums(W);
+	vector<uint8_t> refine(W);
+	vector<int> refined;			// the pixels of a row that are supersampled
+	vector<dvec2> samples;			// their sample positions, samplesPerPixel each
+	vector<dvec2> points;			// where one sample of each goes, and one pixel right and up of it
+	for (int y = 0; y < H; ++y) {
+		refined.clear();
+		for (int x = 0; x < W; ++x) {
+			size_t pixel = (size_t)y * W + x;
+			refine[x] = !adaptive || edges[pixel] != 0 ||
+						(x > 0 && (edges[pixel - 1] & EDGE_X)) || (y > 0 && (edges[pixel - W] & EDGE_Y));
+			sums[x] = refine[x] ? black : firstSamples[pixel];
+			if (refine[x]) {
+				refined.push_back(x);
+			}
+		}
+
+		const size_t M = refined.size();
+		samples.resize(M * samplesPerPixel);
+		points.resize(3 * M);
+		for (size_t k = 0; k < M; k++) {
+			sampler->getSamples(refined[k], y, 0, samplesPerPixel, &samples[k * samplesPerPixel]);
+		}
+		for (int s = 0; s < samplesPerPixel && M > 0; s++) {
+			// off set antiaisling
+			for (size_t k = 0; k < M; k++) {
+				points[k] = dvec2(refined[k], y) + samples[k * samplesPerPixel + s];
+				points[M + k] = points[k] + dvec2(1, 0);
+				points[2 * M + k] = points[k] + dvec2(0, 1);
+			}
+			camera.getRays(points.data(), (int)points.size(), row);
+			for (size_t k = 0; k < M; k++) {
+				int x = refined[k];
+				DEBUG_PIXEL = (x == xDebug && y == yDebug);
+				RayDifferential differential;
+				Ray ray = row.rayWithDifferentials(k, M + k, 2 * M + k, differential);
+				differential.scaleDifferentials(ray, 1.0 / N);
+				sums[x] += traceSample(ray, differential, theScene, depth);
+			}
+		}
+
+		camera.getRays(0, y, W, axisRays);
+		for (int x = 0; x < W; ++x) {
+			frameBuffer.setColor(x, y, refine[x] ? sums[x] / (double)(N * N) : sums[x]);
+
+			frameBuffer.showAxes(x, y, axisRays.ray(x), 0.25);			// Displays R/x, G/y, B/z axes
 		}
 	}
 
 	frameBuffer.showColorBuffer();
 }
 
+/**
+ * @fn	void RayTracer::findHitShapes(const Ray &ray, const IScene &theScene, const IShape *shapes[2]) const
+ * @brief	Finds which opaque and which transparent shape a ray hits first,
+ * 			without shading anything.
+ * @param 		  	ray			The ray.
+ * @param 		  	theScene	The scene.
+ * @param [in,out]	shapes  	The opaque and the transparent shape, null if none.
+ */
+
+void RayTracer::findHitShapes(const Ray &ray, const IScene &theScene, const IShape *shapes[2]) const {
+	HitRecord hit, transHit;
+	theScene.findOpaqueIntersection(ray, hit);
+	theScene.findTransparentIntersection(ray, transHit);
+	shapes[0] = hit.t != FLT_MAX ? hit.shape : nullptr;
+	shapes[1] = transHit.t != FLT_MAX ? transHit.shape : nullptr;
+}
+
+/**
+ * @fn	color RayTracer::traceSample(const Ray &ray, const RayDifferential &differential, const IScene &theScene, int depth, const IShape *shapes[2]) const
+ * @brief	Computes the color of one camera ray.
+ * @param 		  	ray				The ray.
+ * @param 		  	differential	Its differentials, for filtering textures.
+ * @param 		  	theScene		The scene.
+ * @param 		  	depth			The depth of recursion.
+ * @param [in,out]	shapes			If not null, set to the opaque and the
+ * 									transparent shape hit, null if none.
+ * @return	The color.
+ */
+
+color RayTracer::traceSample(const Ray &ray, const RayDifferential &differential,
+								const IScene &theScene, int depth, const IShape *shapes[2]) const {
+	HitRecord hit; 
+	HitRecord transHit; // trans hit
+	color sum = black;
+	color clr;
+
+	theScene.findOpaqueIntersection(ray, hit); // opaque hit
+	theScene.findTransparentIntersection(ray, transHit);
+
+	// backfaces
+	dvec3 d = ray.origin - hit.interceptPt;
+	if (glm::dot(hit.normal, -d) > 0) {
+		hit.normal = -hit.normal;
+	}
+
+	if (hit.t != FLT_MAX && transHit.t == FLT_MAX) { // opaque hit no trans hit
+		clr = traceIndividualRay(ray, differential, theScene, depth);
+		sum += clr;
+	}
+	else if (hit.t != FLT_MAX && transHit.t != FLT_MAX) { // opaque hit and trans hit true
+		if (hit.t < transHit.t) {
+			if (DEBUG_PIXEL) {
+				cout << "";
+			}
+			clr = calTotalColor(theScene, hit, false);
+			sum += clr;
+
+			if (hit.texture != nullptr) {
+				color texel = texelColor(hit, differential);
+				clr = 0.5 * clr + 0.5 * texel;
+				sum += clr;
+			}
+		}
+		else {
+			color source = transHit.material.ambient;
+			color des;
+			des = calTotalColor(theScene, hit, false);
+			clr = (1 - transHit.material.alpha) * des + transHit.material.alpha * source;
+			if (hit.texture != nullptr) {
+				color texel = texelColor(hit, differential);
+				clr = 0.5 * clr + 0.5 * texel;
+			}
+			sum += clr;
+		}
+
+	}
+	else if (transHit.t != FLT_MAX && hit.t == FLT_MAX) { // only trans hit 
+		color backG = defaultColor;
+		color blend = calTotalColor(theScene, transHit, true) + backG;
+		sum += blend;
+	}
+	else { // no hit 
+		color c = defaultColor;
+		sum += c;
+	}
+	if (shapes != nullptr) {
+		shapes[0] = hit.t != FLT_MAX ? hit.shape : nullptr;
+		shapes[1] = transHit.t != FLT_MAX ? transHit.shape : nullptr;
+	}
+	return sum;
+}
+
+/**
+ * @fn	color RayTracer::texelColor(const HitRecord &hit, const RayDifferential &differential) const
+ * @brief	Looks up the hit's texture. If the differentials give a footprint,
+ * 			the texture coordinates at its corners are found from the shape,
+ * 			and the lookup is filtered over it; otherwise it is point sampled.
+ * @param	hit				The hit. Must have a texture.
+ * @param	differential	The differentials of the ray that made the hit.
+ * @return	The texture's color.
+ */
+
+color RayTracer::texelColor(const HitRecord &hit, const RayDifferential &differential) const {
+	dvec3 dpdx, dpdy;
+	if (hit.shape == nullptr || !differential.footprint(hit, dpdx, dpdy)) {
+		return hit.texture->getPixelUV(hit.u, hit.v);
+	}
+	double ux = hit.u, vx = hit.v, uy = hit.u, vy = hit.v;
+	hit.shape->getTexCoords(hit.interceptPt + dpdx, ux, vx);
+	hit.shape->getTexCoords(hit.interceptPt + dpdy, uy, vy);
+	// Across a seam (e.g., where a cylinder's u wraps from 1 to 0) the short way round is meant.
+	auto wrap = [](double d) { return std::abs(d) > 0.5 ? d - std::round(d) : d; };
+	return hit.texture->getPixelUV(hit.u, hit.v, wrap(ux - hit.u), wrap(vx - hit.v),
+									wrap(uy - hit.u), wrap(vy - hit.v));
+}
+
 /**
  * @fn	color RayTracer::traceIndividualRay(const Ray &ray, 
+ *											const RayDifferential &differential,
  *											const IScene &theScene,
  *											int recursionLevel) const
  * @brief	Trace an individual ray.
  * @param	ray			  	The ray.
+ * @param	differential  	Its differentials, for filtering textures.
  * @param	theScene	  	The scene.
  * @param	recursionLevel	The recursion level.
  * @return	The color to be displayed as a result of this ray.
  */
 
-color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel) const {
+color RayTracer::traceIndividualRay(const Ray& ray, const RayDifferential& differential,
+										const IScene& theScene, int recursionLevel) const {
 	/* CSE 386 - todo  */
 	// This might be a useful helper function.
 	HitRecord hit, reflectHit;
@@ -138,30 +290,35 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 	const vector<PositionalLightPtr>& lights = theScene.lights;
 	const RaytracingCamera& camera = *theScene.camera;
 
-	VisibleIShape::findIntersection(ray, theScene.opaqueObjs, hit);
-	dvec3 origin = hit.interceptPt + EPSILON * hit.normal; // reflection origin
+	theScene.findOpaqueIntersection(ray, hit);
 	dvec3 direction = ray.dir - 2 * (glm::dot(ray.dir, hit.normal)) * hit.normal; // reflection direction
-	VisibleIShape::findIntersection(Ray(origin, direction), theScene.opaqueObjs, reflectHit);
+	dvec3 origin = IShape::movePointOffSurface(hit, direction); // reflection origin
+	theScene.findOpaqueIntersection(Ray(origin, direction), reflectHit);
 	if (hit.t != FLT_MAX) {
 		
 		if (reflectHit.t != FLT_MAX) {
 			for (int j = 0; j < lights.size(); j++) {
 				color c = lights[j]->illuminate(hit.interceptPt, hit.normal, hit.material, camera.getFrame(),
-					inShadow(lights[j]->actualPosition(theScene.camera->getFrame()), hit.interceptPt, hit.normal, theScene.opaqueObjs));
+					inShadow(lights[j]->actualPosition(theScene.camera->getFrame()), hit, theScene));
 				totalLight += c;
 			} 
 
-			if (recursionLevel == 0) { return totalLight; }
-			totalLight += 0.3 * traceIndividualRay(Ray(origin, direction), theScene, recursionLevel - 1);
+			if (recursionLevel > 0) {
+				totalLight += 0.3 * traceIndividualRay(Ray(origin, direction), differential.reflected(hit, origin),
+														theScene, recursionLevel - 1);
+			}
 		} 
 		else {
 			for (int j = 0; j < lights.size(); j++) {
 				color c = lights[j]->illuminate(hit.interceptPt, hit.normal, hit.material, camera.getFrame(),
-					inShadow(lights[j]->actualPosition(theScene.camera->getFrame()), hit.interceptPt, hit.normal, theScene.opaqueObjs));
+					inShadow(lights[j]->actualPosition(theScene.camera->getFrame()), hit, theScene));
 				clr += c;
 			}
 			totalLight = clr;
 		}
+		if (hit.texture != nullptr) {
+			totalLight = texelColor(hit, differential) / 2.0 + totalLight / 2.0;
+		}
 	}
 	return totalLight;
 }
@@ -169,7 +326,7 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 /**
 * Helper method to calculate the total color
 */
-color RayTracer::calTotalColor(const IScene& theScene, HitRecord& hit, const vector<VisibleIShapePtr>& objs) const {
+color RayTracer::calTotalColor(const IScene& theScene, HitRecord& hit, bool byTransparent) const {
 	color clr;
 
 	const vector<PositionalLightPtr>& lights = theScene.lights;
@@ -177,7 +334,7 @@ color RayTracer::calTotalColor(const IScene& theScene, HitRecord& hit, const vec
 
 	for (int j = 0; j < lights.size(); j++) {
 		color c = lights[j]->illuminate(hit.interceptPt, hit.normal, hit.material, camera.getFrame(),
-			inShadow(lights[j]->actualPosition(theScene.camera->getFrame()), hit.interceptPt, hit.normal, objs));
+			inShadow(lights[j]->actualPosition(theScene.camera->getFrame()), hit, theScene, byTransparent));
 		clr += c;
 	}
 	return clr;
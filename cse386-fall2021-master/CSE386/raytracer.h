@@ -13,6 +13,7 @@
 #include "framebuffer.h"
 #include "camera.h"
 #include "iscene.h"
+#include "sampler.h"
 
 /**
  * @struct	RayTracer
@@ -21,10 +22,23 @@
 
 struct RayTracer {
 	color defaultColor;
+	bool adaptiveSampling;		//!< Supersample only the pixels on the edges of objects.
 	RayTracer(const color &defaultColor);
+	RayTracer(const RayTracer &) = delete;
+	RayTracer &operator = (const RayTracer &) = delete;
+	~RayTracer();
+	void setSampler(SamplerType type, uint32_t seed = 0);
+	const Sampler &getSampler() const { return *sampler; }
 	void raytraceScene(FrameBuffer &frameBuffer, int depth,
 						const IScene &theScene, int N) const;
 protected:
-	color calTotalColor(const IScene& theScene, HitRecord& hit, const vector<VisibleIShapePtr>& objs) const;
-	color traceIndividualRay(const Ray &ray, const IScene &theScene, int recursionLevel) const;
+	Sampler *sampler;			//!< Places the supersamples within a pixel.
+
+	color calTotalColor(const IScene& theScene, HitRecord& hit, bool byTransparent) const;
+	color traceIndividualRay(const Ray &ray, const RayDifferential &differential,
+								const IScene &theScene, int recursionLevel) const;
+	color traceSample(const Ray &ray, const RayDifferential &differential,
+						const IScene &theScene, int depth, const IShape *shapes[2] = nullptr) const;
+	void findHitShapes(const Ray &ray, const IScene &theScene, const IShape *shapes[2]) const;
+	color texelColor(const HitRecord &hit, const RayDifferential &differential) const;
 };
\ No newline at end of file
@@ -0,0 +1,242 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include "sampler.h"
+
+/**
+ * @fn	static uint32_t mixBits(uint32_t h)
+ * @brief	Scrambles the bits of h, so that inputs differing in one bit give
+ * 			unrelated outputs.
+ * @param	h	The bits.
+ * @return	The scrambled bits.
+ */
+
+static uint32_t mixBits(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+/**
+ * @fn	static double toUnit(uint32_t bits)
+ * @brief	Maps 32 bits to [0, 1).
+ */
+
+static double toUnit(uint32_t bits) {
+	return bits * (1.0 / 4294967296.0);
+}
+
+/**
+ * @fn	static double randomUnit(uint32_t hash, uint32_t k)
+ * @brief	The k'th random number in [0, 1) of the stream named by hash.
+ */
+
+static double randomUnit(uint32_t hash, uint32_t k) {
+	return toUnit(mixBits(hash + k * 0x9e3779b9u));
+}
+
+/**
+ * @fn	void Sampler::getSamples(int x, int y, int dimension, int n, dvec2 *samples) const
+ * @brief	Gets the sample points for a pixel. A single sample is at the center
+ * 			of the square.
+ * @param 		  	x		 	The pixel's x coordinate.
+ * @param 		  	y		 	The pixel's y coordinate.
+ * @param 		  	dimension	Which use the points are for. 0 is the pixel
+ * 								area itself.
+ * @param 		  	n		 	Number of points.
+ * @param [in,out]	samples  	The points, in [0, 1) x [0, 1).
+ */
+
+void Sampler::getSamples(int x, int y, int dimension, int n, dvec2 *samples) const {
+	if (n == 1) {
+		samples[0] = dvec2(0.5, 0.5);
+	} else if (n > 1) {
+		generate(pixelHash(x, y, dimension), dimension, n, samples);
+	}
+}
+
+/**
+ * @fn	uint32_t Sampler::pixelHash(int x, int y, int dimension) const
+ * @brief	Random bits for one pixel and dimension, from which its points are
+ * 			made.
+ */
+
+uint32_t Sampler::pixelHash(int x, int y, int dimension) const {
+	uint32_t h = mixBits(seed + 0x9e3779b9u);
+	h = mixBits(h ^ (uint32_t)x);
+	h = mixBits((h + 0x85ebca6bu) ^ (uint32_t)y);
+	return mixBits(h ^ ((uint32_t)dimension * 0xc2b2ae35u + 0x27d4eb2fu));
+}
+
+/**
+ * @fn	Sampler *Sampler::create(SamplerType type, uint32_t seed)
+ * @brief	Creates a sampler of the given type. The caller owns it.
+ * @param	type	The type.
+ * @param	seed	The seed.
+ * @return	The sampler, or null if the type is not one.
+ */
+
+Sampler *Sampler::create(SamplerType type, uint32_t seed) {
+	switch (type) {
+	case GRID_SAMPLER:			return new GridSampler(seed);
+	case STRATIFIED_SAMPLER:	return new StratifiedSampler(seed);
+	case HALTON_SAMPLER:		return new HaltonSampler(seed);
+	case SOBOL_SAMPLER:			return new SobolSampler(seed);
+	case BLUE_NOISE_SAMPLER:	return new BlueNoiseSampler(seed);
+	default:					return nullptr;
+	}
+}
+
+/**
+ * @fn	static void gridSize(int n, int &cols, int &rows)
+ * @brief	The grid used for n points: as close to square as possible. If n
+ * 			is not a square, the last row is not full.
+ */
+
+static void gridSize(int n, int &cols, int &rows) {
+	cols = (int)std::ceil(std::sqrt((double)n));
+	rows = (n + cols - 1) / cols;
+}
+
+/**
+ * @fn	void GridSampler::generate(uint32_t hash, int dimension, int n, dvec2 *samples) const
+ * @brief	Puts point i in cell i of the grid, at its center.
+ */
+
+void GridSampler::generate(uint32_t /*hash*/, int /*dimension*/, int n, dvec2 *samples) const {
+	int cols, rows;
+	gridSize(n, cols, rows);
+	for (int i = 0; i < n; i++) {
+		samples[i] = dvec2((i % cols + 0.5) / cols, (i / cols + 0.5) / rows);
+	}
+}
+
+/**
+ * @fn	void StratifiedSampler::generate(uint32_t hash, int dimension, int n, dvec2 *samples) const
+ * @brief	Puts point i in cell i of the grid, at a random place.
+ */
+
+void StratifiedSampler::generate(uint32_t hash, int /*dimension*/, int n, dvec2 *samples) const {
+	int cols, rows;
+	gridSize(n, cols, rows);
+	for (int i = 0; i < n; i++) {
+		samples[i] = dvec2((i % cols + randomUnit(hash, 2 * i)) / cols,
+							(i / cols + randomUnit(hash, 2 * i + 1)) / rows);
+	}
+}
+
+/**
+ * @fn	static double radicalInverse(uint32_t i, uint32_t base)
+ * @brief	Mirrors the digits of i in the given base about the radix point,
+ * 			e.g., 6 = 110 in base 2 gives 0.011 = 0.375.
+ */
+
+static double radicalInverse(uint32_t i, uint32_t base) {
+	const double invBase = 1.0 / base;
+	double result = 0, scale = invBase;
+	for (; i != 0; i /= base, scale *= invBase) {
+		result += (i % base) * scale;
+	}
+	return result;
+}
+
+/**
+ * @fn	void HaltonSampler::generate(uint32_t hash, int dimension, int n, dvec2 *samples) const
+ * @brief	Takes Halton points 0 to n - 1 and shifts them, wrapping around.
+ */
+
+void HaltonSampler::generate(uint32_t hash, int dimension, int n, dvec2 *samples) const {
+	static const uint32_t PRIMES[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+	const int NUM_PRIMES = sizeof(PRIMES) / sizeof(PRIMES[0]);
+	const uint32_t baseX = PRIMES[(2 * dimension) % NUM_PRIMES];
+	const uint32_t baseY = PRIMES[(2 * dimension + 1) % NUM_PRIMES];
+	const dvec2 shift(randomUnit(hash, 0), randomUnit(hash, 1));
+	for (int i = 0; i < n; i++) {
+		dvec2 p = shift + dvec2(radicalInverse(i, baseX), radicalInverse(i, baseY));
+		samples[i] = dvec2(p.x >= 1 ? p.x - 1 : p.x, p.y >= 1 ? p.y - 1 : p.y);
+	}
+}
+
+/**
+ * @fn	static uint32_t reverseBits(uint32_t bits)
+ * @brief	Reverses the order of the bits: the first dimension of the Sobol
+ * 			sequence, scaled by 2^32.
+ */
+
+static uint32_t reverseBits(uint32_t bits) {
+	bits = (bits << 16) | (bits >> 16);
+	bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+	bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+	bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+	bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+	return bits;
+}
+
+/**
+ * @fn	static uint32_t sobolSecond(uint32_t i)
+ * @brief	The second dimension of the Sobol sequence, scaled by 2^32.
+ */
+
+static uint32_t sobolSecond(uint32_t i) {
+	uint32_t result = 0;
+	for (uint32_t v = 1u << 31; i != 0; i >>= 1, v ^= v >> 1) {
+		if (i & 1) {
+			result ^= v;
+		}
+	}
+	return result;
+}
+
+/**
+ * @fn	void SobolSampler::generate(uint32_t hash, int dimension, int n, dvec2 *samples) const
+ * @brief	Takes Sobol points 0 to n - 1 and scrambles them.
+ */
+
+void SobolSampler::generate(uint32_t hash, int /*dimension*/, int n, dvec2 *samples) const {
+	// Flipping the same bits of every point keeps the boxes each one is alone in.
+	const uint32_t scrambleX = mixBits(hash), scrambleY = mixBits(hash + 1);
+	for (int i = 0; i < n; i++) {
+		samples[i] = dvec2(toUnit(reverseBits(i) ^ scrambleX), toUnit(sobolSecond(i) ^ scrambleY));
+	}
+}
+
+/**
+ * @fn	void BlueNoiseSampler::generate(uint32_t hash, int dimension, int n, dvec2 *samples) const
+ * @brief	Adds the points one at a time, each the best of CANDIDATES random ones.
+ */
+
+void BlueNoiseSampler::generate(uint32_t hash, int /*dimension*/, int n, dvec2 *samples) const {
+	const int CANDIDATES = 16;
+	uint32_t k = 0;
+	samples[0] = dvec2(randomUnit(hash, k), randomUnit(hash, k + 1));
+	k += 2;
+	for (int i = 1; i < n; i++) {
+		double bestDist2 = -1;
+		for (int c = 0; c < CANDIDATES; c++, k += 2) {
+			dvec2 candidate(randomUnit(hash, k), randomUnit(hash, k + 1));
+			double minDist2 = 2;
+			for (int j = 0; j < i; j++) {
+				double dx = std::abs(candidate.x - samples[j].x);
+				double dy = std::abs(candidate.y - samples[j].y);
+				dx = std::min(dx, 1 - dx);
+				dy = std::min(dy, 1 - dy);
+				minDist2 = std::min(minDist2, dx * dx + dy * dy);
+			}
+			if (minDist2 > bestDist2) {
+				bestDist2 = minDist2;
+				samples[i] = candidate;
+			}
+		}
+	}
+}
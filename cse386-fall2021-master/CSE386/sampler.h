@@ -0,0 +1,117 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include "defs.h"
+
+/**
+ * @enum	SamplerType
+ * @brief	The kinds of Sampler.
+ */
+
+enum SamplerType { GRID_SAMPLER, STRATIFIED_SAMPLER, HALTON_SAMPLER, SOBOL_SAMPLER, BLUE_NOISE_SAMPLER,
+					NUM_SAMPLER_TYPES };
+
+/**
+ * @struct	Sampler
+ * @brief	Places n sample points in the unit square, e.g., within a pixel
+ * 			for anti-aliasing, or on an area light for soft shadows.
+ *
+ * 			The points depend only on the seed, the pixel, the dimension and n,
+ * 			never on what was sampled before, so an image comes out the same
+ * 			however its pixels are divided among threads. The dimension keeps
+ * 			different uses in one pixel (the lens, a light, ...) from getting
+ * 			the same points.
+ */
+
+struct Sampler {
+	Sampler(uint32_t seed) : seed(seed) {}
+	virtual ~Sampler() {}
+	void getSamples(int x, int y, int dimension, int n, dvec2 *samples) const;
+	virtual std::string name() const = 0;
+	static Sampler *create(SamplerType type, uint32_t seed = 0);
+protected:
+	uint32_t seed;			//!< Varies the points of every pixel.
+
+	virtual void generate(uint32_t hash, int dimension, int n, dvec2 *samples) const = 0;
+	uint32_t pixelHash(int x, int y, int dimension) const;
+};
+
+/**
+ * @struct	GridSampler
+ * @brief	Points at the centers of a regular grid of cells, the same in
+ * 			every pixel. Prone to aliasing; for comparison.
+ */
+
+struct GridSampler : public Sampler {
+	GridSampler(uint32_t seed = 0) : Sampler(seed) {}
+	virtual std::string name() const { return "grid"; }
+protected:
+	virtual void generate(uint32_t hash, int dimension, int n, dvec2 *samples) const;
+};
+
+/**
+ * @struct	StratifiedSampler
+ * @brief	One point at a random place in each cell of a regular grid
+ * 			(jittered sampling).
+ */
+
+struct StratifiedSampler : public Sampler {
+	StratifiedSampler(uint32_t seed = 0) : Sampler(seed) {}
+	virtual std::string name() const { return "stratified"; }
+protected:
+	virtual void generate(uint32_t hash, int dimension, int n, dvec2 *samples) const;
+};
+
+/**
+ * @struct	HaltonSampler
+ * @brief	The first n points of the Halton sequence, in bases 2 and 3 for
+ * 			dimension 0 and the next primes for the others, shifted by a
+ * 			random amount per pixel (modulo 1).
+ */
+
+struct HaltonSampler : public Sampler {
+	HaltonSampler(uint32_t seed = 0) : Sampler(seed) {}
+	virtual std::string name() const { return "halton"; }
+protected:
+	virtual void generate(uint32_t hash, int dimension, int n, dvec2 *samples) const;
+};
+
+/**
+ * @struct	SobolSampler
+ * @brief	The first n points of the two dimensional Sobol sequence, with
+ * 			random digit scrambling per pixel. For n a power of two, every
+ * 			way of cutting the square into n equal boxes with power of two
+ * 			sides (n columns, n rows, and all in between) has one point per box.
+ */
+
+struct SobolSampler : public Sampler {
+	SobolSampler(uint32_t seed = 0) : Sampler(seed) {}
+	virtual std::string name() const { return "sobol"; }
+protected:
+	virtual void generate(uint32_t hash, int dimension, int n, dvec2 *samples) const;
+};
+
+/**
+ * @struct	BlueNoiseSampler
+ * @brief	Points spread evenly without any regular structure, found by
+ * 			Mitchell's best candidate algorithm: each point is the one, out of
+ * 			several random candidates, farthest from the points so far. Distance
+ * 			wraps around the square's edges, so the points stay apart across
+ * 			them too.
+ */
+
+struct BlueNoiseSampler : public Sampler {
+	BlueNoiseSampler(uint32_t seed = 0) : Sampler(seed) {}
+	virtual std::string name() const { return "blue noise"; }
+protected:
+	virtual void generate(uint32_t hash, int dimension, int n, dvec2 *samples) const;
+};
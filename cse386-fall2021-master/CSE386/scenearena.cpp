@@ -0,0 +1,116 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "scenearena.h"
+
+/**
+ * @fn	SceneArena::~SceneArena()
+ * @brief	Destroys everything in the arena and frees its memory.
+ */
+
+SceneArena::~SceneArena() {
+	release();
+	for (ArenaPoolBase *p : pools) {
+		delete p;
+	}
+}
+
+/**
+ * @fn	void SceneArena::clear()
+ * @brief	Destroys every object, newest types first. The memory is kept for
+ * 			the next scene.
+ */
+
+void SceneArena::clear() {
+	for (size_t i = pools.size(); i-- > 0;) {
+		if (pools[i] != nullptr) {
+			pools[i]->clear();
+		}
+	}
+}
+
+/**
+ * @fn	void SceneArena::release()
+ * @brief	Destroys every object and gives the memory back.
+ */
+
+void SceneArena::release() {
+	clear();
+	for (ArenaPoolBase *p : pools) {
+		if (p != nullptr) {
+			p->release();
+		}
+	}
+}
+
+/**
+ * @fn	size_t SceneArena::numObjects() const
+ * @brief	Number of objects in the arena.
+ * @return	The count, over all types.
+ */
+
+size_t SceneArena::numObjects() const {
+	size_t n = 0;
+	for (const ArenaPoolBase *p : pools) {
+		if (p != nullptr) {
+			n += p->size();
+		}
+	}
+	return n;
+}
+
+/**
+ * @fn	size_t SceneArena::bytesUsed() const
+ * @brief	Memory taken by the objects themselves.
+ * @return	Number of bytes.
+ */
+
+size_t SceneArena::bytesUsed() const {
+	size_t n = 0;
+	for (const ArenaPoolBase *p : pools) {
+		if (p != nullptr) {
+			n += p->size() * p->objectSize();
+		}
+	}
+	return n;
+}
+
+/**
+ * @fn	size_t SceneArena::bytesReserved() const
+ * @brief	Memory held by the arena, used or not.
+ * @return	Number of bytes.
+ */
+
+size_t SceneArena::bytesReserved() const {
+	size_t n = 0;
+	for (const ArenaPoolBase *p : pools) {
+		if (p != nullptr) {
+			n += p->capacity() * p->objectSize();
+		}
+	}
+	return n;
+}
+
+/**
+ * @fn	void SceneArena::report(ostream &os) const
+ * @brief	Prints the number of objects and the memory used by each type.
+ * @param [in,out]	os	The stream.
+ */
+
+void SceneArena::report(ostream &os) const {
+	for (const ArenaPoolBase *p : pools) {
+		if (p != nullptr && p->capacity() > 0) {
+			os << p->typeName() << ": " << p->size() << " objects, "
+				<< p->size() * p->objectSize() << " of "
+				<< p->capacity() * p->objectSize() << " bytes" << endl;
+		}
+	}
+	os << "Total: " << numObjects() << " objects, " << bytesUsed() << " of "
+		<< bytesReserved() << " bytes" << endl;
+}
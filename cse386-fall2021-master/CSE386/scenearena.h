@@ -0,0 +1,237 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <cstddef>
+#include <new>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+#include "defs.h"
+
+const size_t ARENA_BLOCK_BYTES = 16 * 1024;	//!< Default block size for a pool.
+
+/**
+ * @struct	ArenaPoolBase
+ * @brief	The type independent part of an ArenaPool.
+ */
+
+struct ArenaPoolBase {
+	virtual ~ArenaPoolBase() {}
+	virtual void clear() = 0;
+	virtual void release() = 0;
+	virtual size_t size() const = 0;
+	virtual size_t capacity() const = 0;
+	virtual size_t objectSize() const = 0;
+	virtual const char *typeName() const = 0;
+};
+
+/**
+ * @struct	ArenaPool
+ * @brief	Holds objects of one type in large blocks. Objects never move, so
+ * 			pointers to them stay valid until the pool is cleared.
+ */
+
+template <class T>
+struct ArenaPool : public ArenaPoolBase {
+	ArenaPool() : current(0) {}
+	ArenaPool(const ArenaPool &) = delete;
+	ArenaPool &operator = (const ArenaPool &) = delete;
+	~ArenaPool() { release(); }
+
+	/**
+	 * @fn	template <class... Args> T *create(Args&&... args)
+	 * @brief	Constructs an object in the pool.
+	 * @param	args	Constructor arguments.
+	 * @return	The new object.
+	 */
+
+	template <class... Args>
+	T *create(Args&&... args) {
+		if (current == blocks.size() || blocks[current].used == blocks[current].capacity) {
+			reserve(1);
+		}
+		Block &block = blocks[current];
+		T *obj = new (block.objs + block.used) T(std::forward<Args>(args)...);
+		block.used++;
+		return obj;
+	}
+
+	/**
+	 * @fn	void reserve(size_t n)
+	 * @brief	Makes sure the next n objects will be contiguous, adding a
+	 * 			block if necessary.
+	 * @param	n	Number of objects.
+	 */
+
+	void reserve(size_t n) {
+		if (current < blocks.size() && blocks[current].capacity - blocks[current].used >= n) {
+			return;
+		}
+		// After a clear, the current block and the ones after it are empty and
+		// can be reused, starting with the current one if it holds nothing yet.
+		size_t at = current < blocks.size() && blocks[current].used > 0 ? current + 1 : current;
+		for (size_t i = at; i < blocks.size(); i++) {
+			if (blocks[i].capacity >= n) {
+				std::swap(blocks[at], blocks[i]);
+				current = at;
+				return;
+			}
+		}
+		size_t perBlock = ARENA_BLOCK_BYTES / sizeof(T);
+		Block block;
+		block.capacity = n > perBlock ? n : (perBlock > 0 ? perBlock : 1);
+		block.used = 0;
+		block.objs = static_cast<T *>(::operator new(block.capacity * sizeof(T)));
+		if (at < blocks.size()) {
+			// Every empty block is too small; grow the first rather than skip it.
+			::operator delete(blocks[at].objs);
+			blocks[at] = block;
+		} else {
+			blocks.push_back(block);
+		}
+		current = at;
+	}
+
+	/**
+	 * @fn	void clear()
+	 * @brief	Destroys every object, newest first, but keeps the blocks for reuse.
+	 */
+
+	void clear() {
+		for (size_t b = blocks.size(); b-- > 0;) {
+			Block &block = blocks[b];
+			while (block.used > 0) {
+				block.objs[--block.used].~T();
+			}
+		}
+		current = 0;
+	}
+
+	/**
+	 * @fn	void release()
+	 * @brief	Destroys every object and frees the blocks.
+	 */
+
+	void release() {
+		clear();
+		for (Block &block : blocks) {
+			::operator delete(block.objs);
+		}
+		blocks.clear();
+	}
+
+	size_t size() const {
+		size_t n = 0;
+		for (const Block &block : blocks) n += block.used;
+		return n;
+	}
+	size_t capacity() const {
+		size_t n = 0;
+		for (const Block &block : blocks) n += block.capacity;
+		return n;
+	}
+	size_t objectSize() const { return sizeof(T); }
+	const char *typeName() const { return typeid(T).name(); }
+protected:
+	struct Block {
+		T *objs;			//!< Storage for capacity objects.
+		size_t used;		//!< Number constructed.
+		size_t capacity;	//!< Number that fit.
+	};
+	vector<Block> blocks;	//!< The blocks, in fill order.
+	size_t current;			//!< Block being filled.
+	static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types need their own allocator");
+};
+
+/**
+ * @fn	inline size_t nextArenaTypeId()
+ * @brief	Hands out a small number for each type stored in an arena.
+ */
+
+inline size_t nextArenaTypeId() {
+	static size_t next = 0;
+	return next++;
+}
+
+/**
+ * @fn	template <class T> size_t arenaTypeId()
+ * @brief	The arena slot used for objects of type T.
+ */
+
+template <class T>
+size_t arenaTypeId() {
+	static const size_t id = nextArenaTypeId();
+	return id;
+}
+
+/**
+ * @struct	SceneArena
+ * @brief	Owns the objects that make up a scene -- shapes, VisibleIShapes,
+ * 			lights, cameras and textures. Each type has its own pool, so
+ * 			objects of a type are packed together, and everything is
+ * 			destroyed at once by clear(). Pointers returned by create() are
+ * 			stable until then.
+ *
+ * 			clear() keeps the memory, so a long running program can load one
+ * 			scene after another without going back to the heap.
+ */
+
+struct SceneArena {
+	SceneArena() {}
+	SceneArena(const SceneArena &) = delete;
+	SceneArena &operator = (const SceneArena &) = delete;
+	~SceneArena();
+
+	/**
+	 * @fn	template <class T, class... Args> T *create(Args&&... args)
+	 * @brief	Constructs an object owned by the arena.
+	 * @param	args	Constructor arguments.
+	 * @return	The new object.
+	 */
+
+	template <class T, class... Args>
+	T *create(Args&&... args) {
+		return pool<T>().create(std::forward<Args>(args)...);
+	}
+
+	/**
+	 * @fn	template <class T> void reserve(size_t n)
+	 * @brief	Makes room for n more objects of type T, side by side.
+	 * @param	n	Number of objects.
+	 */
+
+	template <class T>
+	void reserve(size_t n) {
+		if (n > 0) {
+			pool<T>().reserve(n);
+		}
+	}
+
+	void clear();
+	void release();
+	size_t numObjects() const;
+	size_t bytesUsed() const;
+	size_t bytesReserved() const;
+	void report(ostream &os) const;
+protected:
+	vector<ArenaPoolBase *> pools;	//!< Indexed by arenaTypeId. May contain nulls.
+
+	template <class T>
+	ArenaPool<T> &pool() {
+		size_t id = arenaTypeId<T>();
+		if (id >= pools.size()) {
+			pools.resize(id + 1, nullptr);
+		}
+		if (pools[id] == nullptr) {
+			pools[id] = new ArenaPool<T>();
+		}
+		return *static_cast<ArenaPool<T> *>(pools[id]);
+	}
+};
@@ -0,0 +1,364 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "scenecache.h"
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The file layout is the in-memory layout of these, so catch any change.
+static_assert(sizeof(SceneShapeRecord) == 88, "bump SCENE_CACHE_VERSION");
+static_assert(sizeof(SceneMaterialRecord) == 88, "bump SCENE_CACHE_VERSION");
+static_assert(sizeof(SceneLightRecord) == 112, "bump SCENE_CACHE_VERSION");
+// Node size follows RayReal; load() rejects a cache written by a build of the
+// other precision, since its section sizes do not match.
+static_assert(sizeof(BVHNode) == 16 + 6 * sizeof(RayReal), "bump SCENE_CACHE_VERSION");
+static_assert(sizeof(SceneCacheHeader) == 344, "bump SCENE_CACHE_VERSION");
+
+/**
+ * @fn	static uint64_t rotateLeft(uint64_t x, int r)
+ * @brief	Rotates the bits of x left.
+ */
+
+static uint64_t rotateLeft(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * @fn	uint64_t sceneCacheChecksum(const void *data, size_t len)
+ * @brief	64-bit checksum of a block of memory. Four independent lanes of
+ * 			multiply-rotate mixing, so it runs at close to memory speed;
+ * 			this is for catching truncated or damaged files, not tampering.
+ * @param	data	The bytes.
+ * @param	len 	Number of bytes.
+ * @return	The checksum.
+ */
+
+uint64_t sceneCacheChecksum(const void *data, size_t len) {
+	const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+	const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t lane[4] = { PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1 };
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		for (int k = 0; k < 4; k++) {
+			uint64_t word;
+			memcpy(&word, p + i + 8 * k, 8);
+			lane[k] = rotateLeft(lane[k] + word * PRIME2, 31) * PRIME1;
+		}
+	}
+	uint64_t h = len;
+	for (int k = 0; k < 4; k++) {
+		h = rotateLeft(h ^ (rotateLeft(lane[k] * PRIME2, 31) * PRIME1), 27) * PRIME1 + PRIME2;
+	}
+	for (; i < len; i++) {
+		h = rotateLeft(h ^ (p[i] * PRIME1), 11) * PRIME2;
+	}
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	return h;
+}
+
+/**
+ * @fn	static uint64_t alignUp(uint64_t offset)
+ * @brief	Rounds an offset up to the next section boundary.
+ */
+
+static uint64_t alignUp(uint64_t offset) {
+	return (offset + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT * SCENE_CACHE_ALIGNMENT;
+}
+
+/**
+ * @fn	static string joinNames(const vector<string> &names)
+ * @brief	Packs names into one block, each followed by a NUL.
+ */
+
+static string joinNames(const vector<string> &names) {
+	string joined;
+	for (const string &name : names) {
+		joined += name;
+		joined.push_back('\0');
+	}
+	return joined;
+}
+
+/**
+ * @fn	static bool splitNames(const unsigned char *base, const SceneCacheSectionInfo &info, vector<string> &names)
+ * @brief	Unpacks a block written by joinNames.
+ * @param	base 	Start of the file.
+ * @param	info 	The section.
+ * @param	names	Receives the names.
+ * @return	False if the block does not hold info.count names.
+ */
+
+static bool splitNames(const unsigned char *base, const SceneCacheSectionInfo &info, vector<string> &names) {
+	const char *p = (const char *)base + info.offset;
+	const char *end = p + info.bytes;
+	for (uint64_t i = 0; i < info.count; i++) {
+		const char *nul = (const char *)memchr(p, '\0', end - p);
+		if (nul == nullptr) {
+			return false;
+		}
+		names.push_back(string(p, nul - p));
+		p = nul + 1;
+	}
+	return true;
+}
+
+/**
+ * @fn	bool SceneFile::saveCache(const string &fileName) const
+ * @brief	Writes the scene description and its index as a scene cache, which
+ * 			load() and loadCache() read back without parsing or building the
+ * 			index again.
+ * @param	fileName	Name of the file.
+ * @return	True if successful.
+ */
+
+bool SceneFile::saveCache(const string &fileName) const {
+	string textureNames = joinNames(textureFiles);
+	string meshNames = joinNames(meshFiles);
+
+	struct {
+		const void *data;
+		uint64_t count, bytes;
+	} parts[NUM_CACHE_SECTIONS] = {
+		{ materialRecs, numMaterialRecs, numMaterialRecs * sizeof(SceneMaterialRecord) },
+		{ lightRecs, numLightRecs, numLightRecs * sizeof(SceneLightRecord) },
+		{ shapeRecs, numShapeRecs, numShapeRecs * sizeof(SceneShapeRecord) },
+		{ textureNames.data(), textureFiles.size(), textureNames.size() },
+		{ meshNames.data(), meshFiles.size(), meshNames.size() },
+		{ index.nodes, index.numNodes, index.numNodes * sizeof(BVHNode) },
+		{ index.items, index.numItems, index.numItems * sizeof(uint32_t) },
+		{ index.unbounded, index.numUnbounded, index.numUnbounded * sizeof(uint32_t) }
+	};
+
+	SceneCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = SCENE_CACHE_VERSION;
+	header.byteOrder = SCENE_CACHE_BYTE_ORDER;
+	header.width = width;
+	header.height = height;
+	header.isPerspective = isPerspective;
+	for (int i = 0; i < 3; i++) {
+		header.background[i] = background[i];
+		header.cameraPos[i] = cameraPos[i];
+		header.cameraLookAt[i] = cameraLookAt[i];
+		header.cameraUp[i] = cameraUp[i];
+	}
+	header.cameraParam = cameraParam;
+
+	uint64_t offset = alignUp(sizeof(header));
+	for (int s = 0; s < NUM_CACHE_SECTIONS; s++) {
+		header.sections[s].offset = offset;
+		header.sections[s].count = parts[s].count;
+		header.sections[s].bytes = parts[s].bytes;
+		offset = alignUp(offset + parts[s].bytes);
+	}
+	header.fileSize = offset;
+
+	vector<unsigned char> file(header.fileSize, 0);
+	for (int s = 0; s < NUM_CACHE_SECTIONS; s++) {
+		if (parts[s].bytes > 0) {
+			memcpy(file.data() + header.sections[s].offset, parts[s].data, parts[s].bytes);
+		}
+	}
+	header.checksum = sceneCacheChecksum(file.data() + sizeof(header), file.size() - sizeof(header));
+	memcpy(file.data(), &header, sizeof(header));
+
+	FILE *fp = fopen(fileName.c_str(), "wb");
+	if (fp == nullptr) {
+		std::cerr << "Unable to create scene cache: " << fileName << endl;
+		return false;
+	}
+	bool ok = fwrite(file.data(), 1, file.size(), fp) == file.size();
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		std::cerr << "Error writing scene cache: " << fileName << endl;
+	}
+	return ok;
+}
+
+/**
+ * @fn	void SceneFile::unmap()
+ * @brief	Releases the mapped cache file, if any.
+ */
+
+void SceneFile::unmap() {
+	if (mapping == nullptr) {
+		return;
+	}
+#ifdef WINDOWS
+	delete[] (uint64_t *)mapping;
+#else
+	munmap(mapping, mappingSize);
+#endif
+	mapping = nullptr;
+	mappingSize = 0;
+}
+
+/**
+ * @fn	bool SceneFile::loadCache(const string &fileName)
+ * @brief	Maps a scene cache into memory and builds the scene from it. The
+ * 			records and the index are used where they lie in the mapping;
+ * 			only the objects themselves are created.
+ * @param	fileName	Name of the file.
+ * @return	True if successful. A file that fails validation is rejected with
+ * 			a message on cerr.
+ */
+
+bool SceneFile::loadCache(const string &fileName) {
+	auto start = std::chrono::high_resolution_clock::now();
+	clear();
+
+#ifdef WINDOWS
+	FILE *fp = fopen(fileName.c_str(), "rb");
+	if (fp == nullptr) {
+		std::cerr << "Unable to open scene cache: " << fileName << endl;
+		return false;
+	}
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	mappingSize = size > 0 ? (size_t)size : 0;
+	mapping = new uint64_t[(mappingSize + 7) / 8];
+	bool readOK = fread(mapping, 1, mappingSize, fp) == mappingSize;
+	fclose(fp);
+	if (!readOK) {
+		std::cerr << "Error reading scene cache: " << fileName << endl;
+		unmap();
+		return false;
+	}
+#else
+	int fd = open(fileName.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+		std::cerr << "Unable to open scene cache: " << fileName << endl;
+		if (fd >= 0) ::close(fd);
+		return false;
+	}
+	int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;		// it is all about to be read by the checksum anyway
+#endif
+	void *addr = mmap(nullptr, info.st_size, PROT_READ, flags, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED) {
+		std::cerr << "Unable to map scene cache: " << fileName << endl;
+		return false;
+	}
+	mapping = addr;
+	mappingSize = info.st_size;
+#endif
+
+	auto reject = [&](const char *reason) {
+		std::cerr << "Bad scene cache " << fileName << ": " << reason << endl;
+		clear();
+		return false;
+	};
+
+	const unsigned char *base = (const unsigned char *)mapping;
+	if (mappingSize < sizeof(SceneCacheHeader)) {
+		return reject("too short");
+	}
+	const SceneCacheHeader &header = *(const SceneCacheHeader *)base;
+	if (memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic)) != 0) {
+		return reject("not a scene cache");
+	}
+	if (header.version != SCENE_CACHE_VERSION) {
+		return reject("wrong version");
+	}
+	if (header.byteOrder != SCENE_CACHE_BYTE_ORDER) {
+		return reject("wrong byte order");
+	}
+	if (header.fileSize != mappingSize) {
+		return reject("truncated");
+	}
+	if (header.checksum != sceneCacheChecksum(base + sizeof(header), mappingSize - sizeof(header))) {
+		return reject("checksum mismatch");
+	}
+
+	const size_t elementSizes[NUM_CACHE_SECTIONS] = {
+		sizeof(SceneMaterialRecord), sizeof(SceneLightRecord), sizeof(SceneShapeRecord), 0, 0,
+		sizeof(BVHNode), sizeof(uint32_t), sizeof(uint32_t)
+	};
+	for (int s = 0; s < NUM_CACHE_SECTIONS; s++) {
+		const SceneCacheSectionInfo &sec = header.sections[s];
+		if (sec.offset % SCENE_CACHE_ALIGNMENT != 0 || sec.offset > mappingSize ||
+			sec.bytes > mappingSize - sec.offset ||
+			(elementSizes[s] != 0 && sec.bytes != sec.count * elementSizes[s])) {
+			return reject("bad section table");
+		}
+	}
+
+	if (!splitNames(base, header.sections[CACHE_TEXTURE_NAMES], textureFiles) ||
+		!splitNames(base, header.sections[CACHE_MESH_NAMES], meshFiles)) {
+		return reject("bad file names");
+	}
+
+	width = header.width;
+	height = header.height;
+	isPerspective = header.isPerspective != 0;
+	background = color(header.background[0], header.background[1], header.background[2]);
+	cameraPos = dvec3(header.cameraPos[0], header.cameraPos[1], header.cameraPos[2]);
+	cameraLookAt = dvec3(header.cameraLookAt[0], header.cameraLookAt[1], header.cameraLookAt[2]);
+	cameraUp = dvec3(header.cameraUp[0], header.cameraUp[1], header.cameraUp[2]);
+	cameraParam = header.cameraParam;
+
+	materialRecs = (const SceneMaterialRecord *)(base + header.sections[CACHE_MATERIALS].offset);
+	numMaterialRecs = header.sections[CACHE_MATERIALS].count;
+	lightRecs = (const SceneLightRecord *)(base + header.sections[CACHE_LIGHTS].offset);
+	numLightRecs = header.sections[CACHE_LIGHTS].count;
+	shapeRecs = (const SceneShapeRecord *)(base + header.sections[CACHE_SHAPES].offset);
+	numShapeRecs = header.sections[CACHE_SHAPES].count;
+	if (!build(false)) {
+		return reject("bad shape records");
+	}
+
+	// The index must only refer to objects that exist.
+	const BVHNode *nodes = (const BVHNode *)(base + header.sections[CACHE_BVH_NODES].offset);
+	const uint32_t *items = (const uint32_t *)(base + header.sections[CACHE_BVH_ITEMS].offset);
+	const uint32_t *unbounded = (const uint32_t *)(base + header.sections[CACHE_BVH_UNBOUNDED].offset);
+	size_t numNodes = header.sections[CACHE_BVH_NODES].count;
+	size_t numItems = header.sections[CACHE_BVH_ITEMS].count;
+	size_t numUnbounded = header.sections[CACHE_BVH_UNBOUNDED].count;
+	size_t numOpaque = scene.opaqueObjs.size();
+	if (numItems + numUnbounded != numOpaque || (numNodes == 0) != (numItems == 0)) {
+		return reject("index does not match the objects");
+	}
+	for (size_t i = 0; i < numNodes; i++) {
+		const BVHNode &node = nodes[i];
+		bool okNode = node.count > 0 ? node.first <= numItems && node.count <= numItems - node.first
+									: node.right > i + 1 && node.right < numNodes && node.axis < 3;
+		if (!okNode) {
+			return reject("bad index node");
+		}
+	}
+	for (size_t i = 0; i < numItems; i++) {
+		if (items[i] >= numOpaque) return reject("bad index item");
+	}
+	for (size_t i = 0; i < numUnbounded; i++) {
+		if (unbounded[i] >= numOpaque) return reject("bad index item");
+	}
+	index.view(nodes, numNodes, items, numItems, unbounded, numUnbounded);
+	if (index.depth() > MAX_BVH_DEPTH) {
+		return reject("index too deep");
+	}
+
+	parseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	return true;
+}
@@ -0,0 +1,71 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <cstdint>
+#include "scenefile.h"
+
+const char SCENE_CACHE_MAGIC[8] = { 'C', 'S', 'E', '3', '8', '6', 'S', 'C' };	//!< First bytes of a scene cache.
+const uint32_t SCENE_CACHE_VERSION = 2;			//!< Bump whenever any record layout changes.
+const uint32_t SCENE_CACHE_BYTE_ORDER = 0x01020304;	//!< Reads back differently on the wrong endianness.
+const uint64_t SCENE_CACHE_ALIGNMENT = 16;		//!< Every section starts on this boundary.
+
+/**
+ * @enum	SceneCacheSection
+ * @brief	The arrays stored in a scene cache, in file order.
+ */
+
+enum SceneCacheSection {
+	CACHE_MATERIALS,		//!< SceneMaterialRecord[]
+	CACHE_LIGHTS,			//!< SceneLightRecord[]
+	CACHE_SHAPES,			//!< SceneShapeRecord[]
+	CACHE_TEXTURE_NAMES,	//!< NUL terminated file names, back to back. count = number of names.
+	CACHE_MESH_NAMES,		//!< OBJ file names, stored the same way. The meshes are read from these on load.
+	CACHE_BVH_NODES,		//!< BVHNode[]
+	CACHE_BVH_ITEMS,		//!< uint32_t[] - opaque object indices referenced by the leaves.
+	CACHE_BVH_UNBOUNDED,	//!< uint32_t[] - opaque objects outside the hierarchy.
+	NUM_CACHE_SECTIONS
+};
+
+/**
+ * @struct	SceneCacheSectionInfo
+ * @brief	Where one section lives. Offsets are from the start of the file,
+ * 			so the layout does not depend on where it is mapped.
+ */
+
+struct SceneCacheSectionInfo {
+	uint64_t offset;	//!< Byte offset from the start of the file.
+	uint64_t count;		//!< Number of elements.
+	uint64_t bytes;		//!< Size in bytes.
+};
+
+/**
+ * @struct	SceneCacheHeader
+ * @brief	The start of a scene cache file. The checksum covers every byte
+ * 			after the header.
+ */
+
+struct SceneCacheHeader {
+	char magic[8];							//!< SCENE_CACHE_MAGIC
+	uint32_t version;						//!< SCENE_CACHE_VERSION
+	uint32_t byteOrder;						//!< SCENE_CACHE_BYTE_ORDER
+	uint64_t fileSize;						//!< Total size of the file.
+	uint64_t checksum;						//!< sceneCacheChecksum of the rest of the file.
+	uint32_t width, height;					//!< Requested image size.
+	uint32_t isPerspective;					//!< 1 for a perspective camera.
+	uint32_t reserved;						//!< Zero.
+	double background[3];					//!< Background color.
+	double cameraPos[3];					//!< Camera position.
+	double cameraLookAt[3];					//!< Camera focus point.
+	double cameraUp[3];						//!< Camera up vector.
+	double cameraParam;						//!< FOV in radians, or orthographic scale.
+	SceneCacheSectionInfo sections[NUM_CACHE_SECTIONS];	//!< The arrays.
+};
+
+uint64_t sceneCacheChecksum(const void *data, size_t len);
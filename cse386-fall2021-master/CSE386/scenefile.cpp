@@ -0,0 +1,736 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "scenecache.h"
+#include "scenefile.h"
+
+/**
+ * @struct	NamedMaterial
+ * @brief	A material from colorandmaterials.h, by name.
+ */
+
+struct NamedMaterial {
+	const char *name;
+	const Material *material;
+};
+
+static const NamedMaterial builtInMaterials[] = {
+	{ "brass", &brass }, { "bronze", &bronze }, { "polishedBronze", &polishedBronze },
+	{ "chrome", &chrome }, { "copper", &copper }, { "polishedCopper", &polishedCopper },
+	{ "gold", &gold }, { "polishedGold", &polishedGold }, { "tin", &tin },
+	{ "silver", &silver }, { "polishedSilver", &polishedSilver },
+	{ "blackPlastic", &blackPlastic }, { "cyanPlastic", &cyanPlastic },
+	{ "greenPlastic", &greenPlastic }, { "redPlastic", &redPlastic },
+	{ "whitePlastic", &whitePlastic }, { "yellowPlastic", &yellowPlastic },
+	{ "blackRubber", &blackRubber }, { "cyanRubber", &cyanRubber },
+	{ "greenRubber", &greenRubber }, { "redRubber", &redRubber },
+	{ "whiteRubber", &whiteRubber }, { "yellowRubber", &yellowRubber },
+	{ "pewter", &pewter }, { "emerald", &emerald }, { "jade", &jade },
+	{ "obsidian", &obsidian }, { "perl", &perl }, { "ruby", &ruby },
+	{ "turquoise", &turquoise }
+};
+
+/**
+ * @struct	SceneToken
+ * @brief	A word of the scene text. Points into the text; nothing is copied.
+ */
+
+struct SceneToken {
+	const char *s;
+	size_t n;
+	bool is(const char *word) const {
+		return strlen(word) == n && memcmp(s, word, n) == 0;
+	}
+	string str() const { return string(s, n); }
+};
+
+/**
+ * @struct	SceneLexer
+ * @brief	Splits the scene text into lines and tokens in a single pass.
+ */
+
+struct SceneLexer {
+	const char *p;			//!< Current position.
+	const char *end;		//!< One past the last character.
+	int line;				//!< Current line number, starting at 1.
+	const string &source;	//!< Name used in error messages.
+	bool failed;			//!< Set once an error has been reported.
+
+	SceneLexer(const char *text, size_t length, const string &sourceName)
+		: p(text), end(text + length), line(1), source(sourceName), failed(false) {}
+
+	/**
+	 * @brief	Gets the next token on the current line.
+	 * @return	False at the end of the line (or of a comment).
+	 */
+	bool next(SceneToken &tok) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+		if (p >= end || *p == '\n') return false;
+		if (*p == '#') {
+			while (p < end && *p != '\n') p++;
+			return false;
+		}
+		tok.s = p;
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+		tok.n = p - tok.s;
+		return true;
+	}
+
+	/**
+	 * @brief	Moves to the start of the next line, skipping anything left on this one.
+	 * @return	False at the end of the text.
+	 */
+	bool nextLine() {
+		const char *nl = (const char *)memchr(p, '\n', end - p);
+		if (nl == nullptr) {
+			p = end;
+			return false;
+		}
+		p = nl + 1;
+		line++;
+		return true;
+	}
+
+	bool error(const string &message) {
+		if (!failed) {
+			std::cerr << source << ":" << line << ": " << message << endl;
+			failed = true;
+		}
+		return false;
+	}
+
+	bool number(double &value) {
+		SceneToken tok;
+		if (!next(tok)) return error("missing number");
+		if (fastNumber(tok, value)) return true;
+		// The token ends at whitespace, so strtod cannot run past it -- unless
+		// it is the very last thing in the text, which need not be terminated.
+		char buffer[64];
+		const char *s = tok.s;
+		if (tok.s + tok.n == end) {
+			size_t n = std::min(tok.n, sizeof(buffer) - 1);
+			memcpy(buffer, tok.s, n);
+			buffer[n] = '\0';
+			s = buffer;
+		}
+		char *stop;
+		value = strtod(s, &stop);
+		if (stop != s + tok.n) return error("bad number \"" + tok.str() + "\"");
+		return true;
+	}
+
+	/**
+	 * @brief	Converts plain decimals like "-12.375" without calling strtod. When
+	 * 			the digits fit in 53 bits and there are at most 22 of them after
+	 * 			the point, one correctly rounded division gives exactly what strtod
+	 * 			would. Anything else (exponents, long mantissas) is left to strtod.
+	 * @return	True if the token was converted.
+	 */
+	static bool fastNumber(const SceneToken &tok, double &value) {
+		static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+											1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+											1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		const char *c = tok.s, *e = tok.s + tok.n;
+		bool negative = c < e && *c == '-';
+		if (c < e && (*c == '-' || *c == '+')) c++;
+		uint64_t mantissa = 0;
+		int digits = 0, fraction = -1;
+		for (; c < e; c++) {
+			if (*c >= '0' && *c <= '9') {
+				mantissa = mantissa * 10 + (*c - '0');
+				if (++digits > 15) return false;		// 10^15 < 2^53
+				if (fraction >= 0) fraction++;
+			} else if (*c == '.' && fraction < 0) {
+				fraction = 0;
+			} else {
+				return false;
+			}
+		}
+		if (digits == 0) return false;
+		value = (double)mantissa;
+		if (fraction > 0) value /= powersOf10[fraction];
+		if (negative) value = -value;
+		return true;
+	}
+
+	bool vec3(dvec3 &v) {
+		return number(v.x) && number(v.y) && number(v.z);
+	}
+
+	bool word(SceneToken &tok) {
+		return next(tok) || error("missing name");
+	}
+
+	bool atEndOfLine() {
+		SceneToken tok;
+		return !next(tok) || error("unexpected \"" + tok.str() + "\"");
+	}
+};
+
+/**
+ * @fn	static SceneMaterialRecord toRecord(const Material &mat)
+ * @brief	Converts a material to plain data.
+ * @param	mat	The material.
+ * @return	The record.
+ */
+
+static SceneMaterialRecord toRecord(const Material &mat) {
+	SceneMaterialRecord rec;
+	for (int i = 0; i < 3; i++) {
+		rec.ambient[i] = mat.ambient[i];
+		rec.diffuse[i] = mat.diffuse[i];
+		rec.specular[i] = mat.specular[i];
+	}
+	rec.shininess = mat.shininess;
+	rec.alpha = mat.alpha;
+	return rec;
+}
+
+/**
+ * @fn	static Material toMaterial(const SceneMaterialRecord &rec)
+ * @brief	Converts a material record back to a Material.
+ * @param	rec	The record.
+ * @return	The material.
+ */
+
+static Material toMaterial(const SceneMaterialRecord &rec) {
+	Material mat(color(rec.ambient[0], rec.ambient[1], rec.ambient[2]),
+					color(rec.diffuse[0], rec.diffuse[1], rec.diffuse[2]),
+					color(rec.specular[0], rec.specular[1], rec.specular[2]),
+					rec.shininess);
+	mat.alpha = rec.alpha;
+	return mat;
+}
+
+/**
+ * @fn	static bool shapeBounds(const SceneShapeRecord &rec, const vector<ITriangleMesh *> &meshes, BoundingBox &box)
+ * @brief	Computes a conservative bounding box for a shape.
+ * @param	rec   	The shape.
+ * @param	meshes	The loaded meshes.
+ * @param	box   	The bounds.
+ * @return	False if the shape is infinite (a plane).
+ */
+
+static bool shapeBounds(const SceneShapeRecord &rec, const vector<ITriangleMesh *> &meshes,
+						BoundingBox &box) {
+	dvec3 c(rec.a[0], rec.a[1], rec.a[2]);
+	dvec3 half;
+	switch (rec.type) {
+	case SceneShapeType::PLANE:				return false;
+	case SceneShapeType::DISK:
+	case SceneShapeType::SPHERE:			half = dvec3(rec.radius, rec.radius, rec.radius);
+											break;
+	case SceneShapeType::ELLIPSOID:			half = glm::abs(dvec3(rec.b[0], rec.b[1], rec.b[2]));
+											break;
+	case SceneShapeType::CYLINDER_Y:
+	case SceneShapeType::CLOSED_CYLINDER_Y:	half = dvec3(rec.radius, rec.length / 2.0, rec.radius);
+											break;
+	case SceneShapeType::CYLINDER_Z:		half = dvec3(rec.radius, rec.radius, rec.length / 2.0);
+											break;
+	case SceneShapeType::CONE_Y:			c.y += rec.length / 2.0;		// a[] is the center of the base
+											half = dvec3(rec.radius, std::abs(rec.length) / 2.0, rec.radius);
+											break;
+	case SceneShapeType::MESH:				box = meshes[rec.mesh]->getBounds();
+											return box.lo.x <= box.hi.x;
+	default:								return false;
+	}
+	// Pad a little so hits right on the surface are never culled by rounding.
+	half += dvec3(EPSILON, EPSILON, EPSILON);
+	box = BoundingBox(c - half, c + half);
+	return true;
+}
+
+/**
+ * @fn	SceneFile::SceneFile()
+ * @brief	Constructs an empty scene with a default camera.
+ */
+
+SceneFile::SceneFile()
+	: scene(nullptr), background(lightGray), width(WINDOW_WIDTH), height(WINDOW_HEIGHT),
+	parseSeconds(0.0), isPerspective(true), cameraPos(0, 0, 10), cameraLookAt(ORIGIN3D),
+	cameraUp(Y_AXIS), cameraParam(glm::radians(60.0)),
+	shapeRecs(nullptr), numShapeRecs(0), lightRecs(nullptr), numLightRecs(0),
+	materialRecs(nullptr), numMaterialRecs(0), mapping(nullptr), mappingSize(0) {
+}
+
+/**
+ * @fn	SceneFile::~SceneFile()
+ * @brief	Destructor. Frees everything the scene owns.
+ */
+
+SceneFile::~SceneFile() {
+	clear();
+}
+
+/**
+ * @fn	void SceneFile::clear()
+ * @brief	Destroys all objects, lights, textures and the camera. The arena
+ * 			keeps its memory for the next scene.
+ */
+
+void SceneFile::clear() {
+	scene.opaqueObjs.clear();
+	scene.transparentObjs.clear();
+	scene.opaqueGroups.clear();
+	scene.transparentGroups.clear();
+	scene.lights.clear();
+	scene.camera = nullptr;
+	scene.opaqueIndex = nullptr;
+	index.clear();
+	textures.clear();
+	meshes.clear();
+	arena.clear();
+	textureFiles.clear();
+	meshFiles.clear();
+	shapeRecords.clear();
+	lightRecords.clear();
+	materialRecords.clear();
+	shapeRecs = nullptr;
+	lightRecs = nullptr;
+	materialRecs = nullptr;
+	numShapeRecs = numLightRecs = numMaterialRecs = 0;
+	unmap();
+}
+
+/**
+ * @fn	void SceneFile::resizeCamera(int newWidth, int newHeight)
+ * @brief	Sets up the camera for a new window size. The camera is updated in
+ * 			place, so this can be called every frame.
+ * @param	newWidth 	The new width.
+ * @param	newHeight	The new height.
+ */
+
+void SceneFile::resizeCamera(int newWidth, int newHeight) {
+	if (isPerspective) {
+		PerspectiveCamera camera(cameraPos, cameraLookAt, cameraUp, cameraParam, newWidth, newHeight);
+		if (scene.camera == nullptr) {
+			scene.camera = arena.create<PerspectiveCamera>(camera);
+		} else {
+			*static_cast<PerspectiveCamera *>(scene.camera) = camera;
+		}
+	} else {
+		OrthographicCamera camera(cameraPos, cameraLookAt, cameraUp, newWidth, newHeight, cameraParam);
+		if (scene.camera == nullptr) {
+			scene.camera = arena.create<OrthographicCamera>(camera);
+		} else {
+			*static_cast<OrthographicCamera *>(scene.camera) = camera;
+		}
+	}
+}
+
+/**
+ * @fn	bool SceneFile::load(const string &fileName)
+ * @brief	Loads a scene cache, or reads a text scene file into memory in one
+ * 			go and parses it. The format is recognized from the file contents.
+ * @param	fileName	Name of the file.
+ * @return	True if successful. Errors are reported on cerr.
+ */
+
+bool SceneFile::load(const string &fileName) {
+	auto start = std::chrono::high_resolution_clock::now();
+	FILE *fp = fopen(fileName.c_str(), "rb");
+	if (fp == nullptr) {
+		std::cerr << "Unable to open scene file: " << fileName << endl;
+		return false;
+	}
+	char magic[sizeof(SCENE_CACHE_MAGIC)] = { 0 };
+	bool isCache = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+					memcmp(magic, SCENE_CACHE_MAGIC, sizeof(magic)) == 0;
+	bool result;
+	if (isCache) {
+		fclose(fp);
+		result = loadCache(fileName);
+	} else {
+		fseek(fp, 0, SEEK_END);
+		long size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		vector<char> text(size > 0 ? size : 0);
+		size_t got = fread(text.data(), 1, text.size(), fp);
+		fclose(fp);
+		if (got != text.size()) {
+			std::cerr << "Error reading scene file: " << fileName << endl;
+			return false;
+		}
+		result = parse(text.data(), text.size(), fileName);
+	}
+	if (!result) {
+		return false;
+	}
+	parseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	cout << (isCache ? "Loaded " : "Parsed ") << fileName << ": "
+		<< scene.opaqueObjs.size() + scene.transparentObjs.size()
+		<< " objects, " << scene.lights.size() << " lights in " << parseSeconds << " sec." << endl;
+	return result;
+}
+
+/**
+ * @fn	bool SceneFile::parse(const char *text, size_t length, const string &sourceName)
+ * @brief	Parses a scene description, replacing the current scene.
+ * @param	text	  	The scene text.
+ * @param	length	  	Length of the text.
+ * @param	sourceName	Name used in error messages.
+ * @return	True if successful. On error, the objects parsed so far are kept.
+ */
+
+bool SceneFile::parse(const char *text, size_t length, const string &sourceName) {
+	auto start = std::chrono::high_resolution_clock::now();
+	clear();
+
+	// One object per line at most, so this avoids regrowing for big scenes.
+	size_t lines = std::count(text, text + length, '\n') + 1;
+	shapeRecords.reserve(lines);
+
+	std::map<string, int> materialIds;		// name -> index into materialRecords
+	std::map<string, int> textureIds;		// name -> index into textureFiles
+	std::map<string, uint32_t> meshIds;		// file -> index into meshFiles
+	int lastMaterial = -1;					// caches the last material lookup
+	SceneToken lastMaterialName = { "", 0 };
+
+	// Finds a material by name, adding built-in ones to the table on first use.
+	auto findMaterial = [&](const SceneToken &name) -> int {
+		if (lastMaterial >= 0 && lastMaterialName.n == name.n &&
+			memcmp(lastMaterialName.s, name.s, name.n) == 0) {
+			return lastMaterial;
+		}
+		int id = -1;
+		auto found = materialIds.find(name.str());
+		if (found != materialIds.end()) {
+			id = found->second;
+		} else {
+			for (const NamedMaterial &m : builtInMaterials) {
+				if (name.is(m.name)) {
+					id = (int)materialRecords.size();
+					materialRecords.push_back(toRecord(*m.material));
+					materialIds[name.str()] = id;
+					break;
+				}
+			}
+		}
+		if (id >= 0) {
+			lastMaterial = id;
+			lastMaterialName = name;
+		}
+		return id;
+	};
+
+	SceneLexer lex(text, length, sourceName);
+	bool ok = true;
+
+	do {
+		SceneToken cmd;
+		if (!lex.next(cmd)) continue;
+
+		if (cmd.is("size")) {
+			double w, h;
+			ok = lex.number(w) && lex.number(h) && lex.atEndOfLine();
+			if (ok && (w < 1 || h < 1)) {
+				ok = lex.error("size must be at least 1 by 1");
+			}
+			if (ok) {
+				width = (int)w;
+				height = (int)h;
+			}
+		} else if (cmd.is("background")) {
+			ok = lex.vec3(background) && lex.atEndOfLine();
+		} else if (cmd.is("camera")) {
+			SceneToken kind;
+			ok = lex.word(kind);
+			if (ok && !kind.is("perspective") && !kind.is("orthographic")) {
+				ok = lex.error("unknown camera \"" + kind.str() + "\"");
+			}
+			ok = ok && lex.vec3(cameraPos) && lex.vec3(cameraLookAt) && lex.vec3(cameraUp) &&
+					lex.number(cameraParam) && lex.atEndOfLine();
+			isPerspective = kind.is("perspective");
+			if (isPerspective) {
+				cameraParam = glm::radians(cameraParam);
+			}
+		} else if (cmd.is("material")) {
+			SceneToken name;
+			dvec3 amb, dif, spec;
+			double shininess;
+			ok = lex.word(name) && lex.vec3(amb) && lex.vec3(dif) && lex.vec3(spec) &&
+					lex.number(shininess) && lex.atEndOfLine();
+			if (ok) {
+				materialIds[name.str()] = (int)materialRecords.size();
+				materialRecords.push_back(toRecord(Material(amb, dif, spec, shininess)));
+				lastMaterial = -1;		// the name may have been redefined
+			}
+		} else if (cmd.is("texture")) {
+			SceneToken name, file;
+			ok = lex.word(name) && lex.word(file) && lex.atEndOfLine();
+			if (ok) {
+				textureIds[name.str()] = (int)textureFiles.size();
+				textureFiles.push_back(file.str());
+			}
+		} else if (cmd.is("light")) {
+			SceneToken kind;
+			dvec3 pos, dir, rgb;
+			double fov = 0.0;
+			ok = lex.word(kind) && lex.vec3(pos);
+			if (ok && kind.is("positional")) {
+				ok = lex.vec3(rgb) && lex.atEndOfLine();
+			} else if (ok && kind.is("spot")) {
+				ok = lex.vec3(dir) && lex.number(fov) && lex.vec3(rgb) && lex.atEndOfLine();
+			} else if (ok) {
+				ok = lex.error("unknown light \"" + kind.str() + "\"");
+			}
+			if (ok) {
+				SceneLightRecord rec = {};
+				rec.isSpot = kind.is("spot");
+				for (int i = 0; i < 3; i++) {
+					rec.pos[i] = pos[i];
+					rec.dir[i] = dir[i];
+					rec.rgb[i] = rgb[i];
+				}
+				rec.fov = glm::radians(fov);
+				rec.atten[1] = 1.0;		// PositionalLight's default
+				lightRecords.push_back(rec);
+			}
+		} else if (cmd.is("attenuation")) {
+			double c, l, q;
+			ok = lex.number(c) && lex.number(l) && lex.number(q) && lex.atEndOfLine();
+			if (ok && lightRecords.empty()) {
+				ok = lex.error("attenuation before any light");
+			} else if (ok) {
+				SceneLightRecord &rec = lightRecords.back();
+				rec.atten[0] = c;
+				rec.atten[1] = l;
+				rec.atten[2] = q;
+				rec.attenuationIsOn = 1;
+			}
+		} else {
+			SceneShapeRecord rec = {};
+			dvec3 a, b;
+			bool known = true;
+			if (cmd.is("plane")) {
+				rec.type = SceneShapeType::PLANE;
+				ok = lex.vec3(a) && lex.vec3(b);
+			} else if (cmd.is("disk")) {
+				rec.type = SceneShapeType::DISK;
+				ok = lex.vec3(a) && lex.vec3(b) && lex.number(rec.radius);
+			} else if (cmd.is("sphere")) {
+				rec.type = SceneShapeType::SPHERE;
+				ok = lex.vec3(a) && lex.number(rec.radius);
+			} else if (cmd.is("ellipsoid")) {
+				rec.type = SceneShapeType::ELLIPSOID;
+				ok = lex.vec3(a) && lex.vec3(b);
+			} else if (cmd.is("cylindery")) {
+				rec.type = SceneShapeType::CYLINDER_Y;
+				ok = lex.vec3(a) && lex.number(rec.radius) && lex.number(rec.length);
+			} else if (cmd.is("closedcylindery")) {
+				rec.type = SceneShapeType::CLOSED_CYLINDER_Y;
+				ok = lex.vec3(a) && lex.number(rec.radius) && lex.number(rec.length);
+			} else if (cmd.is("cylinderz")) {
+				rec.type = SceneShapeType::CYLINDER_Z;
+				ok = lex.vec3(a) && lex.number(rec.radius) && lex.number(rec.length);
+			} else if (cmd.is("coney")) {
+				rec.type = SceneShapeType::CONE_Y;
+				ok = lex.vec3(a) && lex.number(rec.radius) && lex.number(rec.length);
+			} else if (cmd.is("mesh")) {
+				SceneToken file;
+				rec.type = SceneShapeType::MESH;
+				ok = lex.word(file);
+				if (ok) {
+					// Shapes naming the same file share one mesh.
+					auto found = meshIds.emplace(file.str(), (uint32_t)meshFiles.size());
+					if (found.second) {
+						meshFiles.push_back(file.str());
+					}
+					rec.mesh = found.first->second;
+				}
+			} else {
+				known = false;
+				ok = lex.error("unknown directive \"" + cmd.str() + "\"");
+			}
+			if (!known || !ok) {
+				continue;
+			}
+			for (int i = 0; i < 3; i++) {
+				rec.a[i] = a[i];
+				rec.b[i] = b[i];
+			}
+			rec.material = -1;
+			rec.texture = -1;
+			rec.alpha = 1.0;
+
+			// Options
+			SceneToken opt, name;
+			while (ok && lex.next(opt)) {
+				if (opt.is("material")) {
+					ok = lex.word(name);
+					if (ok && (rec.material = findMaterial(name)) < 0) {
+						ok = lex.error("unknown material \"" + name.str() + "\"");
+					}
+				} else if (opt.is("texture")) {
+					ok = lex.word(name);
+					auto found = ok ? textureIds.find(name.str()) : textureIds.end();
+					if (ok && found == textureIds.end()) {
+						ok = lex.error("unknown texture \"" + name.str() + "\"");
+					} else if (ok) {
+						rec.texture = found->second;
+					}
+				} else if (opt.is("alpha")) {
+					ok = lex.number(rec.alpha);
+				} else {
+					ok = lex.error("unknown option \"" + opt.str() + "\"");
+				}
+			}
+			if (ok) {
+				if (rec.material < 0) {
+					rec.material = findMaterial(SceneToken{ "whitePlastic", 12 });
+				}
+				shapeRecords.push_back(rec);
+			}
+		}
+	} while (ok && lex.nextLine());
+
+	shapeRecs = shapeRecords.data();
+	numShapeRecs = shapeRecords.size();
+	lightRecs = lightRecords.data();
+	numLightRecs = lightRecords.size();
+	materialRecs = materialRecords.data();
+	numMaterialRecs = materialRecords.size();
+	ok = build(true) && ok;
+
+	parseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	return ok;
+}
+
+/**
+ * @fn	bool SceneFile::build(bool buildIndex)
+ * @brief	Creates the camera, lights, textures and objects from the records.
+ * 			Room for each kind of shape is reserved in the arena up front, so
+ * 			there is no allocation per object.
+ * @param	buildIndex	If true, builds the BVH. Otherwise the caller supplies it.
+ * @return	False if a record refers to a missing material, texture or mesh,
+ * 			or a mesh cannot be loaded.
+ */
+
+bool SceneFile::build(bool buildIndex) {
+	resizeCamera(width, height);
+
+	for (size_t i = 0; i < numLightRecs; i++) {
+		const SceneLightRecord &rec = lightRecs[i];
+		dvec3 pos(rec.pos[0], rec.pos[1], rec.pos[2]);
+		LightColor lightColor(color(rec.rgb[0], rec.rgb[1], rec.rgb[2]));
+		PositionalLightPtr light;
+		if (rec.isSpot) {
+			light = arena.create<SpotLight>(pos, dvec3(rec.dir[0], rec.dir[1], rec.dir[2]), rec.fov, lightColor);
+		} else {
+			light = arena.create<PositionalLight>(pos, lightColor);
+		}
+		light->setAttenuationParams(LightATParams(rec.atten[0], rec.atten[1], rec.atten[2]));
+		light->setAttenuation(rec.attenuationIsOn != 0);
+		scene.addLight(light);
+	}
+
+	for (const string &file : textureFiles) {
+		textures.push_back(arena.create<Image>(file));
+	}
+
+	std::map<string, ITriangleMesh *> loadedMeshes;		// a cache may name a file twice
+	for (const string &file : meshFiles) {
+		ITriangleMesh *&mesh = loadedMeshes[file];
+		if (mesh == nullptr) {
+			mesh = arena.create<ITriangleMesh>();
+			if (!mesh->loadOBJ(file)) {
+				return false;
+			}
+		}
+		meshes.push_back(mesh);
+	}
+
+	size_t counts[(int)SceneShapeType::NUM_TYPES] = { 0 };
+	size_t numOpaque = 0;
+	for (size_t i = 0; i < numShapeRecs; i++) {
+		const SceneShapeRecord &rec = shapeRecs[i];
+		if ((uint32_t)rec.type >= (uint32_t)SceneShapeType::NUM_TYPES ||
+			rec.material < 0 || (size_t)rec.material >= numMaterialRecs ||
+			rec.texture < -1 || rec.texture >= (int)textures.size() ||
+			(rec.type == SceneShapeType::MESH && rec.mesh >= meshes.size())) {
+			std::cerr << "Bad shape record " << i << endl;
+			return false;
+		}
+		counts[(int)rec.type]++;
+		numOpaque += rec.alpha >= 1.0;
+	}
+	arena.reserve<IPlane>(counts[(int)SceneShapeType::PLANE]);
+	arena.reserve<IDisk>(counts[(int)SceneShapeType::DISK]);
+	arena.reserve<ISphere>(counts[(int)SceneShapeType::SPHERE]);
+	arena.reserve<IEllipsoid>(counts[(int)SceneShapeType::ELLIPSOID]);
+	arena.reserve<ICylinderY>(counts[(int)SceneShapeType::CYLINDER_Y]);
+	arena.reserve<IClosedCylinderY>(counts[(int)SceneShapeType::CLOSED_CYLINDER_Y]);
+	arena.reserve<ICylinderZ>(counts[(int)SceneShapeType::CYLINDER_Z]);
+	arena.reserve<IConeY>(counts[(int)SceneShapeType::CONE_Y]);
+	arena.reserve<VisibleIShape>(numShapeRecs);
+	scene.opaqueObjs.reserve(numOpaque);
+
+	vector<Material> materials(numMaterialRecs);
+	for (size_t i = 0; i < numMaterialRecs; i++) {
+		materials[i] = toMaterial(materialRecs[i]);
+	}
+
+	vector<BoundingBox> bounds;
+	vector<bool> isBounded;
+	if (buildIndex) {
+		bounds.resize(numOpaque);
+		isBounded.resize(numOpaque);
+	}
+
+	for (size_t i = 0; i < numShapeRecs; i++) {
+		const SceneShapeRecord &rec = shapeRecs[i];
+		dvec3 a(rec.a[0], rec.a[1], rec.a[2]);
+		dvec3 b(rec.b[0], rec.b[1], rec.b[2]);
+		IShapePtr shape = nullptr;
+		switch (rec.type) {
+		case SceneShapeType::PLANE:				shape = arena.create<IPlane>(a, b);
+												break;
+		case SceneShapeType::DISK:				shape = arena.create<IDisk>(a, b, rec.radius);
+												break;
+		case SceneShapeType::SPHERE:			shape = arena.create<ISphere>(a, rec.radius);
+												break;
+		case SceneShapeType::ELLIPSOID:			shape = arena.create<IEllipsoid>(a, b);
+												break;
+		case SceneShapeType::CYLINDER_Y:		shape = arena.create<ICylinderY>(a, rec.radius, rec.length);
+												break;
+		case SceneShapeType::CLOSED_CYLINDER_Y:	shape = arena.create<IClosedCylinderY>(a, rec.radius, rec.length);
+												break;
+		case SceneShapeType::CYLINDER_Z:		shape = arena.create<ICylinderZ>(a, rec.radius, rec.length);
+												break;
+		case SceneShapeType::CONE_Y:			shape = arena.create<IConeY>(a, rec.radius, rec.length);
+												break;
+		case SceneShapeType::MESH:				shape = meshes[rec.mesh];
+												break;
+		default:								break;
+		}
+		Image *texture = rec.texture >= 0 ? textures[rec.texture] : nullptr;
+		VisibleIShapePtr obj = arena.create<VisibleIShape>(shape, materials[rec.material], texture);
+		if (rec.alpha < 1.0) {
+			scene.addTransparentObject(obj, rec.alpha);
+		} else {
+			if (buildIndex) {
+				size_t n = scene.opaqueObjs.size();
+				isBounded[n] = shapeBounds(rec, meshes, bounds[n]);
+			}
+			scene.addOpaqueObject(obj);
+		}
+	}
+
+	if (buildIndex) {
+		index.build(bounds, isBounded);
+	}
+	scene.opaqueIndex = &index;
+	return true;
+}
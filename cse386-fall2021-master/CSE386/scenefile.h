@@ -0,0 +1,157 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "defs.h"
+#include "bvh.h"
+#include "camera.h"
+#include "colorandmaterials.h"
+#include "image.h"
+#include "imesh.h"
+#include "iscene.h"
+#include "ishape.h"
+#include "light.h"
+#include "scenearena.h"
+
+/**
+ * @enum	SceneShapeType
+ * @brief	The kinds of shape a scene file can contain.
+ */
+
+enum class SceneShapeType : uint32_t {
+	PLANE, DISK, SPHERE, ELLIPSOID, CYLINDER_Y, CLOSED_CYLINDER_Y, CYLINDER_Z, CONE_Y, MESH,
+	NUM_TYPES
+};
+
+/**
+ * @struct	SceneShapeRecord
+ * @brief	Everything needed to create one visible shape. Plain data, so
+ * 			arrays of these can be written to and mapped from a scene cache.
+ */
+
+struct SceneShapeRecord {
+	SceneShapeType type;	//!< Kind of shape.
+	int32_t material;		//!< Index into the material table.
+	int32_t texture;		//!< Index into the texture table, or -1.
+	uint32_t mesh;			//!< Index into the mesh table, for MESH.
+	double alpha;			//!< Below 1 for transparent objects.
+	double a[3];			//!< Center, base or point on the plane.
+	double b[3];			//!< Normal (plane, disk) or size (ellipsoid).
+	double radius;			//!< Radius.
+	double length;			//!< Cylinder length or cone height.
+};
+
+/**
+ * @struct	SceneMaterialRecord
+ * @brief	A Material as plain data.
+ */
+
+struct SceneMaterialRecord {
+	double ambient[3], diffuse[3], specular[3];	//!< Material colors.
+	double shininess;							//!< Shininess.
+	double alpha;								//!< Alpha.
+};
+
+/**
+ * @struct	SceneLightRecord
+ * @brief	A positional or spot light as plain data.
+ */
+
+struct SceneLightRecord {
+	uint32_t isSpot;			//!< 1 for a spot light.
+	uint32_t attenuationIsOn;	//!< 1 if attenuation is enabled.
+	double pos[3];				//!< Position.
+	double dir[3];				//!< Spot light direction.
+	double fov;					//!< Spot light field of view, in radians.
+	double rgb[3];				//!< Light color.
+	double atten[3];			//!< Constant, linear and quadratic attenuation.
+};
+
+/**
+ * @struct	SceneFile
+ * @brief	A scene loaded from a text description or a binary scene cache.
+ * 			Everything it creates -- the camera, shapes, lights and textures --
+ * 			lives in its arena, and an index (BVH) over the opaque objects is
+ * 			attached to the scene.
+ *
+ * 			Text format -- one directive per line, '#' starts a comment,
+ * 			angles are in degrees:
+ *
+ * 			size W H
+ * 			background R G B
+ * 			camera perspective PX PY PZ  LX LY LZ  UX UY UZ  FOV
+ * 			camera orthographic PX PY PZ  LX LY LZ  UX UY UZ  SCALE
+ * 			material NAME  AR AG AB  DR DG DB  SR SG SB  SHININESS
+ * 			texture NAME FILE.ppm
+ * 			light positional PX PY PZ  R G B
+ * 			light spot PX PY PZ  DX DY DZ  FOV  R G B
+ * 			attenuation C L Q                         (applies to the last light)
+ * 			plane PX PY PZ  NX NY NZ                  [options]
+ * 			disk CX CY CZ  NX NY NZ  RADIUS           [options]
+ * 			sphere CX CY CZ  RADIUS                   [options]
+ * 			ellipsoid CX CY CZ  SX SY SZ              [options]
+ * 			cylindery | closedcylindery | cylinderz CX CY CZ  RADIUS LENGTH  [options]
+ * 			coney CX CY CZ  RADIUS HEIGHT             [options]
+ * 			mesh FILE.obj                             [options]
+ *
+ * 			Shape options: "material NAME" (any material from colorandmaterials.h
+ * 			or defined earlier in the file; whitePlastic if omitted), "texture NAME"
+ * 			and "alpha A". An alpha below 1 makes the object transparent.
+ *
+ * 			The scene cache (see saveCache) holds the same description as flat
+ * 			records plus the prebuilt index. It is mapped into memory and used
+ * 			in place.
+ */
+
+struct SceneFile {
+	IScene scene;							//!< The scene, ready for RayTracer::raytraceScene.
+	color background;						//!< Background color.
+	int width, height;						//!< Requested image size.
+	double parseSeconds;					//!< Time taken by the last load/parse.
+	SceneArena arena;						//!< Owns every object in the scene, packed by type.
+
+	SceneFile();
+	~SceneFile();
+	bool load(const string &fileName);
+	bool parse(const char *text, size_t length, const string &sourceName = "scene");
+	bool saveCache(const string &fileName) const;
+	bool loadCache(const string &fileName);
+	void resizeCamera(int newWidth, int newHeight);
+	void clear();
+protected:
+	bool isPerspective;							//!< Perspective (or orthographic) camera.
+	dvec3 cameraPos, cameraLookAt, cameraUp;	//!< Camera placement.
+	double cameraParam;							//!< FOV in radians, or orthographic scale.
+
+	// The scene description. The pointers refer either to the vectors below
+	// (after parse) or into the mapped cache file (after loadCache).
+	const SceneShapeRecord *shapeRecs;			//!< Shape records.
+	size_t numShapeRecs;						//!< Number of shape records.
+	const SceneLightRecord *lightRecs;			//!< Light records.
+	size_t numLightRecs;						//!< Number of light records.
+	const SceneMaterialRecord *materialRecs;	//!< Material table.
+	size_t numMaterialRecs;						//!< Number of materials.
+	vector<string> textureFiles;				//!< Texture table (PPM file names).
+	vector<string> meshFiles;					//!< Mesh table (OBJ file names).
+	vector<SceneShapeRecord> shapeRecords;		//!< Parsed shapes.
+	vector<SceneLightRecord> lightRecords;		//!< Parsed lights.
+	vector<SceneMaterialRecord> materialRecords;//!< Parsed materials.
+	void *mapping;								//!< The mapped cache file, if any.
+	size_t mappingSize;							//!< Size of the mapping.
+
+	vector<Image *> textures;					//!< Loaded textures, in the arena.
+	vector<ITriangleMesh *> meshes;				//!< Loaded meshes, in the arena.
+	SceneBVH index;								//!< Index over scene.opaqueObjs.
+
+	bool build(bool buildIndex);
+	void unmap();
+};
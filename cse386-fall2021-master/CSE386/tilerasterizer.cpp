@@ -0,0 +1,431 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "tilerasterizer.h"
+
+/**
+ * @fn	TileRasterizer::TileRasterizer()
+ * @brief	Constructs a rasterizer. Unless setNumThreads is called, it starts one
+ * 			thread per core the first time it draws.
+ */
+
+TileRasterizer::TileRasterizer()
+	: numThreads(0), tilesX(0), tilesY(0), frameBuffer(nullptr), eyePos(nullptr),
+	lights(nullptr), eyeFrame(nullptr), gbuffer(nullptr), shadedGBuffer(nullptr), nextTile(0), generation(0), busyWorkers(0),
+	stopping(false) {
+}
+
+/**
+ * @fn	TileRasterizer::~TileRasterizer()
+ * @brief	Stops the worker threads.
+ */
+
+TileRasterizer::~TileRasterizer() {
+	stopWorkers();
+}
+
+/**
+ * @fn	void TileRasterizer::setNumThreads(int n)
+ * @brief	Sets the number of threads that draw tiles. The calling thread is one
+ * 			of them, so 1 means no workers.
+ * @param	n	Number of threads, or 0 for one per core.
+ */
+
+void TileRasterizer::setNumThreads(int n) {
+	if (n <= 0) {
+		n = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	if (n == numThreads) {
+		return;
+	}
+	stopWorkers();
+	numThreads = n;
+	scratch.assign(n, TileScratch());
+	stopping = false;
+	uint64_t current;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		current = generation;
+	}
+	for (int i = 1; i < n; i++) {
+		workers.push_back(std::thread(&TileRasterizer::workerLoop, this, i, current));
+	}
+}
+
+/**
+ * @fn	void TileRasterizer::stopWorkers()
+ * @brief	Tells the worker threads to exit and waits for them.
+ */
+
+void TileRasterizer::stopWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workReady.notify_all();
+	for (std::thread &t : workers) {
+		t.join();
+	}
+	workers.clear();
+}
+
+/**
+ * @fn	void TileRasterizer::drawTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *											const vector<LightSourcePtr> &lights,
+ *											const vector<VertexData> &windowCoords,
+ *											const Frame &eyeFrame, GBuffer *gbuffer)
+ * @brief	Draws filled triangles. Same result as drawManyFilledTriangles, or, with
+ * 			a G-buffer, as drawing them without shading and saving what shading needs.
+ * @param [in,out]	frameBuffer 	Framebuffer.
+ * @param 		  	eyePos			Eye position.
+ * @param 		  	lights			Vector of lights in scene.
+ * @param 		  	windowCoords	Vertex triplets, in window coordinates.
+ * @param 		  	eyeFrame		The camera's frame.
+ * @param [in,out]	gbuffer			G-buffer for deferred shading, the size of the
+ * 									framebuffer, or null to shade as the triangles
+ * 									are drawn.
+ */
+
+void TileRasterizer::drawTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+									const vector<LightSourcePtr> &lights,
+									const vector<VertexData> &windowCoords,
+									const Frame &eyeFrame, GBuffer *gbuffer) {
+	setTileGrid(frameBuffer);
+	this->eyePos = &eyePos;
+	this->lights = &lights;
+	this->eyeFrame = &eyeFrame;
+	this->gbuffer = gbuffer;
+	shadedGBuffer = nullptr;
+
+	int busyTiles = binTriangles(windowCoords);
+	if (busyTiles > 0) {
+		runJob(busyTiles > 1);
+	}
+}
+
+/**
+ * @fn	void TileRasterizer::shadeGBuffer(FrameBuffer &frameBuffer, const GBuffer &gbuffer,
+ *											const dmat4 &windowToWorld, const dvec3 &eyePos,
+ *											const vector<LightSourcePtr> &lights,
+ *											const Frame &eyeFrame)
+ * @brief	The lighting pass of deferred shading. Every pixel with something in
+ * 			the G-buffer is shaded once, by FragmentOps::processFragment, with its
+ * 			depth from the framebuffer and its world position worked out from the
+ * 			depth. Empty pixels are left alone.
+ * @param [in,out]	frameBuffer  	Framebuffer the G-buffer was drawn with.
+ * @param 		  	gbuffer		 	The G-buffer.
+ * @param 		  	windowToWorld	Inverse of the viewport, projection and viewing
+ * 									matrices used to draw it.
+ * @param 		  	eyePos		 	Eye position.
+ * @param 		  	lights		 	Vector of lights in scene.
+ * @param 		  	eyeFrame	 	The camera's frame.
+ */
+
+void TileRasterizer::shadeGBuffer(FrameBuffer &frameBuffer, const GBuffer &gbuffer,
+									const dmat4 &windowToWorld, const dvec3 &eyePos,
+									const vector<LightSourcePtr> &lights, const Frame &eyeFrame) {
+	if (gbuffer.width != frameBuffer.getWindowWidth() ||
+		gbuffer.height != frameBuffer.getWindowHeight()) {
+		std::cerr << "G-buffer is " << gbuffer.width << 'x' << gbuffer.height
+				<< ", framebuffer is " << frameBuffer.getWindowWidth() << 'x'
+				<< frameBuffer.getWindowHeight() << std::endl;
+		return;
+	}
+	setTileGrid(frameBuffer);
+	this->eyePos = &eyePos;
+	this->lights = &lights;
+	this->eyeFrame = &eyeFrame;
+	this->gbuffer = nullptr;
+	shadedGBuffer = &gbuffer;
+	this->windowToWorld = windowToWorld;
+	runJob(tilesX * tilesY > 1);
+}
+
+/**
+ * @fn	void TileRasterizer::setTileGrid(FrameBuffer &frameBuffer)
+ * @brief	Divides the framebuffer into tiles, starting the threads if this is
+ * 			the first job.
+ * @param [in,out]	frameBuffer	The framebuffer the job draws into.
+ */
+
+void TileRasterizer::setTileGrid(FrameBuffer &frameBuffer) {
+	if (numThreads == 0) {
+		setNumThreads(0);
+	}
+	int width = frameBuffer.getWindowWidth();
+	int height = frameBuffer.getWindowHeight();
+	tilesX = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	tilesY = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	if ((int)bins.size() < tilesX * tilesY) {
+		bins.resize(tilesX * tilesY);
+	}
+	this->frameBuffer = &frameBuffer;
+}
+
+/**
+ * @fn	void TileRasterizer::runJob(bool useWorkers)
+ * @brief	Works through the tiles of the current job, with the worker threads
+ * 			if asked, and returns when all are done.
+ * @param	useWorkers	False to do the job on the calling thread alone.
+ */
+
+void TileRasterizer::runJob(bool useWorkers) {
+	nextTile = 0;
+	useWorkers = useWorkers && !workers.empty();
+	if (useWorkers) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busyWorkers = (int)workers.size();
+			generation++;
+		}
+		workReady.notify_all();
+	}
+	runTiles(scratch[0]);
+	if (useWorkers) {
+		std::unique_lock<std::mutex> lock(mutex);
+		workDone.wait(lock, [this] { return busyWorkers == 0; });
+	}
+}
+
+/**
+ * @fn	int TileRasterizer::binTriangles(const vector<VertexData> &windowCoords)
+ * @brief	Sets up each triangle and adds it to the bin of every tile it covers
+ * 			part of.
+ * @param	windowCoords	Vertex triplets, in window coordinates.
+ * @return	The number of tiles with something to draw.
+ */
+
+int TileRasterizer::binTriangles(const vector<VertexData> &windowCoords) {
+	int width = frameBuffer->getWindowWidth();
+	int height = frameBuffer->getWindowHeight();
+	for (int t = 0; t < tilesX * tilesY; t++) {
+		bins[t].clear();
+	}
+	triangles.resize(windowCoords.size() / 3);
+
+	uint32_t n = 0;
+	for (size_t i = 0; i + 2 < windowCoords.size(); i += 3) {
+		TriangleSetup &setup = triangles[n];
+		if (!setupTriangle(windowCoords[i], windowCoords[i + 1], windowCoords[i + 2],
+							width, height, setup, gbuffer)) {
+			continue;
+		}
+		const EdgeSetup &edges = setup.edges;
+		int tx0 = edges.xMin / RASTER_TILE_SIZE;
+		int tx1 = edges.xMax / RASTER_TILE_SIZE;
+		int ty0 = edges.yMin / RASTER_TILE_SIZE;
+		int ty1 = edges.yMax / RASTER_TILE_SIZE;
+		bool oneTile = tx0 == tx1 && ty0 == ty1;
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) {
+				// Large triangles overlap many tiles that their bounding box does not.
+				if (!oneTile &&
+					edges.classifyRect(std::max(tx * RASTER_TILE_SIZE, edges.xMin),
+										std::max(ty * RASTER_TILE_SIZE, edges.yMin),
+										std::min((tx + 1) * RASTER_TILE_SIZE - 1, edges.xMax),
+										std::min((ty + 1) * RASTER_TILE_SIZE - 1, edges.yMax)) == RECT_OUTSIDE) {
+					continue;
+				}
+				bins[ty * tilesX + tx].push_back(n);
+			}
+		}
+		n++;
+	}
+	triangles.resize(n);
+
+	int busyTiles = 0;
+	for (int t = 0; t < tilesX * tilesY; t++) {
+		if (!bins[t].empty()) {
+			busyTiles++;
+		}
+	}
+	return busyTiles;
+}
+
+/**
+ * @fn	void TileRasterizer::runTiles(TileScratch &scratch)
+ * @brief	Takes tiles from the shared counter and draws or shades them until
+ * 			none are left.
+ * @param [in,out]	scratch	This thread's tile storage.
+ */
+
+void TileRasterizer::runTiles(TileScratch &scratch) {
+	const int numTiles = tilesX * tilesY;
+	for (int tile = nextTile++; tile < numTiles; tile = nextTile++) {
+		if (shadedGBuffer != nullptr) {
+			shadeTile(tile);
+		} else if (!bins[tile].empty()) {
+			drawTile(tile, scratch);
+		}
+	}
+}
+
+/**
+ * @fn	static DepthValue farthestBlock(const RasterTile &rect, int blocksX, int blocksY)
+ * @brief	Finds the farthest depth in a tile from its hierarchical Z.
+ * @param	rect   	The tile.
+ * @param	blocksX	Blocks across the tile.
+ * @param	blocksY	Blocks up the tile.
+ * @return	The farthest of the blocks' depths.
+ */
+
+static DepthValue farthestBlock(const RasterTile &rect, int blocksX, int blocksY) {
+	DepthValue result = rect.blockFarZ[0];
+	for (int j = 0; j < blocksY; j++) {
+		for (int i = 0; i < blocksX; i++) {
+			DepthValue z = rect.blockFarZ[j * RASTER_TILE_BLOCKS + i];
+			result = depthBehind(z, result, rect.reversedZ) ? z : result;
+		}
+	}
+	return result;
+}
+
+/**
+ * @fn	void TileRasterizer::drawTile(int tile, TileScratch &scratch)
+ * @brief	Draws the triangles binned to one tile, in submission order. A
+ * 			triangle whose nearest vertex is behind the farthest depth in the
+ * 			tile is skipped outright.
+ * @param 		  	tile   	The tile.
+ * @param [in,out]	scratch	This thread's tile storage.
+ */
+
+void TileRasterizer::drawTile(int tile, TileScratch &scratch) {
+	RasterTile rect;
+	rect.x0 = (tile % tilesX) * RASTER_TILE_SIZE;
+	rect.y0 = (tile / tilesX) * RASTER_TILE_SIZE;
+	rect.x1 = std::min(rect.x0 + RASTER_TILE_SIZE, frameBuffer->getWindowWidth()) - 1;
+	rect.y1 = std::min(rect.y0 + RASTER_TILE_SIZE, frameBuffer->getWindowHeight()) - 1;
+	rect.depth = scratch.depth.data();
+	rect.stride = RASTER_TILE_SIZE;
+	rect.reversedZ = frameBuffer->isReversedZ();
+	rect.blockFarZ = scratch.blockFarZ.data();
+	rect.blockStride = RASTER_TILE_BLOCKS;
+	rect.gbuffer = gbuffer;
+
+	const int W = frameBuffer->getWindowWidth();
+	const int tileWidth = rect.x1 - rect.x0 + 1;
+	DepthValue *fbDepth = frameBuffer->getDepthBuffer();
+	for (int y = rect.y0; y <= rect.y1; y++) {
+		const DepthValue *row = fbDepth + y * W + rect.x0;
+		std::copy(row, row + tileWidth, rect.depth + (y - rect.y0) * rect.stride);
+	}
+
+	const int blocksX = (tileWidth + RASTER_BLOCK_SIZE - 1) / RASTER_BLOCK_SIZE;
+	const int blocksY = (rect.y1 - rect.y0 + RASTER_BLOCK_SIZE) / RASTER_BLOCK_SIZE;
+	const bool reversed = rect.reversedZ;
+	for (int j = 0; j < blocksY; j++) {
+		for (int i = 0; i < blocksX; i++) {
+			rect.blockFarZ[j * RASTER_TILE_BLOCKS + i] =
+				farthestDepth(rect, rect.x0 + i * RASTER_BLOCK_SIZE, rect.y0 + j * RASTER_BLOCK_SIZE);
+		}
+	}
+	DepthValue tileFarZ = farthestBlock(rect, blocksX, blocksY);
+
+	const bool depthTest = FragmentOps::performDepthTest;
+	for (uint32_t t : bins[tile]) {
+		const TriangleSetup &setup = triangles[t];
+		if (depthTest && depthBehind(toDepthValue(setup.nearestZ(reversed)), tileFarZ, reversed)) {
+			continue;
+		}
+		if (rasterizeTriangle(*frameBuffer, *eyePos, *lights, setup, rect, *eyeFrame)) {
+			tileFarZ = farthestBlock(rect, blocksX, blocksY);
+		}
+	}
+
+	for (int y = rect.y0; y <= rect.y1; y++) {
+		const DepthValue *row = rect.depth + (y - rect.y0) * rect.stride;
+		std::copy(row, row + tileWidth, fbDepth + y * W + rect.x0);
+	}
+}
+
+/**
+ * @fn	void TileRasterizer::shadeTile(int tile)
+ * @brief	Shades the visible pixels of one tile, a row at a time. The row's
+ * 			visible pixels are gathered first, then their world positions
+ * 			are computed in structure of arrays loops the compiler can
+ * 			vectorize, and then each is lit.
+ * @param	tile	The tile.
+ */
+
+void TileRasterizer::shadeTile(int tile) {
+	const int W = frameBuffer->getWindowWidth();
+	const int x0 = (tile % tilesX) * RASTER_TILE_SIZE;
+	const int y0 = (tile / tilesX) * RASTER_TILE_SIZE;
+	const int x1 = std::min(x0 + RASTER_TILE_SIZE, W) - 1;
+	const int y1 = std::min(y0 + RASTER_TILE_SIZE, frameBuffer->getWindowHeight()) - 1;
+	const DepthValue *fbDepth = frameBuffer->getDepthBuffer();
+	const dmat4 &M = windowToWorld;
+
+	int px[RASTER_TILE_SIZE];
+	double wx[RASTER_TILE_SIZE], wy[RASTER_TILE_SIZE], wz[RASTER_TILE_SIZE], ww[RASTER_TILE_SIZE];
+	Fragment fragment;
+	for (int y = y0; y <= y1; y++) {
+		const uint32_t *ids = shadedGBuffer->materialIds.data() + y * W;
+		const uint32_t *normals = shadedGBuffer->normals.data() + y * W;
+		const DepthValue *depthRow = fbDepth + y * W;
+		int n = 0;
+		for (int x = x0; x <= x1; x++) {
+			px[n] = x;
+			n += ids[x] != GBUFFER_EMPTY;
+		}
+
+		const double Y = y;
+		for (int i = 0; i < n; i++) {
+			const double X = px[i];
+			const double Z = fromDepthValue(depthRow[px[i]]);
+			wx[i] = M[0][0] * X + M[1][0] * Y + M[2][0] * Z + M[3][0];
+			wy[i] = M[0][1] * X + M[1][1] * Y + M[2][1] * Z + M[3][1];
+			wz[i] = M[0][2] * X + M[1][2] * Y + M[2][2] * Z + M[3][2];
+			ww[i] = M[0][3] * X + M[1][3] * Y + M[2][3] * Z + M[3][3];
+		}
+		for (int i = 0; i < n; i++) {
+			const double invW = 1.0 / ww[i];
+			wx[i] *= invW;
+			wy[i] *= invW;
+			wz[i] *= invW;
+		}
+
+		for (int i = 0; i < n; i++) {
+			const int x = px[i];
+			fragment.windowPos = dvec3(x, y, fromDepthValue(depthRow[x]));
+			fragment.worldPos = dvec3(wx[i], wy[i], wz[i]);
+			fragment.worldNormal = decodeOctahedral(normals[x]);
+			fragment.material = shadedGBuffer->materials[ids[x]];
+			FragmentOps::processFragment(*frameBuffer, *eyePos, *lights, fragment, *eyeFrame);
+		}
+	}
+}
+
+/**
+ * @fn	void TileRasterizer::workerLoop(int id, uint64_t seen)
+ * @brief	Body of a worker thread: waits for a job, does tiles, repeats.
+ * @param	id  	Index of the thread's depth scratch.
+ * @param	seen	The generation when the thread was started. Only later
+ * 					jobs are its to help with.
+ */
+
+void TileRasterizer::workerLoop(int id, uint64_t seen) {
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workReady.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+		}
+		runTiles(scratch[id]);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busyWorkers--;
+		}
+		workDone.notify_one();
+	}
+}
@@ -0,0 +1,105 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "defs.h"
+#include "rasterization.h"
+
+const int RASTER_TILE_SIZE = 64;	//!< Tiles are RASTER_TILE_SIZE pixels square.
+const int RASTER_TILE_BLOCKS = RASTER_TILE_SIZE / RASTER_BLOCK_SIZE;	//!< Blocks across a tile.
+
+/**
+ * @struct	TileScratch
+ * @brief	One thread's copy of the tile it is drawing: the depths and the
+ * 			coarse hierarchical Z over them.
+ */
+
+struct TileScratch {
+	vector<DepthValue> depth;		//!< RASTER_TILE_SIZE squared depths.
+	vector<DepthValue> blockFarZ;	//!< Farthest depth in each block.
+	TileScratch() : depth(RASTER_TILE_SIZE * RASTER_TILE_SIZE),
+					blockFarZ(RASTER_TILE_BLOCKS * RASTER_TILE_BLOCKS) {}
+};
+
+/**
+ * @struct	TileRasterizer
+ * @brief	Sort-middle rasterizer. Triangles in window coordinates are set up
+ * 			once and binned to the screen tiles they touch. The tiles are then
+ * 			drawn by a pool of worker threads. Each tile is owned by one thread
+ * 			at a time, which draws its triangles in submission order against a
+ * 			private copy of the tile's depth buffer and writes the depths back
+ * 			when done. The copy carries a coarse hierarchical Z, so triangles
+ * 			behind everything already in the tile, or in a block of it, are
+ * 			rejected without touching pixels. No two threads touch the same
+ * 			pixel, so the framebuffer needs no locking and the image is the
+ * 			same as drawing the triangles one after another.
+ *
+ * 			The bins and the threads are kept from one frame to the next.
+ *
+ * 			For deferred shading, the triangles are drawn into a G-buffer instead
+ * 			of being shaded, and shadeGBuffer then lights the visible pixels, one
+ * 			tile per thread at a time.
+ */
+
+struct TileRasterizer {
+	TileRasterizer();
+	TileRasterizer(const TileRasterizer &) = delete;
+	TileRasterizer &operator = (const TileRasterizer &) = delete;
+	~TileRasterizer();
+
+	void setNumThreads(int n);
+	int getNumThreads() const { return numThreads; }
+	void drawTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+						const vector<LightSourcePtr> &lights,
+						const vector<VertexData> &windowCoords,
+						const Frame &eyeFrame,
+						GBuffer *gbuffer = nullptr);
+	void shadeGBuffer(FrameBuffer &frameBuffer, const GBuffer &gbuffer,
+						const dmat4 &windowToWorld, const dvec3 &eyePos,
+						const vector<LightSourcePtr> &lights, const Frame &eyeFrame);
+protected:
+	void setTileGrid(FrameBuffer &frameBuffer);
+	int binTriangles(const vector<VertexData> &windowCoords);
+	void runJob(bool useWorkers);
+	void runTiles(TileScratch &scratch);
+	void drawTile(int tile, TileScratch &scratch);
+	void shadeTile(int tile);
+	void workerLoop(int id, uint64_t seen);
+	void stopWorkers();
+
+	int numThreads;								//!< Threads drawing tiles, including the caller.
+	int tilesX, tilesY;							//!< Size of the tile grid.
+	vector<TriangleSetup> triangles;			//!< The frame's triangles, in submission order.
+	vector<vector<uint32_t>> bins;				//!< Per tile, indices of the triangles touching it.
+	vector<TileScratch> scratch;				//!< Per thread copy of the tile being drawn.
+
+	// The current job.
+	FrameBuffer *frameBuffer;
+	const dvec3 *eyePos;
+	const vector<LightSourcePtr> *lights;
+	const Frame *eyeFrame;
+	GBuffer *gbuffer;							//!< G-buffer being drawn into, or null.
+	const GBuffer *shadedGBuffer;				//!< G-buffer being shaded, or null.
+	dmat4 windowToWorld;						//!< For shading: window coordinates to world.
+	std::atomic<int> nextTile;					//!< Next tile to hand out.
+
+	vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable workReady;			//!< Signalled when a job starts or on shutdown.
+	std::condition_variable workDone;			//!< Signalled when a worker finishes its share.
+	uint64_t generation;						//!< Incremented for every job.
+	int busyWorkers;							//!< Workers still drawing the current job.
+	bool stopping;
+};
@@ -0,0 +1,94 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <iostream>
+#include <random>
+#include "defs.h"
+#include "framebuffer.h"
+#include "rasterization.h"
+#include "tilerasterizer.h"
+
+const int W = 640;
+const int H = 480;
+const int NUM_TRIANGLES = 2000;
+
+/**
+ * @fn	vector<VertexData> randomTriangles()
+ * @brief	Overlapping triangles of many sizes, in window coordinates, some
+ * 			partly off screen.
+ */
+
+vector<VertexData> randomTriangles() {
+	std::mt19937 generator(386);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	const Material materials[] = { gold, redPlastic, cyanPlastic, tin };
+	vector<VertexData> triangles;
+	for (int i = 0; i < NUM_TRIANGLES; i++) {
+		double cx = W * (1.2 * unit(generator) - 0.1);
+		double cy = H * (1.2 * unit(generator) - 0.1);
+		double r = 2 + 100 * unit(generator) * unit(generator) * unit(generator);
+		for (int k = 0; k < 3; k++) {
+			double a = TWO_PI * unit(generator);
+			triangles.push_back(VertexData(dvec4(cx + r * std::cos(a), cy + r * std::sin(a),
+											2 * unit(generator) - 1, 1), Z_AXIS, materials[(i + k) % 4]));
+		}
+	}
+	return triangles;
+}
+
+/**
+ * @fn	bool sameDepths(const FrameBuffer &a, const FrameBuffer &b)
+ * @brief	Determines if two framebuffers of the same size hold the same depths.
+ */
+
+bool sameDepths(const FrameBuffer &a, const FrameBuffer &b) {
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			if (a.getDepth(x, y) != b.getDepth(x, y)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+int main() {
+	const vector<VertexData> triangles = randomTriangles();
+	const vector<LightSourcePtr> lights;
+	const Frame eyeFrame;
+
+	FrameBuffer expected(W, H);
+	expected.setClearColor(black);
+	expected.clearColorAndDepthBuffers();
+	drawManyFilledTriangles(expected, ORIGIN3D, lights, triangles, eyeFrame);
+
+	// Changing the number of threads between frames starts new workers after
+	// jobs have already run; they must only help with the jobs after that.
+	const int THREAD_COUNTS[] = { 4, 2, 8, 1, 3, 4 };
+	TileRasterizer rasterizer;
+	FrameBuffer frameBuffer(W, H);
+	frameBuffer.setClearColor(black);
+	int failures = 0;
+	for (int threads : THREAD_COUNTS) {
+		rasterizer.setNumThreads(threads);
+		for (int frame = 0; frame < 3; frame++) {
+			frameBuffer.clearColorAndDepthBuffers();
+			rasterizer.drawTriangles(frameBuffer, ORIGIN3D, lights, triangles, eyeFrame);
+			ImageDiff diff = compareColorBuffers(expected, frameBuffer);
+			bool ok = diff.pixelsDiffering == 0 && sameDepths(expected, frameBuffer);
+			if (!ok) {
+				cout << "FAIL " << threads << " threads, frame " << frame << ": "
+					<< diff.pixelsDiffering << " pixels differ" << endl;
+				failures++;
+			}
+		}
+	}
+	cout << "TileRasterizer: " << failures << " failures" << endl;
+	return failures == 0 ? 0 : 1;
+}
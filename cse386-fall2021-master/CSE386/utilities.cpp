@@ -11,12 +11,22 @@
 #include <istream>
 #include <iomanip>
 #include <cstdlib>
+#include <algorithm>
+#include <limits>
 
 #include "defs.h"
 #include "framebuffer.h"
 #include "utilities.h"
 #include "ishape.h"
 
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define QUADRATIC_FMA
+#endif
+#if defined(__AVX__)
+#define QUADRATIC_AVX
+#include <immintrin.h>
+#endif
+
 /**
  * @fn	void swap(double &a, double &b)
  * @brief	Swaps that values of two doubleing point numbers, without
@@ -312,7 +322,7 @@ double directionInRadians(const dvec2 &referencePt, const dvec2 &targetPt) {
 	double y = (targetPt.y - referencePt.y);
 	double result = std::atan2(y, x);
 	if (result < 0 || result >= 2 * PI) {
-		normalizeRadians(result);
+		return normalizeRadians(result);
 	}
 	else {
 		return result;
@@ -333,7 +343,7 @@ double directionInRadians(const dvec2& targetPt) {
 	double y = (targetPt.y);
 	double result = std::atan2(y, x);
 	if (result < 0 || result >= 2 * PI) {
-		normalizeRadians(result);
+		return normalizeRadians(result);
 	}
 	else {
 		return result;
@@ -358,7 +368,7 @@ double directionInRadians(double x1, double y1, double x2, double y2) {
 	double y = y2 - y1;
 	double result = std::atan2(y, x);
 	if (result < 0 || result >= 2 * PI) {
-		normalizeRadians(result);
+		return normalizeRadians(result);
 	}
 	else {
 		return result;
@@ -540,6 +550,28 @@ double map(double x, double xLow, double xHigh, double yLow, double yHigh) {
 	return result;
 }
 
+/**
+ * @fn	static double discriminant(double A, double B, double C)
+ * @brief	Computes B^2 - 4AC. When the hardware has fused multiply-add, the
+ * 			rounding error of 4AC is recovered and added back, so the result
+ * 			stays accurate when the two terms nearly cancel, as they do for
+ * 			a ray grazing a quadric.
+ * @param	A	A.
+ * @param	B	B.
+ * @param	C	C.
+ * @return	The discriminant.
+ */
+
+static inline double discriminant(double A, double B, double C) {
+#ifdef QUADRATIC_FMA
+	double w = 4.0 * A * C;
+	double e = std::fma(-4.0 * A, C, w);
+	return std::fma(B, B, -w) + e;
+#else
+	return B * B - 4.0 * A * C;
+#endif
+}
+
 /**
  * @fn	vector<double> quadratic(double A, double B, double C)
  * @brief	Solves the quadratic equation, given A, B, and C.
@@ -557,45 +589,22 @@ double map(double x, double xLow, double xHigh, double yLow, double yHigh) {
  */
 
 vector<double> quadratic(double A, double B, double C) {
-	/* CSE 386 - todo  */
-	vector<double> result;	// put only the roots in here
-	double x1, x2;
-	double discriminant = B * B - 4 * A * C;
-
-	if (discriminant > 0) {
-		double x1 = (-B + sqrt(discriminant)) / (2 * A);
-		double x2 = (-B - sqrt(discriminant)) / (2 * A);
-		if (x1 > x2) {
-			result.push_back(x2);
-			result.push_back(x1);
-		}
-		else {
-			result.push_back(x1);
-			result.push_back(x2);
-		}
-
-	}
-	else if (discriminant == 0) {
-		double x1 = -B / (2 * A);
-
-		result.push_back(x1);
-
-	}
-	else if (discriminant < 0) {
-
-	}
-
-
-	return result;
+	double roots[2];
+	int numRoots = quadratic(A, B, C, roots);
+	return vector<double>(roots, roots + numRoots);
 }
 
-
-
 /**
  * @fn	int quadratic(double A, double B, double C, double roots[2])
  * @brief	Solves the quadratic equation, given A, B, and C.
  * 			0, 1, or 2 roots are inserted into the array 'roots'.
  * 			The roots are sorted in ascending order.
+ * 			
+ * 			The root farther from zero is computed as q/A, where
+ * 			q = -(B + sign(B) sqrt(B^2 - 4AC)) / 2, and the other as C/q. The
+ * 			textbook formula subtracts two nearly equal numbers for the root
+ * 			nearer zero when B^2 >> 4AC, losing most of its digits. If A is 0,
+ * 			the single root of Bx + C = 0 is returned.
  * Here is an example of how this is to be used:
  * 
  * 	double roots[2];
@@ -620,26 +629,96 @@ vector<double> quadratic(double A, double B, double C) {
  * @test	quadratic(1, 4, 3, ary) --> returns 2 and fills in ary with: [-3,-1]
  * @test	quadratic(1 ,0, 0, ary) --> returns 1 and fills in ary with: [0]
  * @test	quadratic(-4, -2, -1, ary) --> returns 0 and does not modify ary.
+ * @test	quadratic(1, 1e8, 1, ary) --> returns 2 and fills in ary with: [-1e8,-1e-8]
+ * @test	quadratic(0, 2, -4, ary) --> returns 1 and fills in ary with: [2]
  * @return	The number of real roots put into the array 'roots'
 */
 
 int quadratic(double A, double B, double C, double roots[2]) {
-	/* CSE 386 - todo  */
-	vector<double> result = quadratic(A, B, C);
-	int rootCnt = result.size();
-
-	if (rootCnt == 2) {
-		roots[0] = result.at(0);
-		roots[1] = result.at(1);
-	}
-	else if (rootCnt == 1) {
-		roots[0] = result.at(0);
+	if (A == 0) {
+		if (B == 0) {
+			return 0;
+		}
+		roots[0] = -C / B;
+		return 1;
 	}
-	else if (rootCnt == 0) {
+	double discrim = discriminant(A, B, C);
+	if (discrim == 0) {
+		roots[0] = -B / (2 * A);
+		return 1;
+	} else if (!(discrim > 0)) {
 		return 0;
 	}
+	double q = -0.5 * (B + std::copysign(std::sqrt(discrim), B));
+	double r1 = q / A;
+	double r2 = C / q;
+	roots[0] = std::min(r1, r2);
+	roots[1] = std::max(r1, r2);
+	return 2;
+}
+
+/**
+ * @fn	void quadratic(size_t n, const double *A, const double *B, const double *C, double *lo, double *hi)
+ * @brief	Solves n quadratic equations the same way as the single version.
+ * 			When built with AVX, 4 equations are solved at a time without
+ * 			branches; the results are the same either way. Equations with
+ * 			no real roots get NaN for both roots, and those with one root
+ * 			get it twice. Comparisons with NaN are false, so
+ * 			"lo[i] > 0 ? lo[i] : hi[i]" is the smallest positive root if
+ * 			that is greater than 0, and fails any test t > 0 otherwise.
+ * @param	n 	Number of equations.
+ * @param	A 	A for each equation.
+ * @param	B 	B for each equation.
+ * @param	C 	C for each equation.
+ * @param	lo	The smaller root of each equation.
+ * @param	hi	The larger root of each equation.
+ * @test	quadratic(2, {1,-4}, {4,-2}, {3,-1}, lo, hi) --> lo = [-3,NaN], hi = [-1,NaN]
+ */
 
-	return rootCnt;
+void quadratic(size_t n, const double *A, const double *B, const double *C,
+				double *lo, double *hi) {
+	const double NaN = std::numeric_limits<double>::quiet_NaN();
+	size_t i = 0;
+#ifdef QUADRATIC_AVX
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d signBit = _mm256_set1_pd(-0.0);
+	const __m256d minusHalf = _mm256_set1_pd(-0.5);
+	const __m256d four = _mm256_set1_pd(4.0);
+	const __m256d noRoot = _mm256_set1_pd(NaN);
+	for (; i + 4 <= n; i += 4) {
+		__m256d a = _mm256_loadu_pd(A + i);
+		__m256d b = _mm256_loadu_pd(B + i);
+		__m256d c = _mm256_loadu_pd(C + i);
+		__m256d fourA = _mm256_mul_pd(four, a);
+		__m256d w = _mm256_mul_pd(fourA, c);
+#ifdef QUADRATIC_FMA
+		__m256d e = _mm256_fnmadd_pd(fourA, c, w);
+		__m256d discrim = _mm256_add_pd(_mm256_fmsub_pd(b, b, w), e);
+#else
+		__m256d discrim = _mm256_sub_pd(_mm256_mul_pd(b, b), w);
+#endif
+		__m256d root = _mm256_sqrt_pd(_mm256_max_pd(discrim, zero));
+		root = _mm256_or_pd(root, _mm256_and_pd(b, signBit));
+		__m256d q = _mm256_mul_pd(minusHalf, _mm256_add_pd(b, root));
+		__m256d r1 = _mm256_div_pd(q, a);
+		__m256d r2 = _mm256_div_pd(c, q);
+		__m256d aNonZero = _mm256_cmp_pd(a, zero, _CMP_NEQ_UQ);
+		r1 = _mm256_blendv_pd(r2, r1, aNonZero);
+		__m256d two = _mm256_and_pd(_mm256_cmp_pd(discrim, zero, _CMP_GT_OQ),
+									_mm256_cmp_pd(q, zero, _CMP_NEQ_UQ));
+		r2 = _mm256_blendv_pd(r1, r2, two);
+		__m256d real = _mm256_and_pd(_mm256_cmp_pd(discrim, zero, _CMP_GE_OQ),
+									_mm256_or_pd(aNonZero, _mm256_cmp_pd(b, zero, _CMP_NEQ_UQ)));
+		_mm256_storeu_pd(lo + i, _mm256_blendv_pd(noRoot, _mm256_min_pd(r2, r1), real));
+		_mm256_storeu_pd(hi + i, _mm256_blendv_pd(noRoot, _mm256_max_pd(r2, r1), real));
+	}
+#endif
+	for (; i < n; i++) {
+		double roots[2];
+		int numRoots = quadratic(A[i], B[i], C[i], roots);
+		lo[i] = numRoots > 0 ? roots[0] : NaN;
+		hi[i] = numRoots > 1 ? roots[1] : lo[i];
+	}
 }
 
 
@@ -1009,7 +1088,7 @@ string extractBaseFilename(const string &str) {
 	return str.substr(pos + 1);
 }
 
-bool DEBUG_PIXEL = false;
+thread_local bool DEBUG_PIXEL = false;
 int xDebug = -1, yDebug = -1;
 
 void mouseUtility(int b, int s, int x, int y) {
@@ -8,6 +8,7 @@
  ****************************************************/
 
 #pragma once
+#include <cstdint>
 #include "defs.h"
 #include "colorandmaterials.h"
 
@@ -37,3 +38,41 @@ struct VertexData {
 };
 
 VertexData operator * (double w, const VertexData &V1);
+
+/**
+ * @struct	IndexedVertex
+ * @brief	A vertex of an IndexedVertexData. The material is an index into the
+ * 			mesh's material table rather than a copy.
+ */
+
+struct IndexedVertex {
+	dvec4 pos;				//!< Object coordinate.
+	dvec3 normal;			//!< Unit normal vector.
+	uint32_t materialId;	//!< Index into IndexedVertexData::materials.
+};
+
+/**
+ * @struct	IndexedVertexData
+ * @brief	Indexed triangles for Pipeline graphics. A vertex shared by several
+ * 			triangles is stored once, so VertexOps transforms it once, and each
+ * 			material is stored once and referred to by id.
+ *
+ * 			bounds is kept up to date by addVertex; code that changes the
+ * 			vertices directly must recompute it, since VertexOps::render skips
+ * 			meshes whose bounds are out of view.
+ */
+
+struct IndexedVertexData {
+	vector<IndexedVertex> vertices;	//!< The distinct vertices.
+	vector<uint32_t> indices;		//!< Three vertex indices per triangle, counterclockwise.
+	vector<Material> materials;		//!< Indexed by IndexedVertex::materialId.
+	BoundingBox bounds;				//!< Bounds of the vertices, in object coordinates.
+
+	IndexedVertexData() {}
+	explicit IndexedVertexData(const vector<VertexData> &triangles);
+	size_t numTriangles() const { return indices.size() / 3; }
+	uint32_t addMaterial(const Material &mat);
+	uint32_t addVertex(const dvec4 &pos, const dvec3 &normal, uint32_t materialId);
+	void addTriangle(uint32_t i0, uint32_t i1, uint32_t i2);
+	VertexData getVertexData(uint32_t index) const;
+};
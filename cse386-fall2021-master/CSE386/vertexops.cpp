@@ -10,7 +10,9 @@
 #include "defs.h"
 #include "vertexops.h"
 
-// Planes describing the normalized device coordinates view volume - 2x2x2 cube
+// Planes describing the normalized device coordinates view volume. The projection
+// is followed by the depth range transformation, so z runs from 0 at the near
+// plane to 1 at the far plane, or the other way round with reversed Z.
 
 vector<IPlane> VertexOps::allButNearNDCPlanes{ IPlane(dvec3(1, 0, 0), dvec3(-1, 0, 0)),
 												IPlane(dvec3(0, 1, 0), dvec3(0, -1, 0)),
@@ -19,241 +21,304 @@ vector<IPlane> VertexOps::allButNearNDCPlanes{ IPlane(dvec3(1, 0, 0), dvec3(-1,
 												IPlane(dvec3(0, -1, 0), dvec3(0, 1, 0)),
 //												IPlane(dvec3(0, 0, -1), dvec3(0, 0, 1))
 										};
+vector<IPlane> VertexOps::allButNearReversedNDCPlanes{ IPlane(dvec3(1, 0, 0), dvec3(-1, 0, 0)),
+												IPlane(dvec3(0, 1, 0), dvec3(0, -1, 0)),
+												IPlane(dvec3(0, 0, 0), dvec3(0, 0, 1)),
+												IPlane(dvec3(-1, 0, 0), dvec3(1, 0, 0)),
+												IPlane(dvec3(0, -1, 0), dvec3(0, 1, 0)),
+										};
+
+RenderContext VertexOps::defaultContext;
 
 /**
- * @fn	vector<VertexData> triangulate(const vector<VertexData> &poly)
- * @brief	Triangulates the given polygon
- * @param	poly	The polygon to be decomposed into individual triangles.
- * @return	A vector of triangles, which comprise the original polygon.
+ * @fn	RenderContext::RenderContext()
+ * @brief	Constructs an empty context. The buffers grow to fit the largest
+ * 			object drawn and are then reused.
  */
 
-vector<VertexData> triangulate(const vector<VertexData> &poly) {
-	vector<VertexData> triangles;
+RenderContext::RenderContext()
+	: nearPlane(1, IPlane(dvec3(0.0, 0.0, -1.0), -Z_AXIS)), nearZ(-1.0), reversedZ(false),
+	deferred(false), frustumCulling(true), occlusionCulling(false) {
+}
 
-	for (unsigned int i = 1; i < poly.size() - 1; i++) {
+double computeNearPlane(const dmat4 &PM) {
+	double alpha = PM[2][2];
+	double beta = PM[3][2];
+	double gamma = PM[2][3];
+	double omega = PM[3][3];
+	double nearf = -(omega + beta) / (alpha + gamma);
+	return nearf;
+}
+
+/**
+ * @fn	void VertexOps::setProjection(RenderContext &ctx, const FrameBuffer &frameBuffer,
+ *										const PipelineMatrices &pipeMats)
+ * @brief	Combines the projection with the depth range transformation that
+ * 			suits the framebuffer's depth buffer, and works out the near plane
+ * 			and the guard band.
+ * @param [in,out]	ctx		   	Gets the projection, the depth convention, the near
+ * 								plane and the guard band.
+ * @param 		  	frameBuffer	The framebuffer about to be drawn.
+ * @param 		  	pipeMats   	The pipeline matrices.
+ */
+
+void VertexOps::setProjection(RenderContext &ctx, const FrameBuffer &frameBuffer,
+								const PipelineMatrices &pipeMats) {
+	const dmat4 &V = pipeMats.viewportMatrix;
+	ctx.reversedZ = frameBuffer.isReversedZ();
+	ctx.projection = getDepthRangeTransformation(ctx.reversedZ) * pipeMats.projectionMatrix;
+	ctx.nearZ = computeNearPlane(pipeMats.projectionMatrix);
+	ctx.nearPlane[0].a = dvec3(0.0, 0.0, ctx.nearZ);
+	// Window x is V[0][0] * ndc x + V[3][0], and likewise for y.
+	ctx.guardBand.x = std::max(1.0, (RASTER_GUARD_BAND - std::abs(V[3][0])) / std::abs(V[0][0]));
+	ctx.guardBand.y = std::max(1.0, (RASTER_GUARD_BAND - std::abs(V[3][1])) / std::abs(V[1][1]));
+}
+
+/**
+ * @fn	int VertexOps::computeOutcode(const RenderContext &ctx, const dvec4 &clipPos)
+ * @brief	Classifies a vertex against the view volume, before the perspective
+ * 			division. The guard band bit means nothing for a vertex behind the
+ * 			near plane.
+ * @param	ctx	   	Holds the depth convention and the guard band.
+ * @param	clipPos	The vertex, in clip coordinates.
+ * @return	The OUT_* bits of the planes it is outside.
+ */
+
+int VertexOps::computeOutcode(const RenderContext &ctx, const dvec4 &clipPos) {
+	const double x = clipPos.x, y = clipPos.y, z = clipPos.z, w = clipPos.w;
+	int outcode = 0;
+	if (x < -w) outcode |= OUT_LEFT;
+	if (x > w) outcode |= OUT_RIGHT;
+	if (y < -w) outcode |= OUT_BOTTOM;
+	if (y > w) outcode |= OUT_TOP;
+	// Window depth is 0 at the near plane and 1 at the far one, or the
+	// other way around with reversed Z.
+	if (ctx.reversedZ ? z > w : z < 0.0) outcode |= OUT_NEAR;
+	if (ctx.reversedZ ? z < 0.0 : z > w) outcode |= OUT_FAR;
+	if (std::abs(x) > ctx.guardBand.x * w || std::abs(y) > ctx.guardBand.y * w) {
+		outcode |= OUT_GUARD_BAND;
+	}
+	return outcode;
+}
+
+/**
+ * @fn	void triangulate(const vector<VertexData> &poly, vector<VertexData> &triangles)
+ * @brief	Triangulates the given polygon
+ * @param			poly		The polygon to be decomposed into individual triangles.
+ * @param [in,out]	triangles	The triangles, which comprise the original polygon, are 
+ * 								added to the end.
+ */
+
+void triangulate(const vector<VertexData> &poly, vector<VertexData> &triangles) {
+	for (unsigned int i = 1; i + 1 < poly.size(); i++) {
 		triangles.push_back(poly[0]);
 		triangles.push_back(poly[i]);
 		triangles.push_back(poly[i + 1]);
 	}
-
-	return triangles;
 }
 
 /**
- * @fn	vector<VertexData> VertexOps::clipAgainstPlane(vector<VertexData> &verts, const IPlane &plane)
+ * @fn	void VertexOps::clipAgainstPlane(const vector<VertexData> &verts, const IPlane &plane,
+ *										vector<VertexData> &output)
  * @brief	Clips a polygon against a single plane
- * @param [in,out]	verts	The array of vertices.
- * @param 		  	plane	The plane that will do the clipping.
- * @return	The polygon that exludes the portions outside the given plane.
+ * @param			verts 	The array of vertices.
+ * @param			plane 	The plane that will do the clipping.
+ * @param [out]		output	The polygon that exludes the portions outside the given plane.
  */
 
-vector<VertexData> VertexOps::clipAgainstPlane(vector<VertexData> &verts, const IPlane &plane) {
-	vector<VertexData> output;
+void VertexOps::clipAgainstPlane(const vector<VertexData> &verts, const IPlane &plane,
+									vector<VertexData> &output) {
+	output.clear();
 
 	if (verts.size() > 2) {
-		verts.push_back(verts[0]);
-
-		for (unsigned int i = 1; i < verts.size(); i++) {
-			bool v0In = plane.onFrontSide(verts[i - 1].pos.xyz());
-			bool v1In = plane.onFrontSide(verts[i].pos.xyz());
+		const size_t N = verts.size();
+		for (size_t i = 1; i <= N; i++) {
+			const VertexData &V0 = verts[i - 1];
+			const VertexData &V1 = verts[i % N];
+			bool v0In = plane.onFrontSide(V0.pos.xyz());
+			bool v1In = plane.onFrontSide(V1.pos.xyz());
 
 			if (v0In && v1In) {
-				output.push_back(verts[i]);
+				output.push_back(V1);
 			} else if (v0In || v1In) {
 				double t;
-				plane.findIntersection(verts[i - 1].pos.xyz(), verts[i].pos.xyz(), t);
-				VertexData I(1.0 - t, verts[i - 1], t, verts[i]);
-				output.push_back(I);
+				plane.findIntersection(V0.pos.xyz(), V1.pos.xyz(), t);
+				output.push_back(VertexData(1.0 - t, V0, t, V1));
 				if (!v0In && v1In) {
-					output.push_back(verts[i]);
+					output.push_back(V1);
 				}
 			}
 		}
 	}
-	return output;
 }
 
 /**
- * @fn	vector<VertexData> VertexOps::clipPolygon(const vector<VertexData> &clipCoords)
- * @brief	Clip polygon against the normalized view volumn - 2x2x2 cube.
- * @param	clipCoords	The array of triangles.
- * @param	planes		Planes to clip against
- * @return	The array of triangles, after performing clipping.
+ * @fn	void VertexOps::clipPolygon(RenderContext &ctx, const vector<VertexData> &clipCoords,
+ *									const vector<IPlane> &planes, vector<VertexData> &ndcCoords)
+ * @brief	Clip triangles against a set of planes.
+ * @param [in,out]	ctx		  	Scratch storage.
+ * @param			clipCoords	The array of triangles.
+ * @param			planes	  	Planes to clip against
+ * @param [out]		ndcCoords 	The array of triangles, after performing clipping.
  */
 
-vector<VertexData> VertexOps::clipPolygon(const vector<VertexData> &clipCoords,
-											const vector<IPlane> &planes) {
-	vector<VertexData> ndcCoords;
-
-	if (clipCoords.size() > 2) {
-		for (unsigned int i = 0; i < clipCoords.size() - 2; i += 3) {
-			vector<VertexData> polygon;
-			polygon.push_back(clipCoords[i]);
-			polygon.push_back(clipCoords[i + 1]);
-			polygon.push_back(clipCoords[i + 2]);
-
-			for (const IPlane &plane : planes) {
-				polygon = clipAgainstPlane(polygon, plane);
-			}
-			if (polygon.size() > 3) {
-				polygon = triangulate(polygon);
-			}
-			for (const VertexData &v : polygon) {
-				ndcCoords.push_back(v);
-			}
+void VertexOps::clipPolygon(RenderContext &ctx, const vector<VertexData> &clipCoords,
+							const vector<IPlane> &planes, vector<VertexData> &ndcCoords) {
+	vector<VertexData> &polygon = ctx.polygon;
+	vector<VertexData> &clipped = ctx.clippedPolygon;
+	ndcCoords.clear();
+
+	for (size_t i = 0; i + 2 < clipCoords.size(); i += 3) {
+		polygon.clear();
+		polygon.push_back(clipCoords[i]);
+		polygon.push_back(clipCoords[i + 1]);
+		polygon.push_back(clipCoords[i + 2]);
+
+		for (const IPlane &plane : planes) {
+			clipAgainstPlane(polygon, plane, clipped);
+			std::swap(polygon, clipped);
 		}
+		triangulate(polygon, ndcCoords);
 	}
-	return ndcCoords;
 }
 
 /**
- * @fn	vector<VertexData> VertexOps::clipLineSegments(const vector<VertexData> &clipCoords)
+ * @fn	void VertexOps::clipLineSegments(const vector<VertexData> &clipCoords,
+ *										const vector<IPlane> &planes, vector<VertexData> &ndcCoords)
  * @brief	Clip line segments against normalized view volume.
- * @param	clipCoords	The vector of line segments that are to be clipped.
- * @param	planes	planes to clip against
- * @return	A vector&lt;VertexData&gt;
+ * @param			clipCoords	The vector of line segments that are to be clipped.
+ * @param			planes	  	planes to clip against
+ * @param [out]		ndcCoords 	The segments that remain.
  */
 
-vector<VertexData> VertexOps::clipLineSegments(const vector<VertexData> &clipCoords,
-											const vector<IPlane> &planes) {
-	vector<VertexData> ndcCoords;
-
-	if (clipCoords.size() > 1) {
-		for (unsigned int i = 0; i < clipCoords.size() - 1; i += 2) {
-			VertexData v0 = clipCoords[i];
-			VertexData v1 = clipCoords[i + 1];
-
-			bool outsideViewVolume = false;
-
-			for (const IPlane &plane : planes) {
-				bool v0In = plane.onFrontSide(v0.pos.xyz());
-				bool v1In = plane.onFrontSide(v1.pos.xyz());
-
-				if (!v0In && !v1In) { // Line segment is entirely clipped
-					outsideViewVolume = true;
-					break; 
-				} else if (v0In && !v1In) {
-					double t;
-					plane.findIntersection(v0.pos.xyz(), v1.pos.xyz(), t);
-					v1 = VertexData(1.0-t, v0, t, v1);
-				} else if (!v0In && v1In) {
-					double t;
-					plane.findIntersection(v0.pos.xyz(), v1.pos.xyz(), t);
-					v0 = VertexData(1.0-t, v0, t, v1);
-				} else {  // both inside
-					;
-				}
-			}
-			if (!outsideViewVolume) {
-				ndcCoords.push_back(v0);
-				ndcCoords.push_back(v1);
+void VertexOps::clipLineSegments(const vector<VertexData> &clipCoords,
+									const vector<IPlane> &planes, vector<VertexData> &ndcCoords) {
+	ndcCoords.clear();
+
+	for (size_t i = 0; i + 1 < clipCoords.size(); i += 2) {
+		VertexData v0 = clipCoords[i];
+		VertexData v1 = clipCoords[i + 1];
+
+		bool outsideViewVolume = false;
+
+		for (const IPlane &plane : planes) {
+			bool v0In = plane.onFrontSide(v0.pos.xyz());
+			bool v1In = plane.onFrontSide(v1.pos.xyz());
+
+			if (!v0In && !v1In) { // Line segment is entirely clipped
+				outsideViewVolume = true;
+				break; 
+			} else if (v0In && !v1In) {
+				double t;
+				plane.findIntersection(v0.pos.xyz(), v1.pos.xyz(), t);
+				v1 = VertexData(1.0-t, v0, t, v1);
+			} else if (!v0In && v1In) {
+				double t;
+				plane.findIntersection(v0.pos.xyz(), v1.pos.xyz(), t);
+				v0 = VertexData(1.0-t, v0, t, v1);
+			} else {  // both inside
+				;
 			}
 		}
+		if (!outsideViewVolume) {
+			ndcCoords.push_back(v0);
+			ndcCoords.push_back(v1);
+		}
 	}
-	return ndcCoords;
 }
 
  /**
- * @fn	vector<VertexData> VertexOps::processBackwardFacingTriangles(const vector<VertexData> &triangleVerts,
- *																	 bool renderBackfaces)
- * @brief	Removes the backward facing triangles
- * @param	triangleVerts	The vector of triangle vertices.
- * @return	Vector of triangle vertices, without those facing backward.
+ * @fn	void VertexOps::processBackwardFacingTriangles(vector<VertexData> &triangleVerts,
+ *														bool renderBackfaces)
+ * @brief	Removes the backward facing triangles, in place. If they are to be rendered
+ * 			instead, their normals are reversed.
+ * @param [in,out]	triangleVerts  	The vector of triangle vertices.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
  */
 
-vector<VertexData> VertexOps::processBackwardFacingTriangles(const vector<VertexData> &triangleVerts, bool renderBackfaces) {
-	vector<VertexData> triangles;
+void VertexOps::processBackwardFacingTriangles(vector<VertexData> &triangleVerts, bool renderBackfaces) {
+	size_t kept = 0;
 
-	for (int i = 0; i < (int)triangleVerts.size() - 2; i += 3) {
+	for (size_t i = 0; i + 2 < triangleVerts.size(); i += 3) {
 		dvec3 n = normalFrom3Points(triangleVerts[i].pos.xyz(), 
 									triangleVerts[i + 1].pos.xyz(), 
 									triangleVerts[i + 2].pos.xyz());
-		if (n.z >= 0.0) {
-			triangles.push_back(triangleVerts[i]);
-			triangles.push_back(triangleVerts[i + 1]);
-			triangles.push_back(triangleVerts[i + 2]);
-		} else if (renderBackfaces) {
-			triangles.push_back(triangleVerts[i]);
-			triangles.back().normal *= -1;
-
-			triangles.push_back(triangleVerts[i + 1]);
-			triangles.back().normal *= -1;
-
-			triangles.push_back(triangleVerts[i + 2]);
-			triangles.back().normal *= -1;
+		if (n.z >= 0.0 || renderBackfaces) {
+			for (size_t j = i; j < i + 3; j++, kept++) {
+				if (kept != j) {
+					triangleVerts[kept] = triangleVerts[j];
+				}
+				if (n.z < 0.0) {
+					triangleVerts[kept].normal *= -1;
+				}
+			}
 		}
 	}
-	return triangles;
+	triangleVerts.erase(triangleVerts.begin() + kept, triangleVerts.end());
 }
 
 /**
- * @fn	vector<VertexData> VertexOps::transformVerticesToWorldCoordinates(const dmat4 &modelMatrix, 
- *																			const vector<VertexData> &vertices)
+ * @fn	void VertexOps::transformVerticesToWorldCoordinates(const dmat4 &modelMatrix, 
+ *															const vector<VertexData> &vertices,
+ *															vector<VertexData> &worldCoords)
  * @brief	Apply modeling transformation to vector of vertices. This method is called only
  *          for the first stage of the pipeline.
- * @param	modelMatrix	Modeling matrix.
- * @param	vertices   	The vector of vertices.
- * @return	The transformed vertices.
+ * @param			modelMatrix	Modeling matrix.
+ * @param			vertices   	The vector of vertices.
+ * @param [out]		worldCoords	The transformed vertices.
  */
 
-vector<VertexData> VertexOps::transformVerticesToWorldCoordinates(const dmat4 &modelMatrix, 
-																	const vector<VertexData> &vertices) {
+void VertexOps::transformVerticesToWorldCoordinates(const dmat4 &modelMatrix, 
+													const vector<VertexData> &vertices,
+													vector<VertexData> &worldCoords) {
 	// Create 3 x 3 matrix for transforming normal vectors to world coordinates
 	dmat3 TM3x3(modelMatrix);
 	dmat3 modelingTransfomationForNormals = glm::transpose(glm::inverse(TM3x3));
 
-	vector<VertexData> transformedVertices;
-	for (unsigned int i=0; i<vertices.size(); i++) {
-		const VertexData &v = vertices[i];
-		dvec3 n = modelingTransfomationForNormals * v.normal;
-		dvec4 worldPos = modelMatrix * v.pos;
-		VertexData vt(worldPos, n, v.material, worldPos.xyz());
-		transformedVertices.push_back(vt);
+	worldCoords.assign(vertices.begin(), vertices.end());
+	transformVertices(modelMatrix, worldCoords);
+	for (VertexData &v : worldCoords) {
+		v.normal = modelingTransfomationForNormals * v.normal;
+		v.worldPos = v.pos.xyz();
 	}
-	return transformedVertices;
 }
 
 /**
- * @fn	vector<VertexData> VertexOps::transformVertices(const dmat4 &TM, 
- *														const vector<VertexData> & vertices)
- * @brief	Applies a transformation matrix to a vector of vertices. Does not change the worldPosition; copies it over.
- * @param	TM			The transformation matrix.
- * @param	vertices   	The vertices.
- * @return	The transformed vector of vertices.
+ * @fn	void VertexOps::transformVertices(const dmat4 &TM, vector<VertexData> &vertices)
+ * @brief	Applies a transformation matrix to a vector of vertices, in place. Does not
+ * 			change the worldPosition, which is kept for per pixel lighting calculations.
+ * @param			TM			The transformation matrix.
+ * @param [in,out]	vertices   	The vertices.
  */
 
-vector<VertexData> VertexOps::transformVertices(const dmat4 &TM, const vector<VertexData> & vertices) {
-	vector<VertexData> transformedVertices;
-
-	for (const VertexData &v : vertices) {
-		VertexData vt(TM * v.pos, v.normal, v.material);
-		// Save the world position separately for use in per pixel lighting calculations
-		vt.worldPos = v.worldPos;
-
-		transformedVertices.push_back(vt);
+void VertexOps::transformVertices(const dmat4 &TM, vector<VertexData> &vertices) {
+	if (!vertices.empty()) {
+		transformPositions(TM, &vertices[0].pos, vertices.size(), sizeof(VertexData));
 	}
-	return transformedVertices;
-}
-
-double computeNearPlane(const dmat4 &PM) {
-	double alpha = PM[2][2];
-	double beta = PM[3][2];
-	double gamma = PM[2][3];
-	double omega = PM[3][3];
-	double nearf = -(omega + beta) / (alpha + gamma);
-	return nearf;
 }
 
 /**
  * @fn	void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos, 
  *												const vector<LightSourcePtr> &lights, 
- *												const vector<VertexData> &objectCoords)
+ *												const vector<VertexData> &objectCoords,
+ *												const dmat4 &modelingMatrix,
+ *												const PipelineMatrices &pipeMats,
+ *												bool renderBackfaces, RenderContext &ctx)
  * @brief	Transforms the triangle vertices through pipeline: 
  *					object -> world -> eye -> clip/ndc -> window.
+ * 			The positions and normals are copied into the context's vertex
+ * 			stream and transformed there, several at a time, with the modeling,
+ * 			viewing and projection matrices concatenated into one. The
+ * 			triangles are then assembled from the stream by assembleTriangle.
+ * 			Once the context's buffers have grown to fit, nothing is allocated.
  * @param [in,out]	frameBuffer 	Buffer for frame data.
  * @param 		  	eyePos			The eye position.
  * @param 		  	lights			The lights.
  * @param 		  	objectCoords	The object coordinates.
+ * @param 		  	modelingMatrix 	The transformation applied to the object.
+ * @param 		  	pipeMats	   	The pipeline matrices.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ * @param [in,out]	ctx			   	Scratch storage.
  */
 
 void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
@@ -261,22 +326,130 @@ void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &e
 										const vector<VertexData> &objectCoords,
 										const dmat4& modelingMatrix,
 										const PipelineMatrices& pipeMats,
-										bool renderBackfaces) {
+										bool renderBackfaces,
+										RenderContext &ctx) {
 	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
-	const dmat4& projectionMatrix = pipeMats.projectionMatrix;
-	const dmat4& viewportMatrix = pipeMats.viewportMatrix;
 
-	vector<VertexData> worldCoords = transformVerticesToWorldCoordinates(modelingMatrix, objectCoords);
-	vector<VertexData> eyeCoords = transformVertices(viewingMatrix, worldCoords);
+	setProjection(ctx, frameBuffer, pipeMats);
+	ctx.stream.load(objectCoords);
+	transformStream(ctx.stream, modelingMatrix, ctx.projection * viewingMatrix * modelingMatrix,
+					pipeMats.viewportMatrix);
+	normalizeVectors(ctx.stream.count, ctx.stream.wnx.data(), ctx.stream.wny.data(), ctx.stream.wnz.data());
+	classifyVertices(ctx);
+
+	ctx.coords.clear();
+	for (uint32_t i = 0; i + 2 < objectCoords.size(); i += 3) {
+		const uint32_t ids[3] = { i, i + 1, i + 2 };
+		const Material *materials[3] = { &objectCoords[i].material, &objectCoords[i + 1].material,
+										&objectCoords[i + 2].material };
+		assembleTriangle(ctx, ids, materials, pipeMats, renderBackfaces);
+	}
 
-	double nearZ = computeNearPlane(projectionMatrix);
-	vector <IPlane> nearPlane = { IPlane(dvec4(0.0, 0.0, nearZ, 1.0), -Z_AXIS) };
-	vector<VertexData> eyeCoordsClippedOnNearPlane = clipPolygon(eyeCoords, nearPlane);
+	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+	ctx.rasterizer.drawTriangles(frameBuffer, eyePos, lights, ctx.coords, eyeFrame,
+									ctx.deferred ? &ctx.gbuffer : nullptr);
+}
 
-	vector<VertexData> projCoords = transformVertices(projectionMatrix, eyeCoordsClippedOnNearPlane);
-	vector<VertexData> clipCoords;
+/**
+ * @fn	void VertexOps::classifyVertices(RenderContext &ctx)
+ * @brief	Finds the outcode of every vertex in the context's stream.
+ * @param [in,out]	ctx	Holds the stream, in clip coordinates, and gets the outcodes.
+ */
 
-	for (VertexData v : projCoords) {		// Perspective division
+void VertexOps::classifyVertices(RenderContext &ctx) {
+	const VertexStream &stream = ctx.stream;
+	ctx.outcodes.resize(stream.count);
+	for (size_t i = 0; i < stream.count; i++) {
+		ctx.outcodes[i] = computeOutcode(ctx, stream.clipPos(i));
+	}
+}
+
+/**
+ * @fn	void VertexOps::assembleTriangle(RenderContext &ctx, const uint32_t ids[3],
+ *											const Material *materials[3],
+ *											const PipelineMatrices &pipeMats,
+ *											bool renderBackfaces)
+ * @brief	The back half of the triangle pipeline, for one triangle of the
+ * 			context's stream, which has been transformed and classified. The
+ * 			triangle that remains, if any, is added to ctx.coords in window
+ * 			coordinates.
+ *
+ * 			A triangle wholly outside a plane of the view volume is dropped. One
+ * 			that only crosses the side planes, within the guard band, goes to
+ * 			the rasterizer unclipped, since the rasterizer draws only the pixels
+ * 			inside the window anyway. Only triangles crossing the near or far
+ * 			plane, or reaching past the guard band, are taken back to eye
+ * 			coordinates and clipped, by clipTriangles.
+ * @param [in,out]	ctx			   	The stream, outcodes and output.
+ * @param			ids			   	The triangle's vertices in the stream.
+ * @param			materials	   	Their materials.
+ * @param			pipeMats	   	The pipeline matrices.
+ * @param			renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void VertexOps::assembleTriangle(RenderContext &ctx, const uint32_t ids[3],
+									const Material *materials[3],
+									const PipelineMatrices &pipeMats,
+									bool renderBackfaces) {
+	const VertexStream &stream = ctx.stream;
+	const int a = ctx.outcodes[ids[0]], b = ctx.outcodes[ids[1]], c = ctx.outcodes[ids[2]];
+	if ((a & b & c & OUT_VIEW) != 0) {
+		return;
+	}
+	if (((a | b | c) & OUT_MUST_CLIP) != 0) {
+		ctx.clipInput.clear();
+		for (int k = 0; k < 3; k++) {
+			dvec3 worldPos = stream.worldPos(ids[k]);
+			ctx.clipInput.push_back(VertexData(pipeMats.viewingMatrix * dvec4(worldPos, 1.0),
+												stream.worldNormal(ids[k]), *materials[k], worldPos));
+		}
+		clipTriangles(ctx, ctx.clipInput, pipeMats, renderBackfaces);
+		ctx.coords.insert(ctx.coords.end(), ctx.clipInput.begin(), ctx.clipInput.end());
+		return;
+	}
+
+	// The viewport scales x and y by positive amounts, so facing is the same
+	// in window coordinates as in normalized device coordinates.
+	dvec4 windowPos[3] = { stream.windowPos(ids[0]), stream.windowPos(ids[1]), stream.windowPos(ids[2]) };
+	dvec3 n = normalFrom3Points(windowPos[0].xyz(), windowPos[1].xyz(), windowPos[2].xyz());
+	bool backward = n.z < 0.0;
+	if (backward && !renderBackfaces) {
+		return;
+	}
+	for (int k = 0; k < 3; k++) {
+		dvec3 normal = stream.worldNormal(ids[k]);
+		ctx.coords.push_back(VertexData(windowPos[k], backward ? -normal : normal,
+										*materials[k], stream.worldPos(ids[k])));
+	}
+}
+
+/**
+ * @fn	void VertexOps::clipTriangles(RenderContext &ctx, vector<VertexData> &coords,
+ *										const PipelineMatrices &pipeMats,
+ *										bool renderBackfaces)
+ * @brief	eye -> clip/ndc -> window for triangles that need clipping: they are
+ * 			clipped against the near plane, projected, culled if backward facing,
+ * 			and clipped against the rest of the view volume. Works in place,
+ * 			using ctx.clipScratch as the other half of a ping-pong pair.
+ * @param [in,out]	ctx			   	Scratch storage.
+ * @param [in,out]	coords		   	Triangle vertices in eye coordinates on entry,
+ * 									the triangles that remain in window coordinates
+ * 									on return.
+ * @param			pipeMats	   	The pipeline matrices.
+ * @param			renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void VertexOps::clipTriangles(RenderContext &ctx, vector<VertexData> &coords,
+								const PipelineMatrices &pipeMats,
+								bool renderBackfaces) {
+	const dmat4& viewportMatrix = pipeMats.viewportMatrix;
+
+	clipPolygon(ctx, coords, ctx.nearPlane, ctx.clipScratch);
+	std::swap(coords, ctx.clipScratch);
+
+	transformVertices(ctx.projection, coords);
+
+	for (VertexData &v : coords) {		// Perspective division
 		if (v.pos.w >= 0) {
 			v.pos /= v.pos.w;
 		} else {							// should not happen
@@ -285,82 +458,408 @@ void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &e
 			v.pos.z = -std::abs(v.pos.z/-v.pos.w);
 			v.pos.w = 1.0;
 		}
-		clipCoords.push_back(v);
 	}
 
-	clipCoords = processBackwardFacingTriangles(clipCoords, renderBackfaces);	
+	processBackwardFacingTriangles(coords, renderBackfaces);
+
+	clipPolygon(ctx, coords, ctx.reversedZ ? allButNearReversedNDCPlanes : allButNearNDCPlanes, ctx.clipScratch);
+	std::swap(coords, ctx.clipScratch);
+	transformVertices(viewportMatrix, coords);
+}
+
+/**
+ * @fn	void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *												const vector<LightSourcePtr> &lights,
+ *												const IndexedVertexData &mesh,
+ *												const dmat4 &modelingMatrix,
+ *												const PipelineMatrices &pipeMats,
+ *												bool renderBackfaces, RenderContext &ctx)
+ * @brief	Indexed version of the triangle pipeline. Each distinct vertex is
+ * 			transformed once, in the context's vertex stream, which then serves
+ * 			as the post-transform cache the triangles are assembled from. Only
+ * 			triangles that survive culling are expanded into VertexData.
+ * @param [in,out]	frameBuffer	   	Buffer for frame data.
+ * @param 		  	eyePos		   	The eye position.
+ * @param 		  	lights		   	The lights.
+ * @param 		  	mesh		   	The indexed triangles, in object coordinates.
+ * @param 		  	modelingMatrix 	The transformation applied to the object.
+ * @param 		  	pipeMats	   	The pipeline matrices.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ * @param [in,out]	ctx			   	Scratch storage.
+ */
 
-	vector<VertexData> ndcCoords = clipPolygon(clipCoords, allButNearNDCPlanes);
-	vector<VertexData> windowCoords = transformVertices(viewportMatrix, ndcCoords);
+void VertexOps::processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+										const vector<LightSourcePtr> &lights,
+										const IndexedVertexData &mesh,
+										const dmat4 &modelingMatrix,
+										const PipelineMatrices &pipeMats,
+										bool renderBackfaces,
+										RenderContext &ctx) {
+	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
+	VertexStream &stream = ctx.stream;
+
+	// Vertex stage: once per distinct vertex.
+	setProjection(ctx, frameBuffer, pipeMats);
+	stream.load(mesh.vertices);
+	transformStream(stream, modelingMatrix, ctx.projection * viewingMatrix * modelingMatrix,
+					pipeMats.viewportMatrix);
+	normalizeVectors(stream.count, stream.wnx.data(), stream.wny.data(), stream.wnz.data());
+	classifyVertices(ctx);
+
+	// Primitive assembly.
+	ctx.coords.clear();
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		const uint32_t ids[3] = { mesh.indices[i], mesh.indices[i + 1], mesh.indices[i + 2] };
+		const Material *materials[3] = { &mesh.materials[mesh.vertices[ids[0]].materialId],
+										&mesh.materials[mesh.vertices[ids[1]].materialId],
+										&mesh.materials[mesh.vertices[ids[2]].materialId] };
+		assembleTriangle(ctx, ids, materials, pipeMats, renderBackfaces);
+	}
 
 	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
-	drawManyFilledTriangles(frameBuffer, eyePos, lights, windowCoords, eyeFrame);
+	ctx.rasterizer.drawTriangles(frameBuffer, eyePos, lights, ctx.coords, eyeFrame,
+									ctx.deferred ? &ctx.gbuffer : nullptr);
 }
 
 /**
  * @fn	void VertexOps::processLineSegments(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *											const vector<LightSourcePtr> &lights,
- *											const vector<VertexData> &objectCoords)
+ *											const vector<VertexData> &objectCoords,
+ *											const dmat4 &modelingMatrix,
+ *											const PipelineMatrices &pipeMats,
+ *											RenderContext &ctx)
  * @brief	Process the line segments through the pipeline.
  * @param [in,out]	frameBuffer 	Frame buffer
  * @param 		  	eyePos			Eye position.
  * @param 		  	lights			The lights in the scene.
  * @param 		  	objectCoords	The vector of object coordinates.
+ * @param 		  	modelingMatrix 	The transformation applied to the object.
+ * @param 		  	pipeMats	   	The pipeline matrices.
+ * @param [in,out]	ctx			   	Scratch storage.
  */
 
 void VertexOps::processLineSegments(FrameBuffer &frameBuffer, const dvec3 &eyePos,
 									const vector<LightSourcePtr> &lights,
 									const vector<VertexData> &objectCoords,
 									const dmat4& modelingMatrix,
-									const PipelineMatrices &pipeMats) {
+									const PipelineMatrices &pipeMats,
+									RenderContext &ctx) {
 	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
-	const dmat4& projectionMatrix = pipeMats.projectionMatrix;
 	const dmat4& viewportMatrix = pipeMats.viewportMatrix;
 
-	vector<VertexData> worldCoords = transformVerticesToWorldCoordinates(modelingMatrix, objectCoords);
-
-	vector<VertexData> eyeCoords = transformVertices(viewingMatrix, worldCoords);
-	vector<VertexData> projCoords = transformVertices(projectionMatrix, eyeCoords);
-	vector<VertexData> clipCoords;
+	setProjection(ctx, frameBuffer, pipeMats);
+	vector<VertexData> &coords = ctx.coords;
+	transformVerticesToWorldCoordinates(modelingMatrix, objectCoords, coords);
+	transformVertices(ctx.projection * viewingMatrix, coords);
 
-	for (VertexData v : projCoords) {	// Perspective division
+	for (VertexData &v : coords) {	// Perspective division
 		if (v.pos.w >= 0)
 			v.pos /= v.pos.w;
 		else {							// this should not happen
 			v.pos /= -v.pos.w;
 			v.pos.z = -std::abs(v.pos.z);
 		}
-		clipCoords.push_back(v);
 	}
 
-	vector<VertexData> ndcCoords = clipLineSegments(clipCoords, allButNearNDCPlanes);
-	vector<VertexData> windowCoords = transformVertices(viewportMatrix, ndcCoords);
+	clipLineSegments(coords, ctx.reversedZ ? allButNearReversedNDCPlanes : allButNearNDCPlanes, ctx.scratch);
+	std::swap(coords, ctx.scratch);
+	transformVertices(viewportMatrix, coords);
 	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
-	drawManyLines(frameBuffer, eyePos, lights, windowCoords, eyeFrame);
+	drawManyLines(frameBuffer, eyePos, lights, coords, eyeFrame);
 }
 
 /**
  * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const vector<VertexData> &verts,
- *								const vector<LightSourcePtr> &lights, const dmat4 &TM)
- * @brief	Renders this object
+ *								const vector<LightSourcePtr> &lights, const dmat4 &modelingMatrix,
+ *								const PipelineMatrices &pipeMats, bool renderBackfaces,
+ *								RenderContext &ctx)
+ * @brief	Renders this object, unless culling is on and its bounding box,
+ * 			found by going through the vertices, shows it cannot be seen.
  * @param [in,out]	frameBuffer	Buffer for frame data.
  * @param 		  	verts	   	The vertices.
  * @param 		  	lights	   	The lights.
  * @param           modelingMatrix  The transformation applied to the object
  * @param 		  	pipeMats    The pipeline matrices
  * @param           renderBackfaces True if backfaces are to be rendered
+ * @param [in,out]	ctx			Scratch storage. Defaults to one shared by all calls.
  */
 
 void VertexOps::render(FrameBuffer &frameBuffer, const vector<VertexData> &verts,
 							const vector<LightSourcePtr> &lights,
 							const dmat4& modelingMatrix,
 							const PipelineMatrices &pipeMats,
-							bool renderBackfaces) {
+							bool renderBackfaces,
+							RenderContext &ctx) {
+	if (ctx.frustumCulling || ctx.occlusionCulling) {
+		render(frameBuffer, verts, getBounds(verts), lights, modelingMatrix,
+				pipeMats, renderBackfaces, ctx);
+		return;
+	}
 	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
 
 	dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
 	VertexOps::processTriangleVertices(frameBuffer, eyePos, lights, verts,
-		modelingMatrix, pipeMats, renderBackfaces);
+		modelingMatrix, pipeMats, renderBackfaces, ctx);
+}
+
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const vector<VertexData> &verts,
+ *								const BoundingBox &objectBounds,
+ *								const vector<LightSourcePtr> &lights, const dmat4 &modelingMatrix,
+ *								const PipelineMatrices &pipeMats, bool renderBackfaces,
+ *								RenderContext &ctx)
+ * @brief	Renders an object whose bounding box is known, such as one kept from
+ * 			getBounds. Nothing is done with the vertices of an object that
+ * 			isObjectVisible rules out.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	verts	   	The vertices.
+ * @param 		  	objectBounds	Bounds of the vertices, in object coordinates.
+ * @param 		  	lights	   	The lights.
+ * @param           modelingMatrix  The transformation applied to the object
+ * @param 		  	pipeMats    The pipeline matrices
+ * @param           renderBackfaces True if backfaces are to be rendered
+ * @param [in,out]	ctx			Scratch storage. Defaults to one shared by all calls.
+ */
+
+void VertexOps::render(FrameBuffer &frameBuffer, const vector<VertexData> &verts,
+							const BoundingBox &objectBounds,
+							const vector<LightSourcePtr> &lights,
+							const dmat4& modelingMatrix,
+							const PipelineMatrices &pipeMats,
+							bool renderBackfaces,
+							RenderContext &ctx) {
+	if (!isObjectVisible(frameBuffer, objectBounds, modelingMatrix, pipeMats, ctx)) {
+		return;
+	}
+	dvec3 eyePos = glm::inverse(pipeMats.viewingMatrix)[3].xyz();
+	VertexOps::processTriangleVertices(frameBuffer, eyePos, lights, verts,
+		modelingMatrix, pipeMats, renderBackfaces, ctx);
+}
+
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const IndexedVertexData &mesh,
+ *								const vector<LightSourcePtr> &lights, const dmat4 &modelingMatrix,
+ *								const PipelineMatrices &pipeMats, bool renderBackfaces,
+ *								RenderContext &ctx)
+ * @brief	Renders an indexed object, unless its bounds show it cannot be seen.
+ * @param [in,out]	frameBuffer	   	Buffer for frame data.
+ * @param 		  	mesh		   	The indexed triangles.
+ * @param 		  	lights		   	The lights.
+ * @param 		  	modelingMatrix 	The transformation applied to the object
+ * @param 		  	pipeMats	   	The pipeline matrices
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered
+ * @param [in,out]	ctx				Scratch storage. Defaults to one shared by all calls.
+ */
+
+void VertexOps::render(FrameBuffer &frameBuffer, const IndexedVertexData &mesh,
+							const vector<LightSourcePtr> &lights,
+							const dmat4& modelingMatrix,
+							const PipelineMatrices &pipeMats,
+							bool renderBackfaces,
+							RenderContext &ctx) {
+	if (!isObjectVisible(frameBuffer, mesh.bounds, modelingMatrix, pipeMats, ctx)) {
+		return;
+	}
+	dvec3 eyePos = glm::inverse(pipeMats.viewingMatrix)[3].xyz();
+	VertexOps::processTriangleVertices(frameBuffer, eyePos, lights, mesh,
+		modelingMatrix, pipeMats, renderBackfaces, ctx);
+}
+
+/**
+ * @fn	void VertexOps::beginDeferred(const FrameBuffer &frameBuffer, RenderContext &ctx)
+ * @brief	Starts a deferred shading frame. Until shadeDeferred is called, the
+ * 			triangles rendered with ctx only fill the depth buffer and the
+ * 			context's G-buffer, so a pixel covered many times is still lit only
+ * 			once. The depth buffer must be writable, and since the G-buffer keeps
+ * 			one surface per pixel, blending does not apply: draw transparent
+ * 			objects, and lines, after shadeDeferred.
+ * @param	frameBuffer	The framebuffer about to be drawn, already cleared.
+ * @param [in,out]	ctx	The context the frame will be rendered with.
+ */
+
+void VertexOps::beginDeferred(const FrameBuffer &frameBuffer, RenderContext &ctx) {
+	ctx.gbuffer.setSize(frameBuffer.getWindowWidth(), frameBuffer.getWindowHeight());
+	ctx.gbuffer.clear();
+	ctx.deferred = true;
+}
+
+/**
+ * @fn	void VertexOps::shadeDeferred(FrameBuffer &frameBuffer,
+ *										const vector<LightSourcePtr> &lights,
+ *										const PipelineMatrices &pipeMats,
+ *										RenderContext &ctx)
+ * @brief	Ends a deferred shading frame by lighting every pixel in the G-buffer,
+ * 			in parallel on the context's rasterizer threads.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	lights	   	The lights.
+ * @param 		  	pipeMats   	The pipeline matrices the frame was drawn with.
+ * @param [in,out]	ctx			The context the frame was rendered with.
+ */
+
+void VertexOps::shadeDeferred(FrameBuffer &frameBuffer,
+								const vector<LightSourcePtr> &lights,
+								const PipelineMatrices &pipeMats,
+								RenderContext &ctx) {
+	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
+
+	dvec3 eyePos = glm::inverse(viewingMatrix)[3].xyz();
+	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+	setProjection(ctx, frameBuffer, pipeMats);
+	dmat4 windowToWorld = glm::inverse(pipeMats.viewportMatrix * ctx.projection * viewingMatrix);
+	ctx.rasterizer.shadeGBuffer(frameBuffer, ctx.gbuffer, windowToWorld, eyePos, lights, eyeFrame);
+	ctx.deferred = false;
+}
+
+/**
+ * @fn	bool VertexOps::isObjectVisible(const FrameBuffer &frameBuffer,
+ *										const BoundingBox &objectBounds,
+ *										const dmat4 &modelingMatrix,
+ *										const PipelineMatrices &pipeMats,
+ *										RenderContext &ctx)
+ * @brief	Decides from its bounding box whether an object might be seen. The
+ * 			eight corners are taken to clip coordinates and given outcodes; if
+ * 			they are all outside the same plane of the view volume, so is the
+ * 			object. With occlusion culling on, an object wholly in front of the
+ * 			near plane is also tested against the occluders. The decision is
+ * 			added to ctx.cullCounts.
+ * @param	frameBuffer   	The framebuffer about to be drawn.
+ * @param	objectBounds  	Bounds of the object, in object coordinates.
+ * @param	modelingMatrix	The transformation applied to the object.
+ * @param	pipeMats	  	The pipeline matrices.
+ * @param [in,out]	ctx	  	The culling settings, occluders and counts.
+ * @return	False if the object certainly cannot be seen.
+ */
+
+bool VertexOps::isObjectVisible(const FrameBuffer &frameBuffer, const BoundingBox &objectBounds,
+								const dmat4 &modelingMatrix, const PipelineMatrices &pipeMats,
+								RenderContext &ctx) {
+	if (objectBounds.isEmpty()) {
+		ctx.cullCounts.outsideView++;
+		return false;
+	}
+	setProjection(ctx, frameBuffer, pipeMats);
+	const dvec3 &lo = objectBounds.lo, &hi = objectBounds.hi;
+	dmat4 toClip = ctx.projection * pipeMats.viewingMatrix * modelingMatrix;
+	dvec4 corners[8];
+	int outsideAll = ~0, outsideAny = 0;
+	for (int i = 0; i < 8; i++) {
+		dvec4 &c = corners[i];
+		c = toClip * dvec4((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z, 1.0);
+		int out = computeOutcode(ctx, c);
+		outsideAll &= out;
+		outsideAny |= out;
+	}
+	if (ctx.frustumCulling && (outsideAll & OUT_VIEW) != 0) {
+		ctx.cullCounts.outsideView++;
+		return false;
+	}
+	const OcclusionBuffer &occluders = ctx.occluders;
+	if (ctx.occlusionCulling && (outsideAny & OUT_NEAR) == 0 && !occluders.farZ.empty() &&
+		occluders.width == frameBuffer.getWindowWidth() &&
+		occluders.height == frameBuffer.getWindowHeight() &&
+		occluders.reversedZ == ctx.reversedZ &&
+		isOccluded(occluders, corners, pipeMats)) {
+		ctx.cullCounts.occluded++;
+		return false;
+	}
+	ctx.cullCounts.visible++;
+	return true;
+}
+
+/**
+ * @fn	bool VertexOps::isOccluded(const OcclusionBuffer &occluders, const dvec4 clipCorners[8],
+ *									const PipelineMatrices &pipeMats)
+ * @brief	Tests a box that is wholly in front of the near plane against the
+ * 			occluders: it is hidden if its nearest depth is behind the farthest
+ * 			depth of every block its screen rectangle touches.
+ * @param	occluders  	The occluders, the same size as the framebuffer.
+ * @param	clipCorners	The box's corners, in clip coordinates.
+ * @param	pipeMats   	The pipeline matrices.
+ * @return	True if the box is hidden.
+ */
+
+bool VertexOps::isOccluded(const OcclusionBuffer &occluders, const dvec4 clipCorners[8],
+							const PipelineMatrices &pipeMats) {
+	const bool reversed = occluders.reversedZ;
+	double xMin = DBL_MAX, xMax = -DBL_MAX, yMin = DBL_MAX, yMax = -DBL_MAX;
+	double nearest = reversed ? 0.0 : 1.0;
+	for (int i = 0; i < 8; i++) {
+		dvec4 ndc = clipCorners[i] / clipCorners[i].w;
+		dvec4 win = pipeMats.viewportMatrix * ndc;
+		xMin = std::min(xMin, win.x);
+		xMax = std::max(xMax, win.x);
+		yMin = std::min(yMin, win.y);
+		yMax = std::max(yMax, win.y);
+		nearest = reversed ? std::max(nearest, ndc.z) : std::min(nearest, ndc.z);
+	}
+	int x0 = std::max(0, (int)std::floor(xMin));
+	int y0 = std::max(0, (int)std::floor(yMin));
+	int x1 = std::min(occluders.width - 1, (int)std::ceil(xMax));
+	int y1 = std::min(occluders.height - 1, (int)std::ceil(yMax));
+	if (x0 > x1 || y0 > y1) {
+		return false;
+	}
+	DepthValue boxNear = toDepthValue(glm::clamp(nearest, 0.0, 1.0));
+	for (int by = y0 / RASTER_BLOCK_SIZE; by <= y1 / RASTER_BLOCK_SIZE; by++) {
+		const DepthValue *row = &occluders.farZ[by * occluders.blocksX];
+		for (int bx = x0 / RASTER_BLOCK_SIZE; bx <= x1 / RASTER_BLOCK_SIZE; bx++) {
+			if (!depthBehind(boxNear, row[bx], reversed)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	void VertexOps::captureOccluders(const FrameBuffer &frameBuffer, RenderContext &ctx)
+ * @brief	Keeps a coarse copy of a finished frame's depths, for occlusion
+ * 			culling in the next frame. Call it once the opaque objects are
+ * 			drawn. An object that comes out from behind an occluder, because
+ * 			it, the occluder or the camera moved, is drawn one frame late.
+ * @param	frameBuffer	The finished frame.
+ * @param [in,out]	ctx	Gets the occluders.
+ */
+
+void VertexOps::captureOccluders(const FrameBuffer &frameBuffer, RenderContext &ctx) {
+	OcclusionBuffer &occluders = ctx.occluders;
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const bool reversed = frameBuffer.isReversedZ();
+	occluders.width = W;
+	occluders.height = H;
+	occluders.blocksX = (W + RASTER_BLOCK_SIZE - 1) / RASTER_BLOCK_SIZE;
+	occluders.blocksY = (H + RASTER_BLOCK_SIZE - 1) / RASTER_BLOCK_SIZE;
+	occluders.reversedZ = reversed;
+	occluders.farZ.assign(occluders.blocksX * occluders.blocksY, toDepthValue(reversed ? 1.0 : 0.0));
+
+	const DepthValue *depth = frameBuffer.getDepthBuffer();
+	for (int y = 0; y < H; y++) {
+		DepthValue *row = &occluders.farZ[(y / RASTER_BLOCK_SIZE) * occluders.blocksX];
+		for (int x = 0; x < W; x++) {
+			DepthValue d = depth[y * W + x];
+			DepthValue &farZ = row[x / RASTER_BLOCK_SIZE];
+			if (depthBehind(d, farZ, reversed)) {
+				farZ = d;
+			}
+		}
+	}
+}
+
+/**
+ * @fn	BoundingBox VertexOps::getBounds(const vector<VertexData> &verts)
+ * @brief	Finds the bounding box of some vertices, to be kept and passed to
+ * 			render with them.
+ * @param	verts	The vertices.
+ * @return	Their bounds, in the same coordinates.
+ */
+
+BoundingBox VertexOps::getBounds(const vector<VertexData> &verts) {
+	BoundingBox box;
+	for (const VertexData &v : verts) {
+		box.grow(v.pos.xyz());
+	}
+	return box;
 }
 
 /**
@@ -371,3 +870,21 @@ void VertexOps::render(FrameBuffer &frameBuffer, const vector<VertexData> &verts
 dmat4 VertexOps::getViewportTransformation(int left, int width, int bottom, int height) {
 	return T((double)left, (double)bottom, 0.0) * S(width / 2.0, height / 2.0, 1.0) * T(1.0, 1.0, 0.0);
 }
+
+/**
+ * @fn	dmat4 VertexOps::getDepthRangeTransformation(bool reversedZ)
+ * @brief	Maps the z of a projection, -1 at the near plane and 1 at the far, to
+ * 			window depth: 0 to 1, or 1 to 0 for reversed Z. It is folded into the
+ * 			projection matrix, so under reversed Z the small depth of a distant
+ * 			point comes out of one dot product rather than as 1 minus a number
+ * 			close to 1, and keeps the precision a float buffer has near 0.
+ * @param	reversedZ	True for reversed Z.
+ * @return	The transformation, to be applied after the projection.
+ */
+
+dmat4 VertexOps::getDepthRangeTransformation(bool reversedZ) {
+	dmat4 result(1.0);
+	result[2][2] = reversedZ ? -0.5 : 0.5;
+	result[3][2] = 0.5;
+	return result;
+}
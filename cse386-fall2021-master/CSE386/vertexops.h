@@ -15,6 +15,21 @@
 #include "vertexdata.h"
 #include "iscene.h"
 #include "rasterization.h"
+#include "tilerasterizer.h"
+#include "vertexstream.h"
+
+// Outcodes: the sides of the view volume a vertex in clip coordinates is outside.
+// Triangles that are only outside the side planes are left to the rasterizer,
+// which draws the part inside the window, as long as they stay in its guard band.
+const int OUT_LEFT = 1;
+const int OUT_RIGHT = 2;
+const int OUT_BOTTOM = 4;
+const int OUT_TOP = 8;
+const int OUT_FAR = 16;
+const int OUT_GUARD_BAND = 32;
+const int OUT_NEAR = 64;
+const int OUT_VIEW = OUT_LEFT | OUT_RIGHT | OUT_BOTTOM | OUT_TOP | OUT_FAR | OUT_NEAR;
+const int OUT_MUST_CLIP = OUT_NEAR | OUT_FAR | OUT_GUARD_BAND;
 
  /**
   * @class	PipelineMatrices
@@ -27,6 +42,75 @@ struct PipelineMatrices {
 	dmat4 viewportMatrix;
 };
 
+/**
+ * @struct	OcclusionBuffer
+ * @brief	A coarse copy of a finished frame's depth buffer: the farthest depth
+ * 			in each RASTER_BLOCK_SIZE square block of pixels. Objects whose
+ * 			bounds lie behind every block they cover are skipped in the next
+ * 			frame. See VertexOps::captureOccluders.
+ */
+
+struct OcclusionBuffer {
+	int width, height;			//!< Size of the framebuffer it was taken from.
+	int blocksX, blocksY;		//!< Size of the block grid.
+	bool reversedZ;				//!< Depth convention of that framebuffer.
+	vector<DepthValue> farZ;	//!< Farthest depth per block, row by row. Empty until captured.
+	OcclusionBuffer() : width(0), height(0), blocksX(0), blocksY(0), reversedZ(false) {}
+};
+
+/**
+ * @struct	CullCounts
+ * @brief	What VertexOps::isObjectVisible decided about the objects it was given.
+ */
+
+struct CullCounts {
+	size_t visible;			//!< Objects sent down the pipeline.
+	size_t outsideView;		//!< Objects skipped as outside the view volume.
+	size_t occluded;		//!< Objects skipped as hidden behind the occluders.
+	CullCounts() : visible(0), outsideView(0), occluded(0) {}
+};
+
+/**
+ * @struct	RenderContext
+ * @brief	Scratch storage for the vertex pipeline. The stages work in place or
+ * 			ping-pong between these buffers, which keep their capacity from one
+ * 			call to the next, so steady-state frames do not touch the heap. A
+ * 			context must not be used by two threads at once; its rasterizer
+ * 			has threads of its own.
+ *
+ * 			While deferred is set, triangles are drawn into the G-buffer rather
+ * 			than shaded; see VertexOps::beginDeferred.
+ *
+ * 			VertexOps::render first checks each object's bounding box against
+ * 			the view volume and, if occlusionCulling is set, against the
+ * 			occluders captured at the end of the previous frame.
+ */
+
+struct RenderContext {
+	vector<VertexData> coords;				//!< The vertices being processed.
+	vector<VertexData> scratch;				//!< The other half of the ping-pong pair.
+	vector<VertexData> polygon;				//!< Polygon being clipped.
+	vector<VertexData> clippedPolygon;		//!< Polygon after clipping against one plane.
+	vector<VertexData> triangle;			//!< Triangle being assembled from the vertex cache.
+	vector<VertexData> clipInput;			//!< A triangle that needs real clipping.
+	vector<VertexData> clipScratch;			//!< Ping-pong partner while clipping it.
+	VertexStream stream;					//!< The vertices of the object being drawn.
+	vector<int> outcodes;					//!< OUT_* bits of each vertex in the stream.
+	vector<IPlane> nearPlane;				//!< The near clipping plane, in eye coordinates.
+	double nearZ;							//!< Eye z of the near plane.
+	dmat4 projection;						//!< Projection to window depth, for the object being drawn.
+	dvec2 guardBand;						//!< Guard band half size, in normalized device units.
+	bool reversedZ;							//!< True if the framebuffer being drawn uses reversed Z.
+	TileRasterizer rasterizer;				//!< Draws the triangles that come out of the pipeline.
+	GBuffer gbuffer;						//!< Normals and materials for deferred shading.
+	bool deferred;							//!< True between beginDeferred and shadeDeferred.
+	bool frustumCulling;					//!< Skip objects outside the view volume. On by default.
+	bool occlusionCulling;					//!< Skip objects hidden behind the occluders. Off by default.
+	OcclusionBuffer occluders;				//!< The previous frame's depths.
+	CullCounts cullCounts;					//!< Totals since they were last reset.
+	RenderContext();
+};
+
 /**
  * @class	VertexOps
  * @brief	Class to encapsulate the methods related to vertex processing for Pipeline graphics.
@@ -34,35 +118,87 @@ struct PipelineMatrices {
 
 class VertexOps {
 public:
-	static vector<IPlane> allButNearNDCPlanes;		//!< 5 of the 6 planes of the 2x2x2 cube.
+	static vector<IPlane> allButNearNDCPlanes;		//!< 5 of the 6 planes of the view volume, -1 <= x, y <= 1, z <= 1.
+	static vector<IPlane> allButNearReversedNDCPlanes;	//!< The same with reversed Z, where the far plane is z = 0.
+	static RenderContext defaultContext;			//!< Used when no context is given.
 
 	static void processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
 										const vector<LightSourcePtr> &lights,
 										const vector<VertexData> &objectCoords,
 										const dmat4& modelingMatrix,
 										const PipelineMatrices& pipeMats,
-										bool renderBackfaces);
+										bool renderBackfaces,
+										RenderContext &ctx = defaultContext);
+	static void processTriangleVertices(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+										const vector<LightSourcePtr> &lights,
+										const IndexedVertexData &mesh,
+										const dmat4& modelingMatrix,
+										const PipelineMatrices& pipeMats,
+										bool renderBackfaces,
+										RenderContext &ctx = defaultContext);
 	static void processLineSegments(FrameBuffer &frameBuffer, const dvec3 &eyePos,
 									const vector<LightSourcePtr> &lights,
 									const vector<VertexData> &objectCoords,
 									const dmat4& modelingMatrix,
-									const PipelineMatrices&pipeMats);
+									const PipelineMatrices&pipeMats,
+									RenderContext &ctx = defaultContext);
+	static void render(FrameBuffer &frameBuffer, const vector<VertexData> &verts,
+								const vector<LightSourcePtr> &lights,
+								const dmat4& modelingMatrix,
+								const PipelineMatrices&pipeMats,
+								bool renderBackfaces,
+								RenderContext &ctx = defaultContext);
 	static void render(FrameBuffer &frameBuffer, const vector<VertexData> &verts,
+								const BoundingBox &objectBounds,
 								const vector<LightSourcePtr> &lights,
 								const dmat4& modelingMatrix,
 								const PipelineMatrices&pipeMats,
-								bool renderBackfaces
-		);
+								bool renderBackfaces,
+								RenderContext &ctx = defaultContext);
+	static void render(FrameBuffer &frameBuffer, const IndexedVertexData &mesh,
+								const vector<LightSourcePtr> &lights,
+								const dmat4& modelingMatrix,
+								const PipelineMatrices&pipeMats,
+								bool renderBackfaces,
+								RenderContext &ctx = defaultContext);
+	static void beginDeferred(const FrameBuffer &frameBuffer,
+								RenderContext &ctx = defaultContext);
+	static void shadeDeferred(FrameBuffer &frameBuffer,
+								const vector<LightSourcePtr> &lights,
+								const PipelineMatrices &pipeMats,
+								RenderContext &ctx = defaultContext);
+	static bool isObjectVisible(const FrameBuffer &frameBuffer, const BoundingBox &objectBounds,
+								const dmat4 &modelingMatrix, const PipelineMatrices &pipeMats,
+								RenderContext &ctx = defaultContext);
+	static void captureOccluders(const FrameBuffer &frameBuffer,
+								RenderContext &ctx = defaultContext);
+	static BoundingBox getBounds(const vector<VertexData> &verts);
 	static dmat4 getViewportTransformation(int left, int width, int bottom, int height);
+	static dmat4 getDepthRangeTransformation(bool reversedZ);
 protected:
-	static vector<VertexData> clipAgainstPlane(vector<VertexData> &verts, const IPlane &plane);
-	static vector<VertexData> clipPolygon(const vector<VertexData> &clipCoords,
-											const vector<IPlane> &planes);
-	static vector<VertexData> clipLineSegments(const vector<VertexData> &clipCoords,
-												const vector<IPlane> &planes);
-	static vector<VertexData> processBackwardFacingTriangles(const vector<VertexData> &triangleVerts,
-																bool renderBackfaces);
-	static vector<VertexData> transformVerticesToWorldCoordinates(const dmat4 &modelMatrix,
-																	const vector<VertexData> &vertices);
-	static vector<VertexData> transformVertices(const dmat4 &TM, const vector<VertexData> &vertices);
+	static void setProjection(RenderContext &ctx, const FrameBuffer &frameBuffer,
+								const PipelineMatrices &pipeMats);
+	static int computeOutcode(const RenderContext &ctx, const dvec4 &clipPos);
+	static bool isOccluded(const OcclusionBuffer &occluders, const dvec4 clipCorners[8],
+							const PipelineMatrices &pipeMats);
+	static void clipAgainstPlane(const vector<VertexData> &verts, const IPlane &plane,
+									vector<VertexData> &output);
+	static void clipPolygon(RenderContext &ctx, const vector<VertexData> &clipCoords,
+							const vector<IPlane> &planes, vector<VertexData> &ndcCoords);
+	static void clipLineSegments(const vector<VertexData> &clipCoords,
+									const vector<IPlane> &planes, vector<VertexData> &ndcCoords);
+	static void processBackwardFacingTriangles(vector<VertexData> &triangleVerts,
+												bool renderBackfaces);
+	static void transformVerticesToWorldCoordinates(const dmat4 &modelMatrix,
+													const vector<VertexData> &vertices,
+													vector<VertexData> &worldCoords);
+	static void transformVertices(const dmat4 &TM, vector<VertexData> &vertices);
+	static void classifyVertices(RenderContext &ctx);
+	static void assembleTriangle(RenderContext &ctx, const uint32_t ids[3],
+									const Material *materials[3],
+									const PipelineMatrices &pipeMats,
+									bool renderBackfaces);
+	static void clipTriangles(RenderContext &ctx, vector<VertexData> &coords,
+								const PipelineMatrices &pipeMats,
+								bool renderBackfaces);
 };
@@ -0,0 +1,349 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <limits>
+#include "defs.h"
+#include "vertexstream.h"
+
+#if defined(__AVX__)
+#define VERTEX_STREAM_AVX
+#include <immintrin.h>
+#endif
+
+#ifdef VERTEX_STREAM_AVX
+
+/**
+ * @struct	Lanes
+ * @brief	The AVX operations the kernels need, for doubles (4 lanes) and
+ * 			floats (8 lanes).
+ */
+
+template <class T> struct Lanes;
+
+template <> struct Lanes<double> {
+	typedef __m256d V;
+	static const size_t N = 4;
+	static V set1(double a) { return _mm256_set1_pd(a); }
+	static V load(const double *p) { return _mm256_loadu_pd(p); }
+	static void store(double *p, V a) { _mm256_storeu_pd(p, a); }
+	static V add(V a, V b) { return _mm256_add_pd(a, b); }
+	static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+	static V div(V a, V b) { return _mm256_div_pd(a, b); }
+	static V sqrt(V a) { return _mm256_sqrt_pd(a); }
+	static V max(V a, V b) { return _mm256_max_pd(a, b); }
+};
+
+template <> struct Lanes<float> {
+	typedef __m256 V;
+	static const size_t N = 8;
+	static V set1(float a) { return _mm256_set1_ps(a); }
+	static V load(const float *p) { return _mm256_loadu_ps(p); }
+	static void store(float *p, V a) { _mm256_storeu_ps(p, a); }
+	static V add(V a, V b) { return _mm256_add_ps(a, b); }
+	static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+	static V div(V a, V b) { return _mm256_div_ps(a, b); }
+	static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+	static V max(V a, V b) { return _mm256_max_ps(a, b); }
+};
+
+typedef Lanes<StreamReal> L;
+typedef L::V Vec;
+
+#endif
+
+/**
+ * @fn	void VertexStream::resize(size_t n)
+ * @brief	Makes room for n vertices.
+ * @param	n	Number of vertices.
+ */
+
+void VertexStream::resize(size_t n) {
+	count = n;
+	vector<StreamReal> *arrays[] = { &px, &py, &pz, &pw, &nx, &ny, &nz,
+									&wx, &wy, &wz, &wnx, &wny, &wnz,
+									&cx, &cy, &cz, &cw, &sx, &sy, &sz };
+	for (vector<StreamReal> *a : arrays) {
+		a->resize(n);
+	}
+}
+
+/**
+ * @fn	void VertexStream::load(const vector<VertexData> &verts)
+ * @brief	Copies the positions and normals of some vertices into the stream.
+ * @param	verts	The vertices, in object coordinates.
+ */
+
+void VertexStream::load(const vector<VertexData> &verts) {
+	resize(verts.size());
+	for (size_t i = 0; i < count; i++) {
+		const VertexData &v = verts[i];
+		px[i] = (StreamReal)v.pos.x;
+		py[i] = (StreamReal)v.pos.y;
+		pz[i] = (StreamReal)v.pos.z;
+		pw[i] = (StreamReal)v.pos.w;
+		nx[i] = (StreamReal)v.normal.x;
+		ny[i] = (StreamReal)v.normal.y;
+		nz[i] = (StreamReal)v.normal.z;
+	}
+}
+
+/**
+ * @fn	void VertexStream::load(const vector<IndexedVertex> &verts)
+ * @brief	Copies the positions and normals of an indexed mesh into the stream.
+ * @param	verts	The vertices, in object coordinates.
+ */
+
+void VertexStream::load(const vector<IndexedVertex> &verts) {
+	resize(verts.size());
+	for (size_t i = 0; i < count; i++) {
+		const IndexedVertex &v = verts[i];
+		px[i] = (StreamReal)v.pos.x;
+		py[i] = (StreamReal)v.pos.y;
+		pz[i] = (StreamReal)v.pos.z;
+		pw[i] = (StreamReal)v.pos.w;
+		nx[i] = (StreamReal)v.normal.x;
+		ny[i] = (StreamReal)v.normal.y;
+		nz[i] = (StreamReal)v.normal.z;
+	}
+}
+
+/**
+ * @fn	void transformPoints(const dmat4 &M, size_t n,
+ *							const StreamReal *x, const StreamReal *y, const StreamReal *z, const StreamReal *w,
+ *							StreamReal *ox, StreamReal *oy, StreamReal *oz, StreamReal *ow)
+ * @brief	Multiplies n points by a matrix.
+ * @param	M 	The matrix.
+ * @param	n 	Number of points.
+ * @param	x,y,z,w		The points' components.
+ * @param	ox,oy,oz,ow	The results' components. ow may be null if w is not wanted.
+ */
+
+void transformPoints(const dmat4 &M, size_t n,
+						const StreamReal *x, const StreamReal *y, const StreamReal *z, const StreamReal *w,
+						StreamReal *ox, StreamReal *oy, StreamReal *oz, StreamReal *ow) {
+	StreamReal m[4][4];
+	for (int c = 0; c < 4; c++) {
+		for (int r = 0; r < 4; r++) {
+			m[c][r] = (StreamReal)M[c][r];
+		}
+	}
+	StreamReal *out[4] = { ox, oy, oz, ow };
+	const int rows = ow != nullptr ? 4 : 3;
+	size_t i = 0;
+#ifdef VERTEX_STREAM_AVX
+	Vec mv[4][4];
+	for (int c = 0; c < 4; c++) {
+		for (int r = 0; r < 4; r++) {
+			mv[c][r] = L::set1(m[c][r]);
+		}
+	}
+	for (; i + L::N <= n; i += L::N) {
+		Vec X = L::load(x + i), Y = L::load(y + i), Z = L::load(z + i), W = L::load(w + i);
+		for (int r = 0; r < rows; r++) {
+			L::store(out[r] + i, L::add(L::add(L::mul(mv[0][r], X), L::mul(mv[1][r], Y)),
+										L::add(L::mul(mv[2][r], Z), L::mul(mv[3][r], W))));
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		for (int r = 0; r < rows; r++) {
+			out[r][i] = (m[0][r] * x[i] + m[1][r] * y[i]) + (m[2][r] * z[i] + m[3][r] * w[i]);
+		}
+	}
+}
+
+/**
+ * @fn	void transformNormals(const dmat3 &N, size_t n,
+ *								const StreamReal *x, const StreamReal *y, const StreamReal *z,
+ *								StreamReal *ox, StreamReal *oy, StreamReal *oz)
+ * @brief	Multiplies n vectors by a 3x3 matrix.
+ * @param	N 	The matrix, usually the inverse transpose of a modeling matrix.
+ * @param	n 	Number of vectors.
+ * @param	x,y,z		The vectors' components.
+ * @param	ox,oy,oz	The results' components.
+ */
+
+void transformNormals(const dmat3 &N, size_t n,
+						const StreamReal *x, const StreamReal *y, const StreamReal *z,
+						StreamReal *ox, StreamReal *oy, StreamReal *oz) {
+	StreamReal m[3][3];
+	for (int c = 0; c < 3; c++) {
+		for (int r = 0; r < 3; r++) {
+			m[c][r] = (StreamReal)N[c][r];
+		}
+	}
+	StreamReal *out[3] = { ox, oy, oz };
+	size_t i = 0;
+#ifdef VERTEX_STREAM_AVX
+	Vec mv[3][3];
+	for (int c = 0; c < 3; c++) {
+		for (int r = 0; r < 3; r++) {
+			mv[c][r] = L::set1(m[c][r]);
+		}
+	}
+	for (; i + L::N <= n; i += L::N) {
+		Vec X = L::load(x + i), Y = L::load(y + i), Z = L::load(z + i);
+		for (int r = 0; r < 3; r++) {
+			L::store(out[r] + i, L::add(L::add(L::mul(mv[0][r], X), L::mul(mv[1][r], Y)),
+										L::mul(mv[2][r], Z)));
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		for (int r = 0; r < 3; r++) {
+			out[r][i] = m[0][r] * x[i] + m[1][r] * y[i] + m[2][r] * z[i];
+		}
+	}
+}
+
+/**
+ * @fn	template <class T> void normalizeVectors(size_t n, T *x, T *y, T *z)
+ * @brief	Scales n vectors, in place, to unit length. Zero vectors stay
+ * 			zero: the squared length is kept at least the smallest normal
+ * 			value, so they are scaled by a finite amount. Instantiated for
+ * 			float and double, whatever StreamReal is, so that other structure
+ * 			of arrays code (e.g., RayBatch) can use it too.
+ * @param	n	Number of vectors.
+ * @param	x,y,z	The vectors' components.
+ */
+
+template <class T>
+void normalizeVectors(size_t n, T *x, T *y, T *z) {
+	size_t i = 0;
+#ifdef VERTEX_STREAM_AVX
+	typedef Lanes<T> LT;
+	const typename LT::V one = LT::set1(1);
+	const typename LT::V tiny = LT::set1(std::numeric_limits<T>::min());
+	for (; i + LT::N <= n; i += LT::N) {
+		typename LT::V X = LT::load(x + i), Y = LT::load(y + i), Z = LT::load(z + i);
+		typename LT::V len2 = LT::max(LT::add(LT::add(LT::mul(X, X), LT::mul(Y, Y)), LT::mul(Z, Z)), tiny);
+		typename LT::V inv = LT::div(one, LT::sqrt(len2));
+		LT::store(x + i, LT::mul(X, inv));
+		LT::store(y + i, LT::mul(Y, inv));
+		LT::store(z + i, LT::mul(Z, inv));
+	}
+#endif
+	for (; i < n; i++) {
+		T inv = 1 / std::sqrt(std::max(x[i] * x[i] + y[i] * y[i] + z[i] * z[i], std::numeric_limits<T>::min()));
+		x[i] *= inv;
+		y[i] *= inv;
+		z[i] *= inv;
+	}
+}
+
+template void normalizeVectors<float>(size_t n, float *x, float *y, float *z);
+template void normalizeVectors<double>(size_t n, double *x, double *y, double *z);
+
+/**
+ * @fn	void projectPoints(const dmat4 &viewportMatrix, size_t n,
+ *							const StreamReal *x, const StreamReal *y, const StreamReal *z, const StreamReal *w,
+ *							StreamReal *ox, StreamReal *oy, StreamReal *oz)
+ * @brief	The perspective division and viewport transformation of n points.
+ * 			Points with w <= 0 give meaningless results.
+ * @param	viewportMatrix	The viewport transformation.
+ * @param	n 	Number of points.
+ * @param	x,y,z,w		The points, in clip coordinates.
+ * @param	ox,oy,oz	The points, in window coordinates.
+ */
+
+void projectPoints(const dmat4 &viewportMatrix, size_t n,
+					const StreamReal *x, const StreamReal *y, const StreamReal *z, const StreamReal *w,
+					StreamReal *ox, StreamReal *oy, StreamReal *oz) {
+	StreamReal m[4][3];
+	for (int c = 0; c < 4; c++) {
+		for (int r = 0; r < 3; r++) {
+			m[c][r] = (StreamReal)viewportMatrix[c][r];
+		}
+	}
+	StreamReal *out[3] = { ox, oy, oz };
+	size_t i = 0;
+#ifdef VERTEX_STREAM_AVX
+	Vec mv[4][3];
+	for (int c = 0; c < 4; c++) {
+		for (int r = 0; r < 3; r++) {
+			mv[c][r] = L::set1(m[c][r]);
+		}
+	}
+	for (; i + L::N <= n; i += L::N) {
+		Vec W = L::load(w + i);
+		Vec X = L::div(L::load(x + i), W), Y = L::div(L::load(y + i), W), Z = L::div(L::load(z + i), W);
+		for (int r = 0; r < 3; r++) {
+			L::store(out[r] + i, L::add(L::add(L::mul(mv[0][r], X), L::mul(mv[1][r], Y)),
+										L::add(L::mul(mv[2][r], Z), mv[3][r])));
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		StreamReal X = x[i] / w[i], Y = y[i] / w[i], Z = z[i] / w[i];
+		for (int r = 0; r < 3; r++) {
+			out[r][i] = (m[0][r] * X + m[1][r] * Y) + (m[2][r] * Z + m[3][r]);
+		}
+	}
+}
+
+/**
+ * @fn	void transformStream(VertexStream &stream, const dmat4 &modelingMatrix,
+ *							const dmat4 &modelViewProjection, const dmat4 &viewportMatrix)
+ * @brief	The vertex stage of a draw: world coordinates and normals for
+ * 			lighting, and clip and window coordinates straight from object
+ * 			coordinates through the concatenated matrices.
+ * @param [in,out]	stream	The vertices, loaded in object coordinates.
+ * @param	modelingMatrix	   	Object to world.
+ * @param	modelViewProjection	Object to clip.
+ * @param	viewportMatrix	   	The viewport transformation.
+ */
+
+void transformStream(VertexStream &stream, const dmat4 &modelingMatrix,
+						const dmat4 &modelViewProjection, const dmat4 &viewportMatrix) {
+	const size_t n = stream.count;
+	dmat3 normalMatrix = glm::transpose(glm::inverse(dmat3(modelingMatrix)));
+	transformPoints(modelingMatrix, n, stream.px.data(), stream.py.data(), stream.pz.data(), stream.pw.data(),
+					stream.wx.data(), stream.wy.data(), stream.wz.data(), nullptr);
+	transformNormals(normalMatrix, n, stream.nx.data(), stream.ny.data(), stream.nz.data(),
+					stream.wnx.data(), stream.wny.data(), stream.wnz.data());
+	transformPoints(modelViewProjection, n, stream.px.data(), stream.py.data(), stream.pz.data(), stream.pw.data(),
+					stream.cx.data(), stream.cy.data(), stream.cz.data(), stream.cw.data());
+	projectPoints(viewportMatrix, n, stream.cx.data(), stream.cy.data(), stream.cz.data(), stream.cw.data(),
+					stream.sx.data(), stream.sy.data(), stream.sz.data());
+}
+
+/**
+ * @fn	void transformPositions(const dmat4 &M, dvec4 *positions, size_t n, size_t stride)
+ * @brief	Multiplies, in place, n positions stored stride bytes apart, such
+ * 			as the pos members of an array of VertexData. With AVX, each
+ * 			position is one register.
+ * @param	M		 	The matrix.
+ * @param	positions	The first position.
+ * @param	n		 	Number of positions.
+ * @param	stride   	Bytes from one position to the next.
+ */
+
+void transformPositions(const dmat4 &M, dvec4 *positions, size_t n, size_t stride) {
+	char *p = reinterpret_cast<char *>(positions);
+#ifdef VERTEX_STREAM_AVX
+	const __m256d c0 = _mm256_setr_pd(M[0][0], M[0][1], M[0][2], M[0][3]);
+	const __m256d c1 = _mm256_setr_pd(M[1][0], M[1][1], M[1][2], M[1][3]);
+	const __m256d c2 = _mm256_setr_pd(M[2][0], M[2][1], M[2][2], M[2][3]);
+	const __m256d c3 = _mm256_setr_pd(M[3][0], M[3][1], M[3][2], M[3][3]);
+	for (size_t i = 0; i < n; i++, p += stride) {
+		double *v = &(*reinterpret_cast<dvec4 *>(p))[0];
+		__m256d r = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(c0, _mm256_set1_pd(v[0])),
+												_mm256_mul_pd(c1, _mm256_set1_pd(v[1]))),
+									_mm256_add_pd(_mm256_mul_pd(c2, _mm256_set1_pd(v[2])),
+												_mm256_mul_pd(c3, _mm256_set1_pd(v[3]))));
+		_mm256_storeu_pd(v, r);
+	}
+#else
+	for (size_t i = 0; i < n; i++, p += stride) {
+		dvec4 &v = *reinterpret_cast<dvec4 *>(p);
+		v = M * v;
+	}
+#endif
+}
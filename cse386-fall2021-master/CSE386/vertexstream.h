@@ -0,0 +1,67 @@
+/****************************************************
+ * 2016-2021 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "defs.h"
+#include "vertexdata.h"
+
+// Define VERTEX_STREAM_FLOAT to transform vertices in single precision, twice
+// as many at a time. The results are rounded to float before rasterization.
+#ifdef VERTEX_STREAM_FLOAT
+typedef float StreamReal;		//!< Precision of the vertex streams.
+#else
+typedef double StreamReal;		//!< Precision of the vertex streams.
+#endif
+
+/**
+ * @struct	VertexStream
+ * @brief	The vertices of one draw in structure of arrays layout: one array
+ * 			per component, so the kernels below work on several vertices with
+ * 			each instruction -- 4 doubles or 8 floats when built with AVX
+ * 			(/arch:AVX2, which the Release configurations set, or -mavx2), and
+ * 			whatever the compiler makes of the plain loops otherwise.
+ *
+ * 			load() fills the object coordinates; transformStream() fills the
+ * 			rest. The arrays keep their capacity from one draw to the next.
+ */
+
+struct VertexStream {
+	size_t count;						//!< Number of vertices.
+	vector<StreamReal> px, py, pz, pw;	//!< Object coordinates.
+	vector<StreamReal> nx, ny, nz;		//!< Object normals.
+	vector<StreamReal> wx, wy, wz;		//!< World coordinates.
+	vector<StreamReal> wnx, wny, wnz;	//!< World normals.
+	vector<StreamReal> cx, cy, cz, cw;	//!< Clip coordinates.
+	vector<StreamReal> sx, sy, sz;		//!< Window coordinates. Valid if cw > 0.
+
+	VertexStream() : count(0) {}
+	void resize(size_t n);
+	void load(const vector<VertexData> &verts);
+	void load(const vector<IndexedVertex> &verts);
+	dvec3 worldPos(size_t i) const { return dvec3(wx[i], wy[i], wz[i]); }
+	dvec3 worldNormal(size_t i) const { return dvec3(wnx[i], wny[i], wnz[i]); }
+	dvec4 clipPos(size_t i) const { return dvec4(cx[i], cy[i], cz[i], cw[i]); }
+	dvec4 windowPos(size_t i) const { return dvec4(sx[i], sy[i], sz[i], 1.0); }
+};
+
+void transformPoints(const dmat4 &M, size_t n,
+						const StreamReal *x, const StreamReal *y, const StreamReal *z, const StreamReal *w,
+						StreamReal *ox, StreamReal *oy, StreamReal *oz, StreamReal *ow);
+void transformNormals(const dmat3 &N, size_t n,
+						const StreamReal *x, const StreamReal *y, const StreamReal *z,
+						StreamReal *ox, StreamReal *oy, StreamReal *oz);
+template <class T> void normalizeVectors(size_t n, T *x, T *y, T *z);	// float and double
+void projectPoints(const dmat4 &viewportMatrix, size_t n,
+					const StreamReal *x, const StreamReal *y, const StreamReal *z, const StreamReal *w,
+					StreamReal *ox, StreamReal *oy, StreamReal *oz);
+void transformStream(VertexStream &stream, const dmat4 &modelingMatrix,
+						const dmat4 &modelViewProjection, const dmat4 &viewportMatrix);
+void transformPositions(const dmat4 &M, dvec4 *positions, size_t n, size_t stride);
@@ -7,6 +7,8 @@
  * permission is granted.
  ****************************************************/
 
+#include <functional>
+#include <unordered_map>
 #include "vertexdata.h"
 #include "utilities.h"
 #include "ishape.h"
@@ -97,3 +99,131 @@ VertexData VertexData::operator + (const VertexData &other) const {
 	result.worldPos += other.worldPos;
 	return result;
 }
+
+/**
+ * @struct	WeldKey
+ * @brief	N doubles compared by value, for finding duplicate vertices and
+ * 			materials.
+ */
+
+template <int N>
+struct WeldKey {
+	double v[N];
+	bool operator == (const WeldKey &other) const {
+		for (int i = 0; i < N; i++) {
+			if (v[i] != other.v[i]) return false;
+		}
+		return true;
+	}
+};
+
+template <int N>
+struct WeldKeyHash {
+	size_t operator () (const WeldKey<N> &key) const {
+		size_t h = 0;
+		for (int i = 0; i < N; i++) {
+			h = h * 1000003 ^ std::hash<double>()(key.v[i]);
+		}
+		return h;
+	}
+};
+
+/**
+ * @fn	IndexedVertexData::IndexedVertexData(const vector<VertexData> &triangles)
+ * @brief	Builds indexed triangles from vertex triplets, such as an EShapeData.
+ * 			Vertices with the same position, normal and material are merged, as
+ * 			are identical materials.
+ * @param	triangles	Each successive triplet is a triangle.
+ */
+
+IndexedVertexData::IndexedVertexData(const vector<VertexData> &triangles) {
+	std::unordered_map<WeldKey<11>, uint32_t, WeldKeyHash<11>> materialIds;
+	std::unordered_map<WeldKey<8>, uint32_t, WeldKeyHash<8>> vertexIds;
+	size_t n = triangles.size() - triangles.size() % 3;
+	indices.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		const VertexData &V = triangles[i];
+		const Material &M = V.material;
+		WeldKey<11> matKey = { { M.ambient.r, M.ambient.g, M.ambient.b,
+								M.diffuse.r, M.diffuse.g, M.diffuse.b,
+								M.specular.r, M.specular.g, M.specular.b,
+								M.shininess, M.alpha } };
+		auto mat = materialIds.find(matKey);
+		uint32_t materialId;
+		if (mat == materialIds.end()) {
+			materialId = addMaterial(M);
+			materialIds[matKey] = materialId;
+		} else {
+			materialId = mat->second;
+		}
+		WeldKey<8> vertKey = { { V.pos.x, V.pos.y, V.pos.z, V.pos.w,
+								V.normal.x, V.normal.y, V.normal.z, (double)materialId } };
+		auto vert = vertexIds.find(vertKey);
+		if (vert == vertexIds.end()) {
+			uint32_t id = addVertex(V.pos, V.normal, materialId);
+			vertexIds[vertKey] = id;
+			indices.push_back(id);
+		} else {
+			indices.push_back(vert->second);
+		}
+	}
+}
+
+/**
+ * @fn	uint32_t IndexedVertexData::addMaterial(const Material &mat)
+ * @brief	Adds a material to the material table.
+ * @param	mat	Material.
+ * @return	The material's id.
+ */
+
+uint32_t IndexedVertexData::addMaterial(const Material &mat) {
+	materials.push_back(mat);
+	return (uint32_t)materials.size() - 1;
+}
+
+/**
+ * @fn	uint32_t IndexedVertexData::addVertex(const dvec4 &pos, const dvec3 &normal, uint32_t materialId)
+ * @brief	Adds a vertex, growing the bounds to include it. The normal is
+ * 			normalized; a zero normal is kept as zero rather than becoming NaN.
+ * @param	pos		  	Object coordinate.
+ * @param	normal	  	Normal vector.
+ * @param	materialId	Id returned by addMaterial.
+ * @return	The vertex's index.
+ */
+
+uint32_t IndexedVertexData::addVertex(const dvec4 &pos, const dvec3 &normal, uint32_t materialId) {
+	IndexedVertex v;
+	v.pos = pos;
+	double length = glm::length(normal);
+	v.normal = length > 0 ? normal / length : dvec3(0.0);
+	v.materialId = materialId;
+	vertices.push_back(v);
+	bounds.grow(pos.xyz());
+	return (uint32_t)vertices.size() - 1;
+}
+
+/**
+ * @fn	void IndexedVertexData::addTriangle(uint32_t i0, uint32_t i1, uint32_t i2)
+ * @brief	Adds a triangle made of existing vertices, in counterclockwise order.
+ * @param	i0	First vertex index.
+ * @param	i1	Second vertex index.
+ * @param	i2	Third vertex index.
+ */
+
+void IndexedVertexData::addTriangle(uint32_t i0, uint32_t i1, uint32_t i2) {
+	indices.push_back(i0);
+	indices.push_back(i1);
+	indices.push_back(i2);
+}
+
+/**
+ * @fn	VertexData IndexedVertexData::getVertexData(uint32_t index) const
+ * @brief	Expands one vertex, material included, into a VertexData.
+ * @param	index	The vertex index.
+ * @return	The vertex.
+ */
+
+VertexData IndexedVertexData::getVertexData(uint32_t index) const {
+	const IndexedVertex &v = vertices[index];
+	return VertexData(v.pos, v.normal, materials[v.materialId]);
+}